@@ -35,16 +35,24 @@ Status BuildTable(const std::string& dbname,
   PmemHashmap* pmem_hashmap;
   switch (options.ds_type) {
     case kSkiplist:
-      pmem_skiplist = options.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
+    case kSortedArray:
+      pmem_skiplist = options.pmem_skiplist[file_number % options.pmem_options.num_of_shards];
       break;
     case kHashmap:
-      pmem_hashmap = options.pmem_hashmap[file_number % NUM_OF_SKIPLIST_MANAGER];
+      pmem_hashmap = options.pmem_hashmap[file_number % options.pmem_options.num_of_shards];
       break;
   }
   
   // Tiering trigger
   bool need_file_creation = pmem_skiplist->IsFreeListEmpty();
   if(need_file_creation) printf("[builder] is free list empty\n");
+  // NOTE: Full pmem buffer falls back to SST, as full free list
+  if (!need_file_creation && sst_type == kPmemSST && options.use_pmem_buffer &&
+      !options.pmem_buffer[file_number % options.pmem_options.num_of_shards]
+          ->HasRoomForTable()) {
+    printf("[builder] pmem buffer is full\n");
+    need_file_creation = true;
+  }
 
   Status s;
   meta->file_size = 0;
@@ -61,6 +69,7 @@ Status BuildTable(const std::string& dbname,
         return s;
       }
       TableBuilder* builder = new TableBuilder(options, file);
+      meta->tier = kTierSST;
       meta->smallest.DecodeFrom(iter->key());
 
       // int i = 0;
@@ -113,9 +122,11 @@ Status BuildTable(const std::string& dbname,
       // printf("%d skiplist@\n", file_number);
 
       TableBuilder* builder = new TableBuilder(options, nullptr);
+      meta->tier = (options.ds_type == kHashmap) ? kTierPmemHashmap
+                                                 : kTierPmemSkiplist;
       meta->smallest.DecodeFrom(iter->key());
 
-      PmemBuffer* pmem_buffer = options.pmem_buffer[file_number % NUM_OF_BUFFER];
+      PmemBuffer* pmem_buffer = options.pmem_buffer[file_number % options.pmem_options.num_of_shards];
       // printf("file_number: %d\n", file_number);
       // int i =0;
       for (; iter->Valid(); iter->Next()) {
@@ -124,6 +135,7 @@ Status BuildTable(const std::string& dbname,
         if (options.use_pmem_buffer) {
           switch (options.ds_type) {
             case kSkiplist:
+            case kSortedArray:
               builder->AddToBufferAndSkiplist(pmem_buffer, pmem_skiplist, 
                                           file_number, key, iter->value());
               break;
@@ -144,7 +156,7 @@ Status BuildTable(const std::string& dbname,
       if(options.use_pmem_buffer) {
         builder->FlushBufferToPmemBuffer(pmem_buffer, file_number);
       }
-      if(options.ds_type == kSkiplist && options.skiplist_cache) {
+      if(options.ds_type != kHashmap && options.skiplist_cache) {
         Iterator* it = table_cache->NewIteratorFromPmem(ReadOptions(),
                                               meta->number,
                                               meta->file_size);
@@ -40,6 +40,12 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+// JH: Backoff of a failed demotion, doubled per failure of the victim
+static const uint64_t kDemotionRetryMicros = 100000;
+// Victim is passed over (lifetime and LRU position restarted)
+// after this many failures
+static const int kMaxDemotionRetries = 4;
+
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   Status status;
@@ -65,6 +71,7 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    FileTier tier;
   };
   std::vector<Output> outputs;
 
@@ -101,6 +108,10 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  // JH
+  ClipToRange(&result.pmem_options.num_of_shards, 1,                   1024);
+  ClipToRange(&result.pmem_options.demotion_watermark, (uint64_t)0,
+              result.pmem_options.skiplist_list_size / 2);
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -114,113 +125,154 @@ Options SanitizeOptions(const std::string& dbname,
   if (result.block_cache == nullptr) {
     result.block_cache = NewLRUCache(8 << 20);
   }
+  // JH: Before pools are opened, recovery reads are emulated too
+  //     NOTE: Global, other open DBs get this model as well
+  const PmemLatencyModel& model = result.pmem_options.latency_model;
+  PmemLatencyModel old_model = GetPmemLatencyModel();
+  if (old_model.enabled != model.enabled ||
+      old_model.read_latency_ns != model.read_latency_ns ||
+      old_model.write_latency_ns != model.write_latency_ns ||
+      old_model.read_bandwidth_mbps != model.read_bandwidth_mbps ||
+      old_model.write_bandwidth_mbps != model.write_bandwidth_mbps) {
+    Log(result.info_log, "Pmem emulation (process-wide) set to %s, "
+        "read %llu ns %llu MB/s, write %llu ns %llu MB/s",
+        model.enabled ? "on" : "off",
+        static_cast<unsigned long long>(model.read_latency_ns),
+        static_cast<unsigned long long>(model.read_bandwidth_mbps),
+        static_cast<unsigned long long>(model.write_latency_ns),
+        static_cast<unsigned long long>(model.write_bandwidth_mbps));
+  }
+  SetPmemLatencyModel(model);
     // SOLVE: JH
   if (result.sst_type == kPmemSST) {
+    const PmemOptions& pmem_options = result.pmem_options;
+    int num_of_shards = pmem_options.num_of_shards;
     switch (result.ds_type) {
       // DS_Option1: Skiplist
+      // DS_Option3: Sorted array (managed by same skiplist manager)
       case kSkiplist:
-        result.pmem_skiplist = new PmemSkiplist*[NUM_OF_SKIPLIST_MANAGER];
-        result.pmem_skiplist[0] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_0);
-        result.pmem_skiplist[1] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_1);
-        result.pmem_skiplist[2] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_2);
-        result.pmem_skiplist[3] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_3);
-        result.pmem_skiplist[4] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_4);
-        result.pmem_skiplist[5] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_5);
-        result.pmem_skiplist[6] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_6);
-        result.pmem_skiplist[7] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_7);
-        result.pmem_skiplist[8] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_8);
-        result.pmem_skiplist[9] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_9);
-
-        // result.pmem_skiplist[10] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_10);
-        // result.pmem_skiplist[11] = new PmemSkiplist(SKIPLIST_MANAGER_PATH_11);
-        
-        // Initialize
-        for (int i=0; i<NUM_OF_SKIPLIST_MANAGER; i++) {
-          result.pmem_skiplist[i]->ClearAll();
+      case kSortedArray:
+        result.pmem_skiplist = new PmemSkiplist*[num_of_shards];
+        for (int i=0; i<num_of_shards; i++) {
+          result.pmem_skiplist[i] = new PmemSkiplist(
+                                  pmem_options.SkiplistPath(i),
+                                  pmem_options.skiplist_pool_size,
+                                  pmem_options.skiplist_list_size,
+                                  pmem_options.max_skiplist_node_size,
+                                  result.ds_type);
+          result.pmem_skiplist[i]->SetNumOfShards(num_of_shards);
+          // NOTE: prefix fast-path is valid only for bytewise user keys
+          result.pmem_skiplist[i]->SetComparator(icmp, 
+                      icmp->user_comparator() == BytewiseComparator());
+          result.pmem_skiplist[i]->SetDeferredDrain(pmem_options.deferred_drain);
         }
+        // NOTE: Initialize on DBImpl::RecoverPmemTier() (not ClearAll)
 
         // NOTE: FIXME: [190313] use this as cache iterator.. 
         // actual skiplist_cache has ordering problem on compaction
         // Smallest and largest key are invalid..
-        result.pmem_internal_iterator = new PmemIterator*[NUM_OF_SKIPLIST_MANAGER];
-        result.pmem_internal_iterator[0] = new PmemIterator(0, result.pmem_skiplist[0]);
-        result.pmem_internal_iterator[1] = new PmemIterator(1, result.pmem_skiplist[1]);
-        result.pmem_internal_iterator[2] = new PmemIterator(2, result.pmem_skiplist[2]);
-        result.pmem_internal_iterator[3] = new PmemIterator(3, result.pmem_skiplist[3]);
-        result.pmem_internal_iterator[4] = new PmemIterator(4, result.pmem_skiplist[4]);
-        result.pmem_internal_iterator[5] = new PmemIterator(5, result.pmem_skiplist[5]);
-        result.pmem_internal_iterator[6] = new PmemIterator(6, result.pmem_skiplist[6]);
-        result.pmem_internal_iterator[7] = new PmemIterator(7, result.pmem_skiplist[7]);
-        result.pmem_internal_iterator[8] = new PmemIterator(8, result.pmem_skiplist[8]);
-        result.pmem_internal_iterator[9] = new PmemIterator(9, result.pmem_skiplist[9]);
-
-        // result.pmem_internal_iterator[10] = new PmemIterator(10, result.pmem_skiplist[10]);
-        // result.pmem_internal_iterator[11] = new PmemIterator(11, result.pmem_skiplist[11]);
+        result.pmem_internal_iterator = new PmemIterator*[num_of_shards];
+        for (int i=0; i<num_of_shards; i++) {
+          result.pmem_internal_iterator[i] = 
+                                  new PmemIterator(i, result.pmem_skiplist[i]);
+        }
         break;
       // DS_Option2: Hashmap
       case kHashmap:
-        result.pmem_hashmap = new PmemHashmap*[NUM_OF_HASHMAP];
-        result.pmem_hashmap[0] = new PmemHashmap(HASHMAP_PATH_0);
-        result.pmem_hashmap[1] = new PmemHashmap(HASHMAP_PATH_1);
-        result.pmem_hashmap[2] = new PmemHashmap(HASHMAP_PATH_2);
-        result.pmem_hashmap[3] = new PmemHashmap(HASHMAP_PATH_3);
-        result.pmem_hashmap[4] = new PmemHashmap(HASHMAP_PATH_4);
-        result.pmem_hashmap[5] = new PmemHashmap(HASHMAP_PATH_5);
-        result.pmem_hashmap[6] = new PmemHashmap(HASHMAP_PATH_6);
-        result.pmem_hashmap[7] = new PmemHashmap(HASHMAP_PATH_7);
-        result.pmem_hashmap[8] = new PmemHashmap(HASHMAP_PATH_8);
-        result.pmem_hashmap[9] = new PmemHashmap(HASHMAP_PATH_9);
-
-        // Initialize
-        for (int i=0; i<NUM_OF_HASHMAP; i++) {
-          result.pmem_hashmap[i]->ClearAll();
+        result.pmem_hashmap = new PmemHashmap*[num_of_shards];
+        for (int i=0; i<num_of_shards; i++) {
+          result.pmem_hashmap[i] = new PmemHashmap(
+                                  pmem_options.HashmapPath(i),
+                                  pmem_options.hashmap_pool_size,
+                                  pmem_options.hashmap_list_size);
+          result.pmem_hashmap[i]->SetNumOfShards(num_of_shards);
         }
+        // NOTE: Initialize on DBImpl::RecoverPmemTier() (not ClearAll)
 
         // NOTE: FIXME: [190313] use this as cache iterator.. 
         // actual skiplist_cache has ordering problem on compaction
         // Smallest and largest key are invalid..
-        result.pmem_internal_iterator = new PmemIterator*[NUM_OF_HASHMAP];
-        result.pmem_internal_iterator[0] = new PmemIterator(0, result.pmem_hashmap[0]);
-        result.pmem_internal_iterator[1] = new PmemIterator(1, result.pmem_hashmap[1]);
-        result.pmem_internal_iterator[2] = new PmemIterator(2, result.pmem_hashmap[2]);
-        result.pmem_internal_iterator[3] = new PmemIterator(3, result.pmem_hashmap[3]);
-        result.pmem_internal_iterator[4] = new PmemIterator(4, result.pmem_hashmap[4]);
-        result.pmem_internal_iterator[5] = new PmemIterator(5, result.pmem_hashmap[5]);
-        result.pmem_internal_iterator[6] = new PmemIterator(6, result.pmem_hashmap[6]);
-        result.pmem_internal_iterator[7] = new PmemIterator(7, result.pmem_hashmap[7]);
-        result.pmem_internal_iterator[8] = new PmemIterator(8, result.pmem_hashmap[8]);
-        result.pmem_internal_iterator[9] = new PmemIterator(9, result.pmem_hashmap[9]);
+        result.pmem_internal_iterator = new PmemIterator*[num_of_shards];
+        for (int i=0; i<num_of_shards; i++) {
+          result.pmem_internal_iterator[i] = 
+                                  new PmemIterator(i, result.pmem_hashmap[i]);
+        }
         break;
     }
   }
   if (result.use_pmem_buffer) {
-    // PROGRESS:
-    result.pmem_buffer = new PmemBuffer*[NUM_OF_BUFFER]; 
-    result.pmem_buffer[0] = new PmemBuffer(BUFFER_PATH_0);
-    result.pmem_buffer[1] = new PmemBuffer(BUFFER_PATH_1);
-    result.pmem_buffer[2] = new PmemBuffer(BUFFER_PATH_2);
-    result.pmem_buffer[3] = new PmemBuffer(BUFFER_PATH_3);
-    result.pmem_buffer[4] = new PmemBuffer(BUFFER_PATH_4);
-    result.pmem_buffer[5] = new PmemBuffer(BUFFER_PATH_5);
-    result.pmem_buffer[6] = new PmemBuffer(BUFFER_PATH_6);
-    result.pmem_buffer[7] = new PmemBuffer(BUFFER_PATH_7);
-    result.pmem_buffer[8] = new PmemBuffer(BUFFER_PATH_8);
-    result.pmem_buffer[9] = new PmemBuffer(BUFFER_PATH_9);
-
-    // result.pmem_buffer[10] = new PmemBuffer(BUFFER_PATH_10);
-    // result.pmem_buffer[11] = new PmemBuffer(BUFFER_PATH_11);
-    // result.pmem_buffer[12] = new PmemBuffer(BUFFER_PATH_12);
-    // result.pmem_buffer[13] = new PmemBuffer(BUFFER_PATH_13);
-    // result.pmem_buffer[14] = new PmemBuffer(BUFFER_PATH_14);
-
-    // Initialize
-    for (int i=0; i<NUM_OF_BUFFER; i++) {
-      result.pmem_buffer[i]->ClearAll();
+    const PmemOptions& pmem_options = result.pmem_options;
+    // NOTE: Records are sharded as skiplists, so same capacity is enough
+    result.pmem_buffer = new PmemBuffer*[pmem_options.num_of_shards]; 
+    for (int i=0; i<pmem_options.num_of_shards; i++) {
+      result.pmem_buffer[i] = new PmemBuffer(
+                                  pmem_options.BufferPath(i),
+                                  pmem_options.buffer_pool_size,
+                                  pmem_options.buffer_contents_size,
+                                  pmem_options.skiplist_list_size);
+      result.pmem_buffer[i]->SetNumOfShards(pmem_options.num_of_shards);
+      result.pmem_buffer[i]->SetDeferredDrain(pmem_options.deferred_drain);
+      // NOTE: Flushed memtable or compaction output, with encoding overhead
+      result.pmem_buffer[i]->SetMaxTableSize(2 * std::max(
+                  static_cast<uint64_t>(result.write_buffer_size),
+                  static_cast<uint64_t>(result.max_file_size)));
+    }
+    // NOTE: Initialize on DBImpl::RecoverPmemTier() (not ClearAll)
+    if (result.sst_type == kPmemSST &&
+        (result.ds_type == kSkiplist || result.ds_type == kSortedArray)) {
+      for (int i=0; i<pmem_options.num_of_shards; i++) {
+        SetBufferBases(result.pmem_skiplist[i], result.pmem_buffer,
+                       pmem_options.num_of_shards);
+      }
+    }
+  }
+  if (result.use_pmem_log) {
+    const PmemOptions& pmem_options = result.pmem_options;
+    // NOTE: Current log and logs of unflushed memtables are live
+    if (pmem_options.log_contents_size < 4 * result.write_buffer_size) {
+      printf("[WARNING][SanitizeOptions] log_contents_size %lu is small for write_buffer_size %lu\n",
+             pmem_options.log_contents_size, result.write_buffer_size);
     }
+    result.pmem_log = new PmemLog(pmem_options.LogPath(dbname),
+                                  pmem_options.log_pool_size,
+                                  pmem_options.log_contents_size);
+  }
+  if (result.use_pmem_memtable) {
+    // NOTE: Memtable is switched above write_buffer_size, or earlier if
+    //       the next write batch does not fit the rest of arena
+    result.pmem_memtable = new PmemMemTablePool(
+                                  result.pmem_options.MemTablePath(dbname),
+                                  2 * result.write_buffer_size);
   }
   return result;
 }
 
+// JH: Pools of other geometry, layout or shards are not used,
+//     DB::Open returns the first mismatch
+static Status PmemPoolStatus(const Options& options) {
+  const int num_of_shards = options.pmem_options.num_of_shards;
+  Status s;
+  for (int i=0; i<num_of_shards && s.ok(); i++) {
+    if (options.sst_type == kPmemSST) {
+      if (options.ds_type == kHashmap) {
+        s = options.pmem_hashmap[i]->status();
+      } else {
+        s = options.pmem_skiplist[i]->status();
+      }
+    }
+    if (s.ok() && options.use_pmem_buffer) {
+      s = options.pmem_buffer[i]->status();
+    }
+  }
+  if (s.ok() && options.use_pmem_log) {
+    s = options.pmem_log->status();
+  }
+  if (s.ok() && options.use_pmem_memtable) {
+    s = options.pmem_memtable->status();
+  }
+  return s;
+}
+
 static int TableCacheSize(const Options& sanitized_options) {
   // Reserve ten files or so for other uses and give the rest to TableCache.
   return sanitized_options.max_open_files - kNumNonTableCacheFiles;
@@ -247,6 +299,9 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       seed_(0),
       tmp_batch_(new WriteBatch),
       background_compaction_scheduled_(false),
+      background_demotion_scheduled_(false),
+      background_promotion_scheduled_(false),
+      demotion_retry_micros_(0),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
                                &internal_comparator_)),
@@ -256,13 +311,16 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       preserve_flag(false)
       {
   has_imm_.Release_Store(nullptr);
+  // JH: LRU lists are sharded as pmem pools
+  tiering_stats_.SetNumOfShards(options_.pmem_options.num_of_shards);
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-null value is ok
-  while (background_compaction_scheduled_) {
+  while (background_compaction_scheduled_ || background_demotion_scheduled_ ||
+         background_promotion_scheduled_) {
     background_work_finished_signal_.Wait();
   }
   mutex_.Unlock();
@@ -274,7 +332,7 @@ DBImpl::~DBImpl() {
   
   // if (options_.sst_type == kPmemSST && options_.ds_type == kSkiplist) {
   //   printf("[DEBUG] free_list size\n");
-  //   for (int i=0; i<NUM_OF_SKIPLIST_MANAGER; i++) {
+  //   for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
   //     size_t freeListSize = options_.pmem_skiplist[i]->GetFreeListSize();
   //     size_t allocatedMapSize = options_.pmem_skiplist[i]->GetAllocatedMapSize();
   //     printf("%d] free_list:'%d', allocated_map:'%d'\n", i, freeListSize, allocatedMapSize);
@@ -290,7 +348,8 @@ DBImpl::~DBImpl() {
     switch (options_.ds_type) {
       // DS_Option1: Skiplist
       case kSkiplist:
-        for (int i=0; i<NUM_OF_SKIPLIST_MANAGER; i++) {
+      case kSortedArray:
+        for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
           delete options_.pmem_skiplist[i];
           // delete options_.pmem_internal_iterator[i]; // DEBUG:
         }
@@ -300,7 +359,7 @@ DBImpl::~DBImpl() {
         break;
       // DS_Option2: Hashmap
       case kHashmap:
-        for (int i=0; i<NUM_OF_HASHMAP; i++) {
+        for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
           delete options_.pmem_hashmap[i];
           delete options_.pmem_internal_iterator[i];
         }
@@ -311,7 +370,7 @@ DBImpl::~DBImpl() {
     }
   }
   if (options_.use_pmem_buffer) {
-    for (int i=0; i<NUM_OF_BUFFER; i++) {
+    for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
       delete options_.pmem_buffer[i];
     }
     delete[] options_.pmem_buffer;
@@ -328,6 +387,14 @@ DBImpl::~DBImpl() {
   delete log_;
   delete logfile_;
   delete table_cache_;
+  // JH: After logfile_, it publishes its tail on close
+  if (options_.use_pmem_log) {
+    delete options_.pmem_log;
+  }
+  // JH: After mem_ and imm_, they release their slots
+  if (options_.use_pmem_memtable) {
+    delete options_.pmem_memtable;
+  }
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -369,6 +436,32 @@ Status DBImpl::NewDB() {
   return s;
 }
 
+Status DBImpl::NewLogFile(uint64_t log_number, WritableFile** file) {
+  if (options_.use_pmem_memtable) {
+    *file = nullptr;
+    return Status::OK();
+  }
+  if (options_.use_pmem_log) {
+    return options_.pmem_log->NewWritableFile(log_number, file);
+  }
+  return env_->NewWritableFile(LogFileName(dbname_, log_number), file);
+}
+
+Status DBImpl::NewMemTable(uint64_t log_number, MemTable** mem) {
+  if (options_.use_pmem_memtable) {
+    int slot = options_.pmem_memtable->NewSlot(log_number);
+    if (slot < 0) {
+      *mem = nullptr;
+      return Status::IOError("too many pmem memtables");
+    }
+    *mem = new MemTable(internal_comparator_, options_.pmem_memtable, slot,
+                        true);
+    return Status::OK();
+  }
+  *mem = new MemTable(internal_comparator_);
+  return Status::OK();
+}
+
 void DBImpl::MaybeIgnoreError(Status* s) const {
   if (s->ok() || options_.paranoid_checks) {
     // No change needed
@@ -435,25 +528,100 @@ void DBImpl::DeleteObsoleteFiles() {
       }
     }
   }
-  
+  // JH: Logs in pmem have no file, same rule as kLogFile
+  if (options_.use_pmem_log) {
+    std::vector<uint64_t> log_numbers;
+    options_.pmem_log->GetLogNumbers(&log_numbers);
+    for (size_t i = 0; i < log_numbers.size(); i++) {
+      if (log_numbers[i] < versions_->LogNumber() &&
+          log_numbers[i] != versions_->PrevLogNumber()) {
+        Log(options_.info_log, "Delete pmem log #%lld\n",
+            static_cast<unsigned long long>(log_numbers[i]));
+        options_.pmem_log->DeleteLog(log_numbers[i]);
+      }
+    }
+  }
+  // JH: Flushed pmem memtables, same rule as logs
+  if (options_.use_pmem_memtable) {
+    std::vector<uint64_t> numbers;
+    options_.pmem_memtable->GetNumbers(&numbers);
+    for (size_t i = 0; i < numbers.size(); i++) {
+      if (numbers[i] < versions_->LogNumber() &&
+          numbers[i] != versions_->PrevLogNumber()) {
+        Log(options_.info_log, "Free pmem memtable #%lld\n",
+            static_cast<unsigned long long>(numbers[i]));
+        options_.pmem_memtable->FreeSlot(numbers[i]);
+      }
+    }
+  }
+  // JH: Pmem tables have no file, free their lists and buffer segments
+  ReclaimPmemTables(live);
+  ReclaimPmemBuffers(live);
+}
 
+/* 
+ * JH: Free lists of pmem tables which left the live set (compacted, demoted)
+ * NOTE: Same rule as kTableFile, a table of an old version is kept
+ *       until no iterator or pinned value (PinnableValue) can read it
+ */
+void DBImpl::ReclaimPmemTables(const std::set<uint64_t>& live) {
+  mutex_.AssertHeld();
+  if (options_.sst_type != kPmemSST || options_.ds_type == kHashmap) return;
+  std::vector<uint64_t> numbers;
+  for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+    options_.pmem_skiplist[i]->GetFileNumbers(&numbers);
+    for (size_t j = 0; j < numbers.size(); j++) {
+      if (live.find(numbers[j]) != live.end()) continue;
+      Log(options_.info_log, "Free pmem table #%llu\n",
+          static_cast<unsigned long long>(numbers[j]));
+      options_.pmem_skiplist[i]->DeleteFile(numbers[j]);
+      if (options_.use_pmem_buffer) {
+        options_.pmem_buffer[i]->DeleteFile(numbers[j]);
+      }
+      if (options_.skiplist_cache) {
+        table_cache_->Evict(numbers[j]);
+      }
+    }
+  }
+}
+
+/* 
+ * JH: Free buffer segments which no live table points into
+ * NOTE: live includes pending outputs and tables of old versions
+ *       (iterators can still read them)
+ */
+void DBImpl::ReclaimPmemBuffers(const std::set<uint64_t>& live) {
+  mutex_.AssertHeld();
+  if (!options_.use_pmem_buffer) return;
+  for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+    options_.pmem_buffer[i]->ReleaseDeadFiles(live);
+  }
 }
 
 Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   mutex_.AssertHeld();
 
+  // JH: Before anything is read from the pools
+  Status s = PmemPoolStatus(options_);
+  if (!s.ok()) {
+    Log(options_.info_log, "Pmem pool: %s", s.ToString().c_str());
+    return s;
+  }
+
   // Ignore error from CreateDir since the creation of the DB is
   // committed only when the descriptor is created, and this directory
   // may already exist from a previous failed creation attempt.
   env_->CreateDir(dbname_);
   assert(db_lock_ == nullptr);
-  Status s = env_->LockFile(LockFileName(dbname_), &db_lock_);
+  s = env_->LockFile(LockFileName(dbname_), &db_lock_);
   if (!s.ok()) {
     return s;
   }
 
+  bool new_db = false;
   if (!env_->FileExists(CurrentFileName(dbname_))) {
     if (options_.create_if_missing) {
+      new_db = true;
       s = NewDB();
       if (!s.ok()) {
         return s;
@@ -491,6 +659,19 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   }
   std::set<uint64_t> expected;
   versions_->AddLiveFiles(&expected);
+  // JH: Pmem-resident tables have no file
+  s = RecoverPmemTier(expected);
+  if (!s.ok()) {
+    return s;
+  }
+  for (std::set<uint64_t>::iterator iter = expected.begin();
+       iter != expected.end(); ) {
+    if (tiering_stats_.IsInSkiplistSet(*iter)) {
+      iter = expected.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
   uint64_t number;
   FileType type;
   std::vector<uint64_t> logs;
@@ -501,6 +682,30 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
         logs.push_back(number);
     }
   }
+  // JH: Logs in pmem (log files written before use_pmem_log are kept above)
+  //     Logs in pmem of a new DB are of a destroyed DB of same name
+  if (options_.use_pmem_log && !new_db) {
+    std::vector<uint64_t> pmem_logs;
+    options_.pmem_log->GetLogNumbers(&pmem_logs);
+    for (size_t i = 0; i < pmem_logs.size(); i++) {
+      if ((pmem_logs[i] >= min_log) || (pmem_logs[i] == prev_log)) {
+        logs.push_back(pmem_logs[i]);
+      }
+    }
+  }
+  // JH: Pmem memtables are reattached instead of replayed
+  //     (those of a new DB are of a destroyed DB, as logs)
+  std::set<uint64_t> pmem_memtables;
+  if (options_.use_pmem_memtable && !new_db) {
+    std::vector<uint64_t> numbers;
+    options_.pmem_memtable->GetNumbers(&numbers);
+    for (size_t i = 0; i < numbers.size(); i++) {
+      if ((numbers[i] >= min_log) || (numbers[i] == prev_log)) {
+        logs.push_back(numbers[i]);
+        pmem_memtables.insert(numbers[i]);
+      }
+    }
+  }
   if (!expected.empty()) {
     char buf[50];
     snprintf(buf, sizeof(buf), "%d missing files; e.g.",
@@ -511,8 +716,13 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   // Recover in the order in which the logs were generated
   std::sort(logs.begin(), logs.end());
   for (size_t i = 0; i < logs.size(); i++) {
-    s = RecoverLogFile(logs[i], (i == logs.size() - 1), save_manifest, edit,
-                       &max_sequence);
+    if (pmem_memtables.count(logs[i]) > 0) {
+      s = RecoverPmemMemTable(logs[i], (i == logs.size() - 1), save_manifest,
+                              edit, &max_sequence);
+    } else {
+      s = RecoverLogFile(logs[i], (i == logs.size() - 1), save_manifest, edit,
+                         &max_sequence);
+    }
     if (!s.ok()) {
       return s;
     }
@@ -526,10 +736,125 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   if (versions_->LastSequence() < max_sequence) {
     versions_->SetLastSequence(max_sequence);
   }
+  // JH: Pmem logs and memtables of a new DB were not replayed, clear them
+  //     before new ones
+  if (options_.use_pmem_log && new_db) {
+    options_.pmem_log->ClearAll();
+  }
+  if (options_.use_pmem_memtable && new_db) {
+    options_.pmem_memtable->ClearAll();
+  }
 
   return Status::OK();
 }
 
+/* 
+ * JH: Recover pmem tier instead of clearing it
+ * 1) Rebuild allocation state of each pool from persistent owners
+ *    (tables not in MANIFEST are discarded)
+ * 2) Rebuild tiering_stats_ from live files
+ */
+Status DBImpl::RecoverPmemTier(const std::set<uint64_t>& live_files) {
+  mutex_.AssertHeld();
+  Status s;
+  if (options_.sst_type == kPmemSST) {
+    switch (options_.ds_type) {
+      // DS_Option1: Skiplist
+      case kSkiplist:
+      case kSortedArray:
+        for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+          options_.pmem_skiplist[i]->Recover(live_files);
+        }
+        break;
+      // DS_Option2: Hashmap
+      case kHashmap:
+        for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+          options_.pmem_hashmap[i]->Recover(live_files);
+        }
+        break;
+    }
+  }
+  if (options_.use_pmem_buffer) {
+    for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+      options_.pmem_buffer[i]->Recover(live_files);
+    }
+  }
+
+  Version* current = versions_->current();
+  for (int level = 0; level < config::kNumLevels; level++) {
+    std::vector<FileMetaData*> files;
+    current->GetOverlappingInputs(level, nullptr, nullptr, &files);
+    for (size_t i = 0; i < files.size(); i++) {
+      uint64_t number = files[i]->number;
+      bool in_pmem = false;
+      if (options_.sst_type == kPmemSST) {
+        switch (options_.ds_type) {
+          case kSkiplist:
+          case kSortedArray:
+            in_pmem = options_.pmem_skiplist[number % options_.pmem_options.num_of_shards]
+                              ->CheckNumberIsInPmem(number);
+            break;
+          case kHashmap:
+            in_pmem = options_.pmem_hashmap[number % options_.pmem_options.num_of_shards]
+                              ->CheckNumberIsInPmem(number);
+            break;
+        }
+      }
+      // NOTE: Tier is recorded in MANIFEST. SST tier with a pmem table
+      //       is from MANIFEST before tier was recorded, trust the pool.
+      if (files[i]->tier == kTierSST && in_pmem) {
+        files[i]->tier = (options_.ds_type == kHashmap) ? kTierPmemHashmap
+                                                        : kTierPmemSkiplist;
+      } else if (files[i]->tier != kTierSST && !in_pmem && s.ok()) {
+        s = Status::Corruption("pmem table is lost", NumberToString(number));
+      }
+      if (in_pmem && options_.use_pmem_buffer) {
+        // NOTE: Segment holders are volatile, hold again by entries
+        //       (before log replay allocates new tables)
+        int shard = number % options_.pmem_options.num_of_shards;
+        PmemIterator* iter = (options_.ds_type == kHashmap) ?
+                new PmemIterator(number, options_.pmem_hashmap[shard]) :
+                new PmemIterator(number, options_.pmem_skiplist[shard]);
+        // NOTE: Scan region is volatile too, same rule as TableBuilder
+        char* scan_start = nullptr;
+        char* scan_end = nullptr;
+        bool scan_contiguous = true;
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+          Slice key = iter->key();
+          Slice value = iter->value();
+          int total_length = GetEncodedLength(key.size(), value.size());
+          PmemBuffer::HoldBufferPtr(number, iter->buffer_ptr(), total_length);
+          if (scan_start == nullptr) {
+            scan_start = iter->buffer_ptr();
+          } else if (iter->buffer_ptr() != scan_end) {
+            scan_contiguous = false;
+          }
+          scan_end = iter->buffer_ptr() + total_length;
+        }
+        delete iter;
+        if (options_.ds_type != kHashmap && scan_start != nullptr &&
+            scan_contiguous) {
+          options_.pmem_skiplist[shard]->SetScanRegion(number, scan_start,
+                                                  scan_end - scan_start);
+        }
+      }
+      if (in_pmem) {
+        tiering_stats_.InsertIntoSkiplistSet(number);
+        if (options_.tiering_option == kColdDataTiering ||
+            options_.tiering_option == kLRUTiering) {
+          tiering_stats_.PushToNumberListInPmem(level, number);
+        }
+      } else {
+        tiering_stats_.InsertIntoFileSet(number);
+      }
+    }
+  }
+  Log(options_.info_log, "Recovered pmem tier: %d tables in pmem, %d files",
+      static_cast<int>(tiering_stats_.GetSkiplistSetSize()),
+      static_cast<int>(tiering_stats_.GetFileSetSize()));
+  return s;
+}
+
 Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
                               SequenceNumber* max_sequence) {
@@ -551,7 +876,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   // Open the log file
   std::string fname = LogFileName(dbname_, log_number);
   SequentialFile* file;
-  Status status = env_->NewSequentialFile(fname, &file);
+  Status status;
+  // JH: Same log::Reader replay for logs in pmem
+  bool in_pmem_log = options_.use_pmem_log &&
+          options_.pmem_log->NewSequentialFile(log_number, &file).ok();
+  if (!in_pmem_log) {
+    status = env_->NewSequentialFile(fname, &file);
+  }
   if (!status.ok()) {
     MaybeIgnoreError(&status);
     return status;
@@ -620,7 +951,9 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   delete file;
 
   // See if we should keep reusing the last log file.
-  if (status.ok() && options_.reuse_logs && last_log && compactions == 0) {
+  // NOTE: Log in pmem is not reused, new log starts at head
+  if (status.ok() && options_.reuse_logs && last_log && compactions == 0 &&
+      !in_pmem_log && !options_.use_pmem_memtable) {
     assert(logfile_ == nullptr);
     assert(log_ == nullptr);
     assert(mem_ == nullptr);
@@ -653,6 +986,74 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
+/*
+ * JH: Reattach persistent memtable of previous run (no replay)
+ * Last one keeps receiving writes, unless it has a torn write batch
+ * (entries after committed sequence). Others are flushed to level-0,
+ * with committed entries only.
+ */
+Status DBImpl::RecoverPmemMemTable(uint64_t number, bool last,
+                                   bool* save_manifest, VersionEdit* edit,
+                                   SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  PmemMemTablePool* pool = options_.pmem_memtable;
+  int slot = pool->FindSlot(number);
+  assert(slot >= 0);
+  const SequenceNumber committed = pool->GetCommittedSequence(slot);
+  MemTable* mem = new MemTable(internal_comparator_, pool, slot, false);
+  mem->Ref();
+  Log(options_.info_log, "Reattaching pmem memtable #%llu",
+      (unsigned long long) number);
+
+  bool torn = false;
+  bool empty = true;
+  Iterator* iter = mem->NewIterator();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    if (!ParseInternalKey(iter->key(), &ikey) || ikey.sequence > committed) {
+      torn = true;
+    } else {
+      empty = false;
+    }
+  }
+  if (!empty && committed > *max_sequence) {
+    *max_sequence = committed;
+  }
+
+  Status status;
+  if (last && !torn && mem_ == nullptr) {
+    assert(log_ == nullptr);
+    mem_ = mem;
+    logfile_number_ = number;
+    delete iter;
+    return status;
+  }
+  if (torn) {
+    // Copy committed entries, arena of torn memtable is not reused
+    Log(options_.info_log, "Dropping torn write batch of pmem memtable #%llu",
+        (unsigned long long) number);
+    MemTable* copy = new MemTable(internal_comparator_);
+    copy->Ref();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ParsedInternalKey ikey;
+      if (ParseInternalKey(iter->key(), &ikey) && ikey.sequence <= committed) {
+        copy->Add(ikey.sequence, ikey.type, ikey.user_key, iter->value());
+      }
+    }
+    delete iter;
+    mem->Unref();
+    mem = copy;
+  } else {
+    delete iter;
+  }
+  if (!empty) {
+    *save_manifest = true;
+    status = WriteLevel0Table(mem, edit, nullptr);
+  }
+  mem->Unref();
+  return status;
+}
+
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
                                 Version* base) {
   mutex_.AssertHeld();
@@ -692,7 +1093,7 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
     }
     edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+                  meta.smallest, meta.largest, meta.tier);
   }
 
   CompactionStats stats;
@@ -807,6 +1208,53 @@ Status DBImpl::TEST_CompactMemTable() {
   return s;
 }
 
+void DBImpl::TEST_WaitForTiering() {
+  MutexLock l(&mutex_);
+  // NOTE: Compaction schedules tiering work when it finishes
+  while ((background_compaction_scheduled_ || background_demotion_scheduled_ ||
+          background_promotion_scheduled_) && bg_error_.ok()) {
+    background_work_finished_signal_.Wait();
+  }
+}
+
+bool DBImpl::TEST_FindLiveFile(uint64_t number, int* level, bool* in_pmem) {
+  MutexLock l(&mutex_);
+  FileMetaData meta;
+  if (!FindLiveFile(number, level, &meta)) {
+    return false;
+  }
+  *in_pmem = (meta.tier != kTierSST);
+  return true;
+}
+
+bool DBImpl::TEST_LRUTableInPmem(int shard, uint64_t* number) {
+  MutexLock l(&mutex_);
+  level_number lru;
+  if (!tiering_stats_.GetLRUTableInPmem(shard, &lru)) {
+    return false;
+  }
+  *number = lru.number;
+  return true;
+}
+
+void DBImpl::TEST_PinInPmem(uint64_t number, bool pin) {
+  MutexLock l(&mutex_);
+  if (pin) {
+    tiering_stats_.PinInPmem(number);
+  } else {
+    tiering_stats_.UnpinInPmem(number);
+  }
+}
+
+bool DBImpl::TEST_PmemTableAllocated(uint64_t number) {
+  MutexLock l(&mutex_);
+  if (options_.sst_type != kPmemSST || options_.ds_type == kHashmap) {
+    return false;
+  }
+  return options_.pmem_skiplist[number % options_.pmem_options.num_of_shards]
+             ->CheckNumberIsInPmem(number);
+}
+
 void DBImpl::RecordBackgroundError(const Status& s) {
   mutex_.AssertHeld();
   if (bg_error_.ok()) {
@@ -855,9 +1303,434 @@ void DBImpl::BackgroundCall() {
   // so reschedule another compaction if needed.
       // printf("22]\n");
   MaybeScheduleCompaction();
+  // JH: Tables may get old by this compaction
+  MaybeScheduleDemotion();
+  // JH: Free slots may come back by this compaction
+  MaybeSchedulePromotion();
+  background_work_finished_signal_.SignalAll();
+}
+
+void DBImpl::MaybeScheduleDemotion() {
+  mutex_.AssertHeld();
+  level_number victim;
+  if (background_demotion_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background demotions
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (demotion_retry_micros_ != 0 &&
+             env_->NowMicros() < demotion_retry_micros_) {
+    // Last demotion failed; retried by a later call, after backoff
+  } else if (!PickDemotionVictim(&victim)) {
+    // No work to be done
+  } else {
+    background_demotion_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGDemotionWork, this);
+  }
+}
+
+bool DBImpl::PickDemotionVictim(level_number* victim) {
+  mutex_.AssertHeld();
+  // Only tables of pmem_skiplist are demoted
+  if (options_.sst_type != kPmemSST || options_.ds_type == kHashmap) {
+    return false;
+  }
+  switch (options_.tiering_option) {
+    case kColdDataTiering:
+      return tiering_stats_.GetColdTableInPmem(victim);
+    case kLRUTiering:
+    {
+      // Shard with the shortest free list first
+      bool found = false;
+      size_t min_free = 0;
+      for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+        size_t free = options_.pmem_skiplist[i]->GetFreeListSize();
+        level_number lru;
+        if (free >= options_.pmem_options.demotion_watermark ||
+            !tiering_stats_.GetLRUTableInPmem(i, &lru)) {
+          continue;
+        }
+        if (!found || free < min_free) {
+          found = true;
+          min_free = free;
+          *victim = lru;
+        }
+      }
+      return found;
+    }
+    default:
+      return false;
+  }
+}
+
+void DBImpl::BGDemotionWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundDemotionCall();
+}
+
+// NOTE: One table per call, so demotions interleave with compactions
+void DBImpl::BackgroundDemotionCall() {
+  MutexLock l(&mutex_);
+  assert(background_demotion_scheduled_);
+  level_number victim;
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (PickDemotionVictim(&victim)) {
+    Status s = DemotePmemTable(victim.number);
+    if (s.ok()) {
+      demotion_failures_.erase(victim.number);
+      demotion_retry_micros_ = 0;
+    } else {
+      // NOTE: Table is still in pmem and readable, so it is not a DB error.
+      //       Shared background thread never sleeps, retry is deferred
+      //       to a MaybeScheduleDemotion() after exponential backoff.
+      int failures = ++demotion_failures_[victim.number];
+      Log(options_.info_log, "Demotion of #%llu failed (%d times): %s",
+          static_cast<unsigned long long>(victim.number), failures,
+          s.ToString().c_str());
+      if (failures >= kMaxDemotionRetries) {
+        // Give other tables a chance, victim is picked again later
+        tiering_stats_.SetLevelInPmem(victim.number, victim.level);
+        tiering_stats_.TouchInPmem(victim.number);
+        demotion_failures_.erase(victim.number);
+      }
+      demotion_retry_micros_ = env_->NowMicros() +
+          (kDemotionRetryMicros << (failures - 1));
+    }
+  }
+
+  background_demotion_scheduled_ = false;
+  MaybeScheduleDemotion();
+  MaybeSchedulePromotion();
   background_work_finished_signal_.SignalAll();
 }
 
+// NOTE: Like promotion, it relies on a single background thread,
+//       so victim is not picked by a compaction meanwhile.
+Status DBImpl::DemotePmemTable(uint64_t number) {
+  mutex_.AssertHeld();
+  int level;
+  FileMetaData input;
+  if (!FindLiveFile(number, &level, &input) || input.tier == kTierSST) {
+    Log(options_.info_log, "Demotion of #%llu skipped: not a live pmem table",
+        static_cast<unsigned long long>(number));
+    tiering_stats_.RemoveFromNumberListInPmem(number);
+    return Status::OK();
+  }
+
+  FileMetaData meta;
+  meta.number = versions_->NewFileNumber();
+  meta.file_size = 0;
+  meta.tier = kTierSST;
+  pending_outputs_.insert(meta.number);
+  PmemSkiplist* pmem_skiplist = 
+      options_.pmem_skiplist[number % options_.pmem_options.num_of_shards];
+  mutex_.Unlock();
+
+  std::string fname = TableFileName(dbname_, meta.number);
+  WritableFile* file;
+  Status s = env_->NewWritableFile(fname, &file);
+  if (s.ok()) {
+    TableBuilder* builder = new TableBuilder(options_, file);
+    PmemIterator* pmem_iterator = new PmemIterator(number, pmem_skiplist);
+    pmem_iterator->SeekToFirst();
+    meta.smallest.DecodeFrom(pmem_iterator->key());
+    for ( ; pmem_iterator->Valid() ; pmem_iterator->Next()) {
+      // Prioritize immutable compaction work
+      if (has_imm_.NoBarrier_Load() != nullptr) {
+        mutex_.Lock();
+        if (imm_ != nullptr) {
+          CompactMemTable();
+          background_work_finished_signal_.SignalAll();
+        }
+        mutex_.Unlock();
+      }
+      Slice key = pmem_iterator->key();
+      meta.largest.DecodeFrom(key);
+      builder->Add(key, pmem_iterator->value());
+    }
+    delete pmem_iterator;
+
+    s = builder->Finish();
+    if (s.ok()) {
+      meta.file_size = builder->FileSize();
+      assert(meta.file_size > 0);
+    }
+    delete builder;
+
+    if (s.ok()) {
+      s = file->Sync();
+    }
+    if (s.ok()) {
+      s = file->Close();
+    }
+    delete file;
+    file = nullptr;
+  }
+
+  if (s.ok()) {
+    // Verify that the table is usable
+    Iterator* it = table_cache_->NewIterator(ReadOptions(), meta.number,
+                                             meta.file_size);
+    s = it->status();
+    delete it;
+  }
+
+  mutex_.Lock();
+  int current_level;
+  FileMetaData current_meta;
+  bool installed = false;
+  if (s.ok() && FindLiveFile(number, &current_level, &current_meta) &&
+      current_level == level) {
+    VersionEdit edit;
+    edit.DeleteFile(level, number);
+    edit.AddFile(level, meta.number, meta.file_size,
+                 meta.smallest, meta.largest, kTierSST);
+    s = versions_->LogAndApply(&edit, &mutex_);
+    installed = s.ok();
+  } else if (s.ok()) {
+    // Compacted away meanwhile
+    env_->DeleteFile(fname);
+    table_cache_->Evict(meta.number);
+  }
+  if (installed) {
+    tiering_stats_.InsertIntoFileSet(meta.number);
+    tiering_stats_.DeleteFromSkiplistSet(number);
+    tiering_stats_.RemoveFromNumberListInPmem(number);
+    // NOTE: Old versions can still read the list, it is freed by
+    //       DeleteObsoleteFiles() once number leaves the live set
+    if (options_.skiplist_cache) {
+      table_cache_->Evict(number);
+    }
+    stats_[level].bytes_written += meta.file_size;
+    tier_stats_.demotions++;
+    Log(options_.info_log, "Demoted #%llu@%d to #%llu: %lld bytes",
+        static_cast<unsigned long long>(number), level,
+        static_cast<unsigned long long>(meta.number),
+        static_cast<long long>(meta.file_size));
+  }
+  // NOTE: A file not installed is deleted as obsolete file
+  pending_outputs_.erase(meta.number);
+  if (s.ok()) {
+    DeleteObsoleteFiles();
+  }
+  return s;
+}
+
+bool DBImpl::IsPromotionEnabled() const {
+  // Only into pmem_skiplist, and only if tables can be demoted again
+  return options_.sst_type == kPmemSST && options_.ds_type != kHashmap &&
+         options_.use_pmem_buffer &&
+         (options_.tiering_option == kColdDataTiering ||
+          options_.tiering_option == kLRUTiering);
+}
+
+void DBImpl::MaybeSchedulePromotion() {
+  mutex_.AssertHeld();
+  uint64_t number;
+  if (background_promotion_scheduled_) {
+    // Already scheduled
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background promotions
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (!PickPromotionCandidate(&number)) {
+    // No work to be done
+  } else {
+    background_promotion_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGPromotionWork, this);
+  }
+}
+
+bool DBImpl::PickPromotionCandidate(uint64_t* number) {
+  mutex_.AssertHeld();
+  if (!IsPromotionEnabled()) {
+    return false;
+  }
+  // NOTE: Never take a slot which demotion would free again
+  for (int i=0; i<options_.pmem_options.num_of_shards; i++) {
+    if (options_.pmem_skiplist[i]->GetFreeListSize() <=
+        options_.pmem_options.demotion_watermark) {
+      return false;
+    }
+  }
+  return tiering_stats_.GetHotFileInFileSet(number);
+}
+
+void DBImpl::BGPromotionWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundPromotionCall();
+}
+
+// NOTE: One file per call, so promotions interleave with compactions
+void DBImpl::BackgroundPromotionCall() {
+  MutexLock l(&mutex_);
+  assert(background_promotion_scheduled_);
+  uint64_t number;
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (PickPromotionCandidate(&number)) {
+    Status s = PromoteSSTFile(number);
+    if (!s.ok()) {
+      // NOTE: Only a failed MANIFEST write is returned
+      Log(options_.info_log, "Promotion of #%llu failed: %s",
+          static_cast<unsigned long long>(number),
+          s.ToString().c_str());
+      RecordBackgroundError(s);
+    }
+  }
+
+  background_promotion_scheduled_ = false;
+  MaybeSchedulePromotion();
+  background_work_finished_signal_.SignalAll();
+}
+
+bool DBImpl::FindLiveFile(uint64_t number, int* level, FileMetaData* meta) {
+  mutex_.AssertHeld();
+  Version* current = versions_->current();
+  for (int l = 0; l < config::kNumLevels; l++) {
+    std::vector<FileMetaData*> files;
+    current->GetOverlappingInputs(l, nullptr, nullptr, &files);
+    for (size_t i = 0; i < files.size(); i++) {
+      if (files[i]->number == number) {
+        *level = l;
+        *meta = *files[i];
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// NOTE: Like demotion, it relies on a single background thread,
+//       so input file is not picked by a compaction meanwhile.
+Status DBImpl::PromoteSSTFile(uint64_t number) {
+  mutex_.AssertHeld();
+  int level;
+  FileMetaData input;
+  if (!FindLiveFile(number, &level, &input) || input.tier != kTierSST) {
+    tiering_stats_.ResetReadCount(number);
+    return Status::OK();
+  }
+  if (options_.tiering_option == kColdDataTiering &&
+      Tiering_stats::GetLifetimeThreshold(level) == 0) {
+    // Would be demoted right away (L5, L6)
+    tiering_stats_.ResetReadCount(number);
+    return Status::OK();
+  }
+
+  FileMetaData meta;
+  meta.number = versions_->NewFileNumber();
+  meta.file_size = 0;
+  const int shard = meta.number % options_.pmem_options.num_of_shards;
+  PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[shard];
+  PmemBuffer* pmem_buffer = options_.pmem_buffer[shard];
+  if (!pmem_buffer->HasRoomForTable()) {
+    // Not promoted until it gets hot again
+    tiering_stats_.ResetReadCount(number);
+    return Status::OK();
+  }
+  pending_outputs_.insert(meta.number);
+  mutex_.Unlock();
+
+  ReadOptions read_options;
+  read_options.fill_cache = false;
+  Iterator* iter = table_cache_->NewIterator(read_options, input.number,
+                                             input.file_size);
+  TableBuilder* builder = new TableBuilder(options_, nullptr);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    // Prioritize immutable compaction work
+    if (has_imm_.NoBarrier_Load() != nullptr) {
+      mutex_.Lock();
+      if (imm_ != nullptr) {
+        CompactMemTable();
+        background_work_finished_signal_.SignalAll();
+      }
+      mutex_.Unlock();
+    }
+    Slice key = iter->key();
+    if (builder->NumEntries() == 0) {
+      meta.smallest.DecodeFrom(key);
+    }
+    meta.largest.DecodeFrom(key);
+    builder->AddToBufferAndSkiplist(pmem_buffer, pmem_skiplist,
+                                    meta.number, key, iter->value());
+  }
+  Status s = iter->status();
+  delete iter;
+
+  bool built = false;
+  if (s.ok() && builder->NumEntries() > 0) {
+    builder->FlushBufferToPmemBuffer(pmem_buffer, meta.number);
+    DelayPmemWriteNtimes(1);
+    s = builder->FinishPmem();
+    meta.file_size = builder->FileSize();
+    built = s.ok();
+  } else {
+    builder->Abandon();
+  }
+  delete builder;
+
+  mutex_.Lock();
+  int current_level;
+  FileMetaData current_meta;
+  bool manifest_error = false;
+  if (built && FindLiveFile(number, &current_level, &current_meta) &&
+      current_level == level) {
+    // NOTE: Readers of old version still find the SST
+    //       until it is deleted as obsolete file
+    tiering_stats_.InsertIntoSkiplistSet(meta.number);
+    tiering_stats_.PushToNumberListInPmem(level, meta.number);
+    VersionEdit edit;
+    edit.DeleteFile(level, number);
+    edit.AddFile(level, meta.number, meta.file_size,
+                 meta.smallest, meta.largest, kTierPmemSkiplist);
+    s = versions_->LogAndApply(&edit, &mutex_);
+    if (s.ok()) {
+      tiering_stats_.DeleteFromFileSet(number);
+      stats_[level].bytes_written += meta.file_size;
+      tier_stats_.promotions++;
+      Log(options_.info_log, "Promoted #%llu@%d to #%llu: %lld bytes",
+          static_cast<unsigned long long>(number), level,
+          static_cast<unsigned long long>(meta.number),
+          static_cast<long long>(meta.file_size));
+    } else {
+      tiering_stats_.DeleteFromSkiplistSet(meta.number);
+      tiering_stats_.RemoveFromNumberListInPmem(meta.number);
+      built = false;
+      manifest_error = true;
+    }
+  } else {
+    // Not promotable, or compacted away meanwhile
+    built = false;
+  }
+  if (!built) {
+    if (pmem_skiplist->CheckNumberIsInPmem(meta.number)) {
+      pmem_skiplist->DeleteFile(meta.number);
+    }
+    pmem_buffer->DeleteFile(meta.number);
+    if (options_.skiplist_cache) {
+      table_cache_->Evict(meta.number);
+    }
+  }
+  tiering_stats_.ResetReadCount(number);
+  pending_outputs_.erase(meta.number);
+  if (built) {
+    DeleteObsoleteFiles();
+  }
+  if (!s.ok() && !manifest_error) {
+    // NOTE: SST is still live and the pmem copy is dropped,
+    //       so a failed read or build is not a DB error
+    Log(options_.info_log, "Promotion of #%llu dropped: %s",
+        static_cast<unsigned long long>(number), s.ToString().c_str());
+    s = Status::OK();
+  }
+  return s;
+}
+
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
@@ -888,6 +1761,10 @@ void DBImpl::BackgroundCompaction() {
   }
 
   Status status;
+  if (c != nullptr) {
+    // JH: Lifetime of pmem tables is counted in compactions
+    tiering_stats_.IncreaseCompactionCount();
+  }
   if (c == nullptr) {
     // Nothing to do
   } else if (!is_manual && c->IsTrivialMove()) {
@@ -896,11 +1773,16 @@ void DBImpl::BackgroundCompaction() {
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
+                       f->smallest, f->largest, f->tier);
     status = versions_->LogAndApply(c->edit(), &mutex_);
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
+    if (status.ok() && f->tier != kTierSST &&
+        (options_.tiering_option == kColdDataTiering ||
+         options_.tiering_option == kLRUTiering)) {
+      tiering_stats_.SetLevelInPmem(f->number, c->level() + 1);
+    }
     VersionSet::LevelSummaryStorage tmp;
     Log(options_.info_log, "Moved #%lld to level-%d %lld bytes %s: %s\n",
         static_cast<unsigned long long>(f->number),
@@ -922,8 +1804,12 @@ void DBImpl::BackgroundCompaction() {
     if(options_.sst_type == kFileDescriptorSST || 
        options_.tiering_option != kNoTiering) {
       DeleteObsoleteFiles();
-    } else if (options_.sst_type == kPmemSST) {
-      // Done
+    } else if (options_.sst_type == kPmemSST && bg_error_.ok()) {
+      // No files to delete, but lists and buffer segments of inputs are dead
+      std::set<uint64_t> live = pending_outputs_;
+      versions_->AddLiveFiles(&live);
+      ReclaimPmemTables(live);
+      ReclaimPmemBuffers(live);
     }
   }
   delete c;
@@ -966,6 +1852,12 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
     const CompactionState::Output& out = compact->outputs[i];
     pending_outputs_.erase(out.number);
   }
+  // NOTE: No-op for inputs already removed from LRU lists
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      tiering_stats_.UnpinInPmem(compact->compaction->input(which, i)->number);
+    }
+  }
   delete compact;
 }
 /* SOLVE: Compaction based on pmem */
@@ -983,6 +1875,12 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact,
     out.number = file_number;
     out.smallest.Clear();
     out.largest.Clear();
+    if (options_.sst_type == kFileDescriptorSST || is_file_creation) {
+      out.tier = kTierSST;
+    } else {
+      out.tier = (options_.ds_type == kHashmap) ? kTierPmemHashmap
+                                                : kTierPmemSkiplist;
+    }
     compact->outputs.push_back(out);
     mutex_.Unlock();
   }
@@ -1071,7 +1969,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
       delete iter;
     // } else if (sst_type == kPmemSST ) {
     } else if (sst_type == kPmemSST && 
-                options_.ds_type == kSkiplist && 
+                options_.ds_type != kHashmap && 
                 options_.skiplist_cache) {
       iter = table_cache_->NewIteratorFromPmem(ReadOptions(),
                                                 output_number,
@@ -1110,7 +2008,7 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     const CompactionState::Output& out = compact->outputs[i];
     compact->compaction->edit()->AddFile(
         level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
+        out.number, out.file_size, out.smallest, out.largest, out.tier);
   }
   return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
 }
@@ -1134,6 +2032,13 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->sequence_number();
   }
 
+  // JH: Inputs in pmem are not demotion victims until cleanup
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      tiering_stats_.PinInPmem(compact->compaction->input(which, i)->number);
+    }
+  }
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
   // SOLVE: Need to analyze here
@@ -1156,10 +2061,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   bool need_file_creation = false; // flag that store contents as SST file
   bool leveled_trigger = false;    // Opt1
   bool lru_trigger = false;        // Opt3
-  uint64_t lru_flushed_bytes_written = 0; // Opt3 for stats
   // std::vector<uint64_t> pending_deleted_number_in_pmem; // for synchronization
 
-  if (options_.ds_type == kSkiplist) {
+  if (options_.ds_type == kSkiplist || options_.ds_type == kSortedArray) {
     switch(options_.tiering_option) {
       // Opt1
       case kLeveledTiering:
@@ -1210,7 +2114,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       if (write_pmem_buffer) {
         uint64_t file_number = compact->current_output()->number;
         PmemBuffer* pmem_buffer = 
-                options_.pmem_buffer[file_number % NUM_OF_BUFFER];
+                options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards];
         compact->builder->FlushBufferToPmemBuffer(pmem_buffer, file_number);
         write_pmem_buffer = false;
       }
@@ -1277,8 +2181,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         /* Check tiering conditions */
         switch (options_.ds_type) {
           case kSkiplist:
+          case kSortedArray:
             PmemSkiplist* pmem_skiplist = 
-                      options_.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
+                      options_.pmem_skiplist[file_number % options_.pmem_options.num_of_shards];
             bool is_freelist_empty = pmem_skiplist->IsFreeListEmptyWarning();
             // PROGRESS: Flush [Opt2, Opt3]
             switch (options_.tiering_option) {
@@ -1288,111 +2193,19 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
                                       false;
                 break;
               case kColdDataTiering:
-              // 1) Get candidate
-              // 2) Flush pmem_skiplist to SST
-              // 3) collect statistics
-                need_file_creation = false;
+                // NOTE: Old tables are demoted in background 
+                //       (MaybeScheduleDemotion), L5, L6 are not kept in pmem
+                need_file_creation = (lru_trigger || is_freelist_empty ||
+                    Tiering_stats::GetLifetimeThreshold(
+                        compact->compaction->level()+1) == 0);
                 break;
               case kLRUTiering:
-              {
-                if (lru_trigger) {
-                  // compulsory creation of SST
-                  need_file_creation = true;
-                }
-                else if (is_freelist_empty) {
-                  /* 1) Get candidate number */
-                  level_number evicted_level_number;
-                  for (int i=0 ; ; i++) {
-                    evicted_level_number =
-                        tiering_stats_.GetElementFromNumberListInPmem(file_number, i);
-                        // printf("evicted_number %d\n", evicted_number);
-                    bool current_in_use = false;
-                    for (int layer=0; layer<2; layer++) {
-                      for (int i=0; i<compact->compaction->num_input_files(layer); i++) {
-                        uint64_t number = compact->compaction->input(layer, i)->number;
-                        if (evicted_level_number.number == number) {
-                          current_in_use = true;
-                          break;
-                        }
-                      }
-                      if(current_in_use) break;
-                    }
-                    if(!current_in_use) break;
-                  }
-                  tiering_stats_.RemoveFromNumberListInPmem(evicted_level_number.number);
-
-                  /* 
-                   * 2) Flush pmem_skiplist to SST 
-                   * Copy from builder.cc
-                   */
-                  FileMetaData meta;
-                  meta.number = evicted_level_number.number;
-                  meta.file_size = 0;
-                  std::string fname = TableFileName(dbname_, meta.number);
-                  WritableFile* file;
-                  Status s = env_->NewWritableFile(fname, &file);
-                  if (!s.ok()) {
-                    return s;
-                  }
-                  TableBuilder* builder = new TableBuilder(options_, file);
-                  // printf("Compaction meta %d\n", meta.number);
-                  PmemIterator* pmem_iterator = new PmemIterator(meta.number, 
-                    options_.pmem_skiplist[meta.number % NUM_OF_SKIPLIST_MANAGER]);
-                  pmem_iterator->SeekToFirst();
-                  meta.smallest.DecodeFrom(pmem_iterator->key());
-                  for ( ; pmem_iterator->Valid() ; pmem_iterator->Next()) {
-                    Slice key = pmem_iterator->key();
-                    meta.largest.DecodeFrom(key);
-                    Slice value = pmem_iterator->value();
-                    builder->Add(key, value);
-                  }
-                  delete pmem_iterator;
-
-                  s = builder->Finish();
-                  if (s.ok()) {
-                    meta.file_size = builder->FileSize();
-                    assert(meta.file_size > 0);
-                    lru_flushed_bytes_written += meta.file_size; // stats
-                  }
-                  delete builder;
-
-                  if (s.ok()) {
-                    s = file->Sync();
-                  }
-                  if (s.ok()) {
-                    s = file->Close();
-                  }
-                  delete file;
-                  file = nullptr;
-
-                  if (s.ok()) {
-                    // Verify that the table is usable
-                    Iterator* it = table_cache_->NewIterator(ReadOptions(),
-                                                    meta.number,
-                                                    meta.file_size);
-                    s = it->status();
-                    delete it;
-                  }
-                  /* 3) Stats */
-                  // NOTE: pending delete file from pmem_skiplist and tiering_stats
-                  // pending_deleted_number_in_pmem.push_back(evicted_level_number.number);
-                  mutex_.Lock();
-                  pmem_skiplist->DeleteFileWithCheckRef(evicted_level_number.number);
-                  tiering_stats_.DeleteFromSkiplistSet(evicted_level_number.number);
-                  tiering_stats_.InsertIntoFileSet(evicted_level_number.number);
-                  mutex_.Unlock();
-                  // printf("[DEBUG] End LRU tiering on %d %d\n", evicted_level_number.number, file_number);
-                  need_file_creation = false;
-                  need_file_creation = pmem_skiplist->IsFreeListEmpty() ? true : false;
-                  if (need_file_creation) {
-                    printf("[WARNING][Compaction] already use LRU-tiering option. but temporarily need_file_creation\n");
-                    printf("file_number %d\n", file_number);
-                  }
-                } else {
-                  need_file_creation = false;
-                }
+                // NOTE: Only pop a free slot here. LRU tables are demoted 
+                //       in background to keep free list above watermark
+                //       (MaybeScheduleDemotion), SST if it is still empty
+                need_file_creation = (lru_trigger || 
+                                      pmem_skiplist->IsFreeListEmpty());
                 break;
-              }
               case kNoTiering:
                 need_file_creation = is_freelist_empty ? true : false;
                 if (need_file_creation) {
@@ -1403,6 +2216,15 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
             } 
           break;
         }
+        // NOTE: Full pmem buffer falls back to SST, as full free list
+        if (!need_file_creation && sst_type == kPmemSST &&
+            options_.use_pmem_buffer &&
+            !options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards]
+                ->HasRoomForTable()) {
+          Log(options_.info_log, "Pmem buffer is full, #%llu goes to SST",
+              static_cast<unsigned long long>(file_number));
+          need_file_creation = true;
+        }
         maintain_flag = true;
         status = OpenCompactionOutputFile(compact, file_number, need_file_creation);
         if (!status.ok()) {
@@ -1435,18 +2257,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         PmemHashmap* pmem_hashmap;
         switch (options_.ds_type) {
           case kSkiplist:
-            pmem_skiplist = options_.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
+          case kSortedArray:
+            pmem_skiplist = options_.pmem_skiplist[file_number % options_.pmem_options.num_of_shards];
             if (options_.use_pmem_buffer) {
               PmemBuffer* pmem_buffer =
-                    options_.pmem_buffer[file_number % NUM_OF_BUFFER];
-              if(input->buffer_ptr() == nullptr) { // SST -> skip list
-                compact->builder->AddToBufferAndSkiplist(pmem_buffer, pmem_skiplist,
-                                                    file_number, key, value);
-                if(!write_pmem_buffer) write_pmem_buffer = true;
-              } else { // skip list -> skip list
-                compact->builder->AddToSkiplistByPtr (pmem_skiplist,
-                              file_number, key, value, input->buffer_ptr());
-              }
+                    options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards];
+              // NOTE: Entries of pmem inputs are copied as well, so no
+              //       output holds a segment of its inputs (a few live 
+              //       entries would keep whole segments from reuse)
+              compact->builder->AddToBufferAndSkiplist(pmem_buffer, pmem_skiplist,
+                                                  file_number, key, value);
+              if(!write_pmem_buffer) write_pmem_buffer = true;
             } else {
               // Deprecated in this version
               /*
@@ -1457,11 +2278,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
             }
             break;
           case kHashmap:
-            pmem_hashmap = options_.pmem_hashmap[file_number % NUM_OF_SKIPLIST_MANAGER];
+            pmem_hashmap = options_.pmem_hashmap[file_number % options_.pmem_options.num_of_shards];
             if (options_.use_pmem_buffer) {
-              compact->builder->AddToHashmapByPtr (pmem_hashmap,
-                            file_number, key, value,
-                            input->key_ptr(), input->buffer_ptr());
+              PmemBuffer* pmem_buffer =
+                    options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards];
+              // NOTE: Copied as skiplist entries above
+              compact->builder->AddToBufferAndHashmap(pmem_buffer, pmem_hashmap,
+                                                  file_number, key, value);
+              if(!write_pmem_buffer) write_pmem_buffer = true;
             } else {
               // TODO:
               // Deprecated in this version
@@ -1474,11 +2298,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
             break;
         }
         // Close output file if it is big enough
-        if (compact->builder->NumEntries() >=
-            compact->compaction->MaxOutputEntriesNum() -1 ) {
+        // NOTE: Skiplists grow by extents, so outputs are cut by size
+        //       as SST. Hashmap keeps fixed capacity of entries.
+        bool output_full = (options_.ds_type == kHashmap) ?
+            (compact->builder->NumEntries() >=
+             compact->compaction->MaxOutputEntriesNum() - 1) :
+            (compact->builder->FileSize() >=
+             compact->compaction->MaxOutputFileSize());
+        if (output_full) {
           if (write_pmem_buffer) {
             PmemBuffer* pmem_buffer = 
-                    options_.pmem_buffer[file_number % NUM_OF_BUFFER];
+                    options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards];
             compact->builder->FlushBufferToPmemBuffer(pmem_buffer, file_number);
             write_pmem_buffer = false;
           }
@@ -1505,7 +2335,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     if (write_pmem_buffer) {
       uint64_t file_number = compact->current_output()->number;
       PmemBuffer* pmem_buffer = 
-              options_.pmem_buffer[file_number % NUM_OF_BUFFER];
+              options_.pmem_buffer[file_number % options_.pmem_options.num_of_shards];
       compact->builder->FlushBufferToPmemBuffer(pmem_buffer, file_number);
       write_pmem_buffer = false;
     }
@@ -1542,19 +2372,13 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   }
   // customized by JH for measuring WAF
   for (size_t i = 0; i < compact->outputs.size(); i++) {
-    uint64_t number = compact->outputs[i].number;
-    if (tiering_stats_.IsInFileSet(number)) {
+    if (compact->outputs[i].tier == kTierSST) {
       stats.bytes_written += compact->outputs[i].file_size;
-    } else if (tiering_stats_.IsInSkiplistSet(number)) {
+    } else {
       uint64_t estimated_written = (compact->outputs[i].file_size / 120) * 8; // pointer = 8bytes
       stats.bytes_written += estimated_written;
-    } else {
-      printf("[WARN][BGCompaction][Stats] % is not in both fileset and skiplistset\n", number);
-      stats.bytes_written += compact->outputs[i].file_size;
     }
   }
-  // LRU stats
-  stats.bytes_written += lru_flushed_bytes_written;
 
   mutex_.Lock();
   stats_[compact->compaction->level() + 1].Add(stats);
@@ -1595,20 +2419,15 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       uint64_t file_number = tmp->number;
       tiering_stats_.DeleteFromSkiplistSet(file_number);
 
+      // NOTE: Lists and buffer records are freed by ReclaimPmemTables,
+      //       once no version (iterator, pinned value) refers to the table
       if (options_.sst_type == kPmemSST && 
-            options_.ds_type == kSkiplist) {
-        PmemSkiplist* pmem_skiplist = 
-                options_.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
-        pmem_skiplist->DeleteFile(file_number);
-
+            options_.ds_type != kHashmap) {
         // PROGRESS: Cold_data, LRU => evict from tiering_stats
         if (options_.tiering_option == kColdDataTiering ||
             options_.tiering_option == kLRUTiering) {
           tiering_stats_.RemoveFromNumberListInPmem(file_number);
         }
-        if (options_.skiplist_cache) {
-          table_cache_->Evict(file_number);
-        }
       }
     }
   }
@@ -1638,6 +2457,31 @@ static void CleanupIteratorState(void* arg1, void* arg2) {
   delete state;
 }
 
+// JH: Source of a pinned Get value, a memtable or a version (pmem table)
+// with the SST block holding the value
+// NOTE: Pmem tables of a referenced version are not reclaimed
+//       (ReclaimPmemTables), even if compacted away or demoted
+struct PinState {
+  port::Mutex* const mu;
+  MemTable* const mem GUARDED_BY(mu);
+  Version* const version GUARDED_BY(mu);
+  Iterator* const block;  // Holds block cache handle, may be null
+
+  PinState(port::Mutex* mutex, MemTable* mem, Version* version,
+           Iterator* block)
+      : mu(mutex), mem(mem), version(version), block(block) { }
+};
+
+static void CleanupPinState(void* arg1, void* arg2) {
+  PinState* state = reinterpret_cast<PinState*>(arg1);
+  delete state->block;
+  state->mu->Lock();
+  if (state->mem != nullptr) state->mem->Unref();
+  if (state->version != nullptr) state->version->Unref();
+  state->mu->Unlock();
+  delete state;
+}
+
 }  // anonymous namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
@@ -1680,6 +2524,21 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
+  return GetImpl(options, key, value, nullptr);
+}
+
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   PinnableValue* value) {
+  value->Reset();
+  return GetImpl(options, key, nullptr, value);
+}
+
+// JH: Copy to *value, or pin the source of the value in *pinned
+Status DBImpl::GetImpl(const ReadOptions& options,
+                       const Slice& key,
+                       std::string* value,
+                       PinnableValue* pinned) {
   Status s;
   MutexLock l(&mutex_);
   SequenceNumber snapshot;
@@ -1699,29 +2558,70 @@ Status DBImpl::Get(const ReadOptions& options,
 
   bool have_stat_update = false;
   Version::GetStats stats;
+  // JH: Pinned value points into found_mem, or into current (pmem table)
+  //     and pinned_block (SST)
+  Slice pinned_value;
+  Slice* pinned_ptr = (pinned != nullptr) ? &pinned_value : nullptr;
+  MemTable* found_mem = nullptr;
+  Iterator* pinned_block = nullptr;
 
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
+    if (mem->Get(lkey, value, &s, pinned_ptr)) {
       // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+      found_mem = mem;
+    } else if (imm != nullptr && imm->Get(lkey, value, &s, pinned_ptr)) {
       // Done
+      found_mem = imm;
     } else {
       /* SOLVE: Get based on pmem */
       // s = current->Get(options, lkey, value, &stats);
-      s = current->Get(options_, options, lkey, value, &stats, &tiering_stats_);
+      s = current->Get(options_, options, lkey, value, &stats, &tiering_stats_,
+                       pinned_ptr, &pinned_block);
       have_stat_update = true;
     }
     mutex_.Lock();
   }
+  if (pinned != nullptr && s.ok()) {
+    // NOTE: References are handed over, released by PinnableValue
+    if (found_mem != nullptr) {
+      found_mem->Ref();
+      pinned->PinSlice(pinned_value, CleanupPinState,
+                       new PinState(&mutex_, found_mem, nullptr, nullptr),
+                       nullptr);
+    } else {
+      current->Ref();
+      pinned->PinSlice(pinned_value, CleanupPinState,
+                       new PinState(&mutex_, nullptr, current, pinned_block),
+                       nullptr);
+      pinned_block = nullptr;
+    }
+  }
+  delete pinned_block;
 
   // DEBUG: Stop scheduling additional compaction
   // if (have_stat_update && current->UpdateStats(stats)) {
   //   MaybeScheduleCompaction();
   // }
+  // JH: Recency of pmem tables, read-driven promotion of hot SST files
+  if (found_mem != nullptr) {
+    tier_stats_.mem_hits++;
+  }
+  if (have_stat_update && stats.read_file != nullptr) {
+    uint64_t number = stats.read_file->number;
+    if (stats.read_file->tier != kTierSST) {
+      tier_stats_.pmem_hits++;
+      tiering_stats_.TouchInPmem(number);
+    } else {
+      tier_stats_.sst_hits++;
+      if (IsPromotionEnabled() && tiering_stats_.RecordRead(number)) {
+        MaybeSchedulePromotion();
+      }
+    }
+  }
   mem->Unref();
   if (imm != nullptr) imm->Unref();
   current->Unref();
@@ -1796,16 +2696,30 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     // into mem_.
     {
       mutex_.Unlock();
-      status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+      // JH: No log for persistent memtable (log_ is null)
+      if (log_ != nullptr) {
+        status = log_->AddRecord(WriteBatchInternal::Contents(updates));
+      }
       bool sync_error = false;
-      if (status.ok() && options.sync) {
+      if (status.ok() && options.sync && logfile_ != nullptr) {
         status = logfile_->Sync();
         if (!status.ok()) {
           sync_error = true;
         }
       }
+      if (status.ok() &&
+          !mem_->HasRoomFor(WriteBatchInternal::Count(updates),
+                            WriteBatchInternal::ByteSize(updates))) {
+        status = Status::InvalidArgument(
+            "write batch is larger than pmem memtable");
+      }
       if (status.ok()) {
         status = WriteBatchInternal::InsertInto(updates, mem_);
+        // JH: Entries are durable, recovered only up to the last
+        //     committed batch (torn batch is dropped as a whole)
+        if (status.ok()) {
+          mem_->Commit(last_sequence);
+        }
       }
       mutex_.Lock();
       if (sync_error) {
@@ -1849,6 +2763,7 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   assert(result != nullptr);
 
   size_t size = WriteBatchInternal::ByteSize(first->batch);
+  int count = WriteBatchInternal::Count(first->batch);
 
   // Allow the group to grow up to a maximum size, but if the
   // original write is small, limit the growth so we do not slow
@@ -1870,10 +2785,15 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
 
     if (w->batch != nullptr) {
       size += WriteBatchInternal::ByteSize(w->batch);
+      count += WriteBatchInternal::Count(w->batch);
       if (size > max_size) {
         // Do not make batch too big
         break;
       }
+      // JH: Group must fit the rest of pmem memtable arena
+      if (!mem_->HasRoomFor(count, size)) {
+        break;
+      }
 
       // Append to *result
       if (result == first->batch) {
@@ -1895,6 +2815,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
   assert(!writers_.empty());
   bool allow_delay = !force;
+  // JH: Pmem memtable is switched if its arena cannot take the batch of
+  //     first writer. Batch larger than an empty arena is rejected by Write()
+  WriteBatch* batch = writers_.front()->batch;
+  bool switched = false;
   Status s;
   uint64_t current_micros = env_->NowMicros();
   uint64_t delayed_micros = 0;
@@ -1919,7 +2843,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       delayed_micros += env_->NowMicros() - current_micros;
       current_micros = env_->NowMicros();
     } else if (!force &&
-               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
+               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size) &&
+               (batch == nullptr || switched ||
+                mem_->HasRoomFor(WriteBatchInternal::Count(batch),
+                                 WriteBatchInternal::ByteSize(batch)))) {
       // There is room in current memtable
       break;
     } else if (imm_ != nullptr) {
@@ -1940,9 +2867,14 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       assert(versions_->PrevLogNumber() == 0);
       uint64_t new_log_number = versions_->NewFileNumber();
       WritableFile* lfile = nullptr;
+      MemTable* new_mem = nullptr;
       // printf("[DEBUG %d] log_num\n", new_log_number);
-      s = env_->NewWritableFile(LogFileName(dbname_, new_log_number), &lfile);
+      s = NewLogFile(new_log_number, &lfile);
+      if (s.ok()) {
+        s = NewMemTable(new_log_number, &new_mem);
+      }
       if (!s.ok()) {
+        delete lfile;
         // Avoid chewing through file number space in a tight loop.
         versions_->ReuseFileNumber(new_log_number);
         break;
@@ -1951,12 +2883,13 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       delete logfile_;
       logfile_ = lfile;
       logfile_number_ = new_log_number;
-      log_ = new log::Writer(lfile);
+      log_ = (lfile != nullptr) ? new log::Writer(lfile) : nullptr;
       imm_ = mem_;
       has_imm_.Release_Store(imm_);
-      mem_ = new MemTable(internal_comparator_);
+      mem_ = new_mem;
       mem_->Ref();
       force = false;   // Do not force another compaction if have room
+      switched = true;
       // printf("33]\n");
       MaybeScheduleCompaction();
     }
@@ -2031,11 +2964,108 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
              static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "pmem-stats") {
+    AppendPmemShardStats(value);
+    AppendPmemTierStats(value);
+    AppendPmemEmulationStats(value);
+    return true;
+  } else if (in == "pmem-shard-stats") {
+    AppendPmemShardStats(value);
+    return true;
+  } else if (in == "pmem-tier-stats") {
+    AppendPmemTierStats(value);
+    return true;
+  } else if (in == "pmem-emulation-stats") {
+    AppendPmemEmulationStats(value);
+    return true;
   }
 
   return false;
 }
 
+/*
+ * JH: Per shard free list depth, tables and buffer usage
+ * NOTE: Buffer segments are counted under lock of each buffer
+ *       (background thread may be writing a table)
+ */
+void DBImpl::AppendPmemShardStats(std::string* value) {
+  mutex_.AssertHeld();
+  char buf[200];
+  snprintf(buf, sizeof(buf),
+           "                    PMem shards\n"
+           "Shard FreeList  Tables Buffer(MB) FreeSegments\n"
+           "----------------------------------------------\n");
+  value->append(buf);
+  for (int i = 0; i < options_.pmem_options.num_of_shards; i++) {
+    size_t free_list = 0;
+    size_t tables = 0;
+    if (options_.sst_type == kPmemSST) {
+      switch (options_.ds_type) {
+        case kSkiplist:
+        case kSortedArray:
+          free_list = options_.pmem_skiplist[i]->GetFreeListSize();
+          tables = options_.pmem_skiplist[i]->GetAllocatedMapSize();
+          break;
+        case kHashmap:
+          free_list = options_.pmem_hashmap[i]->GetFreeListSize();
+          tables = options_.pmem_hashmap[i]->GetAllocatedMapSize();
+          break;
+      }
+    }
+    uint64_t num_segments = 0;
+    uint64_t free_segments = 0;
+    if (options_.use_pmem_buffer) {
+      num_segments = options_.pmem_buffer[i]->GetNumOfSegments();
+      free_segments = options_.pmem_buffer[i]->GetNumOfFreeSegments();
+    }
+    snprintf(buf, sizeof(buf), "%5d %8llu %7llu %10.1f %6llu/%llu\n",
+             i,
+             static_cast<unsigned long long>(free_list),
+             static_cast<unsigned long long>(tables),
+             (num_segments - free_segments) * BUFFER_SEGMENT_SIZE / 1048576.0,
+             static_cast<unsigned long long>(free_segments),
+             static_cast<unsigned long long>(num_segments));
+    value->append(buf);
+  }
+}
+
+// JH: Files per tier, tier moves and Get hits per tier
+void DBImpl::AppendPmemTierStats(std::string* value) {
+  mutex_.AssertHeld();
+  char buf[200];
+  snprintf(buf, sizeof(buf),
+           "Files: pmem %llu, sst %llu\n"
+           "Moves: demotions %lld, promotions %lld\n"
+           "Get hits: memtable %lld, pmem %lld, sst %lld\n",
+           static_cast<unsigned long long>(tiering_stats_.GetSkiplistSetSize()),
+           static_cast<unsigned long long>(tiering_stats_.GetFileSetSize()),
+           static_cast<long long>(tier_stats_.demotions),
+           static_cast<long long>(tier_stats_.promotions),
+           static_cast<long long>(tier_stats_.mem_hits),
+           static_cast<long long>(tier_stats_.pmem_hits),
+           static_cast<long long>(tier_stats_.sst_hits));
+  value->append(buf);
+}
+
+// JH: NVM emulation (process-wide, pmem/pmem_latency.h)
+void DBImpl::AppendPmemEmulationStats(std::string* value) {
+  PmemLatencyStats stats;
+  GetPmemLatencyStats(&stats);
+  char buf[300];
+  snprintf(buf, sizeof(buf),
+           "Emulation: %s\n"
+           "Reads: %llu, %.1f MB, delay %.3f sec\n"
+           "Writes: %llu, %.1f MB, delay %.3f sec\n",
+           GetPmemLatencyModel().enabled ? "on" : "off",
+           static_cast<unsigned long long>(stats.reads),
+           stats.read_bytes / 1048576.0,
+           stats.read_delay_ns / 1e9,
+           static_cast<unsigned long long>(stats.writes),
+           stats.write_bytes / 1048576.0,
+           stats.write_delay_ns / 1e9);
+  value->append(buf);
+}
+
 void DBImpl::GetApproximateSizes(
     const Range* range, int n,
     uint64_t* sizes) {
@@ -2076,8 +3106,49 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+Status DB::Get(const ReadOptions& options, const Slice& key,
+               PinnableValue* value) {
+  std::string result;
+  Status s = Get(options, key, &result);
+  value->Reset();
+  if (s.ok()) {
+    value->PinSelf(result);
+  }
+  return s;
+}
+
 DB::~DB() { }
 
+PinnableValue::PinnableValue()
+    : cleanup_(nullptr), arg1_(nullptr), arg2_(nullptr) { }
+
+PinnableValue::~PinnableValue() {
+  Reset();
+}
+
+void PinnableValue::PinSlice(const Slice& data, CleanupFunction function,
+                             void* arg1, void* arg2) {
+  assert(cleanup_ == nullptr);
+  value_ = data;
+  cleanup_ = function;
+  arg1_ = arg1;
+  arg2_ = arg2;
+}
+
+void PinnableValue::PinSelf(const Slice& data) {
+  assert(cleanup_ == nullptr);
+  self_.assign(data.data(), data.size());
+  value_ = Slice(self_);
+}
+
+void PinnableValue::Reset() {
+  if (cleanup_ != nullptr) {
+    (*cleanup_)(arg1_, arg2_);
+    cleanup_ = nullptr;
+  }
+  value_ = Slice();
+}
+
 Status DB::Open(const Options& options, const std::string& dbname,
                 DB** dbptr) {
   *dbptr = nullptr;
@@ -2090,16 +3161,21 @@ Status DB::Open(const Options& options, const std::string& dbname,
   if (s.ok() && impl->mem_ == nullptr) {
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewFileNumber();
-    WritableFile* lfile;
-    s = options.env->NewWritableFile(LogFileName(dbname, new_log_number),
-                                     &lfile);
+    WritableFile* lfile = nullptr;
+    MemTable* mem = nullptr;
+    s = impl->NewLogFile(new_log_number, &lfile);
+    if (s.ok()) {
+      s = impl->NewMemTable(new_log_number, &mem);
+    }
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->logfile_ = lfile;
       impl->logfile_number_ = new_log_number;
-      impl->log_ = new log::Writer(lfile);
-      impl->mem_ = new MemTable(impl->internal_comparator_);
+      impl->log_ = (lfile != nullptr) ? new log::Writer(lfile) : nullptr;
+      impl->mem_ = mem;
       impl->mem_->Ref();
+    } else {
+      delete lfile;
     }
   }
   if (s.ok() && save_manifest) {
@@ -2149,6 +3225,15 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
         }
       }
     }
+    // JH: Pmem log and memtable pools of this DB
+    const std::string pmem_pools[2] = {
+        options.pmem_options.LogPath(dbname),
+        options.pmem_options.MemTablePath(dbname)};
+    for (int i = 0; i < 2; i++) {
+      if (env->FileExists(pmem_pools[i])) {
+        env->DeleteFile(pmem_pools[i]);  // Ignore error, cleared on create
+      }
+    }
     env->UnlockFile(lock);  // Ignore error since state is already gone
     env->DeleteFile(lockname);
     env->DeleteDir(dbname);  // Ignore error in case dir contains other files
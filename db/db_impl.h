@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
 #include <deque>
+#include <map>
 #include <set>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
@@ -38,6 +39,9 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key,
+                     PinnableValue* value);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -62,6 +66,19 @@ class DBImpl : public DB {
   // file at a level >= 1.
   int64_t TEST_MaxNextLevelOverlappingBytes();
 
+  // JH: Wait until scheduled compactions, demotions and promotions are done
+  void TEST_WaitForTiering();
+
+  // JH: Level and tier of number in current version, false if not live
+  bool TEST_FindLiveFile(uint64_t number, int* level, bool* in_pmem);
+
+  // JH: LRU pmem table of shard (next demotion victim), false if none
+  bool TEST_LRUTableInPmem(int shard, uint64_t* number);
+  void TEST_PinInPmem(uint64_t number, bool pin);
+
+  // JH: Lists of pmem table number are allocated (not reclaimed yet)
+  bool TEST_PmemTableAllocated(uint64_t number);
+
   // Record a sample of bytes read at the specified internal key.
   // Samples are taken approximately once every config::kReadBytesPeriod
   // bytes.
@@ -83,16 +100,35 @@ class DBImpl : public DB {
 
   Status NewDB();
 
+  Status GetImpl(const ReadOptions& options, const Slice& key,
+                 std::string* value, PinnableValue* pinned);
+
+  // JH: New write-ahead log, in pmem if use_pmem_log else in a file
+  Status NewLogFile(uint64_t log_number, WritableFile** file);
+  // JH: New memtable, in pmem if use_pmem_memtable (then no log file)
+  Status NewMemTable(uint64_t log_number, MemTable** mem);
+
   // Recover the descriptor from persistent storage.  May do a significant
   // amount of work to recover recently logged updates.  Any changes to
   // be made to the descriptor are added to *edit.
   Status Recover(VersionEdit* edit, bool* save_manifest)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // JH: Rebuild volatile state of pmem pools and tiering_stats_
+  // from persistent owners, reconciled with the live files of MANIFEST.
+  // Corruption if a table recorded in pmem tier is not in pmem.
+  Status RecoverPmemTier(const std::set<uint64_t>& live_files)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void MaybeIgnoreError(Status* s) const;
 
   // Delete any unneeded files and stale in-memory entries.
   void DeleteObsoleteFiles() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // JH
+  void ReclaimPmemBuffers(const std::set<uint64_t>& live)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ReclaimPmemTables(const std::set<uint64_t>& live)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Compact the in-memory write buffer to disk.  Switches to a new
   // log-file/memtable and writes a new descriptor iff successful.
@@ -102,6 +138,10 @@ class DBImpl : public DB {
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // JH: Reattach (or flush) persistent memtable instead of log replay
+  Status RecoverPmemMemTable(uint64_t number, bool last, bool* save_manifest,
+                             VersionEdit* edit, SequenceNumber* max_sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -132,6 +172,37 @@ class DBImpl : public DB {
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // JH: Demotion of pmem tables to SST, as background work
+  // (kColdDataTiering: tables over lifetime threshold of their level,
+  //  kLRUTiering: LRU tables of shards under demotion_watermark)
+  // Compaction never demotes, it only pops a free slot.
+  void MaybeScheduleDemotion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool PickDemotionVictim(level_number* victim)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGDemotionWork(void* db);
+  void BackgroundDemotionCall();
+  // Write pmem table as SST of new number, swap them by a version edit,
+  // then drop it from pmem. Tier of a file number never changes.
+  Status DemotePmemTable(uint64_t number) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // JH: Read-driven promotion of hot SST files to pmem, as background work
+  // (kColdDataTiering, kLRUTiering: files over PROMOTION_READ_THRESHOLD,
+  //  while every shard keeps free list above demotion_watermark)
+  bool IsPromotionEnabled() const;
+  void MaybeSchedulePromotion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool PickPromotionCandidate(uint64_t* number)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGPromotionWork(void* db);
+  void BackgroundPromotionCall();
+  // Copy SST file into pmem table of new number, then swap them
+  // by a version edit (as demotion). So a crash never leaves a partial
+  // pmem table live. Non-ok only if LogAndApply fails, other failures
+  // drop the pmem copy and reset read count of the file.
+  Status PromoteSSTFile(uint64_t number) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Level and metadata of live file in current version, false if none
+  bool FindLiveFile(uint64_t number, int* level, FileMetaData* meta)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Constant after construction
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
@@ -172,6 +243,17 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool background_compaction_scheduled_ GUARDED_BY(mutex_);
 
+  // Has a background demotion been scheduled or is running?
+  bool background_demotion_scheduled_ GUARDED_BY(mutex_);
+
+  // Has a background promotion been scheduled or is running?
+  bool background_promotion_scheduled_ GUARDED_BY(mutex_);
+
+  // JH: Failed demotion is retried by a later MaybeScheduleDemotion()
+  // (e.g. after next compaction), not before demotion_retry_micros_
+  uint64_t demotion_retry_micros_ GUARDED_BY(mutex_);
+  std::map<uint64_t, int> demotion_failures_ GUARDED_BY(mutex_); // [ number -> failures ]
+
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
@@ -204,6 +286,28 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels] GUARDED_BY(mutex_);
 
+  // JH: Tier counters, reported by "leveldb.pmem-stats"
+  struct TierStats {
+    int64_t demotions;
+    int64_t promotions;
+    // Get answered (value or deletion) by memtable, pmem table or SST
+    int64_t mem_hits;
+    int64_t pmem_hits;
+    int64_t sst_hits;
+
+    TierStats()
+        : demotions(0), promotions(0), mem_hits(0), pmem_hits(0),
+          sst_hits(0) { }
+  };
+  TierStats tier_stats_ GUARDED_BY(mutex_);
+
+  // JH: Sections of "leveldb.pmem-stats"
+  void AppendPmemShardStats(std::string* value)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void AppendPmemTierStats(std::string* value)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void AppendPmemEmulationStats(std::string* value);
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
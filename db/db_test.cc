@@ -528,6 +528,86 @@ class DBTest {
     return false;
   }
 
+  // JH: Pmem tier tests run on a small tier (one shard of 8 lists),
+  // in a pmem_dir of their own
+  Options PmemTierOptions() {
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    options.sst_type = kPmemSST;
+    options.ds_type = kSkiplist;
+    options.use_pmem_buffer = true;
+    options.tiering_option = kLRUTiering;
+    PmemOptions* pmem = &options.pmem_options;
+    pmem->pmem_dir = dbname_ + "_pmem";
+    pmem->num_of_shards = 1;
+    pmem->skiplist_pool_size = 64 << 20;
+    pmem->buffer_pool_size = 64 << 20;
+    pmem->skiplist_list_size = 8;
+    pmem->max_skiplist_node_size = 256;
+    pmem->buffer_contents_size = 32 << 20;
+    pmem->demotion_watermark = 3;
+    return options;
+  }
+
+  // Pools of a previous run may have another topology
+  void DestroyPmemPools(const Options& options) {
+    const std::string& dir = options.pmem_options.pmem_dir;
+    std::vector<std::string> filenames;
+    env_->GetChildren(dir, &filenames);  // Ignoring errors on purpose
+    for (size_t i = 0; i < filenames.size(); i++) {
+      env_->DeleteFile(dir + "/" + filenames[i]);
+    }
+    env_->CreateDir(dir);
+  }
+
+  void OpenPmemTier(Options* options) {
+    Close();
+    DestroyPmemPools(*options);
+    DestroyAndReopen(options);
+  }
+
+  static std::string PmemKey(int i) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "key%06d", i);
+    return std::string(buf);
+  }
+
+  // Flush keys [first, first+n) as one table, then let tiering run
+  void FlushPmemTable(int first, int n) {
+    for (int i = first; i < first + n; i++) {
+      ASSERT_OK(Put(PmemKey(i), "v" + PmemKey(i)));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+    dbfull()->TEST_WaitForTiering();
+  }
+
+  // Tables of the current version in pmem and in SST
+  void CountLiveTables(int* pmem, int* sst) {
+    *pmem = 0;
+    *sst = 0;
+    for (uint64_t number = 1; number < 1000; number++) {
+      int level;
+      bool in_pmem;
+      if (dbfull()->TEST_FindLiveFile(number, &level, &in_pmem)) {
+        if (in_pmem) {
+          (*pmem)++;
+        } else {
+          (*sst)++;
+        }
+      }
+    }
+  }
+
+  // "Files: pmem %d, sst %d" and "Moves: ..." of leveldb.pmem-tier-stats
+  void PmemTierStats(int* pmem, int* sst, int* demotions, int* promotions) {
+    std::string val;
+    ASSERT_TRUE(db_->GetProperty("leveldb.pmem-tier-stats", &val));
+    ASSERT_EQ(4, sscanf(val.c_str(),
+                        "Files: pmem %d, sst %d\n"
+                        "Moves: demotions %d, promotions %d",
+                        pmem, sst, demotions, promotions));
+  }
+
   // Returns number of files renamed.
   int RenameLDBToSST() {
     std::vector<std::string> filenames;
@@ -602,6 +682,29 @@ TEST(DBTest, GetFromVersions) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetPinned) {
+  do {
+    std::string big(8000, 'b');
+    ASSERT_OK(Put("foo", big));
+    PinnableValue value;
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &value));
+    ASSERT_TRUE(value.IsPinned());
+    ASSERT_EQ(big, value.ToString());
+
+    // Pinned memtable value survives overwrite and memtable compaction
+    ASSERT_OK(Put("foo", "v2"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ(big, value.ToString());
+
+    ASSERT_OK(db_->Get(ReadOptions(), "foo", &value));
+    ASSERT_EQ("v2", value.ToString());
+    ASSERT_OK(Delete("foo"));
+    ASSERT_TRUE(db_->Get(ReadOptions(), "foo", &value).IsNotFound());
+    ASSERT_TRUE(!value.IsPinned());
+    ASSERT_EQ(0, value.size());
+  } while (ChangeOptions());
+}
+
 TEST(DBTest, GetMemUsage) {
   do {
     ASSERT_OK(Put("foo", "v1"));
@@ -613,6 +716,392 @@ TEST(DBTest, GetMemUsage) {
   } while (ChangeOptions());
 }
 
+TEST(DBTest, GetPmemStats) {
+  do {
+    ASSERT_OK(Put("foo", "v1"));
+    ASSERT_EQ("v1", Get("foo"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("v1", Get("foo"));
+    std::string val;
+    ASSERT_TRUE(db_->GetProperty("leveldb.pmem-tier-stats", &val));
+    ASSERT_TRUE(val.find("Get hits: memtable 1,") != std::string::npos);
+    ASSERT_TRUE(db_->GetProperty("leveldb.pmem-stats", &val));
+    ASSERT_TRUE(val.find("PMem shards") != std::string::npos);
+    ASSERT_TRUE(val.find("Emulation:") != std::string::npos);
+    ASSERT_TRUE(!db_->GetProperty("leveldb.pmem-unknown", &val));
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, PmemDemotion) {
+  Options options = PmemTierOptions();
+  OpenPmemTier(&options);
+  // Past the watermark, each flush demotes the least recently used table
+  for (int t = 0; t < 8; t++) {
+    FlushPmemTable(t * 10, 10);
+  }
+  int pmem, sst, demotions, promotions;
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_EQ(5, pmem);
+  ASSERT_EQ(3, sst);
+  ASSERT_EQ(3, demotions);
+  ASSERT_EQ(0, promotions);
+  int live_pmem, live_sst;
+  CountLiveTables(&live_pmem, &live_sst);
+  ASSERT_EQ(pmem, live_pmem);
+  ASSERT_EQ(sst, live_sst);
+
+  // Demoted keys (oldest tables) are read back from SST
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+  std::string val;
+  ASSERT_TRUE(db_->GetProperty("leveldb.pmem-tier-stats", &val));
+  ASSERT_TRUE(val.find("Get hits: memtable 0, pmem 50, sst 30") !=
+              std::string::npos) << val;
+
+  // Demoted data survives reopen
+  Reopen(&options);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_EQ(5, pmem);
+  ASSERT_EQ(3, sst);
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemPromotion) {
+  Options options = PmemTierOptions();
+  OpenPmemTier(&options);
+  for (int t = 0; t < 8; t++) {
+    FlushPmemTable(t * 10, 10);
+  }
+  int pmem, sst, demotions, promotions;
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_EQ(3, sst);
+
+  // Free slots above the watermark let hot SST files come back
+  options.pmem_options.demotion_watermark = 1;
+  Reopen(&options);
+  for (int i = 0; i < PROMOTION_READ_THRESHOLD; i++) {
+    ASSERT_EQ("v" + PmemKey(5), Get(PmemKey(5)));
+  }
+  dbfull()->TEST_WaitForTiering();
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_EQ(6, pmem);
+  ASSERT_EQ(2, sst);
+  ASSERT_EQ(0, demotions);
+  ASSERT_EQ(1, promotions);
+  int live_pmem, live_sst;
+  CountLiveTables(&live_pmem, &live_sst);
+  ASSERT_EQ(pmem, live_pmem);
+  ASSERT_EQ(sst, live_sst);
+
+  // Promoted table serves its keys from pmem
+  // (the hot reads above were all served by SST)
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+  std::string val;
+  ASSERT_TRUE(db_->GetProperty("leveldb.pmem-tier-stats", &val));
+  ASSERT_TRUE(val.find("Get hits: memtable 0, pmem 60, sst 1020") !=
+              std::string::npos) << val;
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemLRUOrder) {
+  Options options = PmemTierOptions();
+  options.pmem_options.demotion_watermark = 0;  // No demotion
+  OpenPmemTier(&options);
+  for (int t = 0; t < 3; t++) {
+    FlushPmemTable(t * 10, 10);
+  }
+  uint64_t first, second, third, number;
+  int level;
+  bool in_pmem;
+  // Oldest table first
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &first));
+  ASSERT_TRUE(dbfull()->TEST_FindLiveFile(first, &level, &in_pmem));
+  ASSERT_TRUE(in_pmem);
+  ASSERT_TRUE(!dbfull()->TEST_FindLiveFile(first + 1000, &level, &in_pmem));
+
+  // Read moves a table to MRU end
+  ASSERT_EQ("v" + PmemKey(0), Get(PmemKey(0)));
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &second));
+  ASSERT_GT(second, first);
+
+  // Pinned table is skipped, and reads do not move it
+  dbfull()->TEST_PinInPmem(second, true);
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &third));
+  ASSERT_GT(third, second);
+  ASSERT_EQ("v" + PmemKey(10), Get(PmemKey(10)));
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  ASSERT_EQ(third, number);
+
+  // Unpinned table goes to MRU end: third, first, second
+  dbfull()->TEST_PinInPmem(second, false);
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  ASSERT_EQ(third, number);
+  ASSERT_EQ("v" + PmemKey(20), Get(PmemKey(20)));
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  ASSERT_EQ(first, number);
+  ASSERT_EQ("v" + PmemKey(0), Get(PmemKey(0)));
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  ASSERT_EQ(second, number);
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemPinnedValueCompaction) {
+  Options options = PmemTierOptions();
+  options.pmem_options.demotion_watermark = 0;  // No demotion
+  OpenPmemTier(&options);
+  FlushPmemTable(0, 10);
+  uint64_t number;
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  PinnableValue value;
+  ASSERT_OK(db_->Get(ReadOptions(), PmemKey(3), &value));
+  ASSERT_TRUE(value.IsPinned());
+
+  // Table of the pinned value is compacted away, but not reclaimed
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put(PmemKey(i), "w" + PmemKey(i)));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  db_->CompactRange(nullptr, nullptr);
+  dbfull()->TEST_WaitForTiering();
+  int level;
+  bool in_pmem;
+  ASSERT_TRUE(!dbfull()->TEST_FindLiveFile(number, &level, &in_pmem));
+  ASSERT_TRUE(dbfull()->TEST_PmemTableAllocated(number));
+  ASSERT_EQ("v" + PmemKey(3), value.ToString());
+  ASSERT_EQ("w" + PmemKey(3), Get(PmemKey(3)));
+
+  // Reclaimed with next obsolete files once released
+  value.Reset();
+  FlushPmemTable(10, 10);
+  ASSERT_TRUE(!dbfull()->TEST_PmemTableAllocated(number));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemPinnedValueDemotion) {
+  Options options = PmemTierOptions();
+  OpenPmemTier(&options);
+  for (int t = 0; t < 5; t++) {
+    FlushPmemTable(t * 10, 10);
+  }
+  int pmem, sst, demotions, promotions;
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_EQ(0, demotions);
+  uint64_t number;
+  ASSERT_TRUE(dbfull()->TEST_LRUTableInPmem(0, &number));
+  PinnableValue pmem_value;
+  ASSERT_OK(db_->Get(ReadOptions(), PmemKey(3), &pmem_value));
+  ASSERT_TRUE(pmem_value.IsPinned());
+
+  // Read moved it to MRU end, it is demoted after the other four
+  for (int t = 5; t < 10; t++) {
+    FlushPmemTable(t * 10, 10);
+  }
+  // NOTE: Its lists are not reclaimed while pinned, so one more may go
+  PmemTierStats(&pmem, &sst, &demotions, &promotions);
+  ASSERT_GE(demotions, 5);
+  int level;
+  bool in_pmem;
+  ASSERT_TRUE(!dbfull()->TEST_FindLiveFile(number, &level, &in_pmem));
+  ASSERT_TRUE(dbfull()->TEST_PmemTableAllocated(number));
+  ASSERT_EQ("v" + PmemKey(3), pmem_value.ToString());
+
+  // Value in a demoted SST block survives compaction of its file
+  PinnableValue sst_value;
+  ASSERT_OK(db_->Get(ReadOptions(), PmemKey(13), &sst_value));
+  ASSERT_TRUE(sst_value.IsPinned());
+  db_->CompactRange(nullptr, nullptr);
+  dbfull()->TEST_WaitForTiering();
+  ASSERT_EQ("v" + PmemKey(13), sst_value.ToString());
+  ASSERT_EQ("v" + PmemKey(3), pmem_value.ToString());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+
+  sst_value.Reset();
+  pmem_value.Reset();
+  FlushPmemTable(100, 10);
+  ASSERT_TRUE(!dbfull()->TEST_PmemTableAllocated(number));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemLogRecovery) {
+  Options options = PmemTierOptions();
+  options.use_pmem_log = true;
+  options.write_buffer_size = 1 << 20;
+  options.pmem_options.log_pool_size = 8 << 20;
+  options.pmem_options.log_contents_size = 4 << 20;
+  OpenPmemTier(&options);
+  // Pool of this DB, named after dbname
+  ASSERT_TRUE(env_->FileExists(options.pmem_options.LogPath(dbname_)));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(PmemKey(i), "v" + PmemKey(i)));
+  }
+  // Writes are logged only in pmem
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type)) {
+      ASSERT_TRUE(type != kLogFile) << filenames[i];
+    }
+  }
+
+  Reopen(&options);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+  // New log after replay is recovered as well
+  ASSERT_OK(Put(PmemKey(100), "v" + PmemKey(100)));
+  Reopen(&options);
+  ASSERT_EQ("v" + PmemKey(0), Get(PmemKey(0)));
+  ASSERT_EQ("v" + PmemKey(100), Get(PmemKey(100)));
+
+  // Logs are not replayed from a pool of other contents size
+  Close();
+  Options other = options;
+  other.pmem_options.log_contents_size = 2 << 20;
+  Status s = TryReopen(&other);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  Reopen(&options);
+  ASSERT_EQ("v" + PmemKey(100), Get(PmemKey(100)));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemMemTableCrash) {
+  Options options = PmemTierOptions();
+  options.use_pmem_memtable = true;
+  options.write_buffer_size = 1 << 20;
+  OpenPmemTier(&options);
+  ASSERT_TRUE(env_->FileExists(options.pmem_options.MemTablePath(dbname_)));
+  for (int i = 0; i < 100; i++) {
+    ASSERT_OK(Put(PmemKey(i), "v" + PmemKey(i)));
+  }
+  ASSERT_OK(Delete(PmemKey(50)));
+  // No write-ahead log
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+  uint64_t number;
+  FileType type;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (ParseFileName(filenames[i], &number, &type)) {
+      ASSERT_TRUE(type != kLogFile) << filenames[i];
+    }
+  }
+
+  // Memtable is neither flushed nor logged before the crash
+  Reopen(&options);
+  for (int i = 0; i < 100; i++) {
+    if (i == 50) {
+      ASSERT_EQ("NOT_FOUND", Get(PmemKey(i)));
+    } else {
+      ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+    }
+  }
+  // Reattached memtable takes new writes
+  ASSERT_OK(Put(PmemKey(50), "v2"));
+  Reopen(&options);
+  ASSERT_EQ("v2", Get(PmemKey(50)));
+  ASSERT_EQ("v" + PmemKey(99), Get(PmemKey(99)));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemMemTableRoom) {
+  Options options = PmemTierOptions();
+  options.use_pmem_memtable = true;
+  options.write_buffer_size = 1 << 20;
+  OpenPmemTier(&options);
+  // Below write_buffer_size, but the next value does not fit the arena
+  std::string small(1000 << 10, 'a');
+  std::string large(1500 << 10, 'b');
+  ASSERT_OK(Put("small", small));
+  ASSERT_OK(Put("large", large));
+  ASSERT_EQ(small, Get("small"));
+  ASSERT_EQ(large, Get("large"));
+
+  // Value larger than an empty arena is rejected
+  std::string huge(3 << 20, 'c');
+  ASSERT_TRUE(Put("huge", huge).IsInvalidArgument());
+  Reopen(&options);
+  ASSERT_EQ(small, Get("small"));
+  ASSERT_EQ(large, Get("large"));
+  ASSERT_EQ("NOT_FOUND", Get("huge"));
+
+  // Arenas of the pool are too small for a larger write_buffer_size
+  Close();
+  Options other = options;
+  other.write_buffer_size = 2 << 20;
+  Status s = TryReopen(&other);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  Reopen(&options);
+  ASSERT_EQ(large, Get("large"));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemPoolMismatch) {
+  Options options = PmemTierOptions();
+  OpenPmemTier(&options);
+  FlushPmemTable(0, 100);
+  Close();
+
+  // Pools are kept as they are, open fails instead of the process
+  Options other = options;
+  other.pmem_options.skiplist_list_size = 16;
+  Status s = TryReopen(&other);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  other = options;
+  other.pmem_options.num_of_shards = 2;
+  s = TryReopen(&other);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  other = options;
+  other.ds_type = kSortedArray;
+  s = TryReopen(&other);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+
+  Reopen(&options);
+  ASSERT_EQ("v" + PmemKey(0), Get(PmemKey(0)));
+  ASSERT_EQ("v" + PmemKey(99), Get(PmemKey(99)));
+  Close();
+  DestroyPmemPools(options);
+}
+
+TEST(DBTest, PmemBufferFull) {
+  Options options = PmemTierOptions();
+  // Two segments, a table reserves both
+  options.pmem_options.buffer_contents_size = 2 << 20;
+  OpenPmemTier(&options);
+  FlushPmemTable(0, 10);
+  int pmem, sst;
+  CountLiveTables(&pmem, &sst);
+  ASSERT_EQ(1, pmem);
+  ASSERT_EQ(0, sst);
+
+  // First table holds a segment, next one is written as SST
+  FlushPmemTable(10, 10);
+  CountLiveTables(&pmem, &sst);
+  ASSERT_EQ(1, pmem);
+  ASSERT_EQ(1, sst);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ("v" + PmemKey(i), Get(PmemKey(i)));
+  }
+  Close();
+  DestroyPmemPools(options);
+}
+
 TEST(DBTest, GetSnapshot) {
   do {
     // Try with both a short key and a long key
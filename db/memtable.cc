@@ -8,6 +8,8 @@
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
 #include "util/coding.h"
+// JH
+#include "pmem/pmem_latency.h"
 
 namespace leveldb {
 
@@ -21,14 +23,40 @@ static Slice GetLengthPrefixedSlice(const char* data) {
 MemTable::MemTable(const InternalKeyComparator& cmp)
     : comparator_(cmp),
       refs_(0),
-      table_(comparator_, &arena_) {
+      table_(comparator_, &arena_),
+      pmem_pool_(nullptr),
+      pmem_slot_(-1),
+      pmem_table_(nullptr) {
+}
+
+MemTable::MemTable(const InternalKeyComparator& cmp,
+                   PmemMemTablePool* pmem_pool, int pmem_slot, bool reset)
+    : comparator_(cmp),
+      refs_(0),
+      table_(comparator_, &arena_),
+      pmem_pool_(pmem_pool),
+      pmem_slot_(pmem_slot) {
+  pmem_pool_->AttachSlot(pmem_slot_);
+  pmem_table_ = new PmemTable(comparator_, pmem_pool_->GetPool(),
+                              pmem_pool_->GetArena(pmem_slot_),
+                              pmem_pool_->GetArenaSize(), reset);
 }
 
 MemTable::~MemTable() {
   assert(refs_ == 0);
+  if (pmem_table_ != nullptr) {
+    delete pmem_table_;
+    // NOTE: Slot is reused once it is freed (obsolete) and released
+    pmem_pool_->ReleaseSlot(pmem_slot_);
+  }
 }
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+size_t MemTable::ApproximateMemoryUsage() {
+  if (pmem_table_ != nullptr) {
+    return pmem_table_->MemoryUsage();
+  }
+  return arena_.MemoryUsage();
+}
 
 int MemTable::KeyComparator::operator()(const char* aptr, const char* bptr)
     const {
@@ -75,7 +103,38 @@ class MemTableIterator: public Iterator {
   void operator=(const MemTableIterator&);
 };
 
+// JH: Same as MemTableIterator, over persistent skiplist
+class PmemMemTableIterator: public Iterator {
+ public:
+  explicit PmemMemTableIterator(MemTable::PmemTable* table) : iter_(table) { }
+
+  virtual bool Valid() const { return iter_.Valid(); }
+  virtual void Seek(const Slice& k) { iter_.Seek(EncodeKey(&tmp_, k)); }
+  virtual void SeekToFirst() { iter_.SeekToFirst(); }
+  virtual void SeekToLast() { iter_.SeekToLast(); }
+  virtual void Next() { iter_.Next(); }
+  virtual void Prev() { iter_.Prev(); }
+  virtual Slice key() const { return GetLengthPrefixedSlice(iter_.key()); }
+  virtual Slice value() const {
+    Slice key_slice = GetLengthPrefixedSlice(iter_.key());
+    return GetLengthPrefixedSlice(key_slice.data() + key_slice.size());
+  }
+
+  virtual Status status() const { return Status::OK(); }
+
+ private:
+  MemTable::PmemTable::Iterator iter_;
+  std::string tmp_;       // For passing to EncodeKey
+
+  // No copying allowed
+  PmemMemTableIterator(const PmemMemTableIterator&);
+  void operator=(const PmemMemTableIterator&);
+};
+
 Iterator* MemTable::NewIterator() {
+  if (pmem_table_ != nullptr) {
+    return new PmemMemTableIterator(pmem_table_);
+  }
   return new MemTableIterator(&table_);
 }
 
@@ -93,7 +152,14 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   const size_t encoded_len =
       VarintLength(internal_key_size) + internal_key_size +
       VarintLength(val_size) + val_size;
-  char* buf = arena_.Allocate(encoded_len);
+  char* buf;
+  if (pmem_table_ != nullptr) {
+    // NOTE: Room is checked by HasRoomFor() before the write batch
+    buf = pmem_table_->Allocate(encoded_len);
+    assert(buf != nullptr);
+  } else {
+    buf = arena_.Allocate(encoded_len);
+  }
   char* p = EncodeVarint32(buf, internal_key_size);
   memcpy(p, key.data(), key_size);
   p += key_size;
@@ -102,14 +168,28 @@ void MemTable::Add(SequenceNumber s, ValueType type,
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
   assert(p + val_size == buf + encoded_len);
+  if (pmem_table_ != nullptr) {
+    pmem_table_->Insert(buf);
+    DelayPmemWrite(1, encoded_len);
+    return;
+  }
   table_.Insert(buf);
 }
 
-bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
+bool MemTable::Get(const LookupKey& key, std::string* value, Status* s,
+                   Slice* pinned_value) {
   Slice memkey = key.memtable_key();
-  Table::Iterator iter(&table_);
-  iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  const char* entry = nullptr;
+  if (pmem_table_ != nullptr) {
+    PmemTable::Iterator iter(pmem_table_);
+    iter.Seek(memkey.data());
+    if (iter.Valid()) entry = iter.key();
+  } else {
+    Table::Iterator iter(&table_);
+    iter.Seek(memkey.data());
+    if (iter.Valid()) entry = iter.key();
+  }
+  if (entry != nullptr) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -119,7 +199,6 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
     // Check that it belongs to same user key.  We do not check the
     // sequence number since the Seek() call above should have skipped
     // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
     uint32_t key_length;
     const char* key_ptr = GetVarint32Ptr(entry, entry+5, &key_length);
     if (comparator_.comparator.user_comparator()->Compare(
@@ -130,7 +209,11 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
       switch (static_cast<ValueType>(tag & 0xff)) {
         case kTypeValue: {
           Slice v = GetLengthPrefixedSlice(key_ptr + key_length);
-          value->assign(v.data(), v.size());
+          if (pinned_value != nullptr) {
+            *pinned_value = v;
+          } else {
+            value->assign(v.data(), v.size());
+          }
           return true;
         }
         case kTypeDeletion:
@@ -142,4 +225,20 @@ bool MemTable::Get(const LookupKey& key, std::string* value, Status* s) {
   return false;
 }
 
+bool MemTable::HasRoomFor(size_t num_entries, size_t bytes) const {
+  if (pmem_table_ == nullptr) {
+    return true;
+  }
+  // NOTE: Node of max height, length prefixes and alignment per entry
+  const size_t kMaxEntryOverhead = 8 * 13 + 10 + 8 + 7;
+  return pmem_table_->MemoryUsage() + bytes + num_entries * kMaxEntryOverhead
+         <= pmem_table_->Capacity();
+}
+
+void MemTable::Commit(SequenceNumber sequence) {
+  if (pmem_table_ != nullptr) {
+    pmem_pool_->Commit(pmem_slot_, sequence);
+  }
+}
+
 }  // namespace leveldb
@@ -10,6 +10,9 @@
 #include "db/dbformat.h"
 #include "db/skiplist.h"
 #include "util/arena.h"
+// JH
+#include "db/persistent_skiplist.h"
+#include "pmem/pmem_memtable.h"
 
 namespace leveldb {
 
@@ -22,6 +25,11 @@ class MemTable {
   // is zero and the caller must call Ref() at least once.
   explicit MemTable(const InternalKeyComparator& comparator);
 
+  // JH: Persistent memtable in slot of pmem pool (Options::use_pmem_memtable)
+  // reset: new empty memtable, else reattach the entries of previous run
+  MemTable(const InternalKeyComparator& comparator,
+           PmemMemTablePool* pmem_pool, int pmem_slot, bool reset);
+
   // Increase reference count.
   void Ref() { ++refs_; }
 
@@ -57,7 +65,20 @@ class MemTable {
   // If memtable contains a deletion for key, store a NotFound() error
   // in *status and return true.
   // Else, return false.
-  bool Get(const LookupKey& key, std::string* value, Status* s);
+  // JH: If pinned_value is non-null, it points to the value in memtable
+  //     instead of a copy in *value (caller keeps a reference).
+  bool Get(const LookupKey& key, std::string* value, Status* s,
+           Slice* pinned_value = nullptr);
+
+  // JH: Entries of a write batch fit in the (fixed) pmem arena.
+  // Always true for DRAM memtable.
+  bool HasRoomFor(size_t num_entries, size_t bytes) const;
+
+  // JH: Entries up to sequence are durable (completed write batch).
+  // No-op for DRAM memtable, whose entries are in the log.
+  void Commit(SequenceNumber sequence);
+
+  bool IsPersistent() const { return pmem_table_ != nullptr; }
 
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
@@ -69,13 +90,19 @@ class MemTable {
   };
   friend class MemTableIterator;
   friend class MemTableBackwardIterator;
+  friend class PmemMemTableIterator;
 
   typedef SkipList<const char*, KeyComparator> Table;
+  typedef PersistentSkipList<KeyComparator> PmemTable;
 
   KeyComparator comparator_;
   int refs_;
   Arena arena_;
   Table table_;
+  // JH: Persistent memtable, table_ is unused if set
+  PmemMemTablePool* pmem_pool_;
+  int pmem_slot_;
+  PmemTable* pmem_table_;
 
   // No copying allowed
   MemTable(const MemTable&);
@@ -0,0 +1,443 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_DB_PERSISTENT_SKIPLIST_H_
+#define STORAGE_LEVELDB_DB_PERSISTENT_SKIPLIST_H_
+
+// JH: Skiplist of a persistent memtable (pmem/pmem_memtable.h)
+//
+// Same design as db/skiplist.h (one writer, lock-free readers), but
+// nodes live in an arena of a pmem pool and links are offsets from the
+// arena base. So the list is reattached as is when the pool is mapped
+// again (at any address), instead of being rebuilt from a log.
+//
+// Node layout (8-byte aligned, offset 0 is head, so 0 is null):
+//   height, key_size : uint32, uint32
+//   next_[height]    : offsets of next nodes
+//   key              : key_size bytes
+//
+// Persistence: a node is flushed and fenced before it is linked, and
+// the link of level 0 is persisted right after. Upper levels are only
+// flushed (drained by next insert), any subset of them is still a
+// valid skiplist. Allocation is volatile, it is recomputed from the
+// nodes reachable at level 0 on reattach.
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <libpmemobj.h>
+#include "port/port.h"
+#include "util/random.h"
+
+namespace leveldb {
+
+template<class Comparator>
+class PersistentSkipList {
+ private:
+  struct Node;
+
+ public:
+  typedef const char* Key;
+
+  // Use "capacity" bytes of "arena" (8-byte aligned) in pool "pop".
+  // reset: start an empty list, else reattach the nodes in arena.
+  PersistentSkipList(Comparator cmp, PMEMobjpool* pop,
+                     char* arena, uint64_t capacity, bool reset);
+
+  // Return memory for a key of key_size bytes in a new node,
+  // nullptr if arena is full. Caller fills it, then calls Insert().
+  // REQUIRES: previous Allocate() is inserted
+  char* Allocate(size_t key_size);
+
+  // Insert key returned by the last Allocate() into the list.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  void Insert(const char* key);
+
+  // Returns true iff an entry that compares equal to key is in the list.
+  bool Contains(Key key) const;
+
+  // Bytes of arena in use. Safe to call while list is modified.
+  size_t MemoryUsage() const {
+    return reinterpret_cast<uintptr_t>(used_.NoBarrier_Load());
+  }
+  uint64_t Capacity() const { return capacity_; }
+
+  // Iteration over the contents of a skip list
+  class Iterator {
+   public:
+    // Initialize an iterator over the specified list.
+    // The returned iterator is not valid.
+    explicit Iterator(const PersistentSkipList* list);
+
+    // Returns true iff the iterator is positioned at a valid node.
+    bool Valid() const;
+
+    // Returns the key at the current position.
+    // REQUIRES: Valid()
+    Key key() const;
+
+    // Advances to the next position.
+    // REQUIRES: Valid()
+    void Next();
+
+    // Advances to the previous position.
+    // REQUIRES: Valid()
+    void Prev();
+
+    // Advance to the first entry with a key >= target
+    void Seek(Key target);
+
+    // Position at the first entry in list.
+    // Final state of iterator is Valid() iff list is not empty.
+    void SeekToFirst();
+
+    // Position at the last entry in list.
+    // Final state of iterator is Valid() iff list is not empty.
+    void SeekToLast();
+
+   private:
+    const PersistentSkipList* list_;
+    Node* node_;
+    // Intentionally copyable
+  };
+
+ private:
+  enum { kMaxHeight = 12 };
+
+  // Immutable after construction
+  Comparator const compare_;
+  PMEMobjpool* const pop_;
+  char* const arena_;
+  const uint64_t capacity_;
+
+  Node* const head_;
+
+  // Modified only by Insert().  Read racily by readers, but stale
+  // values are ok.
+  port::AtomicPointer max_height_;   // Height of the entire list
+  port::AtomicPointer used_;         // Bytes of arena in use
+
+  inline int GetMaxHeight() const {
+    return static_cast<int>(
+        reinterpret_cast<intptr_t>(max_height_.NoBarrier_Load()));
+  }
+
+  // Read/written only by Allocate() and Insert().
+  Random rnd_;
+  Node* pending_;
+
+  int RandomHeight();
+  bool Equal(Key a, Key b) const { return (compare_(a, b) == 0); }
+
+  // Offset <-> node, 0 is null
+  Node* NodeAt(uint64_t offset) const {
+    return (offset == 0) ? nullptr : reinterpret_cast<Node*>(arena_ + offset);
+  }
+  uint64_t OffsetOf(const Node* x) const {
+    return (x == nullptr) ? 0 : reinterpret_cast<const char*>(x) - arena_;
+  }
+  static size_t NodeSize(int height, size_t key_size) {
+    size_t size = sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1) +
+                  key_size;
+    return (size + 7) & ~static_cast<size_t>(7);
+  }
+
+  // Links, wrapped in methods with the barriers of db/skiplist.h
+  Node* Next(Node* x, int n) const {
+    assert(n >= 0);
+    // Use an 'acquire load' so that we observe a fully initialized
+    // version of the returned Node.
+    return NodeAt(reinterpret_cast<uintptr_t>(x->next_[n].Acquire_Load()));
+  }
+  void SetNext(Node* x, int n, Node* y) {
+    assert(n >= 0);
+    // Use a 'release store' so that anybody who reads through this
+    // offset observes a fully initialized version of the inserted node.
+    x->next_[n].Release_Store(reinterpret_cast<void*>(OffsetOf(y)));
+  }
+  Node* NoBarrier_Next(Node* x, int n) const {
+    assert(n >= 0);
+    return NodeAt(reinterpret_cast<uintptr_t>(x->next_[n].NoBarrier_Load()));
+  }
+  void NoBarrier_SetNext(Node* x, int n, Node* y) {
+    assert(n >= 0);
+    x->next_[n].NoBarrier_Store(reinterpret_cast<void*>(OffsetOf(y)));
+  }
+
+  // Return true if key is greater than the data stored in "n"
+  bool KeyIsAfterNode(Key key, Node* n) const;
+
+  // Return the earliest node that comes at or after key.
+  // Return nullptr if there is no such node.
+  //
+  // If prev is non-null, fills prev[level] with pointer to previous
+  // node at "level" for every level in [0..max_height_-1].
+  Node* FindGreaterOrEqual(Key key, Node** prev) const;
+
+  // Return the latest node with a key < key.
+  // Return head_ if there is no such node.
+  Node* FindLessThan(Key key) const;
+
+  // Return the last node in the list.
+  // Return head_ if list is empty.
+  Node* FindLast() const;
+
+  // No copying allowed
+  PersistentSkipList(const PersistentSkipList&);
+  void operator=(const PersistentSkipList&);
+};
+
+// Implementation details follow
+template<class Comparator>
+struct PersistentSkipList<Comparator>::Node {
+  uint32_t height;
+  uint32_t key_size;
+  // Array of length equal to the node height.  next_[0] is lowest level link.
+  port::AtomicPointer next_[1];
+
+  const char* key() const {
+    return reinterpret_cast<const char*>(&next_[height]);
+  }
+};
+
+template<class Comparator>
+inline PersistentSkipList<Comparator>::Iterator::Iterator(
+    const PersistentSkipList* list) {
+  list_ = list;
+  node_ = nullptr;
+}
+
+template<class Comparator>
+inline bool PersistentSkipList<Comparator>::Iterator::Valid() const {
+  return node_ != nullptr;
+}
+
+template<class Comparator>
+inline typename PersistentSkipList<Comparator>::Key
+PersistentSkipList<Comparator>::Iterator::key() const {
+  assert(Valid());
+  return node_->key();
+}
+
+template<class Comparator>
+inline void PersistentSkipList<Comparator>::Iterator::Next() {
+  assert(Valid());
+  node_ = list_->Next(node_, 0);
+}
+
+template<class Comparator>
+inline void PersistentSkipList<Comparator>::Iterator::Prev() {
+  // Instead of using explicit "prev" links, we just search for the
+  // last node that falls before key.
+  assert(Valid());
+  node_ = list_->FindLessThan(node_->key());
+  if (node_ == list_->head_) {
+    node_ = nullptr;
+  }
+}
+
+template<class Comparator>
+inline void PersistentSkipList<Comparator>::Iterator::Seek(Key target) {
+  node_ = list_->FindGreaterOrEqual(target, nullptr);
+}
+
+template<class Comparator>
+inline void PersistentSkipList<Comparator>::Iterator::SeekToFirst() {
+  node_ = list_->Next(list_->head_, 0);
+}
+
+template<class Comparator>
+inline void PersistentSkipList<Comparator>::Iterator::SeekToLast() {
+  node_ = list_->FindLast();
+  if (node_ == list_->head_) {
+    node_ = nullptr;
+  }
+}
+
+template<class Comparator>
+int PersistentSkipList<Comparator>::RandomHeight() {
+  // Increase height with probability 1 in kBranching
+  static const unsigned int kBranching = 4;
+  int height = 1;
+  while (height < kMaxHeight && ((rnd_.Next() % kBranching) == 0)) {
+    height++;
+  }
+  assert(height > 0);
+  assert(height <= kMaxHeight);
+  return height;
+}
+
+template<class Comparator>
+bool PersistentSkipList<Comparator>::KeyIsAfterNode(Key key, Node* n) const {
+  // null n is considered infinite
+  return (n != nullptr) && (compare_(n->key(), key) < 0);
+}
+
+template<class Comparator>
+typename PersistentSkipList<Comparator>::Node*
+PersistentSkipList<Comparator>::FindGreaterOrEqual(Key key,
+                                                   Node** prev) const {
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node* next = Next(x, level);
+    if (KeyIsAfterNode(key, next)) {
+      // Keep searching in this list
+      x = next;
+    } else {
+      if (prev != nullptr) prev[level] = x;
+      if (level == 0) {
+        return next;
+      } else {
+        // Switch to next list
+        level--;
+      }
+    }
+  }
+}
+
+template<class Comparator>
+typename PersistentSkipList<Comparator>::Node*
+PersistentSkipList<Comparator>::FindLessThan(Key key) const {
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    assert(x == head_ || compare_(x->key(), key) < 0);
+    Node* next = Next(x, level);
+    if (next == nullptr || compare_(next->key(), key) >= 0) {
+      if (level == 0) {
+        return x;
+      } else {
+        // Switch to next list
+        level--;
+      }
+    } else {
+      x = next;
+    }
+  }
+}
+
+template<class Comparator>
+typename PersistentSkipList<Comparator>::Node*
+PersistentSkipList<Comparator>::FindLast() const {
+  Node* x = head_;
+  int level = GetMaxHeight() - 1;
+  while (true) {
+    Node* next = Next(x, level);
+    if (next == nullptr) {
+      if (level == 0) {
+        return x;
+      } else {
+        // Switch to next list
+        level--;
+      }
+    } else {
+      x = next;
+    }
+  }
+}
+
+template<class Comparator>
+PersistentSkipList<Comparator>::PersistentSkipList(
+    Comparator cmp, PMEMobjpool* pop, char* arena, uint64_t capacity,
+    bool reset)
+    : compare_(cmp),
+      pop_(pop),
+      arena_(arena),
+      capacity_(capacity),
+      head_(reinterpret_cast<Node*>(arena)),
+      max_height_(reinterpret_cast<void*>(1)),
+      used_(reinterpret_cast<void*>(NodeSize(kMaxHeight, 0))),
+      rnd_(0xdeadbeef),
+      pending_(nullptr) {
+  if (reset) {
+    head_->height = kMaxHeight;
+    head_->key_size = 0;
+    for (int i = 0; i < kMaxHeight; i++) {
+      NoBarrier_SetNext(head_, i, nullptr);
+    }
+    pmemobj_persist(pop_, head_, NodeSize(kMaxHeight, 0));
+    return;
+  }
+  // Reattach: height from head, allocation from the last node written
+  int height = 1;
+  for (int i = 1; i < kMaxHeight; i++) {
+    if (NoBarrier_Next(head_, i) != nullptr) height = i + 1;
+  }
+  max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
+  uint64_t used = NodeSize(kMaxHeight, 0);
+  for (Node* x = NoBarrier_Next(head_, 0); x != nullptr;
+       x = NoBarrier_Next(x, 0)) {
+    used = std::max(used, OffsetOf(x) + NodeSize(x->height, x->key_size));
+  }
+  used_.NoBarrier_Store(reinterpret_cast<void*>(used));
+}
+
+template<class Comparator>
+char* PersistentSkipList<Comparator>::Allocate(size_t key_size) {
+  assert(pending_ == nullptr);
+  int height = RandomHeight();
+  uint64_t used = MemoryUsage();
+  size_t size = NodeSize(height, key_size);
+  if (used + size > capacity_) {
+    return nullptr;
+  }
+  Node* x = reinterpret_cast<Node*>(arena_ + used);
+  x->height = height;
+  x->key_size = key_size;
+  used_.NoBarrier_Store(reinterpret_cast<void*>(used + size));
+  pending_ = x;
+  return const_cast<char*>(x->key());
+}
+
+template<class Comparator>
+void PersistentSkipList<Comparator>::Insert(const char* key) {
+  Node* x = pending_;
+  assert(x != nullptr && x->key() == key);
+  pending_ = nullptr;
+
+  Node* prev[kMaxHeight];
+  Node* y = FindGreaterOrEqual(key, prev);
+
+  // Our data structure does not allow duplicate insertion
+  assert(y == nullptr || !Equal(key, y->key()));
+
+  int height = x->height;
+  if (height > GetMaxHeight()) {
+    for (int i = GetMaxHeight(); i < height; i++) {
+      prev[i] = head_;
+    }
+    // It is ok to mutate max_height_ without any synchronization
+    // with concurrent readers (see db/skiplist.h).
+    max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
+  }
+
+  for (int i = 0; i < height; i++) {
+    NoBarrier_SetNext(x, i, NoBarrier_Next(prev[i], i));
+  }
+  // Node is durable before anything points to it
+  pmemobj_flush(pop_, x, NodeSize(height, x->key_size));
+  pmemobj_drain(pop_);
+  SetNext(prev[0], 0, x);
+  pmemobj_persist(pop_, &(prev[0]->next_[0]), sizeof(port::AtomicPointer));
+  for (int i = 1; i < height; i++) {
+    SetNext(prev[i], i, x);
+    pmemobj_flush(pop_, &(prev[i]->next_[i]), sizeof(port::AtomicPointer));
+  }
+}
+
+template<class Comparator>
+bool PersistentSkipList<Comparator>::Contains(Key key) const {
+  Node* x = FindGreaterOrEqual(key, nullptr);
+  if (x != nullptr && Equal(key, x->key())) {
+    return true;
+  } else {
+    return false;
+  }
+}
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_PERSISTENT_SKIPLIST_H_
@@ -96,7 +96,7 @@ Status TableCache::FindSkiplist(uint64_t file_number, Cache::Handle** handle) {
   *handle = cache_->Lookup(key);
   if (*handle == nullptr) {
     // printf("Cache Insert %d\n", file_number);
-    PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
+    PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[file_number % options_.pmem_options.num_of_shards];
     PmemIterator* pmem_iterator = new PmemIterator(file_number, pmem_skiplist); 
     *handle = cache_->Insert(key, 
           pmem_iterator, 
@@ -152,7 +152,7 @@ Iterator* TableCache::NewIteratorFromPmem(const ReadOptions& options,
     result->RegisterCleanup(&UnrefEntry, cache_, handle);
 
   } else {
-    PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER];
+    PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[file_number % options_.pmem_options.num_of_shards];
     result = new PmemIterator(file_number, pmem_skiplist);
     result->SeekToFirst();
   }
@@ -160,19 +160,27 @@ Iterator* TableCache::NewIteratorFromPmem(const ReadOptions& options,
 
   return result;
 }
+Iterator* TableCache::NewScanIteratorFromPmem(uint64_t file_number) {
+  PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[file_number % options_.pmem_options.num_of_shards];
+  Iterator* result = NewPmemCompactionIterator(file_number, pmem_skiplist);
+  DelayPmemReadNtimes(1);
+
+  return result;
+}
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       Iterator** pinned_block) {
 	// std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
                   
   Cache::Handle* handle = nullptr;
   Status s = FindTable(file_number, file_size, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
+    s = t->InternalGet(options, k, arg, saver, pinned_block);
     cache_->Release(handle);
   }
   // 	std::chrono::steady_clock::time_point end= std::chrono::steady_clock::now();
@@ -204,28 +212,34 @@ Status TableCache::GetFromPmem(const Options& options,
     cache_->Release(handle);
 
   } else {
-    // if (options_.skiplist_cache) {
-      PmemIterator* pmem_iterator = options.pmem_internal_iterator[file_number % NUM_OF_SKIPLIST_MANAGER]; 
-      // pmem_iterator->Ref(file_number);
-      pmem_iterator->SetIndex(file_number);
-      pmem_iterator->Seek(k);
-      Slice res_key = pmem_iterator->key();
-      Slice res_value = pmem_iterator->value();
-      // pmem_iterator->UnRef(file_number);
+    // NOTE: Reentrant lookup, DB mutex is not held here.
+    //       Shared pmem_internal_iterator must not be used.
+    Slice res_key, res_value;
+    bool found = false;
+    uint64_t shard = file_number % options.pmem_options.num_of_shards;
+    // NOTE: Skip traversal if filter says k is absent in this table
+    switch (options.ds_type) {
+      case kSkiplist:
+      case kSortedArray:
+        if (options.pmem_skiplist[shard]->KeyMayMatch(options.filter_policy,
+                                                      file_number, k)) {
+          found = options.pmem_skiplist[shard]->Get(file_number, k, 
+                                                    &res_key, &res_value);
+        }
+        break;
+      case kHashmap:
+        if (options.pmem_hashmap[shard]->KeyMayMatch(options.filter_policy,
+                                                     file_number, k)) {
+          found = options.pmem_hashmap[shard]->Get(file_number, k, 
+                                                   &res_key, &res_value);
+        }
+        break;
+    }
+    // NOTE: No key >= k in this table
+    if (found) {
       (*saver)(arg, res_key, res_value);
-    // } else {
-    //   PmemIterator* pmem_iterator = new PmemIterator(file_number, options.pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER]);
-    //   pmem_iterator->Seek(k);
-    //   Slice res_key = pmem_iterator->key();
-    //   (*saver)(arg, res_key, pmem_iterator->value());
-    //   delete pmem_iterator;
-    // }
-    
-    // printf("key:'%s'\n", pmem_iterator->key());
-    // Slice res_value = pmem_iterator->value();
-    // printf("value:'%s'\n", pmem_iterator->value());
-    // (*saver)(arg, pmem_iterator->key(), pmem_iterator->value());
-    // (*saver)(arg, res_key, res_value);
+      DelayPmemRead(0, res_key.size() + res_value.size());
+    }
   }
   // 	std::chrono::steady_clock::time_point end= std::chrono::steady_clock::now();
 	// std::cout << "GetFromPmem " << k.data() << "= " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
@@ -39,15 +39,21 @@ class TableCache {
                         uint64_t file_number,
                         uint64_t file_size,
                         Table** tableptr = nullptr);
+  // Compaction input of pmem table, forward only.
+  // Streams PmemBuffer if entries of the table are contiguous.
+  Iterator* NewScanIteratorFromPmem(uint64_t file_number);
 
   // If a seek to internal key "k" in specified file finds an entry,
   // call (*handle_result)(arg, found_key, found_value).
+  // JH: If pinned_block is non-null, block of the found entry is kept
+  //     in *pinned_block (caller deletes it), so found_value stays valid.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             Iterator** pinned_block = nullptr);
   // JH
   Status GetFromPmem(const Options& options,
                      uint64_t file_number,
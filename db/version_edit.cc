@@ -20,7 +20,9 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  // JH: kNewFile followed by tier, only for tables not in SST
+  kNewTieredFile        = 10
 };
 
 void VersionEdit::Clear() {
@@ -76,12 +78,15 @@ void VersionEdit::EncodeTo(std::string* dst) const {
 
   for (size_t i = 0; i < new_files_.size(); i++) {
     const FileMetaData& f = new_files_[i].second;
-    PutVarint32(dst, kNewFile);
+    PutVarint32(dst, (f.tier == kTierSST) ? kNewFile : kNewTieredFile);
     PutVarint32(dst, new_files_[i].first);  // level
     PutVarint64(dst, f.number);
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    if (f.tier != kTierSST) {
+      PutVarint32(dst, f.tier);
+    }
   }
 }
 
@@ -116,6 +121,7 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   int level;
   uint64_t number;
   FileMetaData f;
+  uint32_t tier;
   Slice str;
   InternalKey key;
 
@@ -186,12 +192,28 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
             GetVarint64(&input, &f.file_size) &&
             GetInternalKey(&input, &f.smallest) &&
             GetInternalKey(&input, &f.largest)) {
+          f.tier = kTierSST;
           new_files_.push_back(std::make_pair(level, f));
         } else {
           msg = "new-file entry";
         }
         break;
 
+      case kNewTieredFile:
+        if (GetLevel(&input, &level) &&
+            GetVarint64(&input, &f.number) &&
+            GetVarint64(&input, &f.file_size) &&
+            GetInternalKey(&input, &f.smallest) &&
+            GetInternalKey(&input, &f.largest) &&
+            GetVarint32(&input, &tier) &&
+            tier <= kTierPmemHashmap) {
+          f.tier = static_cast<FileTier>(tier);
+          new_files_.push_back(std::make_pair(level, f));
+        } else {
+          msg = "new-tiered-file entry";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -258,6 +280,10 @@ std::string VersionEdit::DebugString() const {
     r.append(f.smallest.DebugString());
     r.append(" .. ");
     r.append(f.largest.DebugString());
+    if (f.tier != kTierSST) {
+      r.append(" tier ");
+      AppendNumberTo(&r, f.tier);
+    }
   }
   r.append("\n}\n");
   return r;
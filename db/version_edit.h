@@ -14,6 +14,14 @@ namespace leveldb {
 
 class VersionSet;
 
+// JH: Where the table of a file lives. Fixed for a file number,
+// tiering moves a table by a new number (see DBImpl::PromoteSSTFile).
+enum FileTier {
+  kTierSST = 0,
+  kTierPmemSkiplist = 1,  // also kSortedArray
+  kTierPmemHashmap = 2
+};
+
 struct FileMetaData {
   int refs;
   int allowed_seeks;          // Seeks allowed until compaction
@@ -21,8 +29,10 @@ struct FileMetaData {
   uint64_t file_size;         // File size in bytes
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
+  FileTier tier;              // JH
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0),
+                   tier(kTierSST) { }
 };
 
 class VersionEdit {
@@ -62,12 +72,14 @@ class VersionEdit {
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest) {
+               const InternalKey& largest,
+               FileTier tier = kTierSST) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.tier = tier;
     // printf("AddFile] %d\n", f.number);
     new_files_.push_back(std::make_pair(level, f));
   }
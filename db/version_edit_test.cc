@@ -39,6 +39,31 @@ TEST(VersionEditTest, EncodeDecode) {
   TestEncodeDecode(edit);
 }
 
+TEST(VersionEditTest, EncodeDecodeTier) {
+  VersionEdit edit;
+  edit.AddFile(0, 5, 100, InternalKey("a", 1, kTypeValue),
+               InternalKey("b", 2, kTypeValue));
+  edit.AddFile(1, 6, 200, InternalKey("c", 3, kTypeValue),
+               InternalKey("d", 4, kTypeValue), kTierPmemSkiplist);
+  edit.AddFile(2, 7, 300, InternalKey("e", 5, kTypeValue),
+               InternalKey("f", 6, kTypeValue), kTierPmemHashmap);
+  TestEncodeDecode(edit);
+
+  std::string encoded;
+  edit.EncodeTo(&encoded);
+  VersionEdit parsed;
+  ASSERT_TRUE(parsed.DecodeFrom(encoded).ok());
+  ASSERT_EQ(edit.DebugString(), parsed.DebugString());
+
+  // Unknown tier
+  VersionEdit bad;
+  bad.AddFile(1, 8, 400, InternalKey("g", 7, kTypeValue),
+              InternalKey("h", 8, kTypeValue), static_cast<FileTier>(9));
+  encoded.clear();
+  bad.EncodeTo(&encoded);
+  ASSERT_TRUE(parsed.DecodeFrom(encoded).IsCorruption());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
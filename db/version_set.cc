@@ -215,18 +215,26 @@ class Version::LevelFilesConcatIteratorFromPmem : public Iterator {
   LevelFilesConcatIteratorFromPmem(
                        const InternalKeyComparator& icmp,
                        PmemSkiplist **pmem_skiplist,
-                       const std::vector<FileMetaData*>* flist)
+                       int num_of_shards,
+                       const std::vector<FileMetaData*>* flist,
+                       bool for_compaction = false)
       : icmp_(icmp), flist_(flist), size_(flist->size()), current_(nullptr)
         {
 
-    pmem_iterator = new PmemIterator*[size_];
+    pmem_iterator = new Iterator*[size_];
     // Make PmemIterators based on each index
+    // NOTE: Compaction streams contiguous tables (forward only)
     // printf("LevelFiles size %d\n", size_);
     for (int i=0; i<size_; i++) {
       uint64_t file_number = flist_->at(i)->number;
       // printf("LevelFiles %d\n", file_number);
-      pmem_iterator[i] = new PmemIterator(file_number, 
-                                          pmem_skiplist[file_number % NUM_OF_SKIPLIST_MANAGER]); 
+      if (for_compaction) {
+        pmem_iterator[i] = NewPmemCompactionIterator(file_number,
+                                  pmem_skiplist[file_number % num_of_shards]);
+      } else {
+        pmem_iterator[i] = new PmemIterator(file_number, 
+                                            pmem_skiplist[file_number % num_of_shards]); 
+      }
       // printf("LevelFiles End\n");
     }
   }
@@ -315,7 +323,9 @@ class Version::LevelFilesConcatIteratorFromPmem : public Iterator {
     assert(Valid());
     return current_->value();
   }
-  virtual Status status() const { return Status::OK(); }
+  virtual Status status() const {
+    return (current_ != nullptr) ? current_->status() : Status::OK();
+  }
   PMEMoid* key_oid() const {
     return current_->key_oid();
   }
@@ -333,9 +343,9 @@ class Version::LevelFilesConcatIteratorFromPmem : public Iterator {
   }
  private:
   InternalKeyComparator icmp_;
-  PmemIterator **pmem_iterator;
+  Iterator **pmem_iterator;
   const std::vector<FileMetaData*>* const flist_;
-  PmemIterator* current_;
+  Iterator* current_;
   uint8_t size_;
   uint8_t current_index_;
 
@@ -383,19 +393,14 @@ void Version::AddIterators(const ReadOptions& options,
   // printf("Level 0\n");
   for (size_t i = 0; i < files_[0].size(); i++) {
     uint64_t number = files_[0][i]->number;
-    if (tiering_stats->IsInFileSet(number)) {
-      // printf("file '%d' ", number);
+    if (files_[0][i]->tier == kTierSST) {
       iters->push_back(
           vset_->table_cache_->NewIterator(
               options, number, files_[0][i]->file_size));
-    } else if (tiering_stats->IsInSkiplistSet(number)) {
-      // printf("skiplist '%d' ", number);
+    } else {
       iters->push_back(
           vset_->table_cache_->NewIteratorFromPmem(
               options, number, files_[0][i]->file_size));
-    } else {
-      // WARN
-      printf("[WARN][Version][AddIterators][L0] number '%d' is not in both fileset and skiplistset\n", number);
     }
   }
 
@@ -403,21 +408,11 @@ void Version::AddIterators(const ReadOptions& options,
   for (int level = 1; level < config::kNumLevels; level++) {
     if (!files_[level].empty()) {
       // printf("Level %d\n", level);
-      for (int i=0; i < files_[level].size(); i++) {
-        uint64_t number = files_[level][i]->number;
-        if (tiering_stats->IsInFileSet(number)) {
-          if (!preserve_flag) {
-            fileSet[level].push_back(files_[level][i]);
-            // printf("file '%d' ", number);
-          }
-        } else if (tiering_stats->IsInSkiplistSet(number)) {
-          // printf("skiplist '%d' ", number);
-          if (!preserve_flag) {
-            skiplistSet[level].push_back(files_[level][i]);
-          }
+      for (int i=0; !preserve_flag && i < files_[level].size(); i++) {
+        if (files_[level][i]->tier == kTierSST) {
+          fileSet[level].push_back(files_[level][i]);
         } else {
-          // WARN
-          printf("[WARN][Version][AddIterators][L%d] number '%d' is not in both fileset and skiplistset\n", level, number);
+          skiplistSet[level].push_back(files_[level][i]);
         }
       }
       // printf("\n");
@@ -432,6 +427,7 @@ void Version::AddIterators(const ReadOptions& options,
         iters->push_back(new Version::LevelFilesConcatIteratorFromPmem(
             vset_->icmp_, 
             vset_->options_->pmem_skiplist,
+            vset_->options_->pmem_options.num_of_shards,
             &skiplistSet[level]));
 
       }
@@ -454,6 +450,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  Slice* pinned_value;  // JH: No copy if non-null
 };
 }
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -465,7 +462,11 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
       if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+        if (s->pinned_value != nullptr) {
+          *(s->pinned_value) = v;
+        } else {
+          s->value->assign(v.data(), v.size());
+        }
       }
     }
   }
@@ -525,7 +526,9 @@ Status Version::Get(const Options& options_,
                     const LookupKey& k,
                     std::string* value,
                     GetStats* stats,
-                    Tiering_stats* tiering_stats) {
+                    Tiering_stats* tiering_stats,
+                    Slice* pinned_value,
+                    Iterator** pinned_block) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
@@ -533,6 +536,7 @@ Status Version::Get(const Options& options_,
 
   stats->seek_file = nullptr;
   stats->seek_file_level = -1;
+  stats->read_file = nullptr;
   FileMetaData* last_file_read = nullptr;
   int last_file_read_level = -1;
 
@@ -586,8 +590,6 @@ Status Version::Get(const Options& options_,
 
     // SSTMakerType sst_type = options_.sst_type;
 
-    std::set<uint64_t> dup_candidate_number;
-    std::set<uint64_t>::iterator dup_candidate_number_iter;
     for (uint32_t i = 0; i < num_files; ++i) {
       // printf("[VERSION_SET DEBUG %d]\n", i);
       if (last_file_read != nullptr && stats->seek_file == nullptr) {
@@ -605,35 +607,34 @@ Status Version::Get(const Options& options_,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
+      saver.pinned_value = pinned_value;
+      Iterator* block = nullptr;
       /*
        * SOLVE: Get operation 
        */
-      PmemSkiplist* pmem_skiplist = options_.pmem_skiplist[f->number % NUM_OF_SKIPLIST_MANAGER];
-      if (tiering_stats->IsInFileSet(f->number)) {
-        dup_candidate_number_iter = dup_candidate_number.find(f->number);
-        if (dup_candidate_number_iter == dup_candidate_number.end()) {
-          // printf("Get\n");
-          s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                      ikey, &saver, SaveValue);
-          dup_candidate_number.insert(f->number);
-        }
-      } else if ( tiering_stats->IsInSkiplistSet(f->number) &&
-          pmem_skiplist->CheckNumberIsInPmem(f->number) ) {
-        dup_candidate_number_iter = dup_candidate_number.find(f->number);
-        if (dup_candidate_number_iter == dup_candidate_number.end()) {
-          // printf("GetFromPmem %d", f->number);
-          s = vset_->table_cache_->GetFromPmem(options_, f->number,
-                                    ikey, &saver, SaveValue);
-          // printf(" end\n");
-          dup_candidate_number.insert(f->number);
+      // JH: Tier is in metadata, no lookup of tiering_stats
+      if (f->tier == kTierSST) {
+        s = vset_->table_cache_->Get(options, f->number, f->file_size,
+                                    ikey, &saver, SaveValue,
+                                    (pinned_value != nullptr) ? &block
+                                                              : nullptr);
+        // NOTE: Block of other entry (or other key) is not pinned
+        if (block != nullptr && saver.state == kFound) {
+          *pinned_block = block;
+        } else {
+          delete block;
         }
       } else {
-        printf("[ERROR][VersionSet][Get] Cannot find %d\n", f->number);
+        s = vset_->table_cache_->GetFromPmem(options_, f->number,
+                                  ikey, &saver, SaveValue);
       }
 
       if (!s.ok()) {
         return s;
       }
+      if (saver.state != kNotFound) {
+        stats->read_file = f;
+      }
       switch (saver.state) {
         case kNotFound:
           break;      // NOTE: Keep searching in other files
@@ -1349,7 +1350,8 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                   f->tier);
     }
   }
 
@@ -1508,17 +1510,12 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c, Tiering_stats* tiering_st
       if (c->level() + which == 0) { // Only L0 in Compaction between L0-L1
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          uint64_t number = files[i]->number;
-          PmemSkiplist* pmem_skiplist = options_->pmem_skiplist[number % NUM_OF_SKIPLIST_MANAGER];
-          if (tiering_stats->IsInFileSet(number)) {
+          if (files[i]->tier == kTierSST) {
             list[num++] = table_cache_->NewIterator(
                 options, files[i]->number, files[i]->file_size);
-          } else if ( tiering_stats->IsInSkiplistSet(number) &&
-              pmem_skiplist->CheckNumberIsInPmem(number) ) {
-            list[num++] = table_cache_->NewIteratorFromPmem(
-                options, files[i]->number, files[i]->file_size);
           } else {
-            printf("[ERROR][VersionSet][MakeInputIterator] Cannot find %d\n", number);
+            list[num++] = table_cache_->NewScanIteratorFromPmem(
+                files[i]->number);
           }
         }
         // printf("num1: %d\n", num);
@@ -1532,7 +1529,9 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c, Tiering_stats* tiering_st
         }
         if (c->inputs_in_skiplistset_[which].size() != 0) {
           list[num++] = new Version::LevelFilesConcatIteratorFromPmem(
-                          icmp_, options_->pmem_skiplist, &c->inputs_in_skiplistset_[which]);
+                          icmp_, options_->pmem_skiplist, 
+                          options_->pmem_options.num_of_shards,
+                          &c->inputs_in_skiplistset_[which], true);
         }
         // printf("FI\n");
       }
@@ -1598,28 +1597,6 @@ Compaction* VersionSet::PickCompaction(Tiering_stats* tiering_stats) {
 
   SetupOtherInputs(c);
 
-  // JH
-  for (int layer=0; layer<2; layer++) {
-    std::vector<FileMetaData*>::iterator iter;
-    for (iter = c->inputs_[layer].begin(); iter != c->inputs_[layer].end(); iter++ ) {
-      FileMetaData* tmp = *iter;
-      uint64_t number = tmp->number;
-      
-      PmemSkiplist* pmem_skiplist = options_->pmem_skiplist[number % NUM_OF_SKIPLIST_MANAGER];        
-      if (tiering_stats->IsInFileSet(number)) {
-        c->inputs_in_fileset_[layer].push_back(*iter);
-      } else if ( tiering_stats->IsInSkiplistSet(number) &&
-          pmem_skiplist->CheckNumberIsInPmem(number) ) {
-        // TEST:
-        // pmem_skiplist->Ref(number);
-        c->inputs_in_skiplistset_[layer].push_back(*iter);
-      } else {
-        printf("[ERROR][VersionSet][PickCompaction] Cannot find %d\n", number);
-      }
-    }
-  }
-  // printf("\n");
-
   return c;
 }
 
@@ -1682,6 +1659,20 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   // key range next time.
   compact_pointer_[level] = largest.Encode().ToString();
   c->edit_.SetCompactPointer(level, largest);
+
+  // JH: Split inputs by tier (also for CompactRange)
+  for (int which = 0; which < 2; which++) {
+    c->inputs_in_fileset_[which].clear();
+    c->inputs_in_skiplistset_[which].clear();
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      FileMetaData* f = c->inputs_[which][i];
+      if (f->tier == kTierSST) {
+        c->inputs_in_fileset_[which].push_back(f);
+      } else {
+        c->inputs_in_skiplistset_[which].push_back(f);
+      }
+    }
+  }
 }
 
 Compaction* VersionSet::CompactRange(
@@ -1722,6 +1713,7 @@ Compaction* VersionSet::CompactRange(
 Compaction::Compaction(const Options* options, int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(options, level)),
+      max_output_entries_num_(options->pmem_options.max_skiplist_node_size),
       input_version_(nullptr),
       grandparent_index_(0),
       seen_key_(false),
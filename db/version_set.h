@@ -73,14 +73,20 @@ class Version {
   struct GetStats {
     FileMetaData* seek_file;
     int seek_file_level;
+    // JH: File which answered the read (LRU touch, promotion)
+    FileMetaData* read_file;
   };
   // Customized by JH
   // Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
   //            GetStats* stats);
   // Status Get(const Options&, const ReadOptions&, const LookupKey& key, 
   //             std::string* val, GetStats* stats);
+  // JH: If pinned_val is non-null, it points to the value in pmem table
+  //     or SST block (*pinned_block, caller deletes it) instead of a copy
+  //     in *val. Caller keeps a reference on this version.
   Status Get(const Options&, const ReadOptions&, const LookupKey& key, 
-              std::string* val, GetStats* stats, Tiering_stats* tiering_stats);
+              std::string* val, GetStats* stats, Tiering_stats* tiering_stats,
+              Slice* pinned_val = nullptr, Iterator** pinned_block = nullptr);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -378,7 +384,7 @@ class Compaction {
   void ReleaseInputs();
 
   // JH
-  uint64_t MaxOutputEntriesNum() const {return MAX_SKIPLIST_NODE_SIZE; };
+  uint64_t MaxOutputEntriesNum() const {return max_output_entries_num_; };
   std::vector<FileMetaData*> inputs_in_fileset_[2];      // Inputs in file set 
   std::vector<FileMetaData*> inputs_in_skiplistset_[2];  // Inputs in skiplist set 
 
@@ -390,6 +396,7 @@ class Compaction {
 
   int level_;
   uint64_t max_output_file_size_;
+  uint64_t max_output_entries_num_; // JH: cuts pmem hashmap outputs
   Version* input_version_;
   VersionEdit edit_;
 
@@ -39,6 +39,42 @@ struct LEVELDB_EXPORT Range {
   Range(const Slice& s, const Slice& l) : start(s), limit(l) { }
 };
 
+// JH: Value returned by DB::Get without copy. It points into the memtable,
+// block or PmemBuffer that holds the value, which stays pinned until
+// Reset() or destruction. Values without a source to pin are copied.
+// Must be reset before the DB is deleted (like iterators).
+class LEVELDB_EXPORT PinnableValue {
+ public:
+  typedef void (*CleanupFunction)(void* arg1, void* arg2);
+
+  PinnableValue();
+  ~PinnableValue();
+
+  PinnableValue(const PinnableValue&) = delete;
+  PinnableValue& operator=(const PinnableValue&) = delete;
+
+  const Slice& value() const { return value_; }
+  const char* data() const { return value_.data(); }
+  size_t size() const { return value_.size(); }
+  std::string ToString() const { return value_.ToString(); }
+  bool IsPinned() const { return cleanup_ != nullptr; }
+
+  // Point to data, which is kept alive until (*function)(arg1, arg2)
+  void PinSlice(const Slice& data, CleanupFunction function,
+                void* arg1, void* arg2);
+  // Copy data into own buffer
+  void PinSelf(const Slice& data);
+  // Release pinned source, value becomes empty
+  void Reset();
+
+ private:
+  Slice value_;
+  std::string self_;
+  CleanupFunction cleanup_;
+  void* arg1_;
+  void* arg2_;
+};
+
 // A DB is a persistent ordered map from keys to values.
 // A DB is safe for concurrent access from multiple threads without
 // any external synchronization.
@@ -88,6 +124,12 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // JH: Same as above, but *value points into DB memory (no copy).
+  // Previous value of *value is released first.
+  // Default implementation copies the result of Get() above.
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key, PinnableValue* value);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -122,6 +164,15 @@ class LEVELDB_EXPORT DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  JH:
+  //  "leveldb.pmem-stats" - returns a multi-line string with all of the
+  //     sections below.
+  //  "leveldb.pmem-shard-stats" - free list depth, tables and PmemBuffer
+  //     usage of each shard.
+  //  "leveldb.pmem-tier-stats" - files per tier, demotions, promotions and
+  //     Get hits served by memtable, pmem and SST.
+  //  "leveldb.pmem-emulation-stats" - emulated pmem accesses, bytes and
+  //     delay (process-wide).
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
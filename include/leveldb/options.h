@@ -6,12 +6,17 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string>
 #include "leveldb/export.h"
 // JH
 #include "pmem/pmem_skiplist.h"
 #include "pmem/pmem_iterator.h"
 #include "pmem/pmem_buffer.h"
 #include "pmem/pmem_hashmap.h"
+#include "pmem/pmem_log.h"
+#include "pmem/pmem_memtable.h"
+#include "pmem/pmem_latency.h"
 #include "pmem/tiering_stats.h"
 
 namespace leveldb {
@@ -46,6 +51,79 @@ enum TieringOption {
   kNoTiering
 };
 
+// JH: Topology of pmem pools, defaults are in pmem/layout.h
+// Shard n uses "<pmem_dir>/skiplist_manager_n", "<pmem_dir>/pmem_buffer_n"
+// and "<pmem_dir>/pmem_hashmap_n". Tables are sharded by
+// (file_number % num_of_shards) over skiplist, buffer and hashmap pools.
+// Write-ahead log (if use_pmem_log) is "<pmem_dir>/pmem_log_<dbname>", and
+// memtables (if use_pmem_memtable) are "<pmem_dir>/pmem_memtable_<dbname>"
+// ('/' of dbname as '_', one pool per DB), not sharded.
+// NOTE: capacities are fixed when a pool is created. Reopened pools keep
+//       their stored capacities, but num_of_shards must not be changed.
+struct LEVELDB_EXPORT PmemOptions {
+  // Directory of pool files (DAX-mounted filesystem)
+  // Default: PMEM_DIR
+  std::string pmem_dir;
+
+  // Number of pools per data structure
+  // Default: NUM_OF_SKIPLIST_MANAGER
+  int num_of_shards;
+
+  // Size of each pool file
+  // Default: SKIPLIST_MANAGER_POOL_SIZE, BUFFER_POOL_SIZE, BUFFER_POOL_SIZE
+  size_t skiplist_pool_size;
+  size_t buffer_pool_size;
+  size_t hashmap_pool_size;
+
+  // Per-shard capacity: number of tables in a skiplist (or hashmap) pool
+  // Default: SKIPLIST_MANAGER_LIST_SIZE, HASHMAP_LIST_SIZE
+  uint64_t skiplist_list_size;
+  uint64_t hashmap_list_size;
+
+  // Nodes pre-allocated per skiplist (entries per sorted array).
+  // Lists grow by extents for larger tables, so it is not a limit of
+  // skiplist tables. Hashmap compaction outputs are cut at this size.
+  // Default: MAX_SKIPLIST_NODE_SIZE
+  uint64_t max_skiplist_node_size;
+
+  // Contents size of each buffer pool
+  // Default: MAX_CONTENTS_SIZE
+  uint64_t buffer_contents_size;
+
+  // kLRUTiering: tables are demoted in background while a free list
+  // of skiplist pool is shorter than this (at most skiplist_list_size / 2)
+  // Default: FREE_LIST_DEMOTION_WATERMARK
+  uint64_t demotion_watermark;
+
+  // Table builds (buffer contents, list entries) are flushed without
+  // drain, and drained once when the table is finished (FinishPmem).
+  // false: every write is persisted (flush + drain) on its own.
+  // Default: PMEM_DEFERRED_DRAIN
+  bool deferred_drain;
+
+  // NVM emulation: latency per access and bandwidth of pmem reads and
+  // writes, spun on DRAM.
+  // NOTE: Global setting, not per DB. Pools emulate accesses without a
+  //       DB handle, so the model of the last opened DB applies to all
+  //       DBs of the process (and to stats of "leveldb.pmem-emulation-stats").
+  // Default: PMEM_EMULATION, PMEM_*_LATENCY_NS, PMEM_*_BANDWIDTH_MBPS
+  PmemLatencyModel latency_model;
+
+  // Pool and circular contents size of pmem write-ahead log
+  // (Options::use_pmem_log). Contents must hold all live logs.
+  // Default: PMEM_LOG_POOL_SIZE, PMEM_LOG_CONTENTS_SIZE
+  size_t log_pool_size;
+  uint64_t log_contents_size;
+
+  std::string SkiplistPath(int shard) const;
+  std::string BufferPath(int shard) const;
+  std::string HashmapPath(int shard) const;
+  std::string LogPath(const std::string& dbname) const;
+  std::string MemTablePath(const std::string& dbname) const;
+
+  PmemOptions();
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct LEVELDB_EXPORT Options {
   // -------------------
@@ -179,13 +257,27 @@ struct LEVELDB_EXPORT Options {
   PmemHashmap **pmem_hashmap;
 
   SSTMakerType sst_type;
-  PmemDataStructrueType ds_type;
 
   bool skiplist_cache;
   bool use_pmem_buffer;
+  // Write-ahead log is appended to pmem (PmemLog) instead of log files.
+  // Logs left in files are still replayed on open.
+  // NOTE: Logs in pmem are not replayed if DB is opened without it.
+  bool use_pmem_log;
+  PmemLog *pmem_log;
+  // Memtables are kept in pmem (PmemMemTablePool), so writes are durable
+  // without write-ahead log, and recovery reattaches them (no replay).
+  // Each arena is 2 * write_buffer_size, a write batch must fit in it.
+  // NOTE: No log is written, old logs (file or pmem) are still replayed.
+  bool use_pmem_memtable;
+  PmemMemTablePool *pmem_memtable;
   
   /* Tiering */
   TieringOption tiering_option;
+  PmemDataStructrueType ds_type;
+
+  /* Pmem pool topology */
+  PmemOptions pmem_options;
   // Create an Options object with default values for all fields.
   Options();
 };
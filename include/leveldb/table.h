@@ -72,11 +72,14 @@ class LEVELDB_EXPORT Table {
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
   // that key is not present.
+  // JH: If pinned_block is non-null and an entry is found, its block
+  //     iterator is stored in *pinned_block instead of being deleted.
   friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
-      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+      Iterator** pinned_block = nullptr);
 
 
   void ReadMeta(const Footer& footer);
@@ -111,6 +111,8 @@ class LEVELDB_EXPORT TableBuilder {
   bool ok() const { return status().ok(); }
   void WriteBlock(BlockBuilder* block, BlockHandle* handle);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle);
+  // JH: Collect key for whole-table filter of pmem table
+  void AddKeyToPmemFilter(const Slice& key);
 
   struct Rep;
   Rep* rep_;
@@ -45,6 +45,8 @@
 #include <libpmemobj.h>
 #include "pmem/ds/hashmap_atomic.h"
 #include "pmem/ds/hashmap_internal.h"
+#include "util/coding.h"
+#include "util/hash.h"
 
 namespace leveldb {
 
@@ -85,8 +87,6 @@ POBJ_LIST_HEAD(entries_head, struct entry);
 struct buckets {
 	/* number of buckets */
 	size_t nbuckets;
-	/* array_size of buckets */
-	size_t buckets_size[];
 	/* array of lists */
 	struct entries_head bucket[];
 };
@@ -114,6 +114,9 @@ struct hashmap_atomic {
   /* TEST: list pointer for ordered iterator */
   // POBJ_LIST_ENTRY(struct entry) iterator;
   struct iterator_head entries;
+
+	/* buckets [0, rehash_pos) are moved to buckets_tmp */
+	uint64_t rehash_pos;
 };
 
 /*
@@ -194,55 +197,122 @@ create_hashmap(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 }
 
 /*
- * hash -- the simplest hashing function,
- * see https://en.wikipedia.org/wiki/Universal_hashing#Hashing_integers
+ * user_key_len -- (internal) length of user key,
+ * keys longer than tag are InternalKey (user key + 8-byte tag)
+ */
+static inline size_t
+user_key_len(size_t key_len)
+{
+	return key_len > NUM_OF_TAG_BYTES ? key_len - NUM_OF_TAG_BYTES : key_len;
+}
+
+/*
+ * hash -- hashes raw bytes of user key (util/hash.h), any binary key works.
+ * NOTE: Versions of same user key are in same bucket
  */
 static uint64_t
 hash(const TOID(struct hashmap_atomic) *hashmap,
 		const TOID(struct buckets) *buckets,
-	// uint64_t value)
-	char* value, uint8_t value_len)
+		const char* value, size_t value_len)
 {
-  std::string key_str;
-  key_str.append(value, value_len-NUM_OF_TAG_BYTES);
-  uint64_t v = std::atoi(key_str.c_str());
-  
-	uint32_t a = D_RO(*hashmap)->hash_fun_a;
-	uint32_t b = D_RO(*hashmap)->hash_fun_b;
-	uint64_t p = D_RO(*hashmap)->hash_fun_p;
-	size_t len = D_RO(*buckets)->nbuckets;
+	uint32_t h = Hash(value, user_key_len(value_len),
+										D_RO(*hashmap)->hash_fun_a);
+	return h % D_RO(*buckets)->nbuckets;
+}
 
-	return ((a * v + b) % p) % len;
+/*
+ * entry_key -- (internal) key of entry, copied (insert) or pointed (by_ptr)
+ */
+static inline const char*
+entry_key(TOID(struct entry) var)
+{
+	if (D_RO(var)->key_ptr != nullptr)
+		return (const char *)D_RO(var)->key_ptr;
+	return (const char *)pmemobj_direct(D_RO(var)->key);
 }
 
 /*
- * hm_atomic_rebuild_finish -- finishes rebuild, assumes buckets_tmp is not null
+ * hm_atomic_find_in -- (internal) searches one bucket array for the newest
+ * version of user key, visible to key's sequence (like Table::InternalGet).
+ * exact: match whole key (remove), no sequence check
+ * return:  slot (persistent link) pointing to the entry, or unchanged
  */
 static void
-hm_atomic_rebuild_finish(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
+hm_atomic_find_in(TOID(struct hashmap_atomic) hashmap,
+		TOID(struct buckets) buckets, const char* key, size_t key_len,
+		bool exact, PMEMoid** res, uint64_t* res_seq)
 {
-	TOID(struct buckets) cur = D_RO(hashmap)->buckets;
-	TOID(struct buckets) tmp = D_RO(hashmap)->buckets_tmp;
-
-	for (size_t i = 0; i < D_RO(cur)->nbuckets; ++i) {
-		while (!POBJ_LIST_EMPTY(&D_RO(cur)->bucket[i])) {
-			TOID(struct entry) en =
-					POBJ_LIST_FIRST(&D_RO(cur)->bucket[i]);
-			// uint64_t h = hash(&hashmap, &tmp, D_RO(en)->key);
-      char* key = (char *)pmemobj_direct(D_RO(en)->key);
-			uint64_t h = hash(&hashmap, &tmp, key, D_RO(en)->key_len);
+	size_t ukey_len = user_key_len(key_len);
+	bool has_tag = key_len > NUM_OF_TAG_BYTES;
+	uint64_t seq = has_tag ? (DecodeFixed64(key + ukey_len) >> 8) : 0;
+	uint64_t h = hash(&hashmap, &buckets, key, key_len);
 
-			if (POBJ_LIST_MOVE_ELEMENT_HEAD(pop,
-					&D_RW(cur)->bucket[i],
-					&D_RW(tmp)->bucket[h],
-					en, list, list)) {
-				fprintf(stderr, "move failed: %s\n",
-						pmemobj_errormsg());
-				abort();
+	const struct entries_head* head = &D_RO(buckets)->bucket[h];
+	TOID(struct entry) first = POBJ_LIST_FIRST(head);
+	PMEMoid* slot = const_cast<PMEMoid *>(&head->pe_first.oid);
+	TOID(struct entry) var = first;
+	while (!TOID_IS_NULL(var)) {
+		const char* var_key = entry_key(var);
+		size_t var_len = D_RO(var)->key_len;
+		if (exact) {
+			if (var_len == key_len && memcmp(var_key, key, key_len) == 0) {
+				*res = slot;
+				return;
+			}
+		} else if (user_key_len(var_len) == ukey_len &&
+				memcmp(var_key, key, ukey_len) == 0) {
+			uint64_t var_seq = (has_tag && var_len == key_len) ?
+					(DecodeFixed64(var_key + ukey_len) >> 8) : 0;
+			if ((!has_tag || var_seq <= seq) &&
+					(*res == nullptr || var_seq > *res_seq)) {
+				*res = slot;
+				*res_seq = var_seq;
 			}
 		}
+		slot = const_cast<PMEMoid *>(&D_RO(var)->list.pe_next.oid);
+		var = POBJ_LIST_NEXT(var, list);
+		if (TOID_EQUALS(var, first)) // NOTE: circular list
+			break;
 	}
+}
 
+/*
+ * hm_atomic_find -- (internal) searches both bucket arrays while rehashing
+ * return:  slot pointing to the entry, nullptr = not found
+ */
+static PMEMoid*
+hm_atomic_find(TOID(struct hashmap_atomic) hashmap,
+		const char* key, size_t key_len, bool exact)
+{
+	PMEMoid* res = nullptr;
+	uint64_t res_seq = 0;
+	hm_atomic_find_in(hashmap, D_RO(hashmap)->buckets, key, key_len,
+			exact, &res, &res_seq);
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp) && (res == nullptr || !exact))
+		hm_atomic_find_in(hashmap, D_RO(hashmap)->buckets_tmp, key, key_len,
+				exact, &res, &res_seq);
+	return res;
+}
+
+/*
+ * hm_atomic_insert_buckets -- (internal) buckets taking new entries,
+ * new array while rehashing
+ */
+static inline TOID(struct buckets)
+hm_atomic_insert_buckets(TOID(struct hashmap_atomic) hashmap)
+{
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+		return D_RO(hashmap)->buckets_tmp;
+	return D_RO(hashmap)->buckets;
+}
+
+/*
+ * hm_atomic_rebuild_swap -- (internal) publishes buckets_tmp,
+ * assumes all entries are moved
+ */
+static void
+hm_atomic_rebuild_swap(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
+{
 	POBJ_FREE(&D_RO(hashmap)->buckets);
 
 	D_RW(hashmap)->buckets = D_RO(hashmap)->buckets_tmp;
@@ -262,19 +332,70 @@ hm_atomic_rebuild_finish(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
 }
 
 /*
- * hm_atomic_rebuild -- rebuilds the hashmap with a new number of buckets
+ * hm_atomic_rehash_step -- moves up to nbuckets old buckets to buckets_tmp,
+ * and swaps arrays after the last one. Assumes buckets_tmp is not null.
+ * NOTE: Each move is atomic and rehash_pos is persisted per bucket,
+ *       so an interrupted rehash just continues (see hm_atomic_init)
+ */
+static void
+hm_atomic_rehash_step(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
+		size_t nbuckets)
+{
+	TOID(struct buckets) cur = D_RO(hashmap)->buckets;
+	TOID(struct buckets) tmp = D_RO(hashmap)->buckets_tmp;
+	size_t end = D_RO(cur)->nbuckets;
+	if (nbuckets < end - D_RO(hashmap)->rehash_pos)
+		end = D_RO(hashmap)->rehash_pos + nbuckets;
+
+	for (size_t i = D_RO(hashmap)->rehash_pos; i < end; ++i) {
+		while (!POBJ_LIST_EMPTY(&D_RO(cur)->bucket[i])) {
+			TOID(struct entry) en =
+					POBJ_LIST_FIRST(&D_RO(cur)->bucket[i]);
+			uint64_t h = hash(&hashmap, &tmp, entry_key(en),
+					D_RO(en)->key_len);
+
+			if (POBJ_LIST_MOVE_ELEMENT_HEAD(pop,
+					&D_RW(cur)->bucket[i],
+					&D_RW(tmp)->bucket[h],
+					en, list, list)) {
+				fprintf(stderr, "move failed: %s\n",
+						pmemobj_errormsg());
+				abort();
+			}
+		}
+		D_RW(hashmap)->rehash_pos = i + 1;
+		pmemobj_persist(pop, &D_RW(hashmap)->rehash_pos,
+				sizeof(D_RW(hashmap)->rehash_pos));
+	}
+
+	if (D_RO(hashmap)->rehash_pos >= D_RO(cur)->nbuckets)
+		hm_atomic_rebuild_swap(pop, hashmap);
+}
+
+/*
+ * hm_atomic_rebuild -- starts rebuild with a new number of buckets,
+ * entries are moved incrementally by following inserts
+ * (REHASH_STEP_BUCKETS per insert), so no insert pays a full rehash
  */
 static void
 hm_atomic_rebuild(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		size_t new_len)
 {
-	printf("rebuild\n");
+	/* already rebuilding */
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+		return;
+
 	if (new_len == 0)
 		new_len = D_RO(D_RO(hashmap)->buckets)->nbuckets;
 
 	size_t sz = sizeof(struct buckets) +
 			new_len * sizeof(struct entries_head);
 
+	/* NOTE: reset before buckets_tmp is published */
+	D_RW(hashmap)->rehash_pos = 0;
+	pmemobj_persist(pop, &D_RW(hashmap)->rehash_pos,
+			sizeof(D_RW(hashmap)->rehash_pos));
+
 	POBJ_ALLOC(pop, &D_RW(hashmap)->buckets_tmp, struct buckets, sz,
 			create_buckets, &new_len);
 	if (TOID_IS_NULL(D_RO(hashmap)->buckets_tmp)) {
@@ -284,8 +405,39 @@ hm_atomic_rebuild(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 			new_len, pmemobj_errormsg());
 		return;
 	}
+}
 
-	hm_atomic_rebuild_finish(pop, hashmap);
+/*
+ * hm_atomic_finish_rehash -- moves all remaining buckets of a rebuild,
+ * so lookups of a table which takes no more inserts probe one array
+ */
+int
+hm_atomic_finish_rehash(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
+{
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+		hm_atomic_rehash_step(pop, hashmap, SIZE_MAX);
+	return 0;
+}
+
+/*
+ * hm_atomic_after_insert -- (internal) continues or triggers rebuild
+ * num: number of entries in the bucket of new entry
+ */
+static void
+hm_atomic_after_insert(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
+		TOID(struct buckets) buckets, int num)
+{
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp)) {
+		hm_atomic_rehash_step(pop, hashmap, REHASH_STEP_BUCKETS);
+		return;
+	}
+	if (num > MAX_HASHSET_THRESHOLD ||
+			(num > MIN_HASHSET_THRESHOLD &&
+			D_RO(hashmap)->count > 2 * D_RO(buckets)->nbuckets)) {
+		hm_atomic_rebuild(pop, hashmap, D_RO(buckets)->nbuckets * 2);
+		if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+			hm_atomic_rehash_step(pop, hashmap, REHASH_STEP_BUCKETS);
+	}
 }
 
 /*
@@ -299,39 +451,18 @@ int
 hm_atomic_insert(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		char* key, char* buffer_ptr, int key_len)
 {
-	TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
+	TOID(struct buckets) buckets = hm_atomic_insert_buckets(hashmap);
 	TOID(struct entry) var;
 
-	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-  // printf("1\n");
 	uint64_t h = hash(&hashmap, &buckets, key, key_len);
 	int num = 0;
-	std::chrono::steady_clock::time_point end= std::chrono::steady_clock::now();
-	std::cout << "hash = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	begin = std::chrono::steady_clock::now();
-	// int num =	D_RO(buckets)->buckets_size[h];
-  // printf("2\n");
 
   // FIXME: Count same bucket's entries
 	POBJ_LIST_FOREACH(var, &D_RO(buckets)->bucket[h], list) {
-		// if (D_RO(var)->key == key)
-		// 	return 1;
 		num++;
 	}
-	end= std::chrono::steady_clock::now();
-	std::cout << "num_foreach = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	begin = std::chrono::steady_clock::now();
-
-  // TEST:
-	// D_RW(hashmap)->count_dirty = 1;
-	// pmemobj_persist(pop, &D_RW(hashmap)->count_dirty,
-	// 		sizeof(D_RW(hashmap)->count_dirty));
 
-  // printf("3\n");
 	struct entry_args args;
-	// args.key = key;
-	// args.value = value;
-  
   TX_BEGIN(pop) {
     args.key = pmemobj_tx_zalloc(key_len, 501);
     pmemobj_memcpy_persist(pop, pmemobj_direct(args.key), key, key_len);
@@ -341,11 +472,7 @@ hm_atomic_insert(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
   args.key_len = key_len;
   args.key_ptr = nullptr; // default
   args.buffer_ptr = buffer_ptr;
-	end= std::chrono::steady_clock::now();
-	std::cout << "alloc_copy = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	begin = std::chrono::steady_clock::now();
 	
-  // printf("4\n");
   // For specific bucket
 	PMEMoid oid = POBJ_LIST_INSERT_NEW_HEAD(pop,
 			&D_RW(buckets)->bucket[h],
@@ -355,11 +482,7 @@ hm_atomic_insert(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 			pmemobj_errormsg());
 		return -1;
 	}
-	end= std::chrono::steady_clock::now();
-	std::cout << "hash_list = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	begin = std::chrono::steady_clock::now();
 	
-  // printf("5\n");
   // For total entries
   PMEMoid oid2 = POBJ_LIST_INSERT_NEW_TAIL(pop,
 			&D_RW(hashmap)->entries ,
@@ -369,33 +492,11 @@ hm_atomic_insert(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 			pmemobj_errormsg());
 		return -1;
 	}
-	end= std::chrono::steady_clock::now();
-	std::cout << "iterator = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	begin = std::chrono::steady_clock::now();
-	
 
-  // printf("6\n");
 	D_RW(hashmap)->count++;
-	// pmemobj_persist(pop, &D_RW(hashmap)->count,
-	// 		sizeof(D_RW(hashmap)->count));
-
-  // TEST:
-	// D_RW(hashmap)->count_dirty = 0;
-	// pmemobj_persist(pop, &D_RW(hashmap)->count_dirty,
-	// 		sizeof(D_RW(hashmap)->count_dirty));
 
-  // printf("7\n");
 	num++;
-	// printf("num %d]\n", num);
-	if (num > MAX_HASHSET_THRESHOLD ||
-			(num > MIN_HASHSET_THRESHOLD &&
-			D_RO(hashmap)->count > 2 * D_RO(buckets)->nbuckets))
-		hm_atomic_rebuild(pop, hashmap, D_RW(buckets)->nbuckets * 2);
-
-	end= std::chrono::steady_clock::now();
-	std::cout << "rebuild checking = " << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() <<"\n";
-	
-  // printf("8\n");
+	hm_atomic_after_insert(pop, hashmap, buckets, num);
 	return 0;
 }
 
@@ -406,7 +507,7 @@ int
 hm_atomic_insert_by_ptr(PMEMobjpool* pop, TOID(struct hashmap_atomic) hashmap,
 	void* key_ptr, char* buffer_ptr, int key_len)
 {
-  TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
+  TOID(struct buckets) buckets = hm_atomic_insert_buckets(hashmap);
 	TOID(struct entry) var;
 
 
@@ -456,11 +557,7 @@ hm_atomic_insert_by_ptr(PMEMobjpool* pop, TOID(struct hashmap_atomic) hashmap,
 	// 		sizeof(D_RW(hashmap)->count_dirty));
 
 	num++;
-	if (num > MAX_HASHSET_THRESHOLD ||
-			(num > MIN_HASHSET_THRESHOLD &&
-			D_RO(hashmap)->count > 2 * D_RO(buckets)->nbuckets))
-		hm_atomic_rebuild(pop, hashmap, D_RW(buckets)->nbuckets * 2);
-
+	hm_atomic_after_insert(pop, hashmap, buckets, num);
 	return 0;
 }
 
@@ -476,12 +573,22 @@ hm_atomic_remove(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 {
 	TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
 	TOID(struct entry) var;
-
-	uint64_t h = hash(&hashmap, &buckets, key, key_len);
-	POBJ_LIST_FOREACH(var, &D_RW(buckets)->bucket[h], list) {
-    void* key_ptr = (void *)pmemobj_direct(D_RO(var)->key);
-    if (memcmp(key_ptr, key, key_len) == 0)
-		// if (D_RO(var)->key == key)
+	uint64_t h;
+
+	/* NOTE: entry is in old or new buckets while rehashing */
+	for (int round = 0; round < 2; round++) {
+		if (round == 1) {
+			if (TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+				return 1;
+			buckets = D_RO(hashmap)->buckets_tmp;
+		}
+		h = hash(&hashmap, &buckets, key, key_len);
+		POBJ_LIST_FOREACH(var, &D_RW(buckets)->bucket[h], list) {
+			if (D_RO(var)->key_len == key_len &&
+					memcmp(entry_key(var), key, key_len) == 0)
+				break;
+		}
+		if (!TOID_IS_NULL(var))
 			break;
 	}
 
@@ -507,13 +614,89 @@ hm_atomic_remove(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 	// pmemobj_persist(pop, &D_RW(hashmap)->count_dirty,
 	// 		sizeof(D_RW(hashmap)->count_dirty));
 
-	if (D_RO(hashmap)->count < D_RO(buckets)->nbuckets)
+	// NOTE: Shrink (never below initial size) only if not rehashing
+	buckets = D_RO(hashmap)->buckets;
+	if (TOID_IS_NULL(D_RO(hashmap)->buckets_tmp) &&
+			D_RO(hashmap)->count < D_RO(buckets)->nbuckets &&
+			D_RO(buckets)->nbuckets / 2 >= INIT_BUCKETS_NUM) {
 		hm_atomic_rebuild(pop, hashmap, D_RO(buckets)->nbuckets / 2);
+		if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+			hm_atomic_rehash_step(pop, hashmap, REHASH_STEP_BUCKETS);
+	}
 
 	// return D_RO(var)->value;
 	return 0;
 }
 
+/*
+ * hm_atomic_clear_buckets -- (internal) frees entries of every bucket,
+ * keys are shared with iterator entries, freed there
+ */
+static int
+hm_atomic_clear_buckets(PMEMobjpool *pop, TOID(struct buckets) buckets)
+{
+	for (size_t i = 0; i < D_RO(buckets)->nbuckets; ++i) {
+		while (!POBJ_LIST_EMPTY(&D_RO(buckets)->bucket[i])) {
+			TOID(struct entry) var =
+					POBJ_LIST_FIRST(&D_RO(buckets)->bucket[i]);
+			if (POBJ_LIST_REMOVE_FREE(pop, &D_RW(buckets)->bucket[i],
+					var, list)) {
+				fprintf(stderr, "list remove failed: %s\n",
+					pmemobj_errormsg());
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * hm_atomic_clear -- removes all elements from the hashmap,
+ * so a freed hashmap can be reused by another table.
+ * NOTE: Each removal is atomic, interrupted clear is done again
+ *       by the next one (free slots are cleared on recovery)
+ */
+int
+hm_atomic_clear(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
+{
+	/* entries of an interrupted rehash are in both arrays */
+	if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp)) {
+		if (hm_atomic_clear_buckets(pop, D_RO(hashmap)->buckets_tmp))
+			return 1;
+		POBJ_FREE(&D_RW(hashmap)->buckets_tmp);
+		/* see comment in hm_atomic_rebuild_swap */
+		D_RW(hashmap)->buckets_tmp.oid.off = 0;
+		pmemobj_persist(pop, &D_RW(hashmap)->buckets_tmp,
+				sizeof(D_RW(hashmap)->buckets_tmp));
+	}
+	if (hm_atomic_clear_buckets(pop, D_RO(hashmap)->buckets))
+		return 1;
+
+	while (!POBJ_LIST_EMPTY(&D_RO(hashmap)->entries)) {
+		TOID(struct entry) var = POBJ_LIST_FIRST(&D_RO(hashmap)->entries);
+		/* NOTE: by_ptr entries have no copied key */
+		if (!OID_IS_NULL(D_RO(var)->key))
+			pmemobj_free(&D_RW(var)->key);
+		if (POBJ_LIST_REMOVE_FREE(pop, &D_RW(hashmap)->entries,
+				var, iterator)) {
+			fprintf(stderr, "list remove failed: %s\n",
+				pmemobj_errormsg());
+			return 1;
+		}
+	}
+
+	D_RW(hashmap)->count = 0;
+	D_RW(hashmap)->count_dirty = 0;
+	D_RW(hashmap)->rehash_pos = 0;
+	pmemobj_persist(pop, &D_RW(hashmap)->count,
+			sizeof(D_RW(hashmap)->count));
+	pmemobj_persist(pop, &D_RW(hashmap)->count_dirty,
+			sizeof(D_RW(hashmap)->count_dirty));
+	pmemobj_persist(pop, &D_RW(hashmap)->rehash_pos,
+			sizeof(D_RW(hashmap)->rehash_pos));
+	return 0;
+}
+
 /*
  * hm_atomic_foreach -- prints all values from the hashmap
  */
@@ -521,7 +704,6 @@ int
 hm_atomic_foreach(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 	int (*cb)(char* key, char* buffer_ptr, void* key_ptr, int key_len, void *arg), void *arg)
 {
-	TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
 	TOID(struct entry) var;
 	int ret = 0;
     // TEST:
@@ -581,24 +763,19 @@ hm_atomic_debug(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 }
 
 /*
- * hm_atomic_get -- checks whether specified value is in the hashmap
+ * hm_atomic_get -- returns buffer_ptr of newest visible version of key
+ * (sequence of entry <= sequence of key), nullptr = not found
  */
 void*
 hm_atomic_get(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		char* key, int key_len)
 {
-	TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
+	PMEMoid* slot = hm_atomic_find(hashmap, key, key_len, false);
+	if (slot == nullptr)
+		return nullptr;
 	TOID(struct entry) var;
-
-	uint64_t h = hash(&hashmap, &buckets, key, key_len);
-
-	POBJ_LIST_FOREACH(var, &D_RO(buckets)->bucket[h], list) {
-    void* key_ptr = (void *)pmemobj_direct(D_RO(var)->key);
-		// if (D_RO(var)->key == key)
-    if (memcmp(key_ptr, key, key_len) == 0)
-			return D_RO(var)->buffer_ptr;
-  }
-	return nullptr;
+	TOID_ASSIGN(var, *slot);
+	return D_RO(var)->buffer_ptr;
 }
 
 /*
@@ -608,18 +785,7 @@ int
 hm_atomic_lookup(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		char* key, int key_len)
 {
-	TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
-	TOID(struct entry) var;
-
-	uint64_t h = hash(&hashmap, &buckets, key, key_len);
-
-	POBJ_LIST_FOREACH(var, &D_RO(buckets)->bucket[h], list) {
-		void* key_ptr = (void *)pmemobj_direct(D_RO(var)->key);
-		// if (D_RO(var)->key == key)
-    if (memcmp(key_ptr, key, key_len) == 0)
-			return 1;
-  }
-	return 0;
+	return hm_atomic_find(hashmap, key, key_len, false) != nullptr;
 }
 
 /*
@@ -652,7 +818,7 @@ hm_atomic_init(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
 		printf("rebuild, previous attempt crashed\n");
 		if (TOID_EQUALS(D_RO(hashmap)->buckets,
 				D_RO(hashmap)->buckets_tmp)) {
-			/* see comment in hm_rebuild_finish */
+			/* see comment in hm_atomic_rebuild_swap */
 			D_RW(hashmap)->buckets_tmp.oid.off = 0;
 			pmemobj_persist(pop, &D_RW(hashmap)->buckets_tmp,
 					sizeof(D_RW(hashmap)->buckets_tmp));
@@ -660,12 +826,14 @@ hm_atomic_init(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap)
 			D_RW(hashmap)->buckets = D_RW(hashmap)->buckets_tmp;
 			pmemobj_persist(pop, &D_RW(hashmap)->buckets,
 					sizeof(D_RW(hashmap)->buckets));
-			/* see comment in hm_rebuild_finish */
+			/* see comment in hm_atomic_rebuild_swap */
 			D_RW(hashmap)->buckets_tmp.oid.off = 0;
 			pmemobj_persist(pop, &D_RW(hashmap)->buckets_tmp,
 					sizeof(D_RW(hashmap)->buckets_tmp));
 		} else {
-			hm_atomic_rebuild_finish(pop, hashmap);
+			/* NOTE: moved buckets are kept, following inserts continue */
+			printf("rebuild continues from %" PRIu64 "\n",
+				D_RO(hashmap)->rehash_pos);
 		}
 	}
 
@@ -791,17 +959,10 @@ hm_atomic_seek_OID(PMEMobjpool* pop, TOID(struct hashmap_atomic) hashmap,
   //   return &next.oid;
   // } 
 
-  TOID(struct buckets) buckets = D_RO(hashmap)->buckets;
-  TOID(struct entry) var;
-
-  uint64_t h = hash(&hashmap, &buckets, key, key_len);
-
-  POBJ_LIST_FOREACH(var, &D_RO(buckets)->bucket[h], list) {
-    void* key_ptr = (void *)pmemobj_direct(D_RO(var)->key);
-    if (memcmp(key_ptr, key, key_len) == 0) {
-		  // return &(var.oid);
-      return &var.oid;
-		}
+  // NOTE: Return persistent link to the entry, not a local TOID
+  PMEMoid* slot = hm_atomic_find(hashmap, key, key_len, false);
+  if (slot != nullptr) {
+    return slot;
   }
   return const_cast<PMEMoid *>(&OID_NULL);
 }
@@ -833,7 +994,10 @@ hm_atomic_cmd(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 {
 	switch (cmd) {
 		case HASHMAP_CMD_REBUILD:
+			/* explicit rebuild is done at once */
 			hm_atomic_rebuild(pop, hashmap, arg);
+			if (!TOID_IS_NULL(D_RO(hashmap)->buckets_tmp))
+				hm_atomic_rehash_step(pop, hashmap, SIZE_MAX);
 			return 0;
 		case HASHMAP_CMD_DEBUG:
 			if (!arg)
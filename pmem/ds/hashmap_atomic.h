@@ -65,6 +65,9 @@ int hm_atomic_insert_by_ptr(PMEMobjpool* pop,
 
 int hm_atomic_remove(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		char* key, int key_len);
+int hm_atomic_clear(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap);
+int hm_atomic_finish_rehash(PMEMobjpool *pop,
+		TOID(struct hashmap_atomic) hashmap);
 void* hm_atomic_get(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
 		char* key, int key_len);
 int hm_atomic_lookup(PMEMobjpool *pop, TOID(struct hashmap_atomic) hashmap,
@@ -45,4 +45,7 @@
 /* number of values in a bucket which force hashtable rebuild */
 #define MAX_HASHSET_THRESHOLD 100
 
+/* number of old buckets moved to new array per insert, while rebuilding */
+#define REHASH_STEP_BUCKETS 4
+
 #endif
\ No newline at end of file
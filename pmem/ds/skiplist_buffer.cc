@@ -38,8 +38,10 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "pmem/ds/skiplist_buffer.h"
 
+#include "leveldb/comparator.h"
 #include "util/coding.h" 
 
 #include <chrono>
@@ -49,26 +51,32 @@
 
 namespace leveldb {
 
-struct skiplist_map_entry {
-	char* buffer_ptr;
-};
-
-struct skiplist_map_node {
-	TOID(struct skiplist_map_node) next[SKIPLIST_LEVELS_NUM];
-	struct skiplist_map_entry entry;
-};
-
-/* 
- * LAST_NODE for find insert-position(next) 
- * It's common structure
+/*
+ * EncodeBufferPtr -- (shard, offset) of buffer_ptr
+ * NOTE: Only on table build, reads decode by index
  */
-struct store_last_node {
-	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
-};
-struct store_last_node last_node;
-
-/*  Global constant for binary insertion */
-int common_constant;
+struct skiplist_buffer_ptr EncodeBufferPtr(
+		const struct skiplist_buffer_bases* bases, const char* buffer_ptr) {
+	struct skiplist_buffer_ptr res = { 0, 0 };
+	if (buffer_ptr == nullptr || bases == nullptr) return res;
+	// Last pool with base <= buffer_ptr
+	uint64_t lo = 0, hi = bases->num_of_bases;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (bases->bases[bases->order[mid]] <= buffer_ptr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) return res;
+	uint64_t shard = bases->order[lo - 1];
+	if (buffer_ptr < bases->bases[shard] + bases->sizes[shard]) {
+		res.shard = shard;
+		res.off = (uint64_t)(buffer_ptr - bases->bases[shard]);
+	}
+	return res;
+}
 
 /* Getter of Key & Value from (pmem)buffer */
 uint32_t GetKeyLengthFromBuffer(char* buf) {
@@ -105,6 +113,88 @@ char* GetValueAndLengthFromBuffer(char* buf, uint32_t* value_len) {
 }
 
 
+/*
+ * skiplist_node_is_empty -- (internal) empty (pre-allocated) node, in-node
+ */
+static inline bool skiplist_node_is_empty(TOID(struct skiplist_map_node) node) {
+	const struct skiplist_map_entry* entry = &(D_RO(node)->entry);
+	return entry->buffer_ptr.off == 0 || entry->key_len == 0;
+}
+/*
+ * skiplist_node_key -- (internal) key of node, from (pmem)buffer
+ * NOTE: key_len is in node, so varint is not decoded
+ * return:  false = empty (pre-allocated) node
+ */
+static inline bool skiplist_node_key(const struct skiplist_map_cmp* cmp,
+																		TOID(struct skiplist_map_node) node,
+																		Slice* key) {
+	if (skiplist_node_is_empty(node)) return false;
+	const struct skiplist_map_entry* entry = &(D_RO(node)->entry);
+	char* buffer_ptr = DecodeBufferPtr(cmp->bases, entry->buffer_ptr);
+	if (buffer_ptr == nullptr) return false;
+	*key = Slice(buffer_ptr + VarintLength(entry->key_len), entry->key_len);
+	return true;
+}
+/*
+ * skiplist_key_prefix -- big-endian prefix of user key,
+ * zero-padded. Different prefixes give bytewise order of user keys.
+ */
+uint64_t skiplist_key_prefix(const struct skiplist_map_cmp* cmp,
+																					const Slice& key) {
+	size_t user_key_len = key.size();
+	if (cmp->cmp != nullptr && user_key_len >= NUM_OF_TAG_BYTES) {
+		user_key_len -= NUM_OF_TAG_BYTES;
+	}
+	size_t n = user_key_len < KEY_PREFIX_SIZE ? user_key_len : KEY_PREFIX_SIZE;
+	uint64_t res = 0;
+	for (size_t i=0; i<n; i++) {
+		res |= (uint64_t)(unsigned char)key[i] << (8 * (KEY_PREFIX_SIZE - 1 - i));
+	}
+	return res;
+}
+/*
+ * skiplist_key_compare -- 3-way compare of node key and target
+ * target_prefix = skiplist_key_prefix(target), computed once per lookup
+ */
+int skiplist_key_compare(const struct skiplist_map_cmp* cmp,
+																			const Slice& key, const Slice& target,
+																			uint64_t target_prefix) {
+	if (cmp->use_prefix) {
+		uint64_t prefix = skiplist_key_prefix(cmp, key);
+		if (prefix != target_prefix) {
+			return prefix < target_prefix ? -1 : 1;
+		}
+	}
+	if (cmp->cmp != nullptr) {
+		return cmp->cmp->Compare(key, target);
+	}
+	return key.compare(target);
+}
+/*
+ * skiplist_node_compare -- (internal) 3-way compare of non-empty node
+ * and target. Full key is read from buffer only on prefix tie.
+ */
+static inline int skiplist_node_compare(const struct skiplist_map_cmp* cmp,
+																		TOID(struct skiplist_map_node) node,
+																		const Slice& target, uint64_t target_prefix) {
+	const struct skiplist_map_entry* entry = &(D_RO(node)->entry);
+	if (cmp->use_prefix && entry->key_prefix != target_prefix) {
+		return entry->key_prefix < target_prefix ? -1 : 1;
+	}
+	Slice key;
+	skiplist_node_key(cmp, node, &key);
+	return skiplist_key_compare(cmp, key, target, target_prefix);
+}
+/*
+ * skiplist_node_less -- (internal) node is non-empty and node < target
+ */
+static inline bool skiplist_node_less(const struct skiplist_map_cmp* cmp,
+																		TOID(struct skiplist_map_node) node,
+																		const Slice& target, uint64_t target_prefix) {
+	if (skiplist_node_is_empty(node)) return false;
+	return skiplist_node_compare(cmp, node, target, target_prefix) < 0;
+}
+
 /*
  * skiplist_map_clear -- removes all elements from the map
  * return:  0 = finish all job
@@ -113,9 +203,12 @@ char* GetValueAndLengthFromBuffer(char* buf, uint32_t* value_len) {
 int skiplist_map_clear(PMEMobjpool* pop, TOID(struct skiplist_map_node) map) {
 	TOID(struct skiplist_map_node) next = D_RO(map)->next[0];
 	while (!TOID_EQUALS(next, NULL_NODE)) {
-		D_RW(next)->entry.buffer_ptr = nullptr;
+		D_RW(next)->entry.buffer_ptr.off = 0;
+		D_RW(next)->entry.key_len = 0;
+		pmemobj_flush(pop, &(D_RW(next)->entry), sizeof(struct skiplist_map_entry));
 		next = D_RO(next)->next[0];
 	}
+	pmemobj_drain(pop);
 	return 0;
 }
 
@@ -140,67 +233,25 @@ int skiplist_map_destroy(PMEMobjpool* pop, TOID(struct skiplist_map_node)* map)
 	} TX_END
 	return ret;
 }
-/*
- * skiplist_map_insert_node -- (internal) adds new node in selected place
- * Called by insert. Start from L1. (Additional linking)
- */
-static void skiplist_map_insert_node(TOID(struct skiplist_map_node) new_node,
-											TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM]) {
-	unsigned current_level = 0;
-	// binary insertion
-	if (USE_BINARY_INSERTION) {
-		common_constant++; // counting constant
-		do {
-			if (current_level == 0 ||
-					(current_level == 1 && common_constant % LEVEL_1_POINT == 0 ) ||
-					(current_level == 2 && common_constant % LEVEL_2_POINT == 0 ) ||
-					(current_level == 3 && common_constant % LEVEL_3_POINT == 0 ) ||
-					(current_level == 4 && common_constant % LEVEL_4_POINT == 0 ) ||
-					(current_level == 5 && common_constant % LEVEL_5_POINT == 0 ) ||
-					(current_level == 6 && common_constant % LEVEL_6_POINT == 0 ) ||
-					(current_level == 7 && common_constant % LEVEL_7_POINT == 0 ) ||
-					(current_level == 8 && common_constant % LEVEL_8_POINT == 0 ) ||
-					(current_level == 9 && common_constant % LEVEL_9_POINT == 0 ) ||
-					(current_level == 10 && common_constant % LEVEL_10_POINT == 0 ) ||
-					(current_level == 11 && common_constant % LEVEL_11_POINT == 0 )
-					) {
-				TX_ADD_FIELD(path[current_level], next[current_level]);
-				D_RW(new_node)->next[current_level] =
-					D_RO(path[current_level])->next[current_level];
-				D_RW(path[current_level])->next[current_level] = new_node;
-			}
-		} while (++current_level < SKIPLIST_LEVELS_NUM);
-	}
-	// random insertion
-	else {
-		do {
-			TX_ADD_FIELD(path[current_level], next[current_level]);
-			D_RW(new_node)->next[current_level] =
-				D_RO(path[current_level])->next[current_level];
-			D_RW(path[current_level])->next[current_level] = new_node;
-		} while (++current_level < SKIPLIST_LEVELS_NUM && rand() % 2 == 0);
-	}
-}
-
 /*
  * skiplist_map_find -- (internal) returns path to searched node, or if
  * node doesn't exist, it will return path to place where key should be.
+ * NOTE: path[i] is the last node (key < target) in level i
  */
-static void skiplist_map_find(PMEMobjpool* pop, char* key, 
+static void skiplist_map_find(PMEMobjpool* pop, 
+		const struct skiplist_map_cmp* cmp, const Slice& key,
 		TOID(struct skiplist_map_node) map, TOID(struct skiplist_map_node)* path) {
 	int current_level;
+	uint64_t key_prefix = skiplist_key_prefix(cmp, key);
 	TOID(struct skiplist_map_node) active = map;
 	for (current_level = SKIPLIST_LEVELS_NUM - 1;
 			current_level >= 0; current_level--) {
 		TOID(struct skiplist_map_node) next = D_RO(active)->next[current_level];
-		for ( char *ptr ;
+		for ( ;
 				!TOID_EQUALS(next, NULL_NODE);
 				next = D_RO(active)->next[current_level]) {
-			ptr = GetKeyFromBuffer(D_RO(next)->entry.buffer_ptr);
-			// printf("[DEBUG %d] key:'%s' ptr:'%s'\n", current_level, key, (char *)ptr);
-			if (strcmp(key, ptr) <= 0)  { // ascending order
-			// if (strcmp(key, (char *)ptr) >= 0)  { // descending order
-			// printf("[Break DEBUG %d] key:'%s' ptr:'%s'\n", current_level, key, (char *)ptr);
+			// ascending order, empty node is the end
+			if (!skiplist_node_less(cmp, next, key, key_prefix)) {
 				break;
 			}
 			active = next;
@@ -209,105 +260,156 @@ static void skiplist_map_find(PMEMobjpool* pop, char* key,
 	}
 }
 /*
- * skiplist_map_insert_find -- (internal) returns path to last node, or if
- * node doesn't exist, it will return path to place where key should be.
+ * skiplist_map_builder_init -- resets per-list builder to the head
+ * NOTE: pmem is not touched until first add, so a live list is safe
  */
-static void skiplist_map_insert_find(PMEMobjpool* pop,
-		TOID(struct skiplist_map_node) map, TOID(struct skiplist_map_node)* path) {
-	int current_level;
-	TOID(struct skiplist_map_node) active = map;
-	for (current_level = SKIPLIST_LEVELS_NUM - 1;
-			current_level >= 0; current_level--) {
-		TOID(struct skiplist_map_node) next = D_RO(active)->next[current_level];
-		// NOTE: Need to understand insertion logic
-		if (TOID_EQUALS(next, NULL_NODE)) {
-			path[current_level] = active;
-			last_node.path[current_level] = active;
-		} else {
-			active = last_node.path[current_level];
-			next = D_RO(active)->next[current_level];
-			if (TOID_EQUALS(next, NULL_NODE)) {
-				path[current_level] = active;
-				last_node.path[current_level] = active;
-			} else {
-				path[current_level] = next;
-				last_node.path[current_level] = next;
-			}
-		}
+void skiplist_map_builder_init(struct skiplist_map_builder* builder,
+															TOID(struct skiplist_map_node) map,
+															int deferred_drain) {
+	builder->head = map;
+	builder->current = map;
+	for (int i=0; i<SKIPLIST_LEVELS_NUM; i++) {
+		builder->last[i] = map;
 	}
+	builder->count = 0;
+	builder->deferred_drain = deferred_drain;
 }
 /*
- * skiplist_map_create_insert -- (internal) inserts an empty key-value pair 
- * into the map. Just pre-allocate new-node and key&value area
- * return:  0 = finish all job
- * 					1 = error
+ * skiplist_map_builder_persist -- (internal) persist, or only flush
+ * if drain is deferred to skiplist_map_builder_finish()
  */
-int skiplist_map_create_insert(PMEMobjpool* pop, 
-															TOID(struct skiplist_map_node) map) {
-	int ret = 0;
-	TOID(struct skiplist_map_node) new_node;
-	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
-
-	TX_BEGIN(pop) {
-		new_node = TX_ZNEW(struct skiplist_map_node);
-		D_RW(new_node)->entry.buffer_ptr = nullptr;
-
-		skiplist_map_insert_find(pop, map, path);
-		skiplist_map_insert_node(new_node, path);
-	} TX_ONABORT {
-		ret = 1;
-	} TX_END
-	return ret;
+static inline void skiplist_map_builder_persist(PMEMobjpool* pop,
+										const struct skiplist_map_builder* builder,
+										const void* addr, size_t len) {
+	if (builder->deferred_drain) {
+		pmemobj_flush(pop, addr, len);
+	} else {
+		pmemobj_persist(pop, addr, len);
+	}
 }
 /*
- * skiplist_map_insert -- inserts a new key-value pair into the map
+ * skiplist_map_builder_height -- (internal) tower height of i-th node,
+ * 1 + trailing zeros of i (1-based): perfect skiplist over sorted input
+ */
+static inline int skiplist_map_builder_height(uint64_t i) {
+	int height = 1;
+	while (height < SKIPLIST_LEVELS_NUM && (i & 1) == 0) {
+		i >>= 1;
+		height++;
+	}
+	return height;
+}
+/*
+ * skiplist_map_extent_construct -- (internal) links nodes of new extent
+ * on level 0. Runs before extent is published, so no TX.
+ */
+static int skiplist_map_extent_construct(PMEMobjpool* pop, void* ptr, 
+																				void* arg) {
+	uint64_t num_of_nodes = *(uint64_t *)arg;
+	struct skiplist_map_node* nodes = (struct skiplist_map_node *)ptr;
+	// NOTE: TOID is not trivial in C++, but all-zero is OID_NULL (raw pmem)
+	memset((void *)nodes, 0, num_of_nodes * sizeof(struct skiplist_map_node));
+	for (uint64_t i=0; i+1<num_of_nodes; i++) {
+		TOID_ASSIGN(nodes[i].next[0], pmemobj_oid(&nodes[i+1]));
+	}
+	pmemobj_persist(pop, nodes, num_of_nodes * sizeof(struct skiplist_map_node));
+	return 0;
+}
+/*
+ * skiplist_map_grow -- (internal) appends extent of nodes after tail
+ * NOTE: Allocation is published to tail->next[0] atomically,
+ *       so a crash never leaks or half-links the extent
  * return:  0 = finish all job
  * 					1 = error
  */
-int skiplist_map_insert(PMEMobjpool* pop, 
-												TOID(struct skiplist_map_node) map, 
-												TOID(struct skiplist_map_node)* current_node,
-												char* key, char* buffer_ptr, int key_len, int index) {
-	int ret = 0;
-	TOID(struct skiplist_map_node) new_node = D_RW(*current_node)->next[0];
-	// if (TOID_IS_NULL(new_node) || TOID_EQUALS(new_node, NULL_NODE)) {
-	// 	printf("[ERROR][Skiplist][insertion] Out of bound \n");
-	// 	ret = 1;
-	// }
-	if (TOID_IS_NULL(new_node) || TOID_EQUALS(new_node, NULL_NODE)) {
-		printf("[ERROR][Skiplist][insert] Out of bound \n");
-		// printf("null_node -> create_insert\n");
-		// skiplist_map_create_insert(pop, *current_node);
-		// new_node = D_RW(*current_node)->next[0];
-		// if (TOID_IS_NULL(new_node) || TOID_EQUALS(new_node, NULL_NODE)) {
-		// 	printf("again null... maybe abort()\n");
-		// } else {
-		// 	// Success
-		// }
+static int skiplist_map_grow(PMEMobjpool* pop, 
+														TOID(struct skiplist_map_node) tail,
+														uint64_t num_of_nodes) {
+	if (num_of_nodes < SKIPLIST_EXTENT_MIN_NODES) {
+		num_of_nodes = SKIPLIST_EXTENT_MIN_NODES;
+	} else if (num_of_nodes > SKIPLIST_EXTENT_MAX_NODES) {
+		num_of_nodes = SKIPLIST_EXTENT_MAX_NODES;
 	}
-	*current_node = new_node;
-	D_RW(new_node)->entry.buffer_ptr = buffer_ptr;
-	return ret;
+	return pmemobj_alloc(pop, &(D_RW(tail)->next[0].oid),
+											num_of_nodes * sizeof(struct skiplist_map_node),
+											TOID_TYPE_NUM(struct skiplist_map_node),
+											skiplist_map_extent_construct, &num_of_nodes) ? 1 : 0;
 }
 /*
- * skiplist_map_insert_by_ptr -- inserts a specifics node into the map by kv ptr
+ * skiplist_map_builder_add -- fills next pre-allocated node (level 0)
+ * and links it on upper levels of its tower in one pass.
+ * List grows by an extent when pre-allocated nodes run out.
+ * Input must be sorted. Only builder state is used, so lists of
+ * different builders can be built in parallel.
+ * NOTE: Upper levels always end with NULL_NODE at last[level],
+ *       so list is searchable after each add (no TX needed)
  * return:  0 = finish all job
  * 					1 = error
  */
-int skiplist_map_insert_by_ptr(PMEMobjpool* pop, 
-											TOID(struct skiplist_map_node) map,
-											TOID(struct skiplist_map_node) *current_node, 
-											char* buffer_ptr, int key_len, int index) {
-	int ret = 0;
-	TOID(struct skiplist_map_node) new_node = D_RW(*current_node)->next[0];
+int skiplist_map_builder_add(PMEMobjpool* pop,
+														struct skiplist_map_builder* builder,
+														const struct skiplist_map_cmp* cmp,
+														char* buffer_ptr, const Slice& key) {
+	TOID(struct skiplist_map_node) new_node = D_RO(builder->current)->next[0];
 	if (TOID_IS_NULL(new_node) || TOID_EQUALS(new_node, NULL_NODE)) {
-		printf("[ERROR][Skiplist][insertionByPTR] Out of bound \n");
-		ret = 1;
+		// Out of nodes, list keeps the extent for next tables
+		if (skiplist_map_grow(pop, builder->current, builder->count)) {
+			printf("[ERROR][Skiplist][builder] Cannot grow list (%lu nodes)\n",
+							builder->count);
+			return 1;
+		}
+		new_node = D_RO(builder->current)->next[0];
+	}
+	// Drop upper links of previous table (towers are rebuilt)
+	if (builder->count == 0) {
+		struct skiplist_map_node* head = D_RW(builder->head);
+		for (int i=1; i<SKIPLIST_LEVELS_NUM; i++) {
+			head->next[i] = NULL_NODE;
+		}
+		skiplist_map_builder_persist(pop, builder, &(head->next[1]), 
+										sizeof(head->next[1]) * (SKIPLIST_LEVELS_NUM - 1));
 	}
-	D_RW(new_node)->entry.buffer_ptr = buffer_ptr;
+	builder->count++;
+	struct skiplist_map_node* node = D_RW(new_node);
+	node->entry.buffer_ptr = EncodeBufferPtr(cmp->bases, buffer_ptr);
+	if (buffer_ptr != nullptr && node->entry.buffer_ptr.off == 0) {
+		printf("[ERROR][Skiplist][builder] Buffer pointer is not in PmemBuffer\n");
+		return 1;
+	}
+	node->entry.key_prefix = skiplist_key_prefix(cmp, key);
+	node->entry.key_len = key.size();
+	// NOTE: entry must survive restart (recovery)
+	skiplist_map_builder_persist(pop, builder, &(node->entry), 
+															sizeof(struct skiplist_map_entry));
 
-	*current_node = new_node;
-	return ret;
+	int height = skiplist_map_builder_height(builder->count);
+	if (height > 1) {
+		for (int i=1; i<height; i++) {
+			node->next[i] = NULL_NODE;
+		}
+		skiplist_map_builder_persist(pop, builder, &(node->next[1]), 
+																sizeof(node->next[1]) * (height - 1));
+		for (int i=1; i<height; i++) {
+			D_RW(builder->last[i])->next[i] = new_node;
+			skiplist_map_builder_persist(pop, builder, 
+											&(D_RW(builder->last[i])->next[i]), sizeof(new_node));
+			builder->last[i] = new_node;
+		}
+	}
+	builder->current = new_node;
+	return 0;
+}
+/*
+ * skiplist_map_builder_finish -- drains flushes of the table
+ * NOTE: Table is reachable only after MANIFEST is written, which follows
+ * return:  0 = finish all job
+ */
+int skiplist_map_builder_finish(PMEMobjpool* pop,
+																struct skiplist_map_builder* builder) {
+	if (builder->deferred_drain) {
+		pmemobj_drain(pop);
+	}
+	return 0;
 }
 /*
  * skiplist_map_insert_null_node -- inserts null node at last 
@@ -315,12 +417,11 @@ int skiplist_map_insert_by_ptr(PMEMobjpool* pop,
  * 					1 = error
  */
 int skiplist_map_insert_null_node(PMEMobjpool* pop, 
-											TOID(struct skiplist_map_node) map,
-											TOID(struct skiplist_map_node)* current_node, int index) {
+											struct skiplist_map_builder* builder) {
 	int ret = 0;
 	TOID(struct skiplist_map_node) null_node = NULL_NODE;
-	D_RW(*current_node)->next[0] = null_node;
-	*current_node = NULL_NODE;
+	D_RW(builder->current)->next[0] = null_node;
+	builder->current = NULL_NODE;
 	return ret;
 }
 
@@ -331,19 +432,26 @@ int skiplist_map_insert_null_node(PMEMobjpool* pop,
  */
 int skiplist_map_create(PMEMobjpool* pop, 
 												TOID(struct skiplist_map_node)* map,
-												TOID(struct skiplist_map_node) current_node, 
-												int index, void* arg) {
+												uint64_t num_of_nodes, void* arg) {
 	int ret = 0;
-	// NOTE: initialize common_constant
-	if (USE_BINARY_INSERTION)
-		common_constant = 0;
 	TX_BEGIN(pop) {
-		/* Pre-allcate estimated node-size */
+		/* 
+		 * Pre-allcate estimated node-size, as one extent
+		 * NOTE: Only level 0 is linked, towers are built per table
+		 *       by skiplist_map_builder_add()
+		 */
 		if ((char *)arg != nullptr) {
 			pmemobj_tx_add_range_direct(map, sizeof(*map));
 			*map = TX_ZNEW(struct skiplist_map_node);
-			for (int i=0; i< NUM_OF_PRE_ALLOC_NODE; i++) {
-				skiplist_map_create_insert(pop, *map);
+			if (num_of_nodes > 0) {
+				TOID(struct skiplist_map_node) extent = TX_ZALLOC(
+						struct skiplist_map_node, 
+						num_of_nodes * sizeof(struct skiplist_map_node));
+				struct skiplist_map_node* nodes = D_RW(extent);
+				for (uint64_t i=0; i+1<num_of_nodes; i++) {
+					TOID_ASSIGN(nodes[i].next[0], pmemobj_oid(&nodes[i+1]));
+				}
+				D_RW(*map)->next[0] = extent;
 			}
 		}
 	} TX_ONABORT {
@@ -371,19 +479,19 @@ static void skiplist_map_remove_node (
  * 					1 = error
  */
 int skiplist_map_remove_free(PMEMobjpool* pop, 
-														TOID(struct skiplist_map_node) map, char* key) {
+														TOID(struct skiplist_map_node) map, 
+														const struct skiplist_map_cmp* cmp, const Slice& key) {
 	int ret = 0;
 	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
 	TOID(struct skiplist_map_node) to_remove;
 	TX_BEGIN(pop) {
-		skiplist_map_find(pop, key, map, path);
+		skiplist_map_find(pop, cmp, key, map, path);
 		to_remove = D_RO(path[0])->next[0];
-		if (!TOID_EQUALS(to_remove, NULL_NODE)) {
-			uint32_t key_len;
-			char *ptr = GetKeyAndLengthFromBuffer(D_RO(to_remove)->entry.buffer_ptr, 
-																						&key_len);
-	// printf("[REMOVE_FREE-DEBUG] key:'%s' ptr:'%s' buf:'%s'\n", key, (char *)ptr, buf);
-			if (memcmp(ptr, key, key_len) == 0) {
+		Slice found_key;
+		if (!TOID_EQUALS(to_remove, NULL_NODE) && 
+				skiplist_node_key(cmp, to_remove, &found_key)) {
+			if (skiplist_key_compare(cmp, found_key, key, 
+															skiplist_key_prefix(cmp, key)) == 0) {
 				skiplist_map_remove_node(path);
 				ret = 0;
 			} else {
@@ -402,19 +510,18 @@ int skiplist_map_remove_free(PMEMobjpool* pop,
  * 					1 = error
  */
 int skiplist_map_remove(PMEMobjpool* pop, TOID(struct skiplist_map_node) map,
-												char* key) {
+												const struct skiplist_map_cmp* cmp, const Slice& key) {
 	int ret = 0;
 	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
 	TOID(struct skiplist_map_node) to_remove;
 	TX_BEGIN(pop) {
-		skiplist_map_find(pop, key, map, path);
+		skiplist_map_find(pop, cmp, key, map, path);
 		to_remove = D_RO(path[0])->next[0];
-		if (!TOID_EQUALS(to_remove, NULL_NODE)) {
-			uint32_t key_len; 
-			char *ptr = GetKeyAndLengthFromBuffer(D_RO(to_remove)->entry.buffer_ptr, 
-																						&key_len);
-	// printf("[REMOVE-DEBUG] key:'%s' ptr:'%s' buf:'%s'\n", key, (char *)ptr, buf);
-			if (memcmp(ptr, key, key_len) == 0) {
+		Slice found_key;
+		if (!TOID_EQUALS(to_remove, NULL_NODE) && 
+				skiplist_node_key(cmp, to_remove, &found_key)) {
+			if (skiplist_key_compare(cmp, found_key, key, 
+															skiplist_key_prefix(cmp, key)) == 0) {
 				skiplist_map_remove_node(path);
 			} 
 		}
@@ -427,44 +534,31 @@ int skiplist_map_remove(PMEMobjpool* pop, TOID(struct skiplist_map_node) map,
 /*
  * skiplist_map_minimal_find -- (internal) returns path to searched node, or if
  * node doesn't exist, it will return path to place where key should be.
+ * Stop immediately if key is found in upper level (find_res = level)
  */
-static void skiplist_map_minimal_find(PMEMobjpool* pop, char* key, 
+static void skiplist_map_minimal_find(PMEMobjpool* pop, 
+			const struct skiplist_map_cmp* cmp, const Slice& key, 
 			TOID(struct skiplist_map_node) map, TOID(struct skiplist_map_node)* path,
 			int* find_res) {
 	int current_level;
+	uint64_t key_prefix = skiplist_key_prefix(cmp, key);
 	TOID(struct skiplist_map_node) active = map;
 	for (current_level = SKIPLIST_LEVELS_NUM - 1;
 			current_level >= 0; current_level--) {
-		// void *key_ptr = pmemobj_direct(D_RO(active)->entry.key);
-		// printf("[Before DEBUG %d] key:'%s' ptr:'%s' \n", current_level, key, (char *)key_ptr);
 		TOID(struct skiplist_map_node) next = D_RO(active)->next[current_level];
-		for ( char *ptr ;
+		for ( ;
 				!TOID_EQUALS(next, NULL_NODE);
 				next = D_RO(active)->next[current_level]) {
-			if (D_RO(next)->entry.buffer_ptr == nullptr)
-				break;
-			uint32_t key_len; //= D_RO(next)->entry.key_len;
-			ptr = GetKeyAndLengthFromBuffer(D_RO(next)->entry.buffer_ptr, &key_len);
 			// Avoid looping about empty&pre-allocated key
-			if (key_len == 0) {
-				if (current_level == 0) {
-					path[current_level] = NULL_NODE;
-				}
+			if (skiplist_node_is_empty(next)) {
 				break;
-			} else if (key_len > NUM_OF_TAG_BYTES){
-				key_len -= NUM_OF_TAG_BYTES;
 			}
-			int res_cmp;
-			res_cmp = memcmp(key, ptr, key_len);
-			// printf("[DEBUG %d] key:'%s' ptr:'%s'\n", current_level, key, (char *)ptr);
-			if (res_cmp < 0) {
-			// printf("[Break DEBUG %d] key:'%s' ptr:'%s'\n", current_level, key, (char *)ptr);
+			int res_cmp = skiplist_node_compare(cmp, next, key, key_prefix);
+			if (res_cmp > 0) {
 				break;
 			} 
 			// Immediatly stop
 			else if (res_cmp == 0) {
-				// printf("Break1 '%s'\n", key);
-				// printf("Break2 '%s'\n", (char *)ptr);
 				*find_res = current_level;
 				break;
 			}
@@ -478,43 +572,33 @@ static void skiplist_map_minimal_find(PMEMobjpool* pop, char* key,
 	}
 }
 /*
- * skiplist_map_find_prev -- (internal) returns path to searched node, or if
- * node doesn't exist, it will return path to place where key should be.
+ * skiplist_map_find_prev -- (internal) returns the node whose next[0] is
+ * the last node (key < target). So the result is a stable pointer in pmem.
+ * NOTE: Advance only if successor of next is also less than target,
+ *       these nodes are always prefix of the list.
  */
-static void skiplist_map_find_prev(PMEMobjpool* pop, char* key, 
-																		TOID(struct skiplist_map_node) map, 
-																		TOID(struct skiplist_map_node)* path,
-																		int* find_res) {
+static TOID(struct skiplist_map_node) skiplist_map_find_prev(PMEMobjpool* pop, 
+																		const struct skiplist_map_cmp* cmp, 
+																		const Slice& key, 
+																		TOID(struct skiplist_map_node) map) {
 	int current_level;
+	uint64_t key_prefix = skiplist_key_prefix(cmp, key);
 	TOID(struct skiplist_map_node) active = map;
 	for (current_level = SKIPLIST_LEVELS_NUM - 1;
 			current_level >= 0; current_level--) {
 		TOID(struct skiplist_map_node) next = D_RO(active)->next[current_level];
-		for ( char *ptr ;
+		for ( ;
 				!TOID_EQUALS(next, NULL_NODE);
 				next = D_RO(active)->next[current_level]) {
-			// NOTE: Key-matching exactly
-			uint32_t key_len; 
-			ptr = GetKeyAndLengthFromBuffer(D_RO(next)->entry.buffer_ptr, &key_len);
-			// Avoid looping about empty&pre-allocated key
-			if (key_len == 0) {
-				break;
-			}
-			int res_cmp = memcmp(key, ptr, key_len);
-			if (res_cmp < 0) {
-				break;
-			} 
-			else if (res_cmp == 0) {
-				*find_res = current_level;
+			TOID(struct skiplist_map_node) succ = D_RO(next)->next[0];
+			if (TOID_EQUALS(succ, NULL_NODE) ||
+					!skiplist_node_less(cmp, succ, key, key_prefix)) {
 				break;
 			}
 			active = next;
 		}
-		path[current_level] = active;
-		if (*find_res >= 0) { 
-			break;
-		}
 	}
+	return active;
 }
 /*
  * skiplist_map_get_last_find -- (internal) returns path to searched node, or if
@@ -528,13 +612,11 @@ static void skiplist_map_find_last(PMEMobjpool* pop,
 	for (current_level = SKIPLIST_LEVELS_NUM - 1;
 			current_level >= 0; current_level--) {
 		TOID(struct skiplist_map_node) next = D_RO(active)->next[current_level];
-		for ( void *ptr ;
+		for ( ;
 				!TOID_EQUALS(next, NULL_NODE);
 				next = D_RO(active)->next[current_level]) {
-			// NOTE: Check only Key-length
-			uint32_t key_len = GetKeyLengthFromBuffer(D_RO(next)->entry.buffer_ptr);
 			// Seek first empty node in each level
-			if (key_len == 0) break;
+			if (skiplist_node_is_empty(next)) break;
 			active = next;
 		}
 		path[current_level] = active;
@@ -553,13 +635,13 @@ static void skiplist_map_find_last(PMEMobjpool* pop,
 // 	skiplist_map_minimal_find(pop, key, map, path, &exactly_found_level);
 // 	if (exactly_found_level != -1) {
 // 		found = D_RO(path[exactly_found_level])->next[exactly_found_level];
-// 		res = D_RO(found)->entry.buffer_ptr;
+// 		res = DecodeBufferPtr(cmp->bases, D_RO(found)->entry.buffer_ptr);
 // 		// printf("Get key %d: '%s'\n", exactly_found_level, key_ptr);
 // 	} else {
 // 		found = D_RO(path[0])->next[0];
 // 		if (!TOID_EQUALS(found, NULL_NODE)) {
 // 		// printf("[GET-DEBUG] key:'%s' ptr:'%s' buf:'%s'\n", key, (char *)ptr, buf);
-// 			res = D_RO(found)->entry.buffer_ptr;
+// 			res = DecodeBufferPtr(cmp->bases, D_RO(found)->entry.buffer_ptr);
 // 				// printf("Get key %d : '%s'-'%s'\n", exactly_found_level, key, ptr);
 // 		} else {
 // 			res = nullptr;
@@ -569,47 +651,65 @@ static void skiplist_map_find_last(PMEMobjpool* pop,
 // 	return res;
 // }
 /*
- * skiplist_map_get_OID -- get OID of the key
+ * skiplist_map_get_OID -- get OID of first node (key >= target)
  */
 PMEMoid* skiplist_map_get_OID(PMEMobjpool* pop, 
-															TOID(struct skiplist_map_node) map, char* key) {	
+															TOID(struct skiplist_map_node) map, 
+															const struct skiplist_map_cmp* cmp, const Slice& key) {	
 	PMEMoid* res;
 	int exactly_found_level = -1;
 	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
 
-	skiplist_map_minimal_find(pop, key, map, path, &exactly_found_level);
+	skiplist_map_minimal_find(pop, cmp, key, map, path, &exactly_found_level);
 	if (exactly_found_level != -1) {
 		res = const_cast<PMEMoid *>(&(D_RO(path[exactly_found_level])->next[exactly_found_level].oid));
 	} else {
-		if (!TOID_EQUALS(path[0], NULL_NODE)) {
-			res = const_cast<PMEMoid *>(&(D_RO(path[0])->next[0].oid));
-		} else {
-			res = const_cast<PMEMoid *>(&OID_NULL);
-		}
+		res = const_cast<PMEMoid *>(&(D_RO(path[0])->next[0].oid));
 	}
 	return res;
 }
+/*
+ * skiplist_map_get_buffer_ptr -- get buffer_ptr of first node (key >= target)
+ * Only local state is used, so it is reentrant (for concurrent Get)
+ * return:  nullptr = no such node
+ */
+char* skiplist_map_get_buffer_ptr(PMEMobjpool* pop, 
+																	TOID(struct skiplist_map_node) map, 
+																	const struct skiplist_map_cmp* cmp, 
+																	const Slice& key) {	
+	int exactly_found_level = -1;
+	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM], found;
+
+	skiplist_map_minimal_find(pop, cmp, key, map, path, &exactly_found_level);
+	if (exactly_found_level != -1) {
+		found = D_RO(path[exactly_found_level])->next[exactly_found_level];
+	} else {
+		found = D_RO(path[0])->next[0];
+	}
+	Slice found_key;
+	if (TOID_EQUALS(found, NULL_NODE) || !skiplist_node_key(cmp, found, &found_key)) {
+		return nullptr;
+	}
+	return DecodeBufferPtr(cmp->bases, D_RO(found)->entry.buffer_ptr);
+}
 /*
  * skiplist_map_get_prev_OID -- searches for prev OID of the key
+ * (last node, key < target)
  */
 PMEMoid* skiplist_map_get_prev_OID(PMEMobjpool* pop, 
 																		TOID(struct skiplist_map_node) map, 
-																		char* key) {	
+																		const struct skiplist_map_cmp* cmp,
+																		const Slice& key) {	
 	PMEMoid* res;
-	int exactly_found_level = -1;
-	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM];
-
-	skiplist_map_find_prev(pop, key, map, path, &exactly_found_level);
-	if (exactly_found_level != -1) {
-		res = &(path[exactly_found_level].oid);
+	TOID(struct skiplist_map_node) holder = 
+																skiplist_map_find_prev(pop, cmp, key, map);
+	TOID(struct skiplist_map_node) prev = D_RO(holder)->next[0];
+	// No node is less than key
+	if (TOID_EQUALS(prev, NULL_NODE) ||
+			!skiplist_node_less(cmp, prev, key, skiplist_key_prefix(cmp, key))) {
+		res = const_cast<PMEMoid *>(&OID_NULL);
 	} else {
-		// FIXME: check prev to -1
-		if (TOID_EQUALS(map, path[0])) {
-			res = const_cast<PMEMoid *>(&OID_NULL);
-		}
-		else {
-			res = &(path[0].oid);
-		}
+		res = const_cast<PMEMoid *>(&(D_RO(holder)->next[0].oid));
 	}
 	return res;
 }
@@ -619,9 +719,9 @@ PMEMoid* skiplist_map_get_prev_OID(PMEMobjpool* pop,
  */
 PMEMoid* skiplist_map_get_first_OID(PMEMobjpool* pop, 
 																		TOID(struct skiplist_map_node) map) {	
-	PMEMoid* res;
-	uint32_t key_len = GetKeyLengthFromBuffer(D_RO(D_RO(map)->next[0])->entry.buffer_ptr);
-	if (key_len) {
+	PMEMoid* res = const_cast<PMEMoid *>(&OID_NULL);
+	TOID(struct skiplist_map_node) first = D_RO(map)->next[0];
+	if (!TOID_EQUALS(first, NULL_NODE) && !skiplist_node_is_empty(first)) {
 		res = &(D_RW(map)->next[0].oid);
 	}
 	return res;
@@ -645,18 +745,18 @@ PMEMoid* skiplist_map_get_last_OID(PMEMobjpool* pop,
  * 					1 = error
  */
 int skiplist_map_lookup(PMEMobjpool* pop, 
-												TOID(struct skiplist_map_node) map, char* key) {
+												TOID(struct skiplist_map_node) map, 
+												const struct skiplist_map_cmp* cmp, const Slice& key) {
 	int ret = 0;
 	TOID(struct skiplist_map_node) path[SKIPLIST_LEVELS_NUM], found;
-	skiplist_map_find(pop, key, map, path);
+	skiplist_map_find(pop, cmp, key, map, path);
 	
 	found = D_RO(path[0])->next[0];
-	if (!TOID_EQUALS(found, NULL_NODE)) {
-		uint32_t key_len;
-		char *ptr = GetKeyAndLengthFromBuffer(D_RO(found)->entry.buffer_ptr, &key_len);
-		if (memcmp(ptr, key, key_len) == 0)
+	Slice found_key;
+	if (!TOID_EQUALS(found, NULL_NODE) && skiplist_node_key(cmp, found, &found_key)) {
+		if (skiplist_key_compare(cmp, found_key, key, 
+														skiplist_key_prefix(cmp, key)) == 0)
 			ret = 1;
-		// free(buf);
 	}
 	return ret;
 }
@@ -668,15 +768,17 @@ int skiplist_map_lookup(PMEMobjpool* pop,
  */
 int skiplist_map_foreach(PMEMobjpool* pop, 
 								TOID(struct skiplist_map_node) map,
+								const struct skiplist_map_cmp* cmp,
 								int (*cb)(char* key, char* buffer_ptr, int key_len, void* arg), 
 								void* arg) {
 	TOID(struct skiplist_map_node) next = map;
 	while (!TOID_EQUALS(D_RO(next)->next[0], NULL_NODE)) {
 		next = D_RO(next)->next[0];
-		char* buffer_ptr = D_RO(next)->entry.buffer_ptr;
-		uint32_t key_len;
-		char *ptr = GetKeyAndLengthFromBuffer(D_RO(next)->entry.buffer_ptr, &key_len);
-		cb(ptr, buffer_ptr, key_len, arg);
+		Slice key;
+		// Empty node is the end
+		if (!skiplist_node_key(cmp, next, &key)) break;
+		char* buffer_ptr = DecodeBufferPtr(cmp->bases, D_RO(next)->entry.buffer_ptr);
+		cb(const_cast<char *>(key.data()), buffer_ptr, key.size(), arg);
 	}
 	return 0;
 }
@@ -37,8 +37,10 @@
 #ifndef SKIPLIST_MAP_H
 #define SKIPLIST_MAP_H
 
+#include <assert.h>
 #include <libpmemobj.h>
 #include <string>
+#include "leveldb/slice.h"
 #include "pmem/pmem_latency.h"
 
 #ifndef SKIPLIST_MAP_TYPE_OFFSET
@@ -59,66 +61,155 @@
 
 #define SKIPLIST_LEVELS_NUM 12
 
-#define USE_BINARY_INSERTION 0
-// #define USE_BINARY_INSERTION 1
-
-#define LEVEL_11_POINT ( NUM_OF_USE_ALLOC_NODE / 2 )
-#define LEVEL_10_POINT ( LEVEL_11_POINT / 2)
-#define LEVEL_9_POINT ( LEVEL_10_POINT / 2)
-#define LEVEL_8_POINT ( LEVEL_9_POINT / 2)
-#define LEVEL_7_POINT ( LEVEL_8_POINT / 2)
-#define LEVEL_6_POINT ( LEVEL_7_POINT / 2)
-#define LEVEL_5_POINT ( LEVEL_6_POINT / 2)
-#define LEVEL_4_POINT ( LEVEL_5_POINT / 2)
-#define LEVEL_3_POINT ( LEVEL_4_POINT / 2)
-#define LEVEL_2_POINT ( LEVEL_3_POINT / 2)
-#define LEVEL_1_POINT ( LEVEL_2_POINT / 2)
+/* 
+ * Lists grow by extents (one allocation of nodes) when a table has
+ * more entries than pre-allocated nodes. Extent follows size of table.
+ */
+#define SKIPLIST_EXTENT_MIN_NODES 1024
+#define SKIPLIST_EXTENT_MAX_NODES (1 << 16)
+
+/* Width of user-key prefix compared before the comparator (fast path) */
+#define KEY_PREFIX_SIZE 8
+
+/* 
+ * Persistent layout of skiplist_map_node, kept by skiplist manager
+ * 1: key prefix and key length inline in entry
+ * 2: buffer pointer is (buffer shard, offset), not pool uuid
+ */
+#define SKIPLIST_NODE_LAYOUT 2
 
 namespace leveldb{
+class Comparator;
+
+/*
+ * Key ordering of skiplist nodes
+ * cmp == nullptr : bytewise order of whole key (standalone skiplist)
+ * cmp != nullptr : InternalKeyComparator, keys end with NUM_OF_TAG_BYTES tag
+ * use_prefix     : big-endian KEY_PREFIX_SIZE bytes of user key decide order
+ *                  when they differ. Only for bytewise user comparator.
+ */
+struct skiplist_buffer_bases;
+struct skiplist_map_cmp {
+	const Comparator* cmp;
+	bool use_prefix;
+	const struct skiplist_buffer_bases* bases; // keys of nodes are read here
+};
+
+// Big-endian KEY_PREFIX_SIZE bytes of user key, zero-padded
+uint64_t skiplist_key_prefix(const struct skiplist_map_cmp* cmp,
+		const Slice& key);
+// 3-way compare of key and target, target_prefix = prefix of target
+int skiplist_key_compare(const struct skiplist_map_cmp* cmp,
+		const Slice& key, const Slice& target, uint64_t target_prefix);
+
+/* 
+ * Pool-relative pointer into PmemBuffer
+ * Node stores (buffer shard, offset in pool) instead of raw virtual address,
+ * off 0 = null (pool header, never contents).
+ */
+struct skiplist_buffer_ptr {
+	uint64_t shard;
+	uint64_t off;
+};
+/*
+ * Base addresses of PmemBuffer pools, indexed by buffer shard
+ * Each PmemSkiplist keeps its own copy, set once after pools are opened
+ * (SetBufferBases) and read-only after, so decoding is base + off
+ * without lock or search.
+ */
+struct skiplist_buffer_bases {
+	uint64_t num_of_bases;
+	char* const* bases;      // [shard] base address of pool
+	const uint64_t* sizes;   // [shard] mapped bytes from base
+	const uint64_t* order;   // shards sorted by base address (encode)
+};
+// Binary search of pool by address, off 0 if ptr is in no pool
+struct skiplist_buffer_ptr EncodeBufferPtr(
+		const struct skiplist_buffer_bases* bases, const char* buffer_ptr);
+static inline char* DecodeBufferPtr(const struct skiplist_buffer_bases* bases,
+		const struct skiplist_buffer_ptr& ptr) {
+	assert(ptr.off == 0 || ptr.shard < bases->num_of_bases);
+	return (ptr.off == 0) ? nullptr : bases->bases[ptr.shard] + ptr.off;
+}
+
 uint32_t GetKeyLengthFromBuffer(char* buf);
 char* GetKeyFromBuffer(char* buf);
 char* GetKeyAndLengthFromBuffer(char* buf, uint32_t* key_len);
 char* GetValueFromBuffer(char* buf);
 char* GetValueAndLengthFromBuffer(char* buf, uint32_t* value_len);
 
+/*
+ * Entry of node
+ * key_prefix & key_len are copies of key in (pmem)buffer, so most
+ * comparisons are decided in node without reading the buffer.
+ * NOTE: Entry is first, it shares cache line with lower levels
+ */
 struct skiplist_map_node;
 TOID_DECLARE(struct skiplist_map_node, SKIPLIST_MAP_TYPE_OFFSET + 0);
+struct skiplist_map_entry {
+	struct skiplist_buffer_ptr buffer_ptr; // NOTE: see DecodeBufferPtr()
+	uint64_t key_prefix; // skiplist_key_prefix() of key
+	uint32_t key_len;    // 0 = empty (pre-allocated) node
+	uint32_t reserved;
+};
+struct skiplist_map_node {
+	struct skiplist_map_entry entry;
+	TOID(struct skiplist_map_node) next[SKIPLIST_LEVELS_NUM];
+};
 
 int skiplist_map_check(PMEMobjpool* pop, TOID(struct skiplist_map_node) map);
 int skiplist_map_create(PMEMobjpool* pop, TOID(struct skiplist_map_node)* map,
-	TOID(struct skiplist_map_node) current_node,
-	int index, void* arg);
+	uint64_t num_of_nodes, void* arg);
 int skiplist_map_destroy(PMEMobjpool* pop, TOID(struct skiplist_map_node)* map);
-int skiplist_map_insert(PMEMobjpool* pop, 
-		TOID(struct skiplist_map_node) map, 
-		TOID(struct skiplist_map_node)* current_node,
-		char* key, char* buffer_ptr, int key_len, int index);
-int skiplist_map_insert_by_ptr(PMEMobjpool* pop, 
-		TOID(struct skiplist_map_node) map, 
-		TOID(struct skiplist_map_node)* current_node,
-		char* buffer_ptr, int key_len, int index);
+
+/*
+ * Per-list bulk builder, fed with sorted entries of one table
+ * Tower of i-th node (1-based) is 1 + trailing zeros of i (perfect skiplist)
+ * NOTE: State is per builder, not global, so lists build independently
+ */
+struct skiplist_map_builder {
+	TOID(struct skiplist_map_node) head;
+	TOID(struct skiplist_map_node) current;                   // last filled node
+	TOID(struct skiplist_map_node) last[SKIPLIST_LEVELS_NUM]; // tail of each level
+	uint64_t count;
+	int deferred_drain; // flush only, drained by skiplist_map_builder_finish
+};
+void skiplist_map_builder_init(struct skiplist_map_builder* builder,
+		TOID(struct skiplist_map_node) map, int deferred_drain);
+// key: key of entry, buffer_ptr may not be written yet
+int skiplist_map_builder_add(PMEMobjpool* pop,
+		struct skiplist_map_builder* builder, const struct skiplist_map_cmp* cmp,
+		char* buffer_ptr, const Slice& key);
+int skiplist_map_builder_finish(PMEMobjpool* pop,
+		struct skiplist_map_builder* builder);
 int skiplist_map_insert_null_node(PMEMobjpool* pop, 
-		TOID(struct skiplist_map_node) map, 
-		TOID(struct skiplist_map_node)* current_node,
-		int index);
+		struct skiplist_map_builder* builder);
 int skiplist_map_remove(PMEMobjpool* pop,
-		TOID(struct skiplist_map_node) map, char* key);
+		TOID(struct skiplist_map_node) map, const struct skiplist_map_cmp* cmp,
+		const Slice& key);
 int skiplist_map_remove_free(PMEMobjpool* pop,
-		TOID(struct skiplist_map_node) map, char* key);
+		TOID(struct skiplist_map_node) map, const struct skiplist_map_cmp* cmp,
+		const Slice& key);
 int skiplist_map_clear(PMEMobjpool* pop, TOID(struct skiplist_map_node) map);
 // [Deprecated]
 // char* skiplist_map_get(PMEMobjpool* pop, TOID(struct skiplist_map_node) map,
 // 		char* key);
 PMEMoid* skiplist_map_get_OID(PMEMobjpool* pop, 
-															TOID(struct skiplist_map_node) map, char* key);
+															TOID(struct skiplist_map_node) map, 
+															const struct skiplist_map_cmp* cmp, const Slice& key);
 PMEMoid* skiplist_map_get_prev_OID(PMEMobjpool* pop, 
-																	TOID(struct skiplist_map_node) map, char* key);
+																	TOID(struct skiplist_map_node) map, 
+																	const struct skiplist_map_cmp* cmp, const Slice& key);
+char* skiplist_map_get_buffer_ptr(PMEMobjpool* pop, 
+															TOID(struct skiplist_map_node) map, 
+															const struct skiplist_map_cmp* cmp, const Slice& key);
 PMEMoid* skiplist_map_get_first_OID(PMEMobjpool* pop, TOID(struct skiplist_map_node) map);
 PMEMoid* skiplist_map_get_last_OID(PMEMobjpool* pop, TOID(struct skiplist_map_node) map);
 
 int skiplist_map_lookup(PMEMobjpool* pop, TOID(struct skiplist_map_node) map,
-		char* key);
+		const struct skiplist_map_cmp* cmp, const Slice& key);
 int skiplist_map_foreach(PMEMobjpool* pop, TOID(struct skiplist_map_node) map,
+	const struct skiplist_map_cmp* cmp,
 	int (*cb)(char* key, char* buffer_ptr, int key_len, void* arg), void* arg);
 int skiplist_map_is_empty(PMEMobjpool* pop, TOID(struct skiplist_map_node) map);
 } // namespace leveldb
@@ -0,0 +1,265 @@
+/*
+ * sorted_array.cc -- dense sorted index of pmem table
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "pmem/ds/sorted_array.h"
+
+namespace leveldb {
+
+/*
+ * sorted_array_entries -- (internal) cache-line aligned start of entries
+ * NOTE: pool is mapped page-aligned, so alignment is stable across reopen
+ */
+static inline uint64_t* sorted_array_align(PMEMoid entries_oid) {
+	uintptr_t raw = (uintptr_t)pmemobj_direct(entries_oid);
+	if (raw == 0) return nullptr;
+	raw = (raw + SORTED_ARRAY_ALIGN - 1) & ~((uintptr_t)SORTED_ARRAY_ALIGN - 1);
+	return (uint64_t *)raw;
+}
+static inline uint64_t* sorted_array_entries(
+													const struct sorted_array* array) {
+	return sorted_array_align(array->entries_oid);
+}
+
+/*
+ * sorted_array_create -- allocates array of given capacity
+ * return:  0 = finish all job
+ * 					1 = error
+ */
+int sorted_array_create(PMEMobjpool* pop, TOID(struct sorted_array)* array,
+												uint64_t capacity) {
+	int ret = 0;
+	TX_BEGIN(pop) {
+		pmemobj_tx_add_range_direct(array, sizeof(*array));
+		*array = TX_ZNEW(struct sorted_array);
+		D_RW(*array)->capacity = capacity;
+		D_RW(*array)->entries_oid = pmemobj_tx_zalloc(
+				capacity * sizeof(uint64_t) + SORTED_ARRAY_ALIGN,
+				SORTED_ARRAY_TYPE_OFFSET + 1);
+	} TX_ONABORT {
+		ret = 1;
+	} TX_END
+	return ret;
+}
+
+/*
+ * sorted_array_destroy -- frees array and its entries
+ * return:  0 = finish all job
+ * 					1 = error
+ */
+int sorted_array_destroy(PMEMobjpool* pop, TOID(struct sorted_array)* array) {
+	int ret = 0;
+	TX_BEGIN(pop) {
+		pmemobj_tx_free(D_RO(*array)->entries_oid);
+		TX_FREE(*array);
+		pmemobj_tx_add_range_direct(array, sizeof(*array));
+		*array = TOID_NULL(struct sorted_array);
+	} TX_ONABORT {
+		ret = 1;
+	} TX_END
+	return ret;
+}
+
+/*
+ * sorted_array_clear -- drops all entries (entries are not scrubbed)
+ * return:  0 = finish all job
+ */
+int sorted_array_clear(PMEMobjpool* pop, TOID(struct sorted_array) array) {
+	if (TOID_IS_NULL(array)) return 0;
+	struct sorted_array* a = D_RW(array);
+	a->num_entries = 0;
+	a->num_pools = 0;
+	pmemobj_persist(pop, a, sizeof(uint64_t) * 3);
+	return 0;
+}
+
+/*
+ * sorted_array_pool_slot -- (internal) slot of buffer pool in array,
+ * register (and persist) new pool
+ * return:  -1 = too many pools
+ */
+static int sorted_array_pool_slot(PMEMobjpool* pop, struct sorted_array* a,
+																	uint64_t shard) {
+	for (uint64_t i=0; i<a->num_pools; i++) {
+		if (a->pool_shards[i] == shard) return (int)i;
+	}
+	if (a->num_pools >= SORTED_ARRAY_MAX_POOLS) return -1;
+	a->pool_shards[a->num_pools] = shard;
+	pmemobj_persist(pop, &(a->pool_shards[a->num_pools]), sizeof(uint64_t));
+	a->num_pools++;
+	pmemobj_persist(pop, &(a->num_pools), sizeof(uint64_t));
+	return (int)(a->num_pools - 1);
+}
+
+/*
+ * sorted_array_grow -- (internal) moves entries to larger allocation
+ * NOTE: Only while table is built (not readable yet), so entries can move
+ * return:  0 = finish all job
+ * 					1 = error
+ */
+static int sorted_array_grow(PMEMobjpool* pop, struct sorted_array* a,
+														uint64_t capacity) {
+	int ret = 0;
+	TX_BEGIN(pop) {
+		PMEMoid entries_oid = pmemobj_tx_zalloc(
+				capacity * sizeof(uint64_t) + SORTED_ARRAY_ALIGN,
+				SORTED_ARRAY_TYPE_OFFSET + 1);
+		uint64_t* entries = sorted_array_align(entries_oid);
+		memcpy(entries, sorted_array_entries(a), a->num_entries * sizeof(uint64_t));
+		pmemobj_persist(pop, entries, a->num_entries * sizeof(uint64_t));
+		pmemobj_tx_add_range_direct(&(a->capacity), sizeof(uint64_t));
+		pmemobj_tx_add_range_direct(&(a->entries_oid), sizeof(PMEMoid));
+		pmemobj_tx_free(a->entries_oid);
+		a->capacity = capacity;
+		a->entries_oid = entries_oid;
+	} TX_ONABORT {
+		ret = 1;
+	} TX_END
+	return ret;
+}
+
+/*
+ * sorted_array_append -- appends buffer_ptr as the last (largest) entry
+ * Array grows when full.
+ * NOTE: No TX, except growth. Entry is persisted before num_entries publishes it,
+ *       and unpublished tables are cleared on recovery anyway.
+ * return:  0 = finish all job
+ * 					1 = error
+ */
+int sorted_array_append(PMEMobjpool* pop, TOID(struct sorted_array) array,
+												const struct skiplist_buffer_bases* bases,
+												char* buffer_ptr, int deferred_drain) {
+	struct sorted_array* a = D_RW(array);
+	if (a->num_entries >= a->capacity) {
+		// Double, array keeps its capacity for next tables
+		uint64_t growth = a->capacity;
+		if (growth < SKIPLIST_EXTENT_MIN_NODES) {
+			growth = SKIPLIST_EXTENT_MIN_NODES;
+		} else if (growth > SKIPLIST_EXTENT_MAX_NODES) {
+			growth = SKIPLIST_EXTENT_MAX_NODES;
+		}
+		if (sorted_array_grow(pop, a, a->capacity + growth)) {
+			printf("[ERROR][SortedArray][append] Cannot grow %lu\n", a->capacity);
+			return 1;
+		}
+	}
+	struct skiplist_buffer_ptr encoded = EncodeBufferPtr(bases, buffer_ptr);
+	int slot = sorted_array_pool_slot(pop, a, encoded.shard);
+	if (slot < 0 || encoded.off == 0 || encoded.off > SORTED_ARRAY_OFFSET_MASK) {
+		printf("[ERROR][SortedArray][append] Cannot encode buffer pointer\n");
+		return 1;
+	}
+	uint64_t* entry = sorted_array_entries(a) + a->num_entries;
+	*entry = ((uint64_t)slot << SORTED_ARRAY_POOL_SHIFT) | encoded.off;
+	if (deferred_drain) {
+		pmemobj_flush(pop, entry, sizeof(uint64_t));
+		a->num_entries++;
+		return 0;
+	}
+	pmemobj_persist(pop, entry, sizeof(uint64_t));
+	a->num_entries++;
+	pmemobj_persist(pop, &(a->num_entries), sizeof(uint64_t));
+	return 0;
+}
+
+/*
+ * sorted_array_publish -- drains entries, then persists num_entries
+ * (8-byte atomic store), which publishes them at once
+ * return:  0 = finish all job
+ */
+int sorted_array_publish(PMEMobjpool* pop, TOID(struct sorted_array) array) {
+	struct sorted_array* a = D_RW(array);
+	pmemobj_drain(pop);
+	pmemobj_persist(pop, &(a->num_entries), sizeof(uint64_t));
+	return 0;
+}
+
+/*
+ * sorted_array_get_view -- resolves entries and buffer pool bases
+ */
+void sorted_array_get_view(PMEMobjpool* pop, TOID(struct sorted_array) array,
+													const struct skiplist_buffer_bases* bases,
+													struct sorted_array_view* view) {
+	if (TOID_IS_NULL(array)) {
+		view->entries = nullptr;
+		view->num_entries = 0;
+		return;
+	}
+	const struct sorted_array* a = D_RO(array);
+	view->entries = sorted_array_entries(a);
+	view->num_entries = a->num_entries;
+	for (uint64_t i=0; i<a->num_pools; i++) {
+		view->bases[i] = bases->bases[a->pool_shards[i]];
+	}
+}
+
+char* sorted_array_view_buffer_ptr(const struct sorted_array_view* view,
+																	uint64_t pos) {
+	assert(pos < view->num_entries);
+	uint64_t entry = view->entries[pos];
+	return view->bases[entry >> SORTED_ARRAY_POOL_SHIFT] +
+				(entry & SORTED_ARRAY_OFFSET_MASK);
+}
+
+/*
+ * sorted_array_view_key -- (internal) key of entry, from (pmem)buffer
+ */
+static inline Slice sorted_array_view_key(const struct sorted_array_view* view,
+																					uint64_t pos) {
+	uint32_t key_len;
+	char* key_ptr = GetKeyAndLengthFromBuffer(
+										sorted_array_view_buffer_ptr(view, pos), &key_len);
+	return Slice(key_ptr, key_len);
+}
+
+/*
+ * sorted_array_view_seek -- lower bound of key
+ * 1) Interpolation on user-key prefix (only if prefix gives the order)
+ * 2) Binary search, prefetching entries of both possible next probes
+ * Invariant: entries [0, lo) < key <= entries [hi, num_entries)
+ */
+uint64_t sorted_array_view_seek(const struct sorted_array_view* view,
+																const struct skiplist_map_cmp* cmp,
+																const Slice& key) {
+	uint64_t lo = 0;
+	uint64_t hi = view->num_entries;
+	uint64_t target_prefix = skiplist_key_prefix(cmp, key);
+
+	for (int step=0; cmp->use_prefix && step<SORTED_ARRAY_INTERPOLATION_STEPS &&
+									hi - lo > 2; step++) {
+		uint64_t lo_prefix = skiplist_key_prefix(cmp, sorted_array_view_key(view, lo));
+		uint64_t hi_prefix = skiplist_key_prefix(cmp,
+																						sorted_array_view_key(view, hi-1));
+		if (target_prefix > hi_prefix) return hi;
+		if (target_prefix <= lo_prefix) break; // NOTE: equal prefix, binary search
+		double ratio = (double)(target_prefix - lo_prefix) /
+									(double)(hi_prefix - lo_prefix);
+		uint64_t pos = lo + (uint64_t)(ratio * (double)(hi - 1 - lo));
+		if (pos >= hi) pos = hi - 1;
+		if (skiplist_key_compare(cmp, sorted_array_view_key(view, pos),
+														key, target_prefix) < 0) {
+			lo = pos + 1;
+		} else {
+			hi = pos;
+		}
+	}
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		__builtin_prefetch(&view->entries[lo + (mid - lo) / 2]);
+		__builtin_prefetch(&view->entries[mid + 1 + (hi - mid - 1) / 2]);
+		if (skiplist_key_compare(cmp, sorted_array_view_key(view, mid),
+														key, target_prefix) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+} // namespace leveldb
@@ -0,0 +1,74 @@
+/*
+ * sorted_array.h -- dense sorted index of pmem table
+ *
+ * Pmem tables are written once in sorted order, so index is built
+ * by appending to a flat array (no TX, no per-level links).
+ * Each entry is a pool-relative pointer into PmemBuffer:
+ *   [ pool slot (8 bits) | offset in pool (56 bits) ]
+ * pool slot indexes pool_shards[] (buffer shards) of the array.
+ */
+
+#ifndef SORTED_ARRAY_H
+#define SORTED_ARRAY_H
+
+#include <libpmemobj.h>
+#include "leveldb/slice.h"
+#include "pmem/ds/skiplist_buffer.h" // skiplist_map_cmp, buffer pointers
+
+#ifndef SORTED_ARRAY_TYPE_OFFSET
+#define SORTED_ARRAY_TYPE_OFFSET 2030
+#endif
+
+/* Max number of PmemBuffer pools which can be pointed by one array */
+#define SORTED_ARRAY_MAX_POOLS 16
+#define SORTED_ARRAY_POOL_SHIFT 56
+#define SORTED_ARRAY_OFFSET_MASK ((1ULL << SORTED_ARRAY_POOL_SHIFT) - 1)
+
+/* Entries start at cache-line boundary (8 entries per line) */
+#define SORTED_ARRAY_ALIGN 64
+
+/* Interpolation probes before binary search (bytewise keys only) */
+#define SORTED_ARRAY_INTERPOLATION_STEPS 2
+
+namespace leveldb {
+
+struct sorted_array {
+	uint64_t num_entries; // NOTE: persisted after entry, end of table
+	uint64_t capacity;
+	uint64_t num_pools;
+	uint64_t pool_shards[SORTED_ARRAY_MAX_POOLS];
+	PMEMoid entries_oid;  // capacity entries + SORTED_ARRAY_ALIGN padding
+};
+TOID_DECLARE(struct sorted_array, SORTED_ARRAY_TYPE_OFFSET + 0);
+
+/*
+ * Volatile view for lookup, resolved once per Seek/Get
+ * NOTE: Only local state, so lookups on a view are reentrant
+ */
+struct sorted_array_view {
+	const uint64_t* entries;
+	uint64_t num_entries;
+	char* bases[SORTED_ARRAY_MAX_POOLS];
+};
+
+int sorted_array_create(PMEMobjpool* pop, TOID(struct sorted_array)* array,
+		uint64_t capacity);
+int sorted_array_destroy(PMEMobjpool* pop, TOID(struct sorted_array)* array);
+int sorted_array_clear(PMEMobjpool* pop, TOID(struct sorted_array) array);
+// deferred_drain: entries are only flushed, published by sorted_array_publish
+int sorted_array_append(PMEMobjpool* pop, TOID(struct sorted_array) array,
+		const struct skiplist_buffer_bases* bases, char* buffer_ptr,
+		int deferred_drain);
+int sorted_array_publish(PMEMobjpool* pop, TOID(struct sorted_array) array);
+
+void sorted_array_get_view(PMEMobjpool* pop, TOID(struct sorted_array) array,
+		const struct skiplist_buffer_bases* bases, struct sorted_array_view* view);
+char* sorted_array_view_buffer_ptr(const struct sorted_array_view* view,
+		uint64_t pos);
+// Return position of first entry (key >= target), num_entries if none
+uint64_t sorted_array_view_seek(const struct sorted_array_view* view,
+		const struct skiplist_map_cmp* cmp, const Slice& key);
+
+} // namespace leveldb
+
+#endif /* SORTED_ARRAY_H */
@@ -8,6 +8,12 @@
 
 #include <libpmemobj.h>
 
+/*
+ * NOTE: Below are default values of leveldb::PmemOptions.
+ *       Runtime topology is set by Options::pmem_options.
+ */
+#define PMEM_DIR "/home/hwan/pmem_dir"
+
 /* Single skiplist */
 #define SKIPLIST_PATH "/home/hwan/pmem_dir/skiplist"
 #define SKIPLIST_POOL_SIZE 30 * (1 << 20) // temp setting
@@ -49,7 +55,7 @@
 // #define SKIPLIST_BULK_INSERT_NUM 10
 // #define SKIPLIST_MANAGER_LIST_SIZE 290
 // for YCSB
-#define MAX_SKIPLIST_NODE_SIZE 58830 // Compaction Output file max
+#define MAX_SKIPLIST_NODE_SIZE 58830 // Pre-allocated nodes, lists grow by extents
 #define SKIPLIST_MANAGER_LIST_SIZE 140
 
 #define NUM_OF_SKIPLIST_MANAGER 10
@@ -80,8 +86,48 @@
 #define NUM_OF_CONTENTS 350
 #define EACH_CONTENT_SIZE 4 << 20 // FIXME: 4MB
 #define MAX_CONTENTS_SIZE (NUM_OF_CONTENTS * EACH_CONTENT_SIZE)
+// NOTE: [file_number, offset] records for recovery.
+// Buffer and skiplist are sharded by same file_number,
+// so live records cannot exceed skiplists in a manager
+#define BUFFER_RECORD_LIST_SIZE SKIPLIST_MANAGER_LIST_SIZE
+// Log-structured reclamation of contents.
+// A segment is reused once no live table points into it.
+#define BUFFER_SEGMENT_SIZE (1 << 20)
+// Contiguous space reserved for a table until it is written
+#define BUFFER_MAX_TABLE_SIZE (8 << 20)
+// Table builds flush without drain, one drain at TableBuilder::FinishPmem
+#define PMEM_DEFERRED_DRAIN true
+// Compaction scan of contiguous tables prefetches this far ahead of cursor
+#define BUFFER_SCAN_PREFETCH_DISTANCE 512
+// NVM emulation (pmem/pmem_latency.h), per access latency and bandwidth
+// (MB/s, 0 = unlimited) on DRAM. PMEM_EMULATION false disables it.
+#define PMEM_EMULATION true
+#define PMEM_READ_LATENCY_NS 40
+#define PMEM_WRITE_LATENCY_NS 400
+#define PMEM_READ_BANDWIDTH_MBPS 0
+#define PMEM_WRITE_BANDWIDTH_MBPS 0
+// TSC is calibrated against CLOCK_MONOTONIC for this long, once
+#define PMEM_EMULATION_CALIBRATION_NS (10 * 1000 * 1000)
+// Write-ahead log in pmem (Options::use_pmem_log)
+// Circular contents hold live logs, at least two memtables
+#define PMEM_LOG_POOL_SIZE (80 << 20)
+#define PMEM_LOG_CONTENTS_SIZE (64 << 20)
+#define PMEM_LOG_RECORD_LIST_SIZE 16
+// Persistent memtables (Options::use_pmem_memtable), replace the log
+// Slots hold mutable, immutable and memtables of unfinished flushes
+#define PMEM_MEMTABLE_NUM_SLOTS 4
+#define PMEM_MEMTABLE_POOL_OVERHEAD (8 << 20)
+
+// Persistent layout of pool roots (owners, records), pools of another
+// layout are rejected on open. 0 = created before layout versions.
+// Skiplist managers are versioned by SKIPLIST_NODE_LAYOUT.
+#define PMEM_BUFFER_LAYOUT 1
+#define PMEM_HASHMAP_LAYOUT 1
+#define PMEM_LOG_LAYOUT 1
 
 #define FREE_LIST_WARNING_BOUNDARY 10
+// LRU tiering: background demotion keeps free lists above this
+#define FREE_LIST_DEMOTION_WATERMARK (FREE_LIST_WARNING_BOUNDARY * 2)
 
 // PROGRESS: Hashmap
 #define HASHMAP_PATH "/home/hwan/pmem_dir/pmem_hashmap"
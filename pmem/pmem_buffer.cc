@@ -3,6 +3,7 @@
  * PMDK-based buffer class
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include "util/coding.h" 
@@ -71,42 +72,298 @@ namespace leveldb {
   int GetEncodedLength(const size_t key_size, const size_t value_size) {
     return VarintLength(key_size) + key_size + VarintLength(value_size) + value_size;
   }
+  void SetBufferBases(PmemSkiplist* pmem_skiplist,
+                      PmemBuffer** pmem_buffer, int num_of_buffers) {
+    std::vector<char*> bases(num_of_buffers);
+    std::vector<uint64_t> sizes(num_of_buffers);
+    for (int i=0; i<num_of_buffers; i++) {
+      bases[i] = pmem_buffer[i]->GetBase();
+      sizes[i] = pmem_buffer[i]->GetMappedSize();
+    }
+    pmem_skiplist->SetBufferBases(bases, sizes);
+  }
+
+  /* Open buffers, to find the owner of a buffer pointer */
+  static std::vector<PmemBuffer*> open_buffers;
 
   /* 
    * pmem-buffer DA functions 
    * NOTE: Use only allocated map 
    */
   void PmemBuffer::InsertAllocatedMap(uint64_t file_number, uint64_t index) {
-    allocated_map_.emplace(file_number, index);
+    allocated_map_[file_number] = index;
   }
-  uint64_t PmemBuffer::AddFileAndGetNextOffset(uint64_t file_number) {
+  /*
+   * Reserve max_table_size_ for file_number, at log head if it fits.
+   * Otherwise from the first free run of segments after log head (wrap).
+   * NOTE: Size is known only at SequentialWrite, unused tail is given back
+   *       if no other table is reserved after it.
+   * Return false if no run of free segments fits, table goes to SST then
+   * (callers check HasRoomForTable() first).
+   */
+  bool PmemBuffer::AddFileAndGetNextOffset(uint64_t file_number,
+                                           uint64_t* offset) {
+    MutexLock l(&segment_mutex_);
+    // Re-added before its write, give back old reservation
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator res = 
+            reserved_.find(file_number);
+    if (res != reserved_.end()) {
+      PinSegments(res->second.first, res->second.second, false);
+      reserved_.erase(res);
+    }
     uint64_t new_offset = current_offset;
+    if (!CanAllocateAt(new_offset, max_table_size_) &&
+        !FindFreeRun(max_table_size_, &new_offset)) {
+      printf("[WARNING][PmemBuffer][AddFileAndGetNextOffset] No free segments for %llu (free %llu)\n",
+              (unsigned long long)file_number,
+              (unsigned long long)CountFreeSegments());
+      return false;
+    }
+    PinSegments(new_offset, max_table_size_, true);
+    reserved_[file_number] = std::make_pair(new_offset, max_table_size_);
+    MoveHead(new_offset + max_table_size_);
+
     InsertAllocatedMap(file_number, new_offset);
-    return new_offset;
+    // Persist [file_number, offset] for recovery
+    std::map<uint64_t, uint64_t>::iterator iter = record_map_.find(file_number);
+    if (iter != record_map_.end()) {
+      SetRecord(iter->second, file_number, new_offset);
+    } else if (record_free_list_.size() == 0) {
+      printf("[WARNING][PmemBuffer] record list is full, %llu is not recoverable\n",
+              (unsigned long long)file_number);
+    } else {
+      uint64_t record_index = PopFreeList(&record_free_list_);
+      record_map_.emplace(file_number, record_index);
+      SetRecord(record_index, file_number, new_offset);
+    }
+    *offset = new_offset;
+    return true;
+  }
+  bool PmemBuffer::HasRoomForTable() {
+    MutexLock l(&segment_mutex_);
+    uint64_t offset = current_offset;
+    return CanAllocateAt(offset, max_table_size_) ||
+           FindFreeRun(max_table_size_, &offset);
+  }
+  /* 
+   * NOTE: Only forget offset of file_number.
+   * Contents are freed by ReleaseDeadFiles, since other skiplists can point them.
+   */
+  void PmemBuffer::DeleteFile(uint64_t file_number) {
+    if (!CheckMapValidation(&allocated_map_, file_number)) return;
+    EraseAllocatedMap(&allocated_map_, file_number);
+    std::map<uint64_t, uint64_t>::iterator iter = record_map_.find(file_number);
+    if (iter != record_map_.end()) {
+      SetRecord(iter->second, 0, 0);
+      PushFreeList(&record_free_list_, iter->second);
+      record_map_.erase(iter);
+    }
+  }
+
+  /* Segment reclamation */
+  void PmemBuffer::SetMaxTableSize(uint64_t max_table_size) {
+    MutexLock l(&segment_mutex_);
+    uint64_t capacity = num_segments_ * BUFFER_SEGMENT_SIZE;
+    max_table_size_ = (max_table_size < capacity) ? max_table_size : capacity;
+  }
+  void PmemBuffer::ResetSegments() {
+    segment_refs_.assign(num_segments_, 0);
+    segment_pins_.assign(num_segments_, 0);
+    holders_.clear();
+    reserved_.clear();
+    if (current_offset >= num_segments_ * BUFFER_SEGMENT_SIZE) {
+      current_offset = 0; // NOTE: Wrap, head of old layout can be over last segment
+      PersistCurrentOffset();
+    }
+    // Log head pins its segment, rest of it is not written yet
+    if (current_offset % BUFFER_SEGMENT_SIZE != 0) {
+      segment_pins_[current_offset / BUFFER_SEGMENT_SIZE]++;
+    }
+  }
+  bool PmemBuffer::IsSegmentFree(uint64_t segment) {
+    return segment_refs_[segment] == 0 && segment_pins_[segment] == 0;
+  }
+  /* [offset, offset+n) is free, or follows log head in its segment */
+  bool PmemBuffer::CanAllocateAt(uint64_t offset, uint64_t n) {
+    if (offset + n > num_segments_ * BUFFER_SEGMENT_SIZE) return false;
+    uint64_t first = offset / BUFFER_SEGMENT_SIZE;
+    if (offset % BUFFER_SEGMENT_SIZE != 0) {
+      if (offset != current_offset) return false;
+      first++;
+    }
+    uint64_t last = (offset + n - 1) / BUFFER_SEGMENT_SIZE;
+    for (uint64_t i=first; i<=last; i++) {
+      if (!IsSegmentFree(i)) return false;
+    }
+    return true;
+  }
+  /* First free run after log head, or first one from the start (wrap) */
+  bool PmemBuffer::FindFreeRun(uint64_t n, uint64_t* offset) {
+    uint64_t needed = (n + BUFFER_SEGMENT_SIZE - 1) / BUFFER_SEGMENT_SIZE;
+    uint64_t head_segment = current_offset / BUFFER_SEGMENT_SIZE;
+    bool found = false;
+    uint64_t run = 0;
+    for (uint64_t i=0; i<num_segments_; i++) {
+      run = IsSegmentFree(i) ? run + 1 : 0;
+      if (run < needed) continue;
+      uint64_t start = i + 1 - needed;
+      if (!found || start > head_segment) {
+        found = true;
+        *offset = start * BUFFER_SEGMENT_SIZE;
+      }
+      if (start > head_segment) break;
+    }
+    return found;
+  }
+  void PmemBuffer::PinSegments(uint64_t offset, uint64_t n, bool pin) {
+    if (n == 0) return;
+    uint64_t last = (offset + n - 1) / BUFFER_SEGMENT_SIZE;
+    for (uint64_t i=offset / BUFFER_SEGMENT_SIZE; i<=last; i++) {
+      if (pin) {
+        segment_pins_[i]++;
+      } else {
+        segment_pins_[i]--;
+      }
+    }
+  }
+  void PmemBuffer::HoldSegments(uint64_t file_number, uint64_t offset, uint64_t n) {
+    if (n == 0) return;
+    std::vector<uint64_t>* segments = &holders_[file_number];
+    uint64_t last = (offset + n - 1) / BUFFER_SEGMENT_SIZE;
+    for (uint64_t i=offset / BUFFER_SEGMENT_SIZE; i<=last; i++) {
+      // NOTE: Sorted, entries of a table mostly fall in few segments
+      std::vector<uint64_t>::iterator pos = 
+              std::lower_bound(segments->begin(), segments->end(), i);
+      if (pos != segments->end() && *pos == i) continue;
+      segments->insert(pos, i);
+      segment_refs_[i]++;
+    }
+  }
+  void PmemBuffer::MoveHead(uint64_t offset) {
+    if (current_offset % BUFFER_SEGMENT_SIZE != 0) {
+      segment_pins_[current_offset / BUFFER_SEGMENT_SIZE]--;
+    }
+    current_offset = offset;
+    if (current_offset % BUFFER_SEGMENT_SIZE != 0) {
+      segment_pins_[current_offset / BUFFER_SEGMENT_SIZE]++;
+    }
+    PersistCurrentOffset();
+  }
+  void PmemBuffer::HoldBufferPtr(uint64_t file_number, const char* ptr, size_t n) {
+    for (size_t i=0; i<open_buffers.size(); i++) {
+      PmemBuffer* owner = open_buffers[i];
+      const char* contents = owner->root_buffer_->contents.get();
+      if (ptr >= contents && ptr < contents + owner->contents_size_) {
+        MutexLock l(&owner->segment_mutex_);
+        owner->HoldSegments(file_number, ptr - contents, n);
+        return;
+      }
+    }
+  }
+  /*
+   * NOTE: Called with live files of all versions (DBImpl::ReclaimPmemBuffers),
+   *       so readers of old versions never see reused contents.
+   *       Compaction copies live entries into its output's own segments,
+   *       so a segment is freed with the last table written into it.
+   *       Other holders are tables of old pools, which pointed into
+   *       inputs (HoldBufferPtr on recovery) until they are compacted.
+   *       Unwritten reservations are bounded by max_table_size_ per table,
+   *       plus the segment of log head.
+   */
+  void PmemBuffer::ReleaseDeadFiles(const std::set<uint64_t>& live_files) {
+    MutexLock l(&segment_mutex_);
+    std::map<uint64_t, std::vector<uint64_t> >::iterator holder = holders_.begin();
+    while (holder != holders_.end()) {
+      if (live_files.find(holder->first) != live_files.end()) {
+        holder++;
+        continue;
+      }
+      for (size_t i=0; i<holder->second.size(); i++) {
+        segment_refs_[holder->second[i]]--;
+      }
+      holder = holders_.erase(holder);
+    }
+    // Abandoned tables (never written)
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator res = reserved_.begin();
+    while (res != reserved_.end()) {
+      if (live_files.find(res->first) != live_files.end()) {
+        res++;
+        continue;
+      }
+      PinSegments(res->second.first, res->second.second, false);
+      if (current_offset == res->second.first + res->second.second) {
+        MoveHead(res->second.first);
+      }
+      res = reserved_.erase(res);
+    }
+  }
+  uint64_t PmemBuffer::GetNumOfSegments() {
+    return num_segments_;
+  }
+  size_t PmemBuffer::GetNumOfFreeSegments() {
+    MutexLock l(&segment_mutex_);
+    return CountFreeSegments();
+  }
+  size_t PmemBuffer::CountFreeSegments() {
+    size_t num_free = 0;
+    for (uint64_t i=0; i<num_segments_; i++) {
+      if (IsSegmentFree(i)) num_free++;
+    }
+    return num_free;
+  }
+
+  void PmemBuffer::SetRecord(uint64_t index, 
+                             uint64_t file_number, uint64_t offset) {
+    struct pmem_buffer_record record;
+    record.file_number = file_number;
+    record.offset = offset;
+    buffer_pool_.memcpy_persist(&(root_buffer_->records[index]), 
+                                &record, sizeof(struct pmem_buffer_record));
+  }
+  void PmemBuffer::PersistCurrentOffset() {
+    root_buffer_->current_offset = current_offset;
+    buffer_pool_.persist(root_buffer_->current_offset);
   }
 
   /* pmdk-based buffer */
   PmemBuffer::PmemBuffer() {
-    Init(BUFFER_PATH);
+    Init(BUFFER_PATH, (size_t)BUFFER_POOL_SIZE, 
+         MAX_CONTENTS_SIZE, BUFFER_RECORD_LIST_SIZE);
   }
   PmemBuffer::PmemBuffer(std::string pool_path) {
-    Init(pool_path);
+    Init(pool_path, (size_t)BUFFER_POOL_SIZE, 
+         MAX_CONTENTS_SIZE, BUFFER_RECORD_LIST_SIZE);
+  }
+  PmemBuffer::PmemBuffer(std::string pool_path, size_t pool_size,
+                         uint64_t contents_size, uint64_t record_list_size) {
+    Init(pool_path, pool_size, contents_size, record_list_size);
   }
   PmemBuffer::~PmemBuffer() {
+    open_buffers.erase(std::remove(open_buffers.begin(), open_buffers.end(), this),
+                       open_buffers.end());
     buffer_pool_.close();
   }
-  void PmemBuffer::Init(std::string pool_path) {
+  void PmemBuffer::Init(std::string pool_path, size_t pool_size,
+                        uint64_t contents_size, uint64_t record_list_size) {
     if (!file_exists(pool_path)) {
       buffer_pool_ = pobj::pool<root_pmem_buffer>::create (
                       pool_path, pool_path, 
-                      (unsigned long)BUFFER_POOL_SIZE, 0666);
+                      (unsigned long)pool_size, 0666);
       root_buffer_ = buffer_pool_.get_root();
+      contents_size_ = contents_size;
+      record_list_size_ = record_list_size;
 
       pobj::transaction::exec_tx(buffer_pool_, [&] {
         root_buffer_->contents = 
-              pobj::make_persistent<char[]>(MAX_CONTENTS_SIZE);
+              pobj::make_persistent<char[]>(contents_size_);
         root_buffer_->contents_size =
               pobj::make_persistent<uint32_t[]>(NUM_OF_CONTENTS);
+        root_buffer_->records = 
+              pobj::make_persistent<pmem_buffer_record[]>(record_list_size_);
+        root_buffer_->current_offset = 0;
+        root_buffer_->max_contents_size = contents_size_;
+        root_buffer_->record_list_size = record_list_size_;
+        root_buffer_->layout = PMEM_BUFFER_LAYOUT;
       });
     } 
     // exists
@@ -114,6 +371,55 @@ namespace leveldb {
       buffer_pool_ = pobj::pool<root_pmem_buffer>::open (
                       pool_path, pool_path);
       root_buffer_ = buffer_pool_.get_root();
+      // NOTE: On mismatch, keep geometry of the pool (records are not
+      //       read here) and DB::Open returns status()
+      char buf[120];
+      // NOTE: Records of old layout would be recovered as garbage
+      if (root_buffer_->layout != PMEM_BUFFER_LAYOUT) {
+        snprintf(buf, sizeof(buf), "has layout %llu (not %d), remove the pool",
+                 (unsigned long long)root_buffer_->layout,
+                 PMEM_BUFFER_LAYOUT);
+        status_ = Status::Corruption(pool_path, buf);
+      }
+      // NOTE: The pool is already laid out
+      contents_size_ = root_buffer_->max_contents_size;
+      record_list_size_ = root_buffer_->record_list_size;
+      if (status_.ok() && 
+          (contents_size_ != contents_size || 
+           record_list_size_ != record_list_size)) {
+        snprintf(buf, sizeof(buf), "has contents_size %llu, record_list_size %llu (not %llu, %llu)",
+                 (unsigned long long)contents_size_,
+                 (unsigned long long)record_list_size_,
+                 (unsigned long long)contents_size,
+                 (unsigned long long)record_list_size);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
+    }
+    open_buffers.push_back(this);
+    deferred_drain_ = false;
+
+    num_segments_ = contents_size_ / BUFFER_SEGMENT_SIZE;
+    if (num_segments_ == 0 && status_.ok()) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "contents_size %llu < segment size",
+               (unsigned long long)contents_size_);
+      status_ = Status::InvalidArgument(pool_path, buf);
+    }
+    SetMaxTableSize(BUFFER_MAX_TABLE_SIZE);
+    current_offset = root_buffer_->current_offset;
+    ResetSegments();
+  }
+  void PmemBuffer::SetNumOfShards(uint64_t num_of_shards) {
+    // NOTE: Tables are sharded by file_number % num_of_shards
+    uint64_t stored = root_buffer_->num_of_shards;
+    if (stored == 0) {
+      root_buffer_->num_of_shards = num_of_shards;
+      buffer_pool_.persist(root_buffer_->num_of_shards);
+    } else if (stored != num_of_shards && status_.ok()) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "pool is shard of %llu (not %llu)",
+               (unsigned long long)stored, (unsigned long long)num_of_shards);
+      status_ = Status::InvalidArgument(buf, "remove the pools");
     }
   }
   void PmemBuffer::ClearAll() {
@@ -127,25 +433,110 @@ namespace leveldb {
       //       sizeof(uint32_t));
     }
     // PROGRESS:
+    MutexLock l(&segment_mutex_);
     current_offset = 0;
+    PersistCurrentOffset();
+    ResetSegments();
+    // Clear records
+    allocated_map_.clear();
+    record_map_.clear();
+    record_free_list_.clear();
+    for (uint64_t index=0; index<record_list_size_; index++) {
+      SetRecord(index, 0, 0);
+      PushFreeList(&record_free_list_, index);
+    }
+  }
+  /* 
+   * Recovery on DB::Open
+   * Restore current_offset and offsets of live files (MANIFEST).
+   * Records of dead files are freed.
+   * NOTE: Segment holders are not persistent. Caller holds them again
+   *       by entries of live tables (DBImpl::RecoverPmemTier).
+   */
+  void PmemBuffer::Recover(const std::set<uint64_t>& live_files) {
+    MutexLock l(&segment_mutex_);
+    current_offset = root_buffer_->current_offset;
+    ResetSegments();
+    allocated_map_.clear();
+    record_map_.clear();
+    record_free_list_.clear();
+    for (uint64_t index=0; index<record_list_size_; index++) {
+      struct pmem_buffer_record record = root_buffer_->records[index];
+      if (record.file_number != 0 &&
+          live_files.find(record.file_number) != live_files.end() &&
+          !CheckMapValidation(&allocated_map_, record.file_number)) {
+        InsertAllocatedMap(record.file_number, record.offset);
+        record_map_.emplace(record.file_number, index);
+      } else {
+        if (record.file_number != 0) {
+          SetRecord(index, 0, 0);
+        }
+        PushFreeList(&record_free_list_, index);
+      }
+    }
   }
   void PmemBuffer::SequentialWrite(uint64_t file_number, const Slice& data) {
     // Get offset(index)
     uint64_t offset = GetIndexFromAllocatedMap(&allocated_map_, file_number);
-    uint32_t data_size = data.size();
-    if (offset + data_size >= MAX_CONTENTS_SIZE) {
-      printf("[ERROR][SequentialWrite] Out of bound.. %d %d %d\n", 
-              offset, data_size, MAX_CONTENTS_SIZE);
+    uint64_t data_size = data.size();
+    uint64_t reserved_end = offset + data_size;
+    // NOTE: Reservation keeps [offset, reserved_end) out of other tables,
+    //       so contents are copied without segment_mutex_
+    segment_mutex_.Lock();
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator res = 
+            reserved_.find(file_number);
+    bool reserved = (res != reserved_.end());
+    if (reserved) {
+      reserved_end = res->second.first + res->second.second;
+      // Over max_table_size_, only at log head and if following segments are free
+      if (offset + data_size > reserved_end &&
+          (current_offset != reserved_end ||
+           !CanAllocateAt(reserved_end, offset + data_size - reserved_end))) {
+        printf("[ERROR][SequentialWrite] Out of bound.. %llu %llu %llu\n", 
+                (unsigned long long)offset, (unsigned long long)data_size,
+                (unsigned long long)res->second.second);
+        abort();
+      }
+      if (offset + data_size > reserved_end) {
+        // Grow reservation before copy, no other table is reserved at head
+        uint64_t extra = offset + data_size - reserved_end;
+        PinSegments(reserved_end, extra, true);
+        res->second.second += extra;
+        reserved_end += extra;
+        MoveHead(reserved_end);
+      }
+    } else if (offset + data_size > num_segments_ * BUFFER_SEGMENT_SIZE) {
+      printf("[ERROR][SequentialWrite] Out of bound.. %llu %llu %llu\n", 
+              (unsigned long long)offset, (unsigned long long)data_size,
+              (unsigned long long)contents_size_);
+      abort();
     }
+    segment_mutex_.Unlock();
     // Sequential-Write(memcpy) from buf to specific contents offset
-    DelayPmemWriteNtimes(1);
-    buffer_pool_.memcpy_persist(
-      root_buffer_->contents.get() + offset, 
-      data.data(), 
-      data_size
-    );
-    // Addition for updating current offset
-    current_offset += data_size;
+    DelayPmemWrite(1, data_size);
+    if (deferred_drain_) {
+      // NOTE: Bypass cache, table is drained once at TableBuilder::FinishPmem
+      pmemobj_memcpy(GetPool(), root_buffer_->contents.get() + offset,
+                     data.data(), data_size,
+                     PMEMOBJ_F_MEM_NONTEMPORAL | PMEMOBJ_F_MEM_NODRAIN);
+    } else {
+      buffer_pool_.memcpy_persist(
+        root_buffer_->contents.get() + offset, 
+        data.data(), 
+        data_size
+      );
+    }
+    MutexLock l(&segment_mutex_);
+    HoldSegments(file_number, offset, data_size);
+    if (reserved) {
+      // Give back unused tail, if no table is reserved after it
+      res = reserved_.find(file_number);
+      PinSegments(res->second.first, res->second.second, false);
+      if (current_offset == reserved_end) {
+        MoveHead(offset + data_size);
+      }
+      reserved_.erase(res);
+    }
     // Set contents_size about matching offset(index)
     // buffer_pool_.memcpy_persist(
     //   root_buffer_->contents_size.get() + (index * sizeof(uint32_t)),
@@ -153,12 +544,19 @@ namespace leveldb {
     //   sizeof(uint32_t)
     // );
   }
+  void PmemBuffer::SetDeferredDrain(bool deferred_drain) {
+    deferred_drain_ = deferred_drain;
+  }
+  void PmemBuffer::Drain() {
+    pmemobj_drain(GetPool());
+  }
   void PmemBuffer::RandomRead(uint64_t file_number,
                               uint64_t offset, size_t n, Slice* result) {
     // Get offset(index)
     // + Invaild check (Before read sst, it has been finished write)
     if(!CheckMapValidation(&allocated_map_, file_number)) {
-      printf("[ERROR] %d is not in allocated_map...\n",file_number);
+      printf("[ERROR] %llu is not in allocated_map...\n",
+              (unsigned long long)file_number);
       abort();
     }
     uint32_t index = GetIndexFromAllocatedMap(&allocated_map_, 
@@ -175,7 +573,7 @@ namespace leveldb {
     //   // abort();
     // }
     // Make result Slice
-    DelayPmemReadNtimes(1);
+    DelayPmemRead(1, n);
     *result = Slice( root_buffer_->contents.get() + 
                      (index) + offset, 
                      n);
@@ -202,8 +600,25 @@ namespace leveldb {
   PMEMobjpool* PmemBuffer::GetPool() {
     return buffer_pool_.get_handle();
   }
+  uint64_t PmemBuffer::GetCurrentOffset() {
+    MutexLock l(&segment_mutex_);
+    return current_offset;
+  }
+  size_t PmemBuffer::GetAllocatedMapSize() {
+    return allocated_map_.size();
+  }
+  // NOTE: Pool is mapped at once, contents follow root in same mapping
+  char* PmemBuffer::GetBase() {
+    return (char *)GetPool();
+  }
+  uint64_t PmemBuffer::GetMappedSize() {
+    return (root_buffer_->contents.get() - GetBase()) + contents_size_;
+  }
   char* PmemBuffer::GetStartOffset(uint64_t file_number) {
-    uint64_t offset = AddFileAndGetNextOffset(file_number);
+    uint64_t offset;
+    if (!AddFileAndGetNextOffset(file_number, &offset)) {
+      return nullptr;
+    }
     return root_buffer_->contents.get() + offset;
   }
 
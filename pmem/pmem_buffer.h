@@ -7,7 +7,12 @@
 
 
 // #include "util/coding.h" 
+#include <set>
+#include <vector>
+#include "port/port.h"
+#include "util/mutexlock.h"
 #include "pmem/pmem_skiplist.h"
+#include <libpmemobj++/p.hpp>
 
 // use pmem with c++ bindings
 namespace pobj = pmem::obj;
@@ -15,9 +20,13 @@ namespace pobj = pmem::obj;
 namespace leveldb {
   // PBuf
   struct root_pmem_buffer;
+  struct pmem_buffer_record;
   class PmemBuffer;
 
   void EncodeToBuffer(std::string* buffer, const Slice& key, const Slice& value);
+  // Buffer pointers of pmem_skiplist are decoded by bases of these shards
+  void SetBufferBases(PmemSkiplist* pmem_skiplist,
+                      PmemBuffer** pmem_buffer, int num_of_buffers);
  
   // DEBUG:
   void AddToPmemBuffer(PmemBuffer* pmem_buffer, std::string* buffer, uint64_t file_number);
@@ -31,12 +40,25 @@ namespace leveldb {
    public:
     PmemBuffer();
     PmemBuffer(std::string pool_path);
+    PmemBuffer(std::string pool_path, size_t pool_size,
+               uint64_t contents_size, uint64_t record_list_size);
     ~PmemBuffer();
-    void Init(std::string pool_path);
+    void Init(std::string pool_path, size_t pool_size,
+              uint64_t contents_size, uint64_t record_list_size);
     void ClearAll();
+    // Persisted on first set, other num_of_shards sets status()
+    void SetNumOfShards(uint64_t num_of_shards);
+    // Not ok if the pool does not match options (Init, SetNumOfShards),
+    // the pool must not be used then
+    Status status() const { return status_; }
+    /* Rebuild offset map from persistent records */
+    void Recover(const std::set<uint64_t>& live_files);
 
     /* Read/Write function */
     void SequentialWrite(uint64_t file_number, const Slice& data);
+    // Non-temporal copy without drain in SequentialWrite, until Drain()
+    void SetDeferredDrain(bool deferred_drain);
+    void Drain();
     void RandomRead(uint64_t file_number, 
                     uint64_t offset, size_t n, Slice* result);
     std::string key(char* buf) const;
@@ -44,25 +66,89 @@ namespace leveldb {
 
     /* Getter */
     PMEMobjpool* GetPool();
+    // Reserve room of a table, nullptr if no free segments
     char* GetStartOffset(uint64_t file_number);
+    // Buffer pointer = base + offset in pool, contents end at base + size
+    char* GetBase();
+    uint64_t GetMappedSize();
+
+    uint64_t GetCurrentOffset();
+    size_t GetAllocatedMapSize();
 
     /* Dynamic Allocation */
-    uint64_t AddFileAndGetNextOffset(uint64_t file_number);
+    bool AddFileAndGetNextOffset(uint64_t file_number, uint64_t* offset);
     void InsertAllocatedMap(uint64_t file_number, uint64_t index);
+    void DeleteFile(uint64_t file_number);
+
+    /* Segment reclamation */
+    // Upper bound of a table, reserved from GetStartOffset to SequentialWrite
+    void SetMaxTableSize(uint64_t max_table_size);
+    // False if a table of max_table_size_ does not fit, so it goes to SST
+    bool HasRoomForTable();
+    // Segments of [ptr, ptr+n) are held by file_number. ptr can be in
+    // any open PmemBuffer (tables point into contents of other shards).
+    static void HoldBufferPtr(uint64_t file_number, const char* ptr, size_t n);
+    // Drop holders and reservations of dead files, free their segments
+    void ReleaseDeadFiles(const std::set<uint64_t>& live_files);
+    size_t GetNumOfFreeSegments();
+    uint64_t GetNumOfSegments();
 
    private:
+    /* Persistent record */
+    void SetRecord(uint64_t index, uint64_t file_number, uint64_t offset);
+    void PersistCurrentOffset();
+
+    /* Segment reclamation */
+    void ResetSegments();
+    bool IsSegmentFree(uint64_t segment);
+    bool CanAllocateAt(uint64_t offset, uint64_t n);
+    bool FindFreeRun(uint64_t n, uint64_t* offset);
+    void PinSegments(uint64_t offset, uint64_t n, bool pin);
+    void HoldSegments(uint64_t file_number, uint64_t offset, uint64_t n);
+    void MoveHead(uint64_t offset);
+    size_t CountFreeSegments();
+
     /* pmdk access object */
+    Status status_;
     pobj::pool<root_pmem_buffer> buffer_pool_;
     pobj::persistent_ptr<root_pmem_buffer> root_buffer_;
     uint64_t current_offset;
+    bool deferred_drain_;
+    uint64_t contents_size_;    // NOTE: fixed on create
+    uint64_t record_list_size_;
 
     /* Dynamic allocation */
     std::map<uint64_t, uint64_t> allocated_map_; // [ file_number -> index ]
+    std::list<uint64_t> record_free_list_;
+    std::map<uint64_t, uint64_t> record_map_;    // [ file_number -> record ]
+
+    /* Segment reclamation (volatile, rebuilt from live tables on open) */
+    // NOTE: Tables are written by background threads while DB thread
+    //       releases dead files and reads stats, so guard by segment_mutex_
+    //       (private functions above require it held)
+    port::Mutex segment_mutex_;
+    uint64_t num_segments_;
+    uint64_t max_table_size_;
+    std::vector<uint32_t> segment_refs_; // number of holders
+    std::vector<uint32_t> segment_pins_; // unwritten reservations, log head
+    std::map<uint64_t, std::vector<uint64_t> > holders_; // [ file_number -> segments ]
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> > reserved_; // [ file_number -> (offset, size) ]
+  };
+  /* [file_number -> start offset], file_number 0 = free */
+  struct pmem_buffer_record {
+    uint64_t file_number;
+    uint64_t offset;
   };
   /* root structure for accessing pmdk */
   struct root_pmem_buffer {
     pobj::persistent_ptr<char[]> contents;
     pobj::persistent_ptr<uint32_t[]> contents_size;
+    pobj::persistent_ptr<pmem_buffer_record[]> records;
+    pobj::p<uint64_t> current_offset; // NOTE: end of written contents
+    pobj::p<uint64_t> max_contents_size;
+    pobj::p<uint64_t> record_list_size;
+    pobj::p<uint64_t> layout; // NOTE: PMEM_BUFFER_LAYOUT, 0 = before it
+    pobj::p<uint64_t> num_of_shards; // NOTE: 0 = not set yet
   };
 
 } // namespace leveldb
@@ -38,6 +38,9 @@ SPDX-License-Identifier: BSD-3-Clause
 #include <fstream> //file_exists
 #include <chrono>
 #include "pmem/pmem_buffer.h"
+#include "pmem/pmem_iterator.h"
+#include "leveldb/env.h"
+#include "port/atomic_pointer.h"
 
 
 using namespace std;
@@ -177,6 +180,251 @@ TEST (PmemBufferTest, Buffer) {
 	printf("# End Buffer\n");
 }
 
+TEST (PmemBufferTest, Recover) {
+	cout << "# Start Pmem-Buffer Recover" << endl;
+  std::string buffer;
+  EncodeToBuffer(&buffer, Slice("key-0"), Slice("value-0"));
+
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  pmem_buffer->ClearAll();
+  pmem_buffer->GetStartOffset(7);
+  pmem_buffer->SequentialWrite(7, Slice(buffer));
+  pmem_buffer->GetStartOffset(8);
+  pmem_buffer->SequentialWrite(8, Slice(buffer));
+  uint64_t current_offset = pmem_buffer->GetCurrentOffset();
+  delete pmem_buffer;
+
+  // Reopen, only 7 is live
+  std::set<uint64_t> live_files;
+  live_files.insert(7);
+  pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  pmem_buffer->Recover(live_files);
+  ASSERT_EQ(current_offset, pmem_buffer->GetCurrentOffset());
+  ASSERT_EQ(1, pmem_buffer->GetAllocatedMapSize());
+
+  Slice res;
+  pmem_buffer->RandomRead(7, 0, buffer.size(), &res);
+  ASSERT_EQ(buffer, res.ToString());
+  delete pmem_buffer;
+	printf("# End Buffer Recover\n");
+}
+
+TEST (PmemBufferTest, BinaryKeySeek) {
+	cout << "# Start Pmem-Buffer BinaryKeySeek" << endl;
+  // Keys with NUL bytes, same 8-byte prefix
+  std::string keys[4];
+  keys[0] = std::string("a\0a", 3);
+  keys[1] = std::string("a\0c", 3);
+  keys[2] = std::string("prefix00\0x", 10);
+  keys[3] = std::string("prefix00\0y", 10);
+  std::string buffer;
+  for (int i=0; i<4; i++) {
+    EncodeToBuffer(&buffer, Slice(keys[i]), Slice("value"));
+  }
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  PmemSkiplist* pmem_skiplist = new PmemSkiplist(SKIPLIST_MANAGER_PATH_0);
+  SetBufferBases(pmem_skiplist, &pmem_buffer, 1);
+  pmem_buffer->ClearAll();
+  pmem_skiplist->ClearAll();
+  char* start = pmem_buffer->GetStartOffset(11);
+  pmem_buffer->SequentialWrite(11, Slice(buffer));
+  int offset = 0;
+  for (int i=0; i<4; i++) {
+    pmem_skiplist->InsertByPtr(start + offset, keys[i].size(), 11);
+    offset += GetEncodedLength(keys[i].size(), 5);
+  }
+
+  PmemIterator* iter = new PmemIterator(11, pmem_skiplist);
+  iter->Seek(Slice(std::string("a\0b", 3)));
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(keys[1], iter->key().ToString());
+  iter->Seek(Slice(keys[3]));
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(keys[3], iter->key().ToString());
+  iter->Prev();
+  ASSERT_EQ(keys[2], iter->key().ToString());
+  iter->Seek(Slice("z"));
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+
+  // Reentrant lookup
+  Slice res_key, res_value;
+  ASSERT_TRUE(pmem_skiplist->Get(11, Slice(std::string("a\0b", 3)), 
+                                 &res_key, &res_value));
+  ASSERT_EQ(keys[1], res_key.ToString());
+  ASSERT_EQ("value", res_value.ToString());
+  ASSERT_TRUE(!pmem_skiplist->Get(11, Slice("z"), &res_key, &res_value));
+  ASSERT_TRUE(!pmem_skiplist->Get(12, Slice("a"), &res_key, &res_value));
+  delete pmem_skiplist;
+  delete pmem_buffer;
+	printf("# End Buffer BinaryKeySeek\n");
+}
+
+TEST (PmemBufferTest, Reclaim) {
+	cout << "# Start Pmem-Buffer Reclaim" << endl;
+  std::string pool_path = std::string(PMEM_DIR) + "/buffer_reclaim_test";
+  std::remove(pool_path.c_str());
+  const uint64_t num_segments = 4;
+  PmemBuffer* pmem_buffer = new PmemBuffer(pool_path, (size_t)(32 << 20),
+                                  num_segments * BUFFER_SEGMENT_SIZE, 64);
+  pmem_buffer->ClearAll();
+  pmem_buffer->SetMaxTableSize(BUFFER_SEGMENT_SIZE);
+  ASSERT_EQ(num_segments, pmem_buffer->GetNumOfFreeSegments());
+
+  // Tables of 0.6 segment, 2 live at a time, written over capacity
+  std::string data(BUFFER_SEGMENT_SIZE * 6 / 10, 'a');
+  std::set<uint64_t> live_files;
+  for (uint64_t number=1; number<=32; number++) {
+    data[0] = 'a' + (number % 26);
+    pmem_buffer->GetStartOffset(number);
+    pmem_buffer->SequentialWrite(number, Slice(data));
+    live_files.insert(number);
+    live_files.erase(number - 2);
+    pmem_buffer->DeleteFile(number - 2);
+    pmem_buffer->ReleaseDeadFiles(live_files);
+    Slice res;
+    pmem_buffer->RandomRead(number, 0, data.size(), &res);
+    ASSERT_EQ(data, res.ToString());
+    ASSERT_LE(1, pmem_buffer->GetNumOfFreeSegments());
+  }
+
+  // Segment pointed by other table is held after its owner is dead
+  pmem_buffer->ClearAll();
+  std::string segment(BUFFER_SEGMENT_SIZE, 'b');
+  char* start = pmem_buffer->GetStartOffset(40);
+  pmem_buffer->SequentialWrite(40, Slice(segment));
+  PmemBuffer::HoldBufferPtr(41, start + 10, 10);
+  live_files.clear();
+  live_files.insert(41);
+  pmem_buffer->DeleteFile(40);
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_EQ(num_segments - 1, pmem_buffer->GetNumOfFreeSegments());
+  live_files.clear();
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_EQ(num_segments, pmem_buffer->GetNumOfFreeSegments());
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	printf("# End Buffer Reclaim\n");
+}
+
+TEST (PmemBufferTest, PinningBounded) {
+	cout << "# Start Pmem-Buffer PinningBounded" << endl;
+  std::string pool_path = std::string(PMEM_DIR) + "/buffer_pinning_test";
+  std::remove(pool_path.c_str());
+  const uint64_t num_segments = 16;
+  PmemBuffer* pmem_buffer = new PmemBuffer(pool_path, (size_t)(48 << 20),
+                                  num_segments * BUFFER_SEGMENT_SIZE, 64);
+  pmem_buffer->ClearAll();
+  pmem_buffer->SetMaxTableSize(2 * BUFFER_SEGMENT_SIZE);
+
+  // Unwritten tables pin at most max_table_size each
+  pmem_buffer->GetStartOffset(1);
+  pmem_buffer->GetStartOffset(2);
+  pmem_buffer->GetStartOffset(3);
+  ASSERT_EQ(num_segments - 3 * 2, pmem_buffer->GetNumOfFreeSegments());
+  // Written table keeps only segments of its data
+  std::string data(100, 'a');
+  pmem_buffer->SequentialWrite(1, Slice(data));
+  ASSERT_EQ(num_segments - 1 - 2 * 2, pmem_buffer->GetNumOfFreeSegments());
+  // Abandoned reservations are given back, and log head with them
+  std::set<uint64_t> live_files;
+  live_files.insert(1);
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_EQ(num_segments - 1, pmem_buffer->GetNumOfFreeSegments());
+
+  // A few bytes of a live table hold whole segments (not compacted),
+  // but only the segments they fall in
+  pmem_buffer->DeleteFile(1);
+  std::string segment(BUFFER_SEGMENT_SIZE, 'b');
+  for (uint64_t number=10; number<14; number++) {
+    char* table = pmem_buffer->GetStartOffset(number);
+    pmem_buffer->SequentialWrite(number, Slice(segment));
+    PmemBuffer::HoldBufferPtr(20, table + 10, 10);
+  }
+  live_files.clear();
+  live_files.insert(20);
+  for (uint64_t number=10; number<14; number++) {
+    pmem_buffer->DeleteFile(number);
+  }
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_EQ(num_segments - 4, pmem_buffer->GetNumOfFreeSegments());
+  live_files.clear();
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_EQ(num_segments, pmem_buffer->GetNumOfFreeSegments());
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	printf("# End Buffer PinningBounded\n");
+}
+
+namespace {
+struct StatsThreadState {
+  PmemBuffer* pmem_buffer;
+  uint64_t min_free;
+  port::AtomicPointer stop;
+  port::AtomicPointer done;
+  int num_reads;
+};
+static void StatsThreadBody(void* arg) {
+  StatsThreadState* state = reinterpret_cast<StatsThreadState*>(arg);
+  uint64_t num_segments = state->pmem_buffer->GetNumOfSegments();
+  while (state->stop.Acquire_Load() == nullptr) {
+    // NOTE: As DBImpl::AppendPmemShardStats, while tables are written
+    uint64_t free_segments = state->pmem_buffer->GetNumOfFreeSegments();
+    ASSERT_LE(free_segments, num_segments);
+    ASSERT_GE(free_segments, state->min_free);
+    state->num_reads++;
+  }
+  state->done.Release_Store(state);
+}
+}  // namespace
+
+TEST (PmemBufferTest, ConcurrentStats) {
+	cout << "# Start Pmem-Buffer ConcurrentStats" << endl;
+  std::string pool_path = std::string(PMEM_DIR) + "/buffer_stats_test";
+  std::remove(pool_path.c_str());
+  const uint64_t num_segments = 16;
+  PmemBuffer* pmem_buffer = new PmemBuffer(pool_path, (size_t)(48 << 20),
+                                  num_segments * BUFFER_SEGMENT_SIZE, 64);
+  pmem_buffer->ClearAll();
+  pmem_buffer->SetMaxTableSize(BUFFER_SEGMENT_SIZE);
+
+  StatsThreadState state;
+  state.pmem_buffer = pmem_buffer;
+  // Two live tables and a reservation, each over at most 2 segments,
+  // and the segment of log head
+  state.min_free = num_segments - 3 * 2 - 1;
+  state.stop.Release_Store(nullptr);
+  state.done.Release_Store(nullptr);
+  state.num_reads = 0;
+  Env::Default()->StartThread(StatsThreadBody, &state);
+  // Tables are written and released under the reader
+  std::string data(BUFFER_SEGMENT_SIZE / 2 + 1, 'c');
+  std::set<uint64_t> live_files;
+  for (uint64_t file_number=1; file_number<=200; file_number++) {
+    pmem_buffer->GetStartOffset(file_number);
+    pmem_buffer->SequentialWrite(file_number, Slice(data));
+    if (file_number > 2) {
+      pmem_buffer->DeleteFile(file_number - 2);
+    }
+    live_files.clear();
+    live_files.insert(file_number - 1);
+    live_files.insert(file_number);
+    pmem_buffer->ReleaseDeadFiles(live_files);
+  }
+  state.stop.Release_Store(&state);
+  while (state.done.Acquire_Load() == nullptr) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  printf("reads %d\n", state.num_reads);
+  live_files.clear();
+  pmem_buffer->ReleaseDeadFiles(live_files);
+  ASSERT_LE(num_segments - 1, pmem_buffer->GetNumOfFreeSegments());
+
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	printf("# End Buffer ConcurrentStats\n");
+}
+
 } // namespace leveldb
 
 /* Main */
@@ -7,6 +7,7 @@
 #include <iostream>
 #include <fstream>
 #include "pmem/pmem_hashmap.h"
+#include "leveldb/filter_policy.h"
 
 namespace leveldb {
   /* Structure for hashmap */
@@ -53,20 +54,31 @@ namespace leveldb {
     /* buckets, used during rehashing, null otherwise */
     TOID(struct buckets) buckets_tmp;
     struct iterator_head entries;
+
+    /* buckets [0, rehash_pos) are moved to buckets_tmp */
+    uint64_t rehash_pos;
   };
   struct root_hashmap { // head node
     TOID(struct hashmap_atomic) head;
+    uint64_t file_number; // NOTE: owner of this hashmap, 0 = free
   };
   struct root_hashmap_manager {
     pobj::persistent_ptr<root_hashmap[]> hashmap;
+    pobj::p<uint64_t> list_size;
+    pobj::p<uint64_t> layout;    // NOTE: PMEM_HASHMAP_LAYOUT, 0 = before it
+    pobj::p<uint64_t> num_of_shards; // NOTE: 0 = not set yet
   };
 
   /* PMDK-based hashmap class */
   PmemHashmap::PmemHashmap() {
-    Init(BUFFER_PATH);
+    Init(BUFFER_PATH, (size_t)BUFFER_POOL_SIZE, HASHMAP_LIST_SIZE);
   }
   PmemHashmap::PmemHashmap(std::string pool_path) {
-    Init(pool_path);
+    Init(pool_path, (size_t)BUFFER_POOL_SIZE, HASHMAP_LIST_SIZE);
+  }
+  PmemHashmap::PmemHashmap(std::string pool_path, size_t pool_size,
+                           uint64_t list_size) {
+    Init(pool_path, pool_size, list_size);
   }
   PmemHashmap::~PmemHashmap() {
     hashmap_pool.close();
@@ -74,26 +86,44 @@ namespace leveldb {
   PMEMobjpool* PmemHashmap::GetPool() {
     return hashmap_pool.get_handle();
   }
-  void PmemHashmap::Init(std::string pool_path) {
+  void PmemHashmap::SetNumOfShards(uint64_t num_of_shards) {
+    // NOTE: Tables are sharded by file_number % num_of_shards
+    uint64_t stored = root_hashmap_ptr_->num_of_shards;
+    if (stored == 0) {
+      root_hashmap_ptr_->num_of_shards = num_of_shards;
+      hashmap_pool.persist(root_hashmap_ptr_->num_of_shards);
+    } else if (stored != num_of_shards && status_.ok()) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "pool is shard of %llu (not %llu)",
+               (unsigned long long)stored, (unsigned long long)num_of_shards);
+      status_ = Status::InvalidArgument(buf, "remove the pools");
+    }
+  }
+  void PmemHashmap::Init(std::string pool_path, size_t pool_size,
+                         uint64_t list_size) {
     if (!file_exists(pool_path)) {
       hashmap_pool = pobj::pool<root_hashmap_manager>::create (
                       pool_path, pool_path, 
-                      (unsigned long)BUFFER_POOL_SIZE, 0666);
+                      (unsigned long)pool_size, 0666);
       root_hashmap_ptr_ = hashmap_pool.get_root();
+      list_size_ = list_size;
 
       pobj::transaction::exec_tx(hashmap_pool, [&] {
         root_hashmap_ptr_->hashmap =
-              pobj::make_persistent<root_hashmap[]>(HASHMAP_LIST_SIZE);
+              pobj::make_persistent<root_hashmap[]>(list_size_);
+        root_hashmap_ptr_->list_size = list_size_;
+        root_hashmap_ptr_->layout = PMEM_HASHMAP_LAYOUT;
       });
       root_hashmap_ = (struct root_hashmap *)pmemobj_direct(
          root_hashmap_ptr_->hashmap.raw() );
       hashmap_ = (TOID(struct hashmap_atomic) *) malloc(
-            sizeof(TOID(struct hashmap_atomic)) * HASHMAP_LIST_SIZE);
+            sizeof(TOID(struct hashmap_atomic)) * list_size_);
 
       // printf("Create\n");
-      for (int i=0; i < HASHMAP_LIST_SIZE; i++) {
+      for (uint64_t i=0; i < list_size_; i++) {
         hm_atomic_create(GetPool(), &root_hashmap_[i].head, nullptr);
         hashmap_[i] = root_hashmap_[i].head;
+        SetFileNumber(i, 0);
       }
     } 
     // Not exists
@@ -101,14 +131,35 @@ namespace leveldb {
       hashmap_pool = pobj::pool<root_hashmap_manager>::open (
                       pool_path, pool_path);
       root_hashmap_ptr_ = hashmap_pool.get_root();
+      // NOTE: Owners of old layout would be recovered as garbage
+      char buf[100];
+      if (root_hashmap_ptr_->layout != PMEM_HASHMAP_LAYOUT) {
+        snprintf(buf, sizeof(buf), "has layout %llu (not %d), remove the pool",
+                 (unsigned long long)root_hashmap_ptr_->layout,
+                 PMEM_HASHMAP_LAYOUT);
+        status_ = Status::Corruption(pool_path, buf);
+        // NOTE: Hashmaps are not read, DB::Open returns status()
+        root_hashmap_ = nullptr;
+        list_size_ = 0;
+        hashmap_ = nullptr;
+        return;
+      }
       root_hashmap_ = (struct root_hashmap *)pmemobj_direct(
          root_hashmap_ptr_->hashmap.raw() );
+      // NOTE: The pool is already laid out, owners are indexed by list_size
+      list_size_ = root_hashmap_ptr_->list_size;
+      if (list_size_ != list_size) {
+        snprintf(buf, sizeof(buf), "has list_size %llu (not %llu)",
+                 (unsigned long long)list_size_,
+                 (unsigned long long)list_size);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
 
       hashmap_ = (TOID(struct hashmap_atomic) *) malloc(
-            sizeof(TOID(struct hashmap_atomic)) * HASHMAP_LIST_SIZE);
+            sizeof(TOID(struct hashmap_atomic)) * list_size_);
       
       // FIXME: Check test
-      for (int i=0; i < HASHMAP_LIST_SIZE; i++) {
+      for (uint64_t i=0; i < list_size_; i++) {
         // hm_atomic_create(GetPool(), &root_hashmap_[i].head, nullptr);
         hm_atomic_init(GetPool(), root_hashmap_[i].head);
         hashmap_[i] = root_hashmap_[i].head;
@@ -117,8 +168,7 @@ namespace leveldb {
   }
   void PmemHashmap::Insert(char* key, char* buffer_ptr, 
                            int key_len, uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetInsertIndex(file_number);
     int result = hm_atomic_insert(GetPool(), 
                                   hashmap_[actual_index], 
                                   key, buffer_ptr,
@@ -130,8 +180,7 @@ namespace leveldb {
   }
   void PmemHashmap::InsertByPtr(void* key_ptr, char* buffer_ptr, 
                                       int key_len, uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetInsertIndex(file_number);
     int result = hm_atomic_insert_by_ptr(GetPool(), 
                                           hashmap_[actual_index], 
                                           key_ptr, buffer_ptr,
@@ -141,6 +190,31 @@ namespace leveldb {
       abort();
     } 
   }
+  void PmemHashmap::FinishBuild(uint64_t file_number) {
+    uint64_t actual_index;
+    if (!FindIndex(file_number, &actual_index)) {
+      return;
+    }
+    hm_atomic_finish_rehash(GetPool(), hashmap_[actual_index]);
+  }
+  bool PmemHashmap::Get(uint64_t file_number, const Slice& key,
+                        Slice* res_key, Slice* res_value) {
+    uint64_t actual_index;
+    if (!FindIndex(file_number, &actual_index)) {
+      return false;
+    }
+    char* buffer_ptr = (char *)hm_atomic_get(GetPool(), hashmap_[actual_index],
+                                  const_cast<char *>(key.data()), key.size());
+    if (buffer_ptr == nullptr) {
+      return false;
+    }
+    uint32_t key_len, value_len;
+    char* key_ptr = GetKeyAndLengthFromBuffer(buffer_ptr, &key_len);
+    char* value_ptr = GetValueAndLengthFromBuffer(buffer_ptr, &value_len);
+    *res_key = Slice(key_ptr, key_len);
+    *res_value = Slice(value_ptr, value_len);
+    return true;
+  }
   void PmemHashmap::Foreach(uint64_t file_number,
         int (*callback)(char* key, char* buffer_ptr, void* key_ptr, 
                         int key_len, void *arg)) {
@@ -161,38 +235,129 @@ namespace leveldb {
     Foreach(file_number, Print_hashmap);
   }
   void PmemHashmap::ClearAll() {
-    for (int i=0; i<HASHMAP_LIST_SIZE; i++) {
-      // skiplist_map_clear(GetPool(), skiplists_[i]);
+    MutexLock l(&map_mutex_);
+    free_list_.clear();
+    allocated_map_.clear();
+    filter_map_.clear();
+    for (uint64_t i=0; i<list_size_; i++) {
+      ClearHashmap(i);
+      SetFileNumber(i, 0);
       // DA: Push all to freelist
       PushFreeList(&free_list_, i);
     }
   }
+  /* 
+   * Recovery on DB::Open
+   * Keep hashmaps owned by live files (MANIFEST), clear and free the others.
+   * NOTE: Slot is cleared before its owner is reset, so a free slot
+   *       with entries is left by old ClearAll() only
+   */
+  void PmemHashmap::Recover(const std::set<uint64_t>& live_files) {
+    MutexLock l(&map_mutex_);
+    free_list_.clear();
+    allocated_map_.clear();
+    filter_map_.clear();
+    for (uint64_t i=0; i<list_size_; i++) {
+      uint64_t file_number = root_hashmap_[i].file_number;
+      if (file_number != 0 &&
+          live_files.find(file_number) != live_files.end() &&
+          !CheckMapValidation(&allocated_map_, file_number)) {
+        // NOTE: Rehash interrupted by crash (resumed by hm_atomic_init),
+        //       live table takes no more inserts
+        hm_atomic_finish_rehash(GetPool(), hashmap_[i]);
+        InsertAllocatedMap(&allocated_map_, file_number, i);
+      } else {
+        if (file_number != 0 ||
+            hm_atomic_count(GetPool(), hashmap_[i]) != 0) {
+          ClearHashmap(i);
+          SetFileNumber(i, 0);
+        }
+        PushFreeList(&free_list_, i);
+      }
+    }
+  }
+  size_t PmemHashmap::GetFreeListSize() {
+    MutexLock l(&map_mutex_);
+    return free_list_.size();
+  }
+  size_t PmemHashmap::GetAllocatedMapSize() {
+    MutexLock l(&map_mutex_);
+    return allocated_map_.size();
+  }
+  void PmemHashmap::ClearHashmap(uint64_t index) {
+    if (hm_atomic_clear(GetPool(), hashmap_[index])) {
+      fprintf(stderr, "[ERROR] clear %llu\n", (unsigned long long)index);
+      abort();
+    }
+  }
+  void PmemHashmap::SetFileNumber(uint64_t index, uint64_t file_number) {
+    pmemobj_memcpy_persist(GetPool(), &(root_hashmap_[index].file_number),
+                           &file_number, sizeof(uint64_t));
+  }
+  uint64_t PmemHashmap::GetInsertIndex(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
+    if (CheckMapValidation(&allocated_map_, file_number)) {
+      return GetIndexFromAllocatedMap(&allocated_map_, file_number);
+    }
+    uint64_t new_index = AddFileAndGetNewIndex(&free_list_, &allocated_map_,
+                                               file_number);
+    SetFileNumber(new_index, file_number);
+    return new_index;
+  }
+  uint64_t PmemHashmap::GetIndex(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
+    return GetActualIndex(&free_list_, &allocated_map_, file_number);
+  }
+  bool PmemHashmap::FindIndex(uint64_t file_number, uint64_t* index) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, uint64_t>::iterator iter = allocated_map_.find(file_number);
+    if (iter == allocated_map_.end()) {
+      return false;
+    }
+    *index = iter->second;
+    return true;
+  }
+  bool PmemHashmap::CheckNumberIsInPmem(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
+    return CheckMapValidation(&allocated_map_, file_number);
+  }
+
+  /* Whole-table filter */
+  void PmemHashmap::SetFilter(uint64_t file_number, const std::string& filter) {
+    MutexLock l(&map_mutex_);
+    filter_map_[file_number] = filter;
+  }
+  bool PmemHashmap::KeyMayMatch(const FilterPolicy* policy, uint64_t file_number,
+                       const Slice& key) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, std::string>::iterator iter = 
+                                              filter_map_.find(file_number);
+    if (policy == nullptr || iter == filter_map_.end()) {
+      return true;
+    }
+    return policy->KeyMayMatch(key, Slice(iter->second));
+  }
   
 
   PMEMoid* PmemHashmap::GetPrevOID(uint64_t file_number, TOID(struct entry) current_entry) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     // return hm_atomic_get_prev_OID(GetPool(), hashmap_[actual_index], key);
     return hm_atomic_get_prev_OID(GetPool(), current_entry);
   }
   PMEMoid* PmemHashmap::GetNextOID(uint64_t file_number, TOID(struct entry) current_entry) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return hm_atomic_get_next_OID(GetPool(), current_entry);
   }
   PMEMoid* PmemHashmap::GetFirstOID(uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return hm_atomic_get_first_OID(GetPool(), hashmap_[actual_index]);
   }
   PMEMoid* PmemHashmap::GetLastOID(uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return hm_atomic_get_last_OID(GetPool(), hashmap_[actual_index]);
   }
   PMEMoid* PmemHashmap::SeekOID(uint64_t file_number, char* key, int key_len) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return hm_atomic_seek_OID(GetPool(), hashmap_[actual_index], key, key_len);
   }
 
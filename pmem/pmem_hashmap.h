@@ -43,20 +43,36 @@ namespace leveldb {
    public:
     PmemHashmap();
     PmemHashmap(std::string pool_path);
+    PmemHashmap(std::string pool_path, size_t pool_size, uint64_t list_size);
     ~PmemHashmap();
-    void Init(std::string pool_path);
+    void Init(std::string pool_path, size_t pool_size, uint64_t list_size);
+    // Persisted on first set, other num_of_shards sets status()
+    void SetNumOfShards(uint64_t num_of_shards);
+    // Not ok if the pool does not match options (Init, SetNumOfShards),
+    // the pool must not be used then
+    Status status() const { return status_; }
     
     /* Wrapper functions */
     void Insert(char* key, char* buffer_ptr, 
                       int key_len, uint64_t file_number);
     void InsertByPtr(void* key_ptr, char* buffer_ptr, int key_len, 
                       uint64_t file_number);
+    // End of table build: finish rehash, lookups probe one bucket array
+    void FinishBuild(uint64_t file_number);
+    /* 
+     * Point lookup, reentrant (no shared iterator state)
+     * NOTE: key & value point into PmemBuffer
+     */
+    bool Get(uint64_t file_number, const Slice& key, 
+             Slice* res_key, Slice* res_value);
     // void InsertNullNode(uint64_t file_number);
     // // char* Get(int index, char *key);
     void Foreach(uint64_t file_number, int (*callback) (
           char* key, char* buffer_ptr, void* key_ptr, int key_len, void* arg));
     void PrintAll(uint64_t file_number);
     void ClearAll();
+    /* Rebuild free_list_, allocated_map_ from persistent owners */
+    void Recover(const std::set<uint64_t>& live_files);
 
     // /* Iterator functions */
     PMEMoid* GetPrevOID(uint64_t file_number, TOID(struct entry) current_entry);
@@ -67,9 +83,34 @@ namespace leveldb {
 
     /* Getter */
     PMEMobjpool* GetPool();
+    size_t GetFreeListSize();
+    size_t GetAllocatedMapSize();
+
+    /* Setter */
+    void SetFileNumber(uint64_t index, uint64_t file_number);
+
+    /* Check whether hashmap is valid in a specific version */
+    bool CheckNumberIsInPmem(uint64_t file_number);
+
+    /* Whole-table filter (DRAM only, not rebuilt on Recover) */
+    void SetFilter(uint64_t file_number, const std::string& filter);
+    // Return true if file_number has no filter
+    bool KeyMayMatch(const FilterPolicy* policy, uint64_t file_number,
+                     const Slice& key);
 
    private:
+    // Same as GetActualIndex(), but persist owner of new index
+    uint64_t GetInsertIndex(uint64_t file_number);
+    // GetActualIndex() under map_mutex_
+    uint64_t GetIndex(uint64_t file_number);
+    // Read-only, false if file_number is not allocated
+    bool FindIndex(uint64_t file_number, uint64_t* index);
+    // Remove all entries, before index is freed
+    void ClearHashmap(uint64_t index);
+
+    Status status_;
     struct root_hashmap* root_hashmap_;
+    uint64_t list_size_; // NOTE: number of hashmaps, fixed on create
 
     /* Actual Skiplist interface */
     TOID(struct hashmap_atomic)* hashmap_;
@@ -80,8 +121,11 @@ namespace leveldb {
     pobj::persistent_ptr<root_hashmap_manager> root_hashmap_ptr_;
 
     /* Dynamic allocation */
+    // NOTE: Readers (Get) run without DB mutex, so guard maps by map_mutex_
+    port::Mutex map_mutex_;
     std::list<uint64_t> free_list_;
     std::map<uint64_t, uint64_t> allocated_map_; // [ file_number -> index ]
+    std::map<uint64_t, std::string> filter_map_; // [ file_number -> filter ]
   };
 
 } // namespace leveldb
@@ -40,6 +40,9 @@ SPDX-License-Identifier: BSD-3-Clause
 // #include "pmem/layout.h"
 // #include "pmem/ds/hashmap_atomic.h"
 #include "pmem/pmem_hashmap.h"
+#include "pmem/pmem_buffer.h"
+#include "pmem/ds/hashmap_internal.h"
+#include "db/dbformat.h"
 
 
 
@@ -127,6 +130,199 @@ TEST (PmemHashmapTest, HashMap) {
 	printf("# End Hashmap\n");
 }
 
+TEST (PmemHashmapTest, BinaryKeys) {
+  printf("# Start Hashmap BinaryKeys\n");
+  std::string pool_path = std::string(PMEM_DIR) + "/hashmap_binary_test";
+  PmemHashmap* pmem_hashmap = new PmemHashmap(pool_path, 
+                                              (size_t)(64 << 20), 2);
+  pmem_hashmap->ClearAll();
+
+  // Sorted order of a table: same user key, newer sequence first
+  const Slice user_keys[4] = { Slice("\x00\x01", 2), Slice("a\0b", 3),
+                               Slice("a\0b", 3), Slice("\xff\xfe", 2) };
+  const SequenceNumber seqs[4] = { 7, 5, 3, 9 };
+  std::string keys[4], buffers[4];
+  for (int i=0; i<4; i++) {
+    AppendInternalKey(&keys[i], 
+                      ParsedInternalKey(user_keys[i], seqs[i], kTypeValue));
+    EncodeToBuffer(&buffers[i], Slice(keys[i]), Slice(keys[i]));
+  }
+  for (int i=0; i<4; i++) {
+    pmem_hashmap->InsertByPtr(const_cast<char *>(keys[i].data()), 
+                              const_cast<char *>(buffers[i].data()),
+                              keys[i].size(), 31);
+  }
+
+  Slice res_key, res_value;
+  ASSERT_TRUE(pmem_hashmap->Get(31, LookupKey(user_keys[0], 10).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[0], res_key.ToString());
+  ASSERT_TRUE(pmem_hashmap->Get(31, LookupKey(user_keys[3], 9).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[3], res_key.ToString());
+  // Newest version visible to lookup sequence
+  ASSERT_TRUE(pmem_hashmap->Get(31, LookupKey(user_keys[1], 10).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[1], res_key.ToString());
+  ASSERT_TRUE(pmem_hashmap->Get(31, LookupKey(user_keys[1], 4).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[2], res_key.ToString());
+  ASSERT_TRUE(!pmem_hashmap->Get(31, LookupKey(user_keys[1], 2).internal_key(),
+                                 &res_key, &res_value));
+  ASSERT_TRUE(!pmem_hashmap->Get(31, LookupKey(Slice("a\0c", 3), 10).internal_key(),
+                                 &res_key, &res_value));
+  delete pmem_hashmap;
+  printf("# End Hashmap BinaryKeys\n");
+}
+
+TEST (PmemHashmapTest, SlotReuse) {
+  printf("# Start Hashmap SlotReuse\n");
+  std::string pool_path = std::string(PMEM_DIR) + "/hashmap_reuse_test";
+  // NOTE: One slot, every table reuses it
+  PmemHashmap* pmem_hashmap = new PmemHashmap(pool_path, 
+                                              (size_t)(64 << 20), 1);
+  pmem_hashmap->ClearAll();
+
+  std::string keys[3], buffers[3];
+  const char* user_keys[3] = { "old1", "old2", "new1" };
+  for (int i=0; i<3; i++) {
+    AppendInternalKey(&keys[i], 
+                      ParsedInternalKey(Slice(user_keys[i]), 5, kTypeValue));
+    EncodeToBuffer(&buffers[i], Slice(keys[i]), Slice(keys[i]));
+  }
+  Slice res_key, res_value;
+
+  // 1) Dead table is freed by Recover
+  pmem_hashmap->Insert(const_cast<char *>(keys[0].data()), 
+                       const_cast<char *>(buffers[0].data()),
+                       keys[0].size(), 41);
+  pmem_hashmap->InsertByPtr(const_cast<char *>(keys[1].data()), 
+                            const_cast<char *>(buffers[1].data()),
+                            keys[1].size(), 41);
+  std::set<uint64_t> live_files;
+  pmem_hashmap->Recover(live_files);
+  ASSERT_EQ(1, pmem_hashmap->GetFreeListSize());
+  ASSERT_EQ(0, pmem_hashmap->GetAllocatedMapSize());
+
+  pmem_hashmap->InsertByPtr(const_cast<char *>(keys[2].data()), 
+                            const_cast<char *>(buffers[2].data()),
+                            keys[2].size(), 42);
+  for (int i=0; i<2; i++) {
+    ASSERT_TRUE(!pmem_hashmap->Get(42, LookupKey(Slice(user_keys[i]), 
+                                                 10).internal_key(),
+                                   &res_key, &res_value)) << user_keys[i];
+  }
+  ASSERT_TRUE(pmem_hashmap->Get(42, LookupKey(Slice(user_keys[2]), 
+                                              10).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[2], res_key.ToString());
+
+  // 2) Reopen, slot freed by ClearAll is empty too
+  pmem_hashmap->ClearAll();
+  delete pmem_hashmap;
+  pmem_hashmap = new PmemHashmap(pool_path, (size_t)(64 << 20), 1);
+  pmem_hashmap->Recover(live_files);
+  pmem_hashmap->InsertByPtr(const_cast<char *>(keys[0].data()), 
+                            const_cast<char *>(buffers[0].data()),
+                            keys[0].size(), 43);
+  ASSERT_TRUE(!pmem_hashmap->Get(43, LookupKey(Slice(user_keys[2]), 
+                                               10).internal_key(),
+                                 &res_key, &res_value));
+  ASSERT_TRUE(pmem_hashmap->Get(43, LookupKey(Slice(user_keys[0]), 
+                                              10).internal_key(),
+                                &res_key, &res_value));
+  ASSERT_EQ(keys[0], res_key.ToString());
+  pmem_hashmap->ClearAll();
+  delete pmem_hashmap;
+  printf("# End Hashmap SlotReuse\n");
+}
+
+TEST (PmemHashmapTest, RehashReopen) {
+  printf("# Start Hashmap RehashReopen\n");
+  std::string pool_path = std::string(PMEM_DIR) + "/hashmap_rehash_test";
+  PmemHashmap* pmem_hashmap = new PmemHashmap(pool_path, 
+                                              (size_t)(256 << 20), 2);
+  pmem_hashmap->ClearAll();
+
+  // NOTE: Versions of a user key share a bucket, so more than 
+  //       MAX_HASHSET_THRESHOLD versions start a rebuild, which moves
+  //       REHASH_STEP_BUCKETS of INIT_BUCKETS_NUM buckets per insert
+  const int kVersions = MAX_HASHSET_THRESHOLD + 20;
+  const int kKeys = 200;
+  std::vector<std::string> keys, buffers;
+  for (int i=0; i<kVersions; i++) {
+    // Sorted order of a table: newer sequence first
+    std::string key;
+    AppendInternalKey(&key, ParsedInternalKey(Slice("dup"), kVersions - i,
+                                              kTypeValue));
+    keys.push_back(key);
+  }
+  for (int i=0; i<kKeys; i++) {
+    char user_key[20];
+    snprintf(user_key, sizeof(user_key), "key%04d", i);
+    std::string key;
+    AppendInternalKey(&key, ParsedInternalKey(Slice(user_key), 1, 
+                                              kTypeValue));
+    keys.push_back(key);
+  }
+  buffers.resize(keys.size());
+  for (size_t i=0; i<keys.size(); i++) {
+    EncodeToBuffer(&buffers[i], Slice(keys[i]), Slice(keys[i]));
+    pmem_hashmap->Insert(const_cast<char *>(keys[i].data()), 
+                         const_cast<char *>(buffers[i].data()),
+                         keys[i].size(), 51);
+  }
+  ASSERT_LT(keys.size() * REHASH_STEP_BUCKETS, (size_t)INIT_BUCKETS_NUM);
+
+  // Every version is visible while both bucket arrays are probed
+  for (int reopen=0; reopen<2; reopen++) {
+    Slice res_key, res_value;
+    for (int i=0; i<kVersions; i++) {
+      SequenceNumber seq = kVersions - i;
+      ASSERT_TRUE(pmem_hashmap->Get(51, LookupKey(Slice("dup"), 
+                                                  seq).internal_key(),
+                                    &res_key, &res_value)) << seq;
+      ASSERT_EQ(keys[i], res_key.ToString()) << seq;
+    }
+    for (int i=0; i<kKeys; i++) {
+      ParsedInternalKey parsed;
+      ASSERT_TRUE(ParseInternalKey(Slice(keys[kVersions + i]), &parsed));
+      ASSERT_TRUE(pmem_hashmap->Get(51, LookupKey(parsed.user_key, 
+                                                  10).internal_key(),
+                                    &res_key, &res_value)) << i;
+      ASSERT_EQ(keys[kVersions + i], res_key.ToString()) << i;
+    }
+    if (reopen == 0) {
+      // Reopen with rehash in progress, Recover finishes it for live table
+      delete pmem_hashmap;
+      pmem_hashmap = new PmemHashmap(pool_path, (size_t)(256 << 20), 2);
+      std::set<uint64_t> live_files;
+      live_files.insert(51);
+      pmem_hashmap->Recover(live_files);
+      ASSERT_TRUE(pmem_hashmap->CheckNumberIsInPmem(51));
+    }
+  }
+
+  // Rebuild of next table is finished at the end of its build
+  for (int i=0; i<kVersions; i++) {
+    pmem_hashmap->Insert(const_cast<char *>(keys[i].data()), 
+                         const_cast<char *>(buffers[i].data()),
+                         keys[i].size(), 52);
+  }
+  pmem_hashmap->FinishBuild(52);
+  Slice res_key, res_value;
+  for (int i=0; i<kVersions; i++) {
+    SequenceNumber seq = kVersions - i;
+    ASSERT_TRUE(pmem_hashmap->Get(52, LookupKey(Slice("dup"), 
+                                                seq).internal_key(),
+                                  &res_key, &res_value)) << seq;
+    ASSERT_EQ(keys[i], res_key.ToString()) << seq;
+  }
+  pmem_hashmap->ClearAll();
+  delete pmem_hashmap;
+  printf("# End Hashmap RehashReopen\n");
+}
+
 } // namespace leveldb
 
 /* Main */
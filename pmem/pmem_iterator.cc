@@ -5,16 +5,10 @@
  */
 #include <iostream>
 #include "pmem/pmem_iterator.h"
+#include "util/coding.h"
 
 namespace leveldb {
-  /* Structure for skiplist */
-  struct skiplist_map_entry {
-    char* buffer_ptr;
-  };
-  struct skiplist_map_node {
-    TOID(struct skiplist_map_node) next[SKIPLIST_LEVELS_NUM];
-    struct skiplist_map_entry entry;
-  };
+  /* Structure for skiplist (node: pmem/ds/skiplist_buffer.h) */
   /* Structure for Hashmap */
   struct entry {
     PMEMoid key;
@@ -30,11 +24,14 @@ namespace leveldb {
    * Pmem-based Iterator 
    */
   PmemIterator::PmemIterator(PmemSkiplist *pmem_skiplist) 
-    : index_(0), pmem_skiplist_(pmem_skiplist), data_structure(kSkiplist) {
-    
+    : index_(0), pmem_skiplist_(pmem_skiplist), pos_(0),
+      data_structure(pmem_skiplist->GetDataStructureType()) {
+    view_.num_entries = 0;
   }
   PmemIterator::PmemIterator(int index, PmemSkiplist *pmem_skiplist) 
-    : index_(index), pmem_skiplist_(pmem_skiplist), data_structure(kSkiplist) {
+    : index_(index), pmem_skiplist_(pmem_skiplist), pos_(0),
+      data_structure(pmem_skiplist->GetDataStructureType()) {
+    view_.num_entries = 0;
       // printf("[Constructor]New Iterator From Pmem %d\n", index_);
     pmem_skiplist->Ref(index);
   }
@@ -54,12 +51,16 @@ namespace leveldb {
 
   void PmemIterator::Seek(const Slice& target) {
     if (data_structure == kSkiplist) {
-      current_ = (pmem_skiplist_->GetOID(index_, (char *)target.data()));
+      current_ = (pmem_skiplist_->GetOID(index_, target));
       SetCurrentNode(current_);
     } else if (data_structure == kHashmap) {
       current_ = pmem_hashmap_->SeekOID(index_, (char *)target.data(), 
                                 target.size());
       SetCurrentEntry(current_);
+    } else if (data_structure == kSortedArray) {
+      LoadSortedArrayView();
+      pos_ = sorted_array_view_seek(&view_, 
+                                    pmem_skiplist_->GetComparator(), target);
     }
   }
   void PmemIterator::SeekToFirst() {
@@ -71,6 +72,9 @@ namespace leveldb {
       current_ = pmem_hashmap_->GetFirstOID(index_);
       assert(!OID_IS_NULL(*current_));
       SetCurrentEntry(current_);
+    } else if (data_structure == kSortedArray) {
+      LoadSortedArrayView();
+      pos_ = 0;
     }
   }
   void PmemIterator::SeekToLast() {
@@ -82,6 +86,10 @@ namespace leveldb {
       current_ = pmem_hashmap_->GetLastOID(index_);
       assert(!OID_IS_NULL(*current_));
       SetCurrentEntry(current_);
+    } else if (data_structure == kSortedArray) {
+      LoadSortedArrayView();
+      // NOTE: empty table, pos_ = num_entries = invalid
+      pos_ = view_.num_entries == 0 ? 0 : view_.num_entries - 1;
     }
   }
   void PmemIterator::Next() {
@@ -98,12 +106,17 @@ namespace leveldb {
         printf("[ERROR][PmemIterator][Next] OID IS NULL\n");
       }
       SetCurrentEntry(current_);
+    } else if (data_structure == kSortedArray) {
+      pos_++;
     }
   }
   void PmemIterator::Prev() {
     if (data_structure == kSkiplist) {
-      char* key =  (char *)key_ptr_;
-      current_ = (pmem_skiplist_->GetPrevOID(index_, key));
+      uint32_t key_len;
+      char* key = GetKeyAndLengthFromBuffer(
+                    DecodeBufferPtr(pmem_skiplist_->GetComparator()->bases,
+                                    current_node_->entry.buffer_ptr), &key_len);
+      current_ = (pmem_skiplist_->GetPrevOID(index_, Slice(key, key_len)));
       if (OID_IS_NULL(*current_)) {
         printf("[ERROR][PmemIterator][Prev] OID IS NULL\n");
       }
@@ -115,6 +128,9 @@ namespace leveldb {
         printf("[ERROR][PmemIterator][Next] OID IS NULL\n");
       }
       SetCurrentEntry(current_);
+    } else if (data_structure == kSortedArray) {
+      // NOTE: Before first entry = invalid
+      pos_ = (pos_ == 0) ? view_.num_entries : pos_ - 1;
     }
   }
 
@@ -124,24 +140,25 @@ namespace leveldb {
         printf("[Valid()]OID IS NULL\n");
         return false;
       }
-      if (current_node_->entry.buffer_ptr == nullptr) {
-        return false;
-      }
-      uint8_t key_len = GetKeyLengthFromBuffer(current_node_->entry.buffer_ptr);
-      return key_len;
+      // NOTE: In-node key length, buffer is not read
+      return current_node_->entry.buffer_ptr.off != 0 &&
+             current_node_->entry.key_len != 0;
     } else if (data_structure == kHashmap) {
       if (OID_IS_NULL(*current_)) return false;
       uint8_t key_len = current_entry_->key_len;
       return key_len;
+    } else if (data_structure == kSortedArray) {
+      return pos_ < view_.num_entries;
     }
   }
   Slice PmemIterator::key() const {
     if (data_structure == kSkiplist) {
       assert(!OID_IS_NULL(*current_));
       uint32_t key_len;
-      char* ptr = GetKeyAndLengthFromBuffer(current_node_->entry.buffer_ptr, &key_len);
+      buffer_ptr_ = DecodeBufferPtr(pmem_skiplist_->GetComparator()->bases,
+                                    current_node_->entry.buffer_ptr);
+      char* ptr = GetKeyAndLengthFromBuffer(buffer_ptr_, &key_len);
       key_ptr_ = ptr;
-      buffer_ptr_ = current_node_->entry.buffer_ptr;
       Slice res((char *)ptr, key_len);
       return res;
     } else if (data_structure == kHashmap) {
@@ -161,6 +178,14 @@ namespace leveldb {
       }
       Slice res((char *)ptr, key_len);
       return res;
+    } else if (data_structure == kSortedArray) {
+      assert(pos_ < view_.num_entries);
+      uint32_t key_len;
+      buffer_ptr_ = sorted_array_view_buffer_ptr(&view_, pos_);
+      char* ptr = GetKeyAndLengthFromBuffer(buffer_ptr_, &key_len);
+      key_ptr_ = ptr;
+      Slice res((char *)ptr, key_len);
+      return res;
     }
   }
   Slice PmemIterator::value() const {
@@ -172,6 +197,13 @@ namespace leveldb {
       return res;
     } else if (data_structure == kHashmap) {
       // TODO: Implement hashmap-based value()
+    } else if (data_structure == kSortedArray) {
+      assert(pos_ < view_.num_entries);
+      uint32_t value_len;
+      char* ptr = GetValueAndLengthFromBuffer(
+                    sorted_array_view_buffer_ptr(&view_, pos_), &value_len);
+      Slice res((char *)ptr, value_len);
+      return res;
     }
   }
   Status PmemIterator::status() const {
@@ -199,6 +231,9 @@ namespace leveldb {
     } else if (data_structure == kHashmap) {
       printf("[ERROR][GetCurrentNode] Hashmap is operated\n");
       abort();
+    } else if (data_structure == kSortedArray) {
+      printf("[ERROR][GetCurrentNode] Sorted array is operated\n");
+      abort();
     }
   }
   int PmemIterator::GetIndex() {
@@ -213,6 +248,10 @@ namespace leveldb {
   void PmemIterator::SetCurrentEntry(PMEMoid* current_oid) {
     current_entry_ = (struct entry*)pmemobj_direct_latency(*current_oid);
   }
+  void PmemIterator::LoadSortedArrayView() {
+    // NOTE: Reload on every seek, table may be built after construction
+    pmem_skiplist_->GetSortedArrayView(index_, &view_);
+  }
 
   void PmemIterator::Ref(uint64_t file_number) {
     pmem_skiplist_->Ref(file_number);
@@ -220,4 +259,105 @@ namespace leveldb {
   void PmemIterator::UnRef(uint64_t file_number) {
     pmem_skiplist_->UnRef(file_number);
   }
-} // namespace leveldb 
\ No newline at end of file
+
+  /* 
+   * Compaction-only scan iterator
+   */
+  PmemScanIterator::PmemScanIterator(uint64_t file_number,
+                                     PmemSkiplist* pmem_skiplist,
+                                     char* start, uint64_t size)
+    : pmem_skiplist_(pmem_skiplist), file_number_(file_number),
+      start_(start), limit_(start + size), 
+      current_(start + size), next_(start + size) {
+    pmem_skiplist_->Ref(file_number_);
+  }
+  PmemScanIterator::~PmemScanIterator() {
+    pmem_skiplist_->UnRef(file_number_);
+  }
+
+  void PmemScanIterator::ParseCurrentEntry() {
+    if (current_ >= limit_) {
+      current_ = limit_;
+      return;
+    }
+    // NOTE: Entries are read in address order, so hardware prefetcher
+    //       follows the stream. Hint keeps lines ahead of the decoder.
+    __builtin_prefetch(current_ + BUFFER_SCAN_PREFETCH_DISTANCE);
+    uint32_t key_len, value_len = 0;
+    const char* p = GetVarint32Ptr(current_, limit_, &key_len);
+    if (p != nullptr && p + key_len <= limit_) {
+      key_ = Slice(p, key_len);
+      p = GetVarint32Ptr(p + key_len, limit_, &value_len);
+    } else {
+      p = nullptr;
+    }
+    if (p == nullptr || p + value_len > limit_) {
+      printf("[ERROR][PmemScanIterator] Bad entry of %lu at %lu\n",
+             file_number_, (uint64_t)(current_ - start_));
+      status_ = Status::Corruption("bad entry in pmem scan region");
+      current_ = limit_;
+      return;
+    }
+    value_ = Slice(p, value_len);
+    next_ = (char *)p + value_len;
+    // NOTE: Stream is bandwidth-bound, no latency per entry
+    DelayPmemRead(0, next_ - current_);
+  }
+  void PmemScanIterator::Seek(const Slice& target) {
+    // NOTE: Linear, compaction seeks only at start of input
+    const struct skiplist_map_cmp* cmp = pmem_skiplist_->GetComparator();
+    uint64_t target_prefix = skiplist_key_prefix(cmp, target);
+    for (SeekToFirst(); Valid(); Next()) {
+      if (skiplist_key_compare(cmp, key_, target, target_prefix) >= 0) break;
+    }
+  }
+  void PmemScanIterator::SeekToFirst() {
+    current_ = start_;
+    ParseCurrentEntry();
+  }
+  void PmemScanIterator::SeekToLast() {
+    printf("[ERROR][PmemScanIterator][SeekToLast] Not supported\n");
+    status_ = Status::NotSupported("pmem scan iterator is forward only");
+    current_ = limit_;
+  }
+  void PmemScanIterator::Next() {
+    assert(Valid());
+    current_ = next_;
+    ParseCurrentEntry();
+  }
+  void PmemScanIterator::Prev() {
+    printf("[ERROR][PmemScanIterator][Prev] Not supported\n");
+    status_ = Status::NotSupported("pmem scan iterator is forward only");
+    current_ = limit_;
+  }
+  bool PmemScanIterator::Valid() const {
+    return current_ < limit_;
+  }
+  Slice PmemScanIterator::key() const {
+    assert(Valid());
+    return key_;
+  }
+  Slice PmemScanIterator::value() const {
+    assert(Valid());
+    return value_;
+  }
+  Status PmemScanIterator::status() const {
+    return status_;
+  }
+  void* PmemScanIterator::key_ptr() const {
+    return (void *)key_.data();
+  }
+  char* PmemScanIterator::buffer_ptr() const {
+    return current_;
+  }
+
+  Iterator* NewPmemCompactionIterator(uint64_t file_number,
+                                      PmemSkiplist* pmem_skiplist) {
+    char* start;
+    uint64_t size;
+    if (pmem_skiplist->GetScanRegion(file_number, &start, &size)) {
+      return new PmemScanIterator(file_number, pmem_skiplist, start, size);
+    }
+    return new PmemIterator(file_number, pmem_skiplist);
+  }
+} // namespace leveldb
@@ -30,15 +30,12 @@ namespace leveldb {
   struct skiplist_map_node; 
   struct entry;
 
-  // Choose data-structure options
-  enum PmemDataStructrueType {
-    kSkiplist = 0,
-    kHashmap = 1
-  };
+  // NOTE: PmemDataStructrueType is declared in pmem_skiplist.h
 
   /* 
    * Pmem-based Iterator 
-   * Support skiplist-based and hashmap-based iterator
+   * Support skiplist-based, sorted-array-based and hashmap-based iterator
+   * NOTE: ds of PmemSkiplist (kSkiplist or kSortedArray) is chosen by pool
    * TODO: hashmap-based value()
    */
   class PmemIterator: public Iterator {
@@ -73,6 +70,7 @@ namespace leveldb {
     void SetIndex(int index);
     void SetCurrentNode(PMEMoid* current_oid);  // for skiplist
     void SetCurrentEntry(PMEMoid* current_oid); // for hashmap
+    void LoadSortedArrayView();                 // for sorted array
 
     void Ref(uint64_t file_number);
     void UnRef(uint64_t file_number);
@@ -85,6 +83,8 @@ namespace leveldb {
     PMEMoid* current_;
     struct skiplist_map_node* current_node_; // for skiplist
     struct entry* current_entry_;            // for hashmap
+    struct sorted_array_view view_;          // for sorted array
+    uint64_t pos_;                           // for sorted array
 
     mutable PMEMoid* key_oid_;
     mutable PMEMoid* value_oid_;
@@ -95,6 +95,52 @@ namespace leveldb {
     const PmemDataStructrueType data_structure; 
 
   };
+
+  /*
+   * Compaction-only iterator over a contiguous table
+   * Decodes entries of PmemBuffer in place, front to back, without
+   * touching skiplist nodes or sorted-array entries.
+   * NOTE: Forward only. SeekToLast(), Prev() are not supported.
+   */
+  class PmemScanIterator: public Iterator {
+   public:
+    PmemScanIterator(uint64_t file_number, PmemSkiplist* pmem_skiplist,
+                     char* start, uint64_t size);
+    ~PmemScanIterator();
+
+    void Seek(const Slice& target);
+    void SeekToFirst();
+    void SeekToLast();
+    void Next();
+    void Prev();
+
+    bool Valid() const;
+    Slice key() const;
+    Slice value() const;
+    Status status() const;
+
+    virtual void* key_ptr() const;
+    virtual char* buffer_ptr() const;
+
+   private:
+    // Decode entry at current_, invalid at limit_
+    void ParseCurrentEntry();
+
+    PmemSkiplist* pmem_skiplist_;
+    uint64_t file_number_;
+    char* const start_;
+    char* const limit_;
+    char* current_; // encoded entry, limit_ = invalid
+    char* next_;
+    Slice key_;
+    Slice value_;
+    Status status_;
+  };
+
+  // Scan iterator if entries of file_number are contiguous in PmemBuffer,
+  // PmemIterator otherwise. Only for compaction inputs.
+  Iterator* NewPmemCompactionIterator(uint64_t file_number,
+                                      PmemSkiplist* pmem_skiplist);
  
 } // namespace leveldb
 
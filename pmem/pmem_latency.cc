@@ -2,55 +2,159 @@
  * [2019.03.20][JH]
  * PMDK-based latency functions
  */
+#include <atomic>
+#include <time.h>
 #include "pmem/pmem_latency.h"
+#include "port/port.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace leveldb {
-/* Return the UNIX time in nanoseconds */
-struct timespec nstimespec(void) {
-    struct timespec spec;
-    clock_gettime(CLOCK_REALTIME, &spec);
-    return spec;
-}
-int nstimeCompare(const struct timespec a, const struct timespec b) {
-    if (a.tv_sec != b.tv_sec) {
-        if (a.tv_sec > b.tv_sec) {
-            return 1;
-        }
-        return -1;
-    }
-    if (a.tv_nsec > b.tv_nsec) {
-        return 1;
-    } else if (a.tv_nsec < b.tv_nsec) {
-        return -1;
-    } else {
-        return 0;
-    }
-}
-
-// Delay function
-void DelayPmemReadNtimes(int n) {
-  // std::this_thread::sleep_for(std::chrono::nanoseconds(READ_DELAY * n));
-	// struct timespec interval, remainder;
-	// interval.tv_nsec = READ_DELAY * n;
-	// nanosleep(&interval, &remainder);
-  struct timespec base = nstimespec();
-  base.tv_nsec += (READ_DELAY * n);
-  while (nstimeCompare(base, nstimespec()) == 1) {
+
+/* Clock */
+// Monotonic time in nanoseconds (no tv_nsec carry to handle)
+static uint64_t NowNanos() {
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return static_cast<uint64_t>(spec.tv_sec) * 1000000000ULL + spec.tv_nsec;
+}
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t ReadTicks() { return __rdtsc(); }
+static inline void SpinPause() { _mm_pause(); }
+#else
+static inline uint64_t ReadTicks() { return NowNanos(); }
+static inline void SpinPause() { }
+#endif
+
+// NOTE: Invariant TSC is assumed (constant rate across cores)
+static double ticks_per_ns = 1.0;
+static port::OnceType calibrate_once = LEVELDB_ONCE_INIT;
+static void CalibrateTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t start_ns = NowNanos();
+  uint64_t start_ticks = ReadTicks();
+  while (NowNanos() - start_ns < PMEM_EMULATION_CALIBRATION_NS) {
   }
+  uint64_t elapsed_ns = NowNanos() - start_ns;
+  uint64_t elapsed_ticks = ReadTicks() - start_ticks;
+  ticks_per_ns = static_cast<double>(elapsed_ticks) / elapsed_ns;
+#endif
 }
-void DelayPmemWriteNtimes(int n) {
-  // std::this_thread::sleep_for(std::chrono::nanoseconds(WRITE_DELAY * n));
-	// struct timespec interval, remainder;
-	// interval.tv_nsec = WRITE_DELAY * n;
-	// nanosleep(&interval, &remainder);
-  struct timespec base = nstimespec();
-  base.tv_nsec += (WRITE_DELAY * n);
-  while (nstimeCompare(base, nstimespec()) == 1) {
+
+/* Model */
+PmemLatencyModel::PmemLatencyModel()
+    : enabled(PMEM_EMULATION),
+      read_latency_ns(PMEM_READ_LATENCY_NS),
+      write_latency_ns(PMEM_WRITE_LATENCY_NS),
+      read_bandwidth_mbps(PMEM_READ_BANDWIDTH_MBPS),
+      write_bandwidth_mbps(PMEM_WRITE_BANDWIDTH_MBPS) {
+}
+
+// NOTE: Read racily by delay functions, a stale model is harmless
+static std::atomic<bool> model_enabled(PMEM_EMULATION);
+static std::atomic<uint64_t> model_read_latency_ns(PMEM_READ_LATENCY_NS);
+static std::atomic<uint64_t> model_write_latency_ns(PMEM_WRITE_LATENCY_NS);
+static std::atomic<uint64_t> model_read_bandwidth_mbps(PMEM_READ_BANDWIDTH_MBPS);
+static std::atomic<uint64_t> model_write_bandwidth_mbps(PMEM_WRITE_BANDWIDTH_MBPS);
+
+void SetPmemLatencyModel(const PmemLatencyModel& model) {
+  if (model.enabled) {
+    port::InitOnce(&calibrate_once, CalibrateTicks);
+  }
+  model_read_latency_ns.store(model.read_latency_ns, std::memory_order_relaxed);
+  model_write_latency_ns.store(model.write_latency_ns, std::memory_order_relaxed);
+  model_read_bandwidth_mbps.store(model.read_bandwidth_mbps,
+                                  std::memory_order_relaxed);
+  model_write_bandwidth_mbps.store(model.write_bandwidth_mbps,
+                                   std::memory_order_relaxed);
+  model_enabled.store(model.enabled, std::memory_order_relaxed);
+}
+PmemLatencyModel GetPmemLatencyModel() {
+  PmemLatencyModel model;
+  model.enabled = model_enabled.load(std::memory_order_relaxed);
+  model.read_latency_ns = model_read_latency_ns.load(std::memory_order_relaxed);
+  model.write_latency_ns = model_write_latency_ns.load(std::memory_order_relaxed);
+  model.read_bandwidth_mbps =
+      model_read_bandwidth_mbps.load(std::memory_order_relaxed);
+  model.write_bandwidth_mbps =
+      model_write_bandwidth_mbps.load(std::memory_order_relaxed);
+  return model;
+}
+
+/* Stats */
+static std::atomic<uint64_t> stat_reads(0);
+static std::atomic<uint64_t> stat_writes(0);
+static std::atomic<uint64_t> stat_read_bytes(0);
+static std::atomic<uint64_t> stat_write_bytes(0);
+static std::atomic<uint64_t> stat_read_delay_ns(0);
+static std::atomic<uint64_t> stat_write_delay_ns(0);
+
+void GetPmemLatencyStats(PmemLatencyStats* stats) {
+  stats->reads = stat_reads.load(std::memory_order_relaxed);
+  stats->writes = stat_writes.load(std::memory_order_relaxed);
+  stats->read_bytes = stat_read_bytes.load(std::memory_order_relaxed);
+  stats->write_bytes = stat_write_bytes.load(std::memory_order_relaxed);
+  stats->read_delay_ns = stat_read_delay_ns.load(std::memory_order_relaxed);
+  stats->write_delay_ns = stat_write_delay_ns.load(std::memory_order_relaxed);
+}
+void ResetPmemLatencyStats() {
+  stat_reads.store(0, std::memory_order_relaxed);
+  stat_writes.store(0, std::memory_order_relaxed);
+  stat_read_bytes.store(0, std::memory_order_relaxed);
+  stat_write_bytes.store(0, std::memory_order_relaxed);
+  stat_read_delay_ns.store(0, std::memory_order_relaxed);
+  stat_write_delay_ns.store(0, std::memory_order_relaxed);
+}
+
+/* Delay */
+// Latency per access + bytes / bandwidth (1 MB/s = 1e6 ps per byte)
+static uint64_t DelayNanos(int accesses, uint64_t bytes,
+                           uint64_t latency_ns, uint64_t bandwidth_mbps) {
+  uint64_t delay_ns = accesses * latency_ns;
+  if (bandwidth_mbps != 0) {
+    delay_ns += bytes * 1000 / bandwidth_mbps;
   }
+  return delay_ns;
+}
+static void Spin(uint64_t delay_ns) {
+  if (delay_ns == 0) return;
+  port::InitOnce(&calibrate_once, CalibrateTicks);
+  uint64_t end = ReadTicks() + static_cast<uint64_t>(delay_ns * ticks_per_ns);
+  while (ReadTicks() < end) {
+    SpinPause();
+  }
+}
+
+void DelayPmemRead(int accesses, uint64_t bytes) {
+  if (!model_enabled.load(std::memory_order_relaxed)) return;
+  uint64_t delay_ns = DelayNanos(accesses, bytes,
+              model_read_latency_ns.load(std::memory_order_relaxed),
+              model_read_bandwidth_mbps.load(std::memory_order_relaxed));
+  Spin(delay_ns);
+  stat_reads.fetch_add(accesses, std::memory_order_relaxed);
+  stat_read_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  stat_read_delay_ns.fetch_add(delay_ns, std::memory_order_relaxed);
+}
+void DelayPmemWrite(int accesses, uint64_t bytes) {
+  if (!model_enabled.load(std::memory_order_relaxed)) return;
+  uint64_t delay_ns = DelayNanos(accesses, bytes,
+              model_write_latency_ns.load(std::memory_order_relaxed),
+              model_write_bandwidth_mbps.load(std::memory_order_relaxed));
+  Spin(delay_ns);
+  stat_writes.fetch_add(accesses, std::memory_order_relaxed);
+  stat_write_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  stat_write_delay_ns.fetch_add(delay_ns, std::memory_order_relaxed);
+}
+void DelayPmemReadNtimes(int n) {
+  DelayPmemRead(n, 0);
+}
+void DelayPmemWriteNtimes(int n) {
+  DelayPmemWrite(n, 0);
 }
 void* pmemobj_direct_latency(PMEMoid oid) {
     DelayPmemReadNtimes(1);
     return pmemobj_direct(oid);
 }
 
-} // namespace leveldb
\ No newline at end of file
+} // namespace leveldb
@@ -1,14 +1,21 @@
 /*
  * [2019.03.20][JH]
  * PMDK-based latency functions
+ *
+ * NVM emulation on DRAM: each access spins for a fixed latency, plus a
+ * per-byte cost of the emulated bandwidth (bandwidth-bound scans).
+ * Spin is on TSC (calibrated once against CLOCK_MONOTONIC), model is
+ * set at runtime (PmemOptions) and can be disabled.
+ * NOTE: Model and stats are global (one per process, not per DB),
+ *       DB::Open replaces the model of DBs opened before.
  */
-#include <libpmemobj.h>
-#include <time.h>
+#ifndef PMEM_LATENCY_H
+#define PMEM_LATENCY_H
 
-// #define READ_DELAY 0
-// #define WRITE_DELAY 0
-#define READ_DELAY 40
-#define WRITE_DELAY 400
+#include <libpmemobj.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pmem/layout.h"
 
 	// DelayPmemReadNtimes(1);
 #define D_RW_LATENCY(o) ({\
@@ -21,9 +28,39 @@
 
 namespace leveldb {
 
+// Emulation model, defaults are PMEM_EMULATION, PMEM_*_LATENCY_NS
+// and PMEM_*_BANDWIDTH_MBPS in pmem/layout.h
+struct PmemLatencyModel {
+  bool enabled;
+  uint64_t read_latency_ns;     // per access
+  uint64_t write_latency_ns;
+  uint64_t read_bandwidth_mbps; // 0 = unlimited (no per-byte cost)
+  uint64_t write_bandwidth_mbps;
+
+  PmemLatencyModel();
+};
+// Emulated accesses and time, counted only while model is enabled
+struct PmemLatencyStats {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  uint64_t read_delay_ns;
+  uint64_t write_delay_ns;
+};
+
+void SetPmemLatencyModel(const PmemLatencyModel& model);
+PmemLatencyModel GetPmemLatencyModel();
+void GetPmemLatencyStats(PmemLatencyStats* stats);
+void ResetPmemLatencyStats();
+
 // NVM latency
+void DelayPmemRead(int accesses, uint64_t bytes);
+void DelayPmemWrite(int accesses, uint64_t bytes);
 void DelayPmemReadNtimes(int n); // DelayPmemReadNtimes(1);
 void DelayPmemWriteNtimes(int n); // DelayPmemWriteNtimes(1);
 void* pmemobj_direct_latency(PMEMoid oid);
 
-}
\ No newline at end of file
+} // namespace leveldb
+
+#endif
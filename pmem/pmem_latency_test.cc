@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2018 Intel Corporation
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+ 
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ 
+SPDX-License-Identifier: BSD-3-Clause
+*/
+
+// For TEST tool
+#include "util/logging.h"
+#include "util/testharness.h"
+
+// For this test
+#include <iostream>
+#include <chrono>
+#include "pmem/pmem_latency.h"
+
+
+using namespace std;
+
+namespace leveldb {
+
+
+class PmemLatencyTest { };
+
+TEST (PmemLatencyTest, Model) {
+	cout << "# Start Latency-Model" << endl;
+  PmemLatencyModel saved = GetPmemLatencyModel();
+  PmemLatencyModel model;
+  model.enabled = true;
+  model.read_latency_ns = 1000;
+  model.read_bandwidth_mbps = 1000; // 1 byte per ns
+  SetPmemLatencyModel(model);
+  ResetPmemLatencyStats();
+
+  // 2 accesses + 1MB scan = 2us + 1ms
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  DelayPmemRead(2, 1 << 20);
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            end - begin).count();
+  PmemLatencyStats stats;
+  GetPmemLatencyStats(&stats);
+  ASSERT_EQ(2, stats.reads);
+  ASSERT_EQ(1 << 20, stats.read_bytes);
+  ASSERT_EQ(2000 + (1 << 20), stats.read_delay_ns);
+  ASSERT_TRUE(elapsed_ns >= stats.read_delay_ns * 9 / 10);
+
+  // Disabled model neither spins nor counts
+  model.enabled = false;
+  SetPmemLatencyModel(model);
+  DelayPmemWriteNtimes(1000);
+  GetPmemLatencyStats(&stats);
+  ASSERT_EQ(0, stats.writes);
+  ASSERT_EQ(0, stats.write_delay_ns);
+
+  SetPmemLatencyModel(saved);
+  ResetPmemLatencyStats();
+	printf("# End Latency-Model\n");
+}
+
+} // namespace leveldb
+
+/* Main */
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
+/* End Main */
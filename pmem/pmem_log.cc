@@ -0,0 +1,282 @@
+/*
+ * PMDK-based write-ahead log
+ */
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include "pmem/pmem_log.h"
+#include "pmem/pmem_latency.h"
+#include "pmem/pmem_skiplist.h" // file_exists
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+  /*
+   * Log file appended by log::Writer
+   * NOTE: Single writer. Contents are flushed on Append, and published
+   *       by Flush() (log::Writer flushes after each physical record).
+   */
+  class PmemLogWritableFile : public WritableFile {
+   public:
+    PmemLogWritableFile(PmemLog* log, uint64_t index, uint64_t log_number,
+                        uint64_t start)
+      : log_(log), index_(index), log_number_(log_number), start_(start),
+        size_(0), published_size_(0), limit_(0) {
+    }
+    ~PmemLogWritableFile() {
+      Close();
+    }
+    virtual Status Append(const Slice& data) {
+      uint64_t end = start_ + size_ + data.size();
+      if (end > limit_) {
+        // NOTE: Limit only grows (obsolete logs are deleted), refresh lazily
+        limit_ = log_->GetWriteLimit();
+        if (end > limit_) {
+          printf("[WARNING][PmemLog][Append] Log %llu is full\n",
+                  (unsigned long long)log_number_);
+          return Status::IOError("pmem log is full, grow log_contents_size");
+        }
+      }
+      log_->CopyIn(start_ + size_, data.data(), data.size());
+      size_ += data.size();
+      return Status::OK();
+    }
+    virtual Status Close() {
+      return Flush();
+    }
+    virtual Status Flush() {
+      if (size_ == published_size_) {
+        return Status::OK();
+      }
+      if (!log_->PublishSize(index_, log_number_, size_)) {
+        return Status::IOError("pmem log is deleted while written");
+      }
+      published_size_ = size_;
+      return Status::OK();
+    }
+    virtual Status Sync() {
+      // NOTE: Flush() already drains, no fsync
+      return Flush();
+    }
+
+   private:
+    PmemLog* log_;
+    const uint64_t index_;
+    const uint64_t log_number_;
+    const uint64_t start_;
+    uint64_t size_;
+    uint64_t published_size_;
+    uint64_t limit_;
+  };
+
+  /* Log file replayed by log::Reader, up to last published size */
+  class PmemLogSequentialFile : public SequentialFile {
+   public:
+    PmemLogSequentialFile(PmemLog* log, uint64_t start, uint64_t size)
+      : log_(log), start_(start), size_(size), pos_(0) {
+    }
+    virtual Status Read(size_t n, Slice* result, char* scratch) {
+      n = std::min(static_cast<uint64_t>(n), size_ - pos_);
+      log_->CopyOut(start_ + pos_, scratch, n);
+      *result = Slice(scratch, n);
+      pos_ += n;
+      return Status::OK();
+    }
+    virtual Status Skip(uint64_t n) {
+      pos_ = std::min(size_, pos_ + n);
+      return Status::OK();
+    }
+
+   private:
+    PmemLog* log_;
+    const uint64_t start_;
+    const uint64_t size_;
+    uint64_t pos_;
+  };
+
+  /* pmdk-based log */
+  PmemLog::PmemLog(std::string pool_path, size_t pool_size,
+                   uint64_t contents_size) {
+    if (!file_exists(pool_path)) {
+      log_pool_ = pobj::pool<root_pmem_log>::create (
+                      pool_path, pool_path,
+                      (unsigned long)pool_size, 0666);
+      root_log_ = log_pool_.get_root();
+      contents_size_ = contents_size;
+
+      pobj::transaction::exec_tx(log_pool_, [&] {
+        root_log_->contents =
+              pobj::make_persistent<char[]>(contents_size_);
+        root_log_->records =
+              pobj::make_persistent<pmem_log_record[]>(PMEM_LOG_RECORD_LIST_SIZE);
+        root_log_->contents_size = contents_size_;
+        root_log_->layout = PMEM_LOG_LAYOUT;
+      });
+    }
+    // exists
+    else {
+      log_pool_ = pobj::pool<root_pmem_log>::open (
+                      pool_path, pool_path);
+      root_log_ = log_pool_.get_root();
+      // NOTE: On mismatch, keep geometry of the pool (records are not
+      //       read here) and DB::Open returns status()
+      char buf[100];
+      if (root_log_->layout != PMEM_LOG_LAYOUT) {
+        snprintf(buf, sizeof(buf), "has layout %llu (not %d), remove the pool",
+                 (unsigned long long)root_log_->layout, PMEM_LOG_LAYOUT);
+        status_ = Status::Corruption(pool_path, buf);
+      }
+      // NOTE: The pool is already laid out
+      contents_size_ = root_log_->contents_size;
+      if (status_.ok() && contents_size_ != contents_size) {
+        snprintf(buf, sizeof(buf), "has contents_size %llu (not %llu)",
+                 (unsigned long long)contents_size_,
+                 (unsigned long long)contents_size);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
+    }
+  }
+  PmemLog::~PmemLog() {
+    log_pool_.close();
+  }
+  void PmemLog::ClearAll() {
+    MutexLock l(&mutex_);
+    for (uint64_t index=0; index<PMEM_LOG_RECORD_LIST_SIZE; index++) {
+      SetRecord(index, 0, 0);
+    }
+  }
+
+  /* Record */
+  int PmemLog::FindRecord(uint64_t log_number) {
+    mutex_.AssertHeld();
+    for (uint64_t index=0; index<PMEM_LOG_RECORD_LIST_SIZE; index++) {
+      if (root_log_->records[index].log_number == log_number) {
+        return (int)index;
+      }
+    }
+    return -1;
+  }
+  // NOTE: start and size first, then log_number publishes the record
+  void PmemLog::SetRecord(uint64_t index, uint64_t log_number, uint64_t start) {
+    struct pmem_log_record* record = &(root_log_->records[index]);
+    if (log_number != 0) {
+      record->start = start;
+      record->size = 0;
+      pmemobj_persist(GetPool(), &(record->start), 2 * sizeof(uint64_t));
+    }
+    record->log_number = log_number;
+    pmemobj_persist(GetPool(), &(record->log_number), sizeof(uint64_t));
+  }
+
+  /* Log file interface */
+  Status PmemLog::NewWritableFile(uint64_t log_number, WritableFile** result) {
+    MutexLock l(&mutex_);
+    // Head: end of newest log
+    uint64_t head = 0;
+    for (uint64_t index=0; index<PMEM_LOG_RECORD_LIST_SIZE; index++) {
+      const struct pmem_log_record& record = root_log_->records[index];
+      if (record.log_number != 0 && record.log_number != log_number) {
+        head = std::max(head, record.start + record.size);
+      }
+    }
+    int index = FindRecord(log_number);
+    if (index < 0) {
+      index = FindRecord(0);
+    }
+    if (index < 0) {
+      *result = nullptr;
+      printf("[ERROR][PmemLog][NewWritableFile] No free record for %llu\n",
+              (unsigned long long)log_number);
+      return Status::IOError("too many pmem logs");
+    }
+    SetRecord(index, log_number, head);
+    *result = new PmemLogWritableFile(this, index, log_number, head);
+    return Status::OK();
+  }
+  Status PmemLog::NewSequentialFile(uint64_t log_number,
+                                    SequentialFile** result) {
+    MutexLock l(&mutex_);
+    int index = FindRecord(log_number);
+    if (log_number == 0 || index < 0) {
+      *result = nullptr;
+      return Status::NotFound("pmem log", std::to_string(log_number));
+    }
+    const struct pmem_log_record& record = root_log_->records[index];
+    *result = new PmemLogSequentialFile(this, record.start, record.size);
+    return Status::OK();
+  }
+  void PmemLog::DeleteLog(uint64_t log_number) {
+    MutexLock l(&mutex_);
+    int index = FindRecord(log_number);
+    if (log_number == 0 || index < 0) {
+      printf("[WARNING][PmemLog][DeleteLog] %llu is not in pool\n",
+              (unsigned long long)log_number);
+      return;
+    }
+    SetRecord(index, 0, 0);
+  }
+  void PmemLog::GetLogNumbers(std::vector<uint64_t>* log_numbers) {
+    MutexLock l(&mutex_);
+    log_numbers->clear();
+    for (uint64_t index=0; index<PMEM_LOG_RECORD_LIST_SIZE; index++) {
+      uint64_t log_number = root_log_->records[index].log_number;
+      if (log_number != 0) {
+        log_numbers->push_back(log_number);
+      }
+    }
+  }
+
+  /* Contents */
+  void PmemLog::CopyIn(uint64_t pos, const char* data, size_t n) {
+    char* contents = root_log_->contents.get();
+    uint64_t offset = pos % contents_size_;
+    size_t first = std::min(static_cast<uint64_t>(n), contents_size_ - offset);
+    pmemobj_memcpy(GetPool(), contents + offset, data, first,
+                   PMEMOBJ_F_MEM_NODRAIN);
+    if (first < n) { // wrap around
+      pmemobj_memcpy(GetPool(), contents, data + first, n - first,
+                     PMEMOBJ_F_MEM_NODRAIN);
+    }
+  }
+  void PmemLog::CopyOut(uint64_t pos, char* scratch, size_t n) {
+    const char* contents = root_log_->contents.get();
+    uint64_t offset = pos % contents_size_;
+    size_t first = std::min(static_cast<uint64_t>(n), contents_size_ - offset);
+    memcpy(scratch, contents + offset, first);
+    if (first < n) { // wrap around
+      memcpy(scratch + first, contents, n - first);
+    }
+  }
+  bool PmemLog::PublishSize(uint64_t index, uint64_t log_number, uint64_t size) {
+    MutexLock l(&mutex_);
+    struct pmem_log_record* record = &(root_log_->records[index]);
+    if (record->log_number != log_number) {
+      return false;
+    }
+    DelayPmemWrite(1, size - record->size);
+    pmemobj_drain(GetPool());
+    record->size = size;
+    pmemobj_persist(GetPool(), &(record->size), sizeof(uint64_t));
+    return true;
+  }
+  uint64_t PmemLog::GetWriteLimit() {
+    MutexLock l(&mutex_);
+    uint64_t oldest = UINT64_MAX;
+    for (uint64_t index=0; index<PMEM_LOG_RECORD_LIST_SIZE; index++) {
+      const struct pmem_log_record& record = root_log_->records[index];
+      if (record.log_number != 0) {
+        oldest = std::min(oldest, record.start);
+      }
+    }
+    return (oldest == UINT64_MAX) ? contents_size_ : oldest + contents_size_;
+  }
+
+  /* Getter */
+  PMEMobjpool* PmemLog::GetPool() {
+    return log_pool_.get_handle();
+  }
+  uint64_t PmemLog::GetContentsSize() {
+    return contents_size_;
+  }
+
+} // namespace leveldb
@@ -0,0 +1,92 @@
+/*
+ * PMDK-based write-ahead log
+ * Log files of DB (records of log::Writer) are kept in a circular
+ * contents area of a pool, instead of files in DB directory.
+ * Flush() and Sync() persist by cache-line flush and fence (no fsync).
+ */
+#ifndef PMEM_LOG_H
+#define PMEM_LOG_H
+
+#include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "pmem/layout.h"
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/transaction.hpp>
+#include <libpmemobj++/pool.hpp>
+
+// use pmem with c++ bindings
+namespace pobj = pmem::obj;
+
+namespace leveldb {
+  struct root_pmem_log;
+  struct pmem_log_record;
+  class PmemLogWritableFile;
+  class PmemLogSequentialFile;
+
+  /* pmdk-based circular log */
+  class PmemLog {
+   public:
+    PmemLog(std::string pool_path, size_t pool_size, uint64_t contents_size);
+    ~PmemLog();
+    void ClearAll();
+    // Not ok if the pool does not match options, the pool must not be
+    // used then
+    Status status() const { return status_; }
+
+    /* Log file interface (log::Writer, log::Reader) */
+    // New empty log at the head, replaces old log of same number
+    Status NewWritableFile(uint64_t log_number, WritableFile** result);
+    // NotFound if log_number is not in pool
+    Status NewSequentialFile(uint64_t log_number, SequentialFile** result);
+    void DeleteLog(uint64_t log_number);
+    void GetLogNumbers(std::vector<uint64_t>* log_numbers);
+
+    /* Getter */
+    PMEMobjpool* GetPool();
+    uint64_t GetContentsSize();
+
+   private:
+    friend class PmemLogWritableFile;
+    friend class PmemLogSequentialFile;
+
+    // Positions are monotonic, contents[pos % contents_size_]
+    void CopyIn(uint64_t pos, const char* data, size_t n); // flush, no drain
+    void CopyOut(uint64_t pos, char* scratch, size_t n);
+    // Drain contents, then persist size of log (8-byte atomic store)
+    bool PublishSize(uint64_t index, uint64_t log_number, uint64_t size);
+    // Logs may write below this position (oldest live log is not overrun)
+    uint64_t GetWriteLimit();
+    // REQUIRES: mutex_ held, -1 if log_number is not in pool
+    int FindRecord(uint64_t log_number);
+    void SetRecord(uint64_t index, uint64_t log_number, uint64_t start);
+
+    /* pmdk access object */
+    pobj::pool<root_pmem_log> log_pool_;
+    pobj::persistent_ptr<root_pmem_log> root_log_;
+    uint64_t contents_size_; // NOTE: fixed on create
+    Status status_;
+
+    // NOTE: Records are changed by DB thread (new log, obsolete log),
+    //       while writer appends to current log without DB mutex
+    port::Mutex mutex_;
+  };
+  /* [log_number -> start, size], log_number 0 = free */
+  struct pmem_log_record {
+    uint64_t log_number;
+    uint64_t start;
+    uint64_t size; // NOTE: persisted by Flush()/Sync(), end of valid records
+  };
+  /* root structure for accessing pmdk */
+  struct root_pmem_log {
+    pobj::persistent_ptr<char[]> contents;
+    pobj::persistent_ptr<pmem_log_record[]> records;
+    pobj::p<uint64_t> contents_size;
+    pobj::p<uint64_t> layout; // NOTE: PMEM_LOG_LAYOUT, 0 = before it
+  };
+
+} // namespace leveldb
+
+#endif
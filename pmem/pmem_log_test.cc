@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2018 Intel Corporation
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+ 
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ 
+SPDX-License-Identifier: BSD-3-Clause
+*/
+
+// For TEST tool
+#include "util/logging.h"
+#include "util/testharness.h"
+
+// For this test
+#include <iostream>
+#include "pmem/pmem_log.h"
+#include "db/log_reader.h"
+#include "db/log_writer.h"
+
+
+using namespace std;
+
+namespace leveldb {
+
+
+class PmemLogTest { };
+
+TEST (PmemLogTest, Circular) {
+	cout << "# Start Pmem-Log" << endl;
+  std::string pool_path = std::string(PMEM_DIR) + "/pmem_log_test";
+  std::remove(pool_path.c_str());
+  const uint64_t contents_size = 1 << 20;
+  PmemLog* pmem_log = new PmemLog(pool_path, (size_t)(16 << 20), contents_size);
+  pmem_log->ClearAll();
+
+  // Log 3 fills 70% of contents, log 4 wraps around once 3 is obsolete
+  std::string record(1000, 'r');
+  const int num_records = (contents_size * 7 / 10) / record.size();
+  for (uint64_t log_number=3; log_number<=4; log_number++) {
+    WritableFile* file;
+    ASSERT_OK(pmem_log->NewWritableFile(log_number, &file));
+    log::Writer writer(file);
+    for (int i=0; i<num_records; i++) {
+      if (log_number == 4 && i == num_records / 4) {
+        pmem_log->DeleteLog(3);
+      }
+      record[0] = 'a' + (i % 26);
+      ASSERT_OK(writer.AddRecord(Slice(record)));
+    }
+    ASSERT_OK(file->Sync());
+    delete file;
+  }
+  // Log 4 is live, no space for a large log after it
+  WritableFile* full;
+  ASSERT_OK(pmem_log->NewWritableFile(5, &full));
+  log::Writer full_writer(full);
+  std::string large(contents_size / 2, 'l');
+  ASSERT_TRUE(!full_writer.AddRecord(Slice(large)).ok());
+  delete full;
+  pmem_log->DeleteLog(5);
+  delete pmem_log;
+
+  // Reopen and replay by log::Reader
+  pmem_log = new PmemLog(pool_path, (size_t)(16 << 20), contents_size);
+  std::vector<uint64_t> log_numbers;
+  pmem_log->GetLogNumbers(&log_numbers);
+  ASSERT_EQ(1, log_numbers.size());
+  ASSERT_EQ(4, log_numbers[0]);
+  SequentialFile* file;
+  ASSERT_TRUE(pmem_log->NewSequentialFile(3, &file).IsNotFound());
+  ASSERT_OK(pmem_log->NewSequentialFile(4, &file));
+  log::Reader reader(file, nullptr, true/*checksum*/, 0/*initial_offset*/);
+  Slice res;
+  std::string scratch;
+  int count = 0;
+  while (reader.ReadRecord(&res, &scratch)) {
+    record[0] = 'a' + (count % 26);
+    ASSERT_EQ(record, res.ToString());
+    count++;
+  }
+  ASSERT_EQ(num_records, count);
+  delete file;
+  delete pmem_log;
+  std::remove(pool_path.c_str());
+	printf("# End Pmem-Log\n");
+}
+
+} // namespace leveldb
+
+/* Main */
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
+/* End Main */
@@ -0,0 +1,151 @@
+/*
+ * PMDK-based memtable pool
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "pmem/pmem_memtable.h"
+#include "pmem/pmem_latency.h"
+#include "pmem/pmem_skiplist.h" // file_exists
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+  PmemMemTablePool::PmemMemTablePool(std::string pool_path,
+                                     uint64_t arena_size) {
+    // NOTE: Arenas keep 8-byte aligned nodes
+    arena_size = (arena_size + 63) & ~static_cast<uint64_t>(63);
+    if (!file_exists(pool_path)) {
+      memtable_pool_ = pobj::pool<root_pmem_memtable>::create (
+                      pool_path, pool_path,
+                      (unsigned long)(PMEM_MEMTABLE_NUM_SLOTS * arena_size +
+                                      PMEM_MEMTABLE_POOL_OVERHEAD), 0666);
+      root_memtable_ = memtable_pool_.get_root();
+      arena_size_ = arena_size;
+
+      pobj::transaction::exec_tx(memtable_pool_, [&] {
+        root_memtable_->arenas = pobj::make_persistent<char[]>(
+                                    PMEM_MEMTABLE_NUM_SLOTS * arena_size_);
+        root_memtable_->slots = pobj::make_persistent<pmem_memtable_slot[]>(
+                                    PMEM_MEMTABLE_NUM_SLOTS);
+        root_memtable_->arena_size = arena_size_;
+      });
+    }
+    // exists
+    else {
+      memtable_pool_ = pobj::pool<root_pmem_memtable>::open (
+                      pool_path, pool_path);
+      root_memtable_ = memtable_pool_.get_root();
+      // NOTE: Use stored size, the pool is already laid out. Larger
+      //       arenas only switch memtables later (write_buffer_size)
+      arena_size_ = root_memtable_->arena_size;
+      if (arena_size_ < arena_size) {
+        char buf[100];
+        snprintf(buf, sizeof(buf), "has arena_size %llu (< %llu)",
+                 (unsigned long long)arena_size_,
+                 (unsigned long long)arena_size);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
+    }
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      attached_[slot] = false;
+    }
+  }
+  PmemMemTablePool::~PmemMemTablePool() {
+    memtable_pool_.close();
+  }
+  void PmemMemTablePool::ClearAll() {
+    MutexLock l(&mutex_);
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      SetSlot(slot, 0);
+    }
+  }
+
+  /* Slot */
+  // NOTE: committed_sequence first, then number publishes the slot
+  void PmemMemTablePool::SetSlot(int slot, uint64_t number) {
+    struct pmem_memtable_slot* s = &(root_memtable_->slots[slot]);
+    if (number != 0) {
+      s->committed_sequence = 0;
+      pmemobj_persist(GetPool(), &(s->committed_sequence), sizeof(uint64_t));
+    }
+    s->number = number;
+    pmemobj_persist(GetPool(), &(s->number), sizeof(uint64_t));
+  }
+  int PmemMemTablePool::NewSlot(uint64_t number) {
+    MutexLock l(&mutex_);
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      if (root_memtable_->slots[slot].number == 0 && !attached_[slot]) {
+        SetSlot(slot, number);
+        return slot;
+      }
+    }
+    printf("[ERROR][PmemMemTablePool][NewSlot] No free slot for %llu\n",
+            (unsigned long long)number);
+    return -1;
+  }
+  int PmemMemTablePool::FindSlot(uint64_t number) {
+    MutexLock l(&mutex_);
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      if (number != 0 && root_memtable_->slots[slot].number == number) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+  void PmemMemTablePool::FreeSlot(uint64_t number) {
+    MutexLock l(&mutex_);
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      if (number != 0 && root_memtable_->slots[slot].number == number) {
+        SetSlot(slot, 0);
+        return;
+      }
+    }
+    printf("[WARNING][PmemMemTablePool][FreeSlot] %llu is not in pool\n",
+            (unsigned long long)number);
+  }
+  void PmemMemTablePool::GetNumbers(std::vector<uint64_t>* numbers) {
+    MutexLock l(&mutex_);
+    numbers->clear();
+    for (int slot=0; slot<PMEM_MEMTABLE_NUM_SLOTS; slot++) {
+      uint64_t number = root_memtable_->slots[slot].number;
+      if (number != 0) {
+        numbers->push_back(number);
+      }
+    }
+  }
+  void PmemMemTablePool::AttachSlot(int slot) {
+    MutexLock l(&mutex_);
+    assert(!attached_[slot]);
+    attached_[slot] = true;
+  }
+  void PmemMemTablePool::ReleaseSlot(int slot) {
+    MutexLock l(&mutex_);
+    attached_[slot] = false;
+  }
+
+  /* Commit */
+  // NOTE: Single writer per slot (DB writer), no mutex
+  void PmemMemTablePool::Commit(int slot, uint64_t sequence) {
+    struct pmem_memtable_slot* s = &(root_memtable_->slots[slot]);
+    DelayPmemWriteNtimes(1);
+    pmemobj_drain(GetPool());
+    s->committed_sequence = sequence;
+    pmemobj_persist(GetPool(), &(s->committed_sequence), sizeof(uint64_t));
+  }
+  uint64_t PmemMemTablePool::GetCommittedSequence(int slot) {
+    return root_memtable_->slots[slot].committed_sequence;
+  }
+
+  /* Getter */
+  char* PmemMemTablePool::GetArena(int slot) {
+    return root_memtable_->arenas.get() + slot * arena_size_;
+  }
+  uint64_t PmemMemTablePool::GetArenaSize() {
+    return arena_size_;
+  }
+  PMEMobjpool* PmemMemTablePool::GetPool() {
+    return memtable_pool_.get_handle();
+  }
+
+} // namespace leveldb
@@ -0,0 +1,91 @@
+/*
+ * PMDK-based memtable pool
+ * Arenas of persistent memtables (db/persistent_skiplist.h). Entries are
+ * durable once inserted, so no write-ahead log is written, and recovery
+ * reattaches the memtables instead of replaying logs.
+ * Each slot holds one memtable, named by the log number it replaces.
+ */
+#ifndef PMEM_MEMTABLE_H
+#define PMEM_MEMTABLE_H
+
+#include <vector>
+#include "leveldb/status.h"
+#include "port/port.h"
+#include "pmem/layout.h"
+#include <libpmemobj++/p.hpp>
+#include <libpmemobj++/persistent_ptr.hpp>
+#include <libpmemobj++/make_persistent_array.hpp>
+#include <libpmemobj++/transaction.hpp>
+#include <libpmemobj++/pool.hpp>
+
+// use pmem with c++ bindings
+namespace pobj = pmem::obj;
+
+namespace leveldb {
+  struct root_pmem_memtable;
+  struct pmem_memtable_slot;
+
+  /* pmdk-based memtable arenas */
+  class PmemMemTablePool {
+   public:
+    PmemMemTablePool(std::string pool_path, uint64_t arena_size);
+    ~PmemMemTablePool();
+    void ClearAll();
+    // Not ok if arenas of the pool are smaller than arena_size, the pool
+    // must not be used then
+    Status status() const { return status_; }
+
+    /* Slot */
+    // New slot for memtable of number, -1 if all slots are in use
+    // NOTE: committed_sequence is reset first, so stale entries of a
+    //       reused arena are never recovered
+    int NewSlot(uint64_t number);
+    // -1 if number is not in pool
+    int FindSlot(uint64_t number);
+    // Obsolete (flushed) memtable, slot is reused after its release
+    void FreeSlot(uint64_t number);
+    void GetNumbers(std::vector<uint64_t>* numbers);
+    // MemTable object is alive on slot (volatile)
+    void AttachSlot(int slot);
+    void ReleaseSlot(int slot);
+
+    /* Commit */
+    // Drain inserted entries, then persist the last sequence of a
+    // completed write batch (8-byte atomic store)
+    void Commit(int slot, uint64_t sequence);
+    uint64_t GetCommittedSequence(int slot);
+
+    /* Getter */
+    char* GetArena(int slot);
+    uint64_t GetArenaSize();
+    PMEMobjpool* GetPool();
+
+   private:
+    void SetSlot(int slot, uint64_t number);
+
+    /* pmdk access object */
+    pobj::pool<root_pmem_memtable> memtable_pool_;
+    pobj::persistent_ptr<root_pmem_memtable> root_memtable_;
+    uint64_t arena_size_; // NOTE: fixed on create
+    Status status_;
+
+    // NOTE: Slots are changed by DB thread, memtables are released by
+    //       any thread holding the last reference
+    port::Mutex mutex_;
+    bool attached_[PMEM_MEMTABLE_NUM_SLOTS];
+  };
+  /* number = log number of memtable, 0 = free */
+  struct pmem_memtable_slot {
+    uint64_t number;
+    uint64_t committed_sequence; // NOTE: entries after it are torn
+  };
+  /* root structure for accessing pmdk */
+  struct root_pmem_memtable {
+    pobj::persistent_ptr<char[]> arenas;
+    pobj::persistent_ptr<pmem_memtable_slot[]> slots;
+    pobj::p<uint64_t> arena_size;
+  };
+
+} // namespace leveldb
+
+#endif
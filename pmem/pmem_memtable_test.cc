@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2018 Intel Corporation
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+ 
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ 
+SPDX-License-Identifier: BSD-3-Clause
+*/
+
+// For TEST tool
+#include "util/logging.h"
+#include "util/testharness.h"
+
+// For this test
+#include <iostream>
+#include "db/dbformat.h"
+#include "db/memtable.h"
+#include "pmem/pmem_memtable.h"
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+
+
+using namespace std;
+
+namespace leveldb {
+
+
+class PmemMemTableTest { };
+
+TEST (PmemMemTableTest, Reattach) {
+	cout << "# Start Pmem-MemTable" << endl;
+  std::string pool_path = std::string(PMEM_DIR) + "/pmem_memtable_test";
+  std::remove(pool_path.c_str());
+  const uint64_t arena_size = 1 << 20;
+  InternalKeyComparator cmp(BytewiseComparator());
+  PmemMemTablePool* pool = new PmemMemTablePool(pool_path, arena_size);
+  pool->ClearAll();
+
+  // Committed entries 1..num_entries, then a torn (uncommitted) entry
+  const int num_entries = 1000;
+  int slot = pool->NewSlot(7);
+  ASSERT_TRUE(slot >= 0);
+  MemTable* mem = new MemTable(cmp, pool, slot, true);
+  mem->Ref();
+  char key[100];
+  for (int i=0; i<num_entries; i++) {
+    snprintf(key, sizeof(key), "key%06d", (i * 7) % num_entries);
+    mem->Add(i + 1, kTypeValue, Slice(key), Slice(std::string(100, 'v')));
+  }
+  mem->Commit(num_entries);
+  mem->Add(num_entries + 1, kTypeDeletion, Slice("key000000"), Slice());
+  ASSERT_TRUE(!mem->HasRoomFor(1, arena_size));
+  mem->Unref();
+  // Slot is live until it is freed
+  ASSERT_TRUE(pool->NewSlot(8) != slot);
+  pool->FreeSlot(8);
+  delete pool;
+
+  // Reopen and reattach (no replay)
+  pool = new PmemMemTablePool(pool_path, arena_size);
+  ASSERT_EQ(slot, pool->FindSlot(7));
+  ASSERT_EQ(num_entries, pool->GetCommittedSequence(slot));
+  mem = new MemTable(cmp, pool, slot, false);
+  mem->Ref();
+  Iterator* iter = mem->NewIterator();
+  int count = 0;
+  std::string prev;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    if (!prev.empty()) {
+      ASSERT_TRUE(cmp.Compare(Slice(prev), iter->key()) < 0);
+    }
+    prev = iter->key().ToString();
+    count++;
+  }
+  ASSERT_EQ(num_entries + 1, count);
+  delete iter;
+  std::string value;
+  Status s;
+  ASSERT_TRUE(mem->Get(LookupKey("key000123", num_entries), &value, &s));
+  ASSERT_EQ(std::string(100, 'v'), value);
+  ASSERT_TRUE(!mem->Get(LookupKey("key001000", num_entries), &value, &s));
+
+  // New entries go after the reattached ones
+  size_t usage = mem->ApproximateMemoryUsage();
+  mem->Add(num_entries + 2, kTypeValue, Slice("key999999"), Slice("v"));
+  mem->Commit(num_entries + 2);
+  ASSERT_TRUE(mem->ApproximateMemoryUsage() > usage);
+  ASSERT_TRUE(mem->Get(LookupKey("key999999", num_entries + 2), &value, &s));
+  ASSERT_EQ("v", value);
+  mem->Unref();
+
+  pool->FreeSlot(7);
+  std::vector<uint64_t> numbers;
+  pool->GetNumbers(&numbers);
+  ASSERT_EQ(0, numbers.size());
+  delete pool;
+  std::remove(pool_path.c_str());
+	printf("# End Pmem-MemTable\n");
+}
+
+} // namespace leveldb
+
+/* Main */
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
+/* End Main */
@@ -4,27 +4,39 @@
  * Include dynamic allocation methods and for iterator functions
  */
 
+#include <assert.h>
 #include <iostream>
 #include <fstream>
 #include "pmem/pmem_skiplist.h"
+#include "leveldb/filter_policy.h"
 
 namespace leveldb {
-  /* Structure for skiplist */
-  struct skiplist_map_entry {
-    char* buffer_ptr;
-  };
-  struct skiplist_map_node {
-    TOID(struct skiplist_map_node) next[SKIPLIST_LEVELS_NUM];
-    struct skiplist_map_entry entry;
-  };
+  /* Structure for skiplist (node: pmem/ds/skiplist_buffer.h) */
   // Register root-manager & node structrue
   // Skiplist single-node
   struct root_skiplist { // head node
     TOID(struct skiplist_map_node) head;
+    uint64_t file_number; // NOTE: owner of this list, 0 = free
+  };
+  /* 
+   * Owner is marked unpublished while its table is built (no TX).
+   * FinishBuild() publishes it by one atomic 8-byte store, 
+   * Recover() discards lists which are still unpublished.
+   */
+  #define SKIPLIST_UNPUBLISHED_OWNER (1ULL << 63)
+  // Sorted-array single-head (kSortedArray)
+  struct root_sorted_array {
+    TOID(struct sorted_array) array;
   };
   // Skiplists manager
   struct root_skiplist_manager {
     pobj::persistent_ptr<root_skiplist[]> skiplists;
+    pobj::p<uint64_t> list_size;
+    pobj::p<uint64_t> node_size;
+    pobj::p<uint64_t> ds_type;   // NOTE: 0 = kSkiplist
+    pobj::persistent_ptr<root_sorted_array[]> sorted_arrays;
+    pobj::p<uint64_t> node_layout; // NOTE: 0 = before SKIPLIST_NODE_LAYOUT
+    pobj::p<uint64_t> num_of_shards; // NOTE: 0 = not set yet
   };
 
   bool file_exists (const std::string &name) {
@@ -34,10 +46,11 @@ namespace leveldb {
   static int
   Print_skiplist(char* key, char* value, int key_len, void *arg)
   {
-    // FIXME: Get value from value_ptr
-    if (strcmp(key, "") != 0)
-      printf("[print] [key %d]:'%s', [value]:'%s'\n", key_len, key, value);
-    delete[] key;
+    // NOTE: key is not null-terminated (binary key in buffer)
+    uint32_t value_len;
+    char* value_ptr = GetValueAndLengthFromBuffer(value, &value_len);
+    printf("[print] [key %d]:'%.*s', [value]:'%.*s'\n", 
+            key_len, key_len, key, value_len, value_ptr);
     return 0;
   }
   /*
@@ -64,16 +77,18 @@ namespace leveldb {
   // Allocated-map
   void InsertAllocatedMap(std::map<uint64_t, uint64_t>* allocated_map, 
                           uint64_t file_number, uint64_t index) {
-    allocated_map->emplace(file_number, index);
-    if (allocated_map->size() > SKIPLIST_MANAGER_LIST_SIZE) {
-      printf("[WARNING][InsertAllocatedMap] map size is full... %d\n", allocated_map->size());
+    bool inserted = allocated_map->emplace(file_number, index).second;
+    if (!inserted) {
+      printf("[WARNING][InsertAllocatedMap] %llu is already allocated\n",
+              (unsigned long long)file_number);
     }
   }
   uint64_t GetIndexFromAllocatedMap(std::map<uint64_t, uint64_t>* allocated_map,
                                     uint64_t file_number) {
     std::map<uint64_t, uint64_t>::iterator iter = allocated_map->find(file_number);
     if (iter == allocated_map->end()) {
-      printf("[WARNING][GetAllocatedMap] Cannot get %d from allocated map\n", file_number);
+      printf("[WARNING][GetAllocatedMap] Cannot get %llu from allocated map\n",
+              (unsigned long long)file_number);
     }
     return iter->second;
   }
@@ -81,7 +96,8 @@ namespace leveldb {
                           uint64_t file_number) {
     int res = allocated_map->erase(file_number);
     if (!res) {
-      printf("[WARNING][EraseAllocatedMap] fail to erase %d\n", file_number);
+      printf("[WARNING][EraseAllocatedMap] fail to erase %llu\n",
+              (unsigned long long)file_number);
     }
   }
   bool CheckMapValidation(std::map<uint64_t, uint64_t>* allocated_map, 
@@ -110,50 +126,102 @@ namespace leveldb {
   }
 
   /* PMDK-based skiplist */
-  PmemSkiplist::PmemSkiplist() {
-    Init(SKIPLIST_MANAGER_PATH);
-  }
-  PmemSkiplist::PmemSkiplist(std::string pool_path) {
-    Init(pool_path);
+  PmemSkiplist::PmemSkiplist()
+      : unpinned_cv_(&map_mutex_) {
+    Init(SKIPLIST_MANAGER_PATH, (size_t)SKIPLIST_MANAGER_POOL_SIZE,
+         SKIPLIST_MANAGER_LIST_SIZE, MAX_SKIPLIST_NODE_SIZE, kSkiplist);
+  }
+  PmemSkiplist::PmemSkiplist(std::string pool_path)
+      : unpinned_cv_(&map_mutex_) {
+    Init(pool_path, (size_t)SKIPLIST_MANAGER_POOL_SIZE,
+         SKIPLIST_MANAGER_LIST_SIZE, MAX_SKIPLIST_NODE_SIZE, kSkiplist);
+  }
+  PmemSkiplist::PmemSkiplist(std::string pool_path, size_t pool_size,
+                             uint64_t list_size, uint64_t node_size)
+      : unpinned_cv_(&map_mutex_) {
+    Init(pool_path, pool_size, list_size, node_size, kSkiplist);
+  }
+  PmemSkiplist::PmemSkiplist(std::string pool_path, size_t pool_size,
+                             uint64_t list_size, uint64_t node_size,
+                             PmemDataStructrueType ds_type)
+      : unpinned_cv_(&map_mutex_) {
+    Init(pool_path, pool_size, list_size, node_size, ds_type);
   }
   PmemSkiplist::~PmemSkiplist() {
     free(skiplists_);
-    free(current_node);
+    free(builders_);
+    free(sorted_arrays_);
     pmemobj_close(GetPool());
   }
-  void PmemSkiplist::Init(std::string pool_path) {
+  void PmemSkiplist::Init(std::string pool_path, size_t pool_size,
+                          uint64_t list_size, uint64_t node_size,
+                          PmemDataStructrueType ds_type) {
+    // NOTE: bytewise order of whole key, until SetComparator()
+    cmp_.cmp = nullptr;
+    cmp_.use_prefix = true;
+    SetBufferBases(std::vector<char*>(), std::vector<uint64_t>());
+    deferred_drain_ = false;
+    root_sorted_array_map_ = nullptr;
     if(!file_exists(pool_path)) {
       skiplist_pool = pobj::pool<root_skiplist_manager>::create (
                       pool_path, pool_path, 
-                      (unsigned long)SKIPLIST_MANAGER_POOL_SIZE, 0666);
+                      (unsigned long)pool_size, 0666);
       // Get Pool
       skiplist_pool_c = skiplist_pool.get_handle();
 
       root_skiplist_ = skiplist_pool.get_root();
+      list_size_ = list_size;
+      pins_.assign(list_size_, 0);
+      ds_type_ = ds_type;
       pobj::transaction::exec_tx(skiplist_pool, [&] {
         // Allocate multiple skiplists
         root_skiplist_->skiplists = 
-              pobj::make_persistent<root_skiplist[]>(SKIPLIST_MANAGER_LIST_SIZE);
+              pobj::make_persistent<root_skiplist[]>(list_size_);
+        if (ds_type_ == kSortedArray) {
+          root_skiplist_->sorted_arrays = 
+                pobj::make_persistent<root_sorted_array[]>(list_size_);
+        }
+        root_skiplist_->list_size = list_size_;
+        root_skiplist_->node_size = node_size;
+        root_skiplist_->ds_type = (uint64_t)ds_type_;
+        root_skiplist_->node_layout = SKIPLIST_NODE_LAYOUT;
       });
       root_skiplist_map_ = (struct root_skiplist *)pmemobj_direct_latency(
          root_skiplist_->skiplists.raw() );
+      if (ds_type_ == kSortedArray) {
+        root_sorted_array_map_ = (struct root_sorted_array *)
+            pmemobj_direct_latency(root_skiplist_->sorted_arrays.raw());
+      }
 
   		skiplists_ = (TOID(struct skiplist_map_node) *) malloc(
-            sizeof(TOID(struct skiplist_map_node)) * SKIPLIST_MANAGER_LIST_SIZE);
-      current_node = (TOID(struct skiplist_map_node) *) malloc(
-            sizeof(TOID(struct skiplist_map_node)) * SKIPLIST_MANAGER_LIST_SIZE);
+            sizeof(TOID(struct skiplist_map_node)) * list_size_);
+      builders_ = (struct skiplist_map_builder *) malloc(
+            sizeof(struct skiplist_map_builder) * list_size_);
+
+      sorted_arrays_ = (TOID(struct sorted_array) *) malloc(
+            sizeof(TOID(struct sorted_array)) * list_size_);
 
       struct hashmap_args args; // empty
       /* create */
-      for (int i=0; i<SKIPLIST_MANAGER_LIST_SIZE; i++) {
+      for (uint64_t i=0; i<list_size_; i++) {
         // printf("i %d\n",i);
-        int res = skiplist_map_create(GetPool(), 
-                  &(root_skiplist_map_[i].head), current_node[i], i, &args);
-        if (res) printf("[CREATE ERROR %d] %d\n",i ,res);
-        else if (i==SKIPLIST_MANAGER_LIST_SIZE-1) printf("[CREATE SUCCESS %d]\n",i);	
+        int res;
+        if (ds_type_ == kSortedArray) {
+          // NOTE: No skiplist nodes, head stays null
+          res = sorted_array_create(GetPool(), 
+                  &(root_sorted_array_map_[i].array), node_size);
+          sorted_arrays_[i] = root_sorted_array_map_[i].array;
+        } else {
+          res = skiplist_map_create(GetPool(), 
+                  &(root_skiplist_map_[i].head), node_size, &args);
+          sorted_arrays_[i] = TOID_NULL(struct sorted_array);
+        }
+        if (res) printf("[CREATE ERROR %llu] %d\n", (unsigned long long)i, res);
+        else if (i==list_size_-1) printf("[CREATE SUCCESS %llu]\n", (unsigned long long)i);	
         skiplists_[i] = root_skiplist_map_[i].head;
-        /* NOTE: Reset current node */
-        ResetCurrentNodeToHeader(i);
+        SetFileNumber(i, 0);
+        /* NOTE: Reset builder to head */
+        ResetBuilder(i);
       }
     } 
     else {
@@ -161,66 +229,194 @@ namespace leveldb {
       skiplist_pool_c = skiplist_pool.get_handle();
 
       root_skiplist_ = skiplist_pool.get_root();
+      // NOTE: On mismatch, keep geometry of the pool (no node is read here)
+      //       and DB::Open returns status()
+      char buf[100];
+      if (root_skiplist_->node_layout != SKIPLIST_NODE_LAYOUT) {
+        // NOTE: Nodes (and array entries) of old layout cannot be read in place
+        snprintf(buf, sizeof(buf), "has node layout %llu (not %d), remove the pool",
+                 (unsigned long long)root_skiplist_->node_layout,
+                 SKIPLIST_NODE_LAYOUT);
+        status_ = Status::Corruption(pool_path, buf);
+      }
       root_skiplist_map_ = (struct root_skiplist *)pmemobj_direct_latency(
          root_skiplist_->skiplists.raw() );
+      // NOTE: The pool is already laid out, tables are indexed by list_size
+      //       and nodes are pre-allocated by node_size
+      list_size_ = root_skiplist_->list_size;
+      if (status_.ok() && 
+          (list_size_ != list_size || root_skiplist_->node_size != node_size)) {
+        snprintf(buf, sizeof(buf), "has list_size %llu, node_size %llu (not %llu, %llu)",
+                 (unsigned long long)list_size_, 
+                 (unsigned long long)root_skiplist_->node_size,
+                 (unsigned long long)list_size, (unsigned long long)node_size);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
+      pins_.assign(list_size_, 0);
+      ds_type_ = (PmemDataStructrueType)(uint64_t)root_skiplist_->ds_type;
+      if (status_.ok() && ds_type_ != ds_type) {
+        snprintf(buf, sizeof(buf), "has ds_type %d (not %d)",
+                 (int)ds_type_, (int)ds_type);
+        status_ = Status::InvalidArgument(pool_path, buf);
+      }
+      if (ds_type_ == kSortedArray) {
+        root_sorted_array_map_ = (struct root_sorted_array *)
+            pmemobj_direct_latency(root_skiplist_->sorted_arrays.raw());
+      }
 
   		skiplists_ = (TOID(struct skiplist_map_node) *) malloc(
-            sizeof(TOID(struct skiplist_map_node)) * SKIPLIST_MANAGER_LIST_SIZE);
-      current_node = (TOID(struct skiplist_map_node) *) malloc(
-            sizeof(TOID(struct skiplist_map_node)) * SKIPLIST_MANAGER_LIST_SIZE);
+            sizeof(TOID(struct skiplist_map_node)) * list_size_);
+      builders_ = (struct skiplist_map_builder *) malloc(
+            sizeof(struct skiplist_map_builder) * list_size_);
+      sorted_arrays_ = (TOID(struct sorted_array) *) malloc(
+            sizeof(TOID(struct sorted_array)) * list_size_);
       
-      for (int i=0; i<SKIPLIST_MANAGER_LIST_SIZE; i++) {
+      for (uint64_t i=0; i<list_size_; i++) {
 				skiplists_[i] = root_skiplist_map_[i].head;
-        ResetCurrentNodeToHeader(i);
+        sorted_arrays_[i] = (ds_type_ == kSortedArray) ? 
+                              root_sorted_array_map_[i].array :
+                              TOID_NULL(struct sorted_array);
+        ResetBuilder(i);
       }
     }
   }
   void PmemSkiplist::ClearAll() {
-    for (int i=0; i<SKIPLIST_MANAGER_LIST_SIZE; i++) {
-      skiplist_map_clear(GetPool(), skiplists_[i]);
+    MutexLock l(&map_mutex_);
+    filter_map_.clear();
+    scan_region_map_.clear();
+    for (uint64_t i=0; i<list_size_; i++) {
+      ClearList(i);
+      SetFileNumber(i, 0);
       // DA: Push all to freelist
       PushFreeList(&free_list_, i);
     }
   }
+  /* 
+   * Recovery on DB::Open
+   * Keep lists owned by live files (MANIFEST), clear the others.
+   * Unpublished lists (crash during build) are cleared, even if
+   * MANIFEST has their number.
+   */
+  void PmemSkiplist::Recover(const std::set<uint64_t>& live_files) {
+    MutexLock l(&map_mutex_);
+    free_list_.clear();
+    allocated_map_.clear();
+    filter_map_.clear();
+    scan_region_map_.clear();
+    pending_deletion_files_.clear();
+    referenced_files_.clear();
+    for (uint64_t i=0; i<list_size_; i++) {
+      uint64_t file_number = root_skiplist_map_[i].file_number;
+      ResetBuilder(i);
+      if (file_number != 0 &&
+          (file_number & SKIPLIST_UNPUBLISHED_OWNER) == 0 &&
+          live_files.find(file_number) != live_files.end() &&
+          !CheckMapValidation(&allocated_map_, file_number)) {
+        InsertAllocatedMap(&allocated_map_, file_number, i);
+      } else {
+        if (file_number != 0) {
+          ClearList(i);
+          SetFileNumber(i, 0);
+        }
+        PushFreeList(&free_list_, i);
+      }
+    }
+  }
 
   /* Wrapper functions */
   void PmemSkiplist::Insert(char* key, char* buffer_ptr, int key_len, 
                             uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
-    int result = skiplist_map_insert(GetPool(), 
-                                      skiplists_[actual_index], 
-                                      &current_node[actual_index],
-                                      key, buffer_ptr,
-                                      key_len, actual_index);
+    uint64_t actual_index = GetInsertIndex(file_number);
+    if (ds_type_ == kSortedArray) {
+      // NOTE: key is read back from buffer_ptr
+      if (sorted_array_append(GetPool(), sorted_arrays_[actual_index], 
+                              &bases_, buffer_ptr, deferred_drain_)) {
+        fprintf(stderr, "[ERROR] insert %llu\n", (unsigned long long)file_number);  
+        abort();
+      }
+      return;
+    }
+    // NOTE: buffer_ptr is written later (FlushBufferToPmemBuffer), input is sorted
+    int result = skiplist_map_builder_add(GetPool(), 
+                                          &builders_[actual_index], &cmp_,
+                                          buffer_ptr, Slice(key, key_len));
     if(result) { 
-      fprintf(stderr, "[ERROR] insert %d\n", file_number);  
+      fprintf(stderr, "[ERROR] insert %llu\n", (unsigned long long)file_number);  
       abort();
     } 
   }
   void PmemSkiplist::InsertByPtr(char* buffer_ptr,
                                  int key_len, uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
-    int result = skiplist_map_insert_by_ptr(GetPool(), 
-                                      skiplists_[actual_index], 
-                                      &current_node[actual_index],
-                                      buffer_ptr, key_len, actual_index);
+    uint64_t actual_index = GetInsertIndex(file_number);
+    if (ds_type_ == kSortedArray) {
+      if (sorted_array_append(GetPool(), sorted_arrays_[actual_index], 
+                              &bases_, buffer_ptr, deferred_drain_)) {
+        fprintf(stderr, "[ERROR] insert_by_oid %llu\n", (unsigned long long)file_number);  
+        abort();
+      }
+      return;
+    }
+    uint32_t buffer_key_len;
+    char* key = GetKeyAndLengthFromBuffer(buffer_ptr, &buffer_key_len);
+    int result = skiplist_map_builder_add(GetPool(), 
+                                          &builders_[actual_index], &cmp_,
+                                          buffer_ptr, Slice(key, buffer_key_len));
     if(result) { 
-      fprintf(stderr, "[ERROR] insert_by_oid %d\n", file_number);  
+      fprintf(stderr, "[ERROR] insert_by_oid %llu\n", (unsigned long long)file_number);  
       abort();
     } 
   }
   void PmemSkiplist::InsertNullNode(uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetInsertIndex(file_number);
+    // NOTE: End of sorted array is num_entries
+    if (ds_type_ == kSortedArray) return;
     int result = skiplist_map_insert_null_node(GetPool(),
-                                skiplists_[actual_index], 
-                                &current_node[actual_index], 
-                                actual_index);
+                                               &builders_[actual_index]);
     if(result) {
-      fprintf(stderr, "[ERROR] insert_null_node %d\n", file_number);  
+      fprintf(stderr, "[ERROR] insert_null_node %llu\n", (unsigned long long)file_number);  
+    }
+  }
+  void PmemSkiplist::FinishBuild(uint64_t file_number) {
+    uint64_t actual_index;
+    if (!FindIndex(file_number, &actual_index)) return;
+    if (ds_type_ == kSortedArray) {
+      sorted_array_publish(GetPool(), sorted_arrays_[actual_index]);
+    } else {
+      skiplist_map_builder_finish(GetPool(), &builders_[actual_index]);
+    }
+    // NOTE: Entries are durable (drained) before owner is published
+    SetFileNumber(actual_index, file_number);
+  }
+  bool PmemSkiplist::Get(uint64_t file_number, const Slice& key,
+                         Slice* res_key, Slice* res_value) {
+    uint64_t actual_index;
+    // NOTE: Walk runs without map_mutex_, DeleteFile of file_number
+    //       waits for it instead of clearing nodes under the reader
+    if (!PinIndex(file_number, &actual_index)) {
+      return false;
+    }
+    char* buffer_ptr;
+    if (ds_type_ == kSortedArray) {
+      struct sorted_array_view view;
+      sorted_array_get_view(GetPool(), sorted_arrays_[actual_index], 
+                            &bases_, &view);
+      uint64_t pos = sorted_array_view_seek(&view, &cmp_, key);
+      buffer_ptr = (pos < view.num_entries) ? 
+                    sorted_array_view_buffer_ptr(&view, pos) : nullptr;
+    } else {
+      buffer_ptr = skiplist_map_get_buffer_ptr(GetPool(), 
+                                    skiplists_[actual_index], &cmp_, key);
     }
+    UnpinIndex(actual_index);
+    if (buffer_ptr == nullptr) {
+      return false;
+    }
+    uint32_t key_len, value_len;
+    char* key_ptr = GetKeyAndLengthFromBuffer(buffer_ptr, &key_len);
+    char* value_ptr = GetValueAndLengthFromBuffer(buffer_ptr, &value_len);
+    *res_key = Slice(key_ptr, key_len);
+    *res_value = Slice(value_ptr, value_len);
+    return true;
   }
   // NOTE: [Deprecated] 
   // char* PmemSkiplist::Get(int index, char *key) {
@@ -228,10 +424,22 @@ namespace leveldb {
   // }
   void PmemSkiplist::Foreach(uint64_t file_number,
         int (*callback)(char* key, char* buffer_ptr, int key_len, void* arg)) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
+    if (ds_type_ == kSortedArray) {
+      struct sorted_array_view view;
+      sorted_array_get_view(GetPool(), sorted_arrays_[actual_index], 
+                            &bases_, &view);
+      for (uint64_t pos=0; pos<view.num_entries; pos++) {
+        char* buffer_ptr = sorted_array_view_buffer_ptr(&view, pos);
+        uint32_t key_len;
+        char* key = GetKeyAndLengthFromBuffer(buffer_ptr, &key_len);
+        if (callback(key, buffer_ptr, key_len, nullptr)) break;
+      }
+      return;
+    }
     int res = skiplist_map_foreach(GetPool(), 
-                                  skiplists_[actual_index], callback, nullptr);
+                                  skiplists_[actual_index], &cmp_,
+                                  callback, nullptr);
   }
   void PmemSkiplist::PrintAll(uint64_t file_number) {
     Foreach(file_number, Print_skiplist);
@@ -239,24 +447,34 @@ namespace leveldb {
   
 
   /* Iterator functions */
-  PMEMoid* PmemSkiplist::GetPrevOID(uint64_t file_number, char* key) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
-    return skiplist_map_get_prev_OID(GetPool(), skiplists_[actual_index], key);
+  bool PmemSkiplist::GetSortedArrayView(uint64_t file_number,
+                                        struct sorted_array_view* view) {
+    uint64_t actual_index;
+    if (ds_type_ != kSortedArray || !FindIndex(file_number, &actual_index)) {
+      view->entries = nullptr;
+      view->num_entries = 0;
+      return false;
+    }
+    sorted_array_get_view(GetPool(), sorted_arrays_[actual_index], 
+                          &bases_, view);
+    return true;
   }
-  PMEMoid* PmemSkiplist::GetOID(uint64_t file_number, char* key) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
-    return skiplist_map_get_OID(GetPool(), skiplists_[actual_index], key);
+  PMEMoid* PmemSkiplist::GetPrevOID(uint64_t file_number, const Slice& key) {
+    uint64_t actual_index = GetIndex(file_number);
+    return skiplist_map_get_prev_OID(GetPool(), skiplists_[actual_index], 
+                                     &cmp_, key);
+  }
+  PMEMoid* PmemSkiplist::GetOID(uint64_t file_number, const Slice& key) {
+    uint64_t actual_index = GetIndex(file_number);
+    return skiplist_map_get_OID(GetPool(), skiplists_[actual_index], 
+                                &cmp_, key);
   }
   PMEMoid* PmemSkiplist::GetFirstOID(uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return skiplist_map_get_first_OID(GetPool(), skiplists_[actual_index]);
   }
   PMEMoid* PmemSkiplist::GetLastOID(uint64_t file_number) {
-    uint64_t actual_index = GetActualIndex(&free_list_, &allocated_map_, 
-                                                  file_number);
+    uint64_t actual_index = GetIndex(file_number);
     return skiplist_map_get_last_OID(GetPool(), skiplists_[actual_index]);
   }
 
@@ -265,20 +483,136 @@ namespace leveldb {
     return skiplist_pool_c;
   }
   size_t PmemSkiplist::GetFreeListSize() {
+    MutexLock l(&map_mutex_);
     return free_list_.size();
   }
   size_t PmemSkiplist::GetAllocatedMapSize() {
+    MutexLock l(&map_mutex_);
     return allocated_map_.size();
   }
+  void PmemSkiplist::GetFileNumbers(std::vector<uint64_t>* file_numbers) {
+    MutexLock l(&map_mutex_);
+    file_numbers->clear();
+    std::map<uint64_t, uint64_t>::iterator iter = allocated_map_.begin();
+    for ( ; iter != allocated_map_.end(); iter++) {
+      file_numbers->push_back(iter->first);
+    }
+  }
+  uint64_t PmemSkiplist::GetListSize() {
+    return list_size_;
+  }
+  PmemDataStructrueType PmemSkiplist::GetDataStructureType() {
+    return ds_type_;
+  }
+  const struct skiplist_map_cmp* PmemSkiplist::GetComparator() {
+    return &cmp_;
+  }
   /* Setter */
-  void PmemSkiplist::ResetCurrentNodeToHeader(uint64_t index) {
-    current_node[index] = skiplists_[index];
+  void PmemSkiplist::ResetBuilder(uint64_t index) {
+    skiplist_map_builder_init(&builders_[index], skiplists_[index],
+                              deferred_drain_);
+  }
+  void PmemSkiplist::SetNumOfShards(uint64_t num_of_shards) {
+    // NOTE: Tables are sharded by file_number % num_of_shards
+    uint64_t stored = root_skiplist_->num_of_shards;
+    if (stored == 0) {
+      root_skiplist_->num_of_shards = num_of_shards;
+      skiplist_pool.persist(root_skiplist_->num_of_shards);
+    } else if (stored != num_of_shards && status_.ok()) {
+      char buf[100];
+      snprintf(buf, sizeof(buf), "pool is shard of %llu (not %llu)",
+               (unsigned long long)stored, (unsigned long long)num_of_shards);
+      status_ = Status::InvalidArgument(buf, "remove the pools");
+    }
+  }
+  void PmemSkiplist::SetDeferredDrain(bool deferred_drain) {
+    deferred_drain_ = deferred_drain;
+    for (uint64_t i=0; i<list_size_; i++) {
+      builders_[i].deferred_drain = deferred_drain;
+    }
+  }
+  void PmemSkiplist::SetBufferBases(const std::vector<char*>& bases,
+                                    const std::vector<uint64_t>& sizes) {
+    assert(bases.size() == sizes.size());
+    buffer_bases_ = bases;
+    buffer_sizes_ = sizes;
+    buffer_order_.resize(bases.size());
+    for (size_t i=0; i<bases.size(); i++) {
+      buffer_order_[i] = i;
+    }
+    // NOTE: Encode searches pools by address
+    std::sort(buffer_order_.begin(), buffer_order_.end(), 
+              [this](uint64_t a, uint64_t b) {
+                return buffer_bases_[a] < buffer_bases_[b];
+              });
+    bases_.num_of_bases = buffer_bases_.size();
+    bases_.bases = buffer_bases_.data();
+    bases_.sizes = buffer_sizes_.data();
+    bases_.order = buffer_order_.data();
+    cmp_.bases = &bases_;
+  }
+  void PmemSkiplist::SetComparator(const Comparator* cmp, bool use_prefix) {
+    cmp_.cmp = cmp;
+    cmp_.use_prefix = use_prefix;
+  }
+  void PmemSkiplist::SetFileNumber(uint64_t index, uint64_t file_number) {
+    // NOTE: Aligned 8-byte store, atomic publish of owner
+    root_skiplist_map_[index].file_number = file_number;
+    pmemobj_persist(GetPool(), &(root_skiplist_map_[index].file_number),
+                    sizeof(uint64_t));
+  }
+  uint64_t PmemSkiplist::GetInsertIndex(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
+    if (CheckMapValidation(&allocated_map_, file_number)) {
+      return GetIndexFromAllocatedMap(&allocated_map_, file_number);
+    }
+    uint64_t new_index = AddFileAndGetNewIndex(&free_list_, &allocated_map_,
+                                               file_number);
+    SetFileNumber(new_index, file_number | SKIPLIST_UNPUBLISHED_OWNER);
+    return new_index;
+  }
+  uint64_t PmemSkiplist::GetIndex(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
+    return GetActualIndex(&free_list_, &allocated_map_, file_number);
+  }
+  void PmemSkiplist::ClearList(uint64_t index) {
+    if (ds_type_ == kSortedArray) {
+      sorted_array_clear(GetPool(), sorted_arrays_[index]);
+    } else {
+      skiplist_map_clear(GetPool(), skiplists_[index]);
+    }
+  }
+  bool PmemSkiplist::FindIndex(uint64_t file_number, uint64_t* index) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, uint64_t>::iterator iter = allocated_map_.find(file_number);
+    if (iter == allocated_map_.end()) {
+      return false;
+    }
+    *index = iter->second;
+    return true;
+  }
+  bool PmemSkiplist::PinIndex(uint64_t file_number, uint64_t* index) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, uint64_t>::iterator iter = allocated_map_.find(file_number);
+    if (iter == allocated_map_.end()) {
+      return false;
+    }
+    *index = iter->second;
+    pins_[*index]++;
+    return true;
+  }
+  void PmemSkiplist::UnpinIndex(uint64_t index) {
+    MutexLock l(&map_mutex_);
+    assert(pins_[index] > 0);
+    if (--pins_[index] == 0) {
+      unpinned_cv_.SignalAll();
+    }
   }
 
 
   bool PmemSkiplist::IsFreeListEmpty() {
     return GetFreeListSize() == 0 || 
-           GetAllocatedMapSize() >= SKIPLIST_MANAGER_LIST_SIZE;
+           GetAllocatedMapSize() >= list_size_;
   }
   // PROGRESS:
   bool PmemSkiplist::IsFreeListEmptyWarning() {
@@ -292,13 +626,29 @@ namespace leveldb {
 
   /* Dynamic allocation */
   void PmemSkiplist::ResetInfo(uint64_t index, uint64_t file_number) {
-    skiplist_map_clear(GetPool(), skiplists_[index]);
-    ResetCurrentNodeToHeader(index);
-    EraseAllocatedMap(&allocated_map_, file_number); // file_number -> index
+    // NOTE: Unmap first, then new readers cannot reach cleared entries
+    {
+      MutexLock l(&map_mutex_);
+      EraseAllocatedMap(&allocated_map_, file_number); // file_number -> index
+      filter_map_.erase(file_number);
+      scan_region_map_.erase(file_number);
+      while (pins_[index] > 0) {
+        unpinned_cv_.Wait();
+      }
+    }
+    ClearList(index);
+    SetFileNumber(index, 0);
+    ResetBuilder(index);
+    MutexLock l(&map_mutex_);
     PushFreeList(&free_list_, index);
   }
   void PmemSkiplist::DeleteFile(uint64_t file_number) {
-    uint64_t old_index = GetIndexFromAllocatedMap(&allocated_map_, file_number);
+    uint64_t old_index;
+    if (!FindIndex(file_number, &old_index)) {
+      printf("[WARNING][PmemSkiplist][DeleteFile] %llu is not allocated\n",
+              (unsigned long long)file_number);
+      return;
+    }
     // printf("[DeleteFile] file_number %d index %d\n", file_number, old_index);
     ResetInfo(old_index, file_number);
     // clear1) pending files
@@ -311,7 +661,12 @@ namespace leveldb {
   }
   // PROGRESS: Check pending_deletion_list (ref_count)
   void PmemSkiplist::DeleteFileWithCheckRef(uint64_t file_number) {
-    uint64_t old_index = GetIndexFromAllocatedMap(&allocated_map_, file_number);
+    uint64_t old_index;
+    if (!FindIndex(file_number, &old_index)) {
+      printf("[WARNING][PmemSkiplist][DeleteFileWithCheckRef] %llu is not allocated\n",
+              (unsigned long long)file_number);
+      return;
+    }
     // printf("[DeleteFileWithCheckRef] file_number %d index %d\n", file_number, old_index);
     std::list<uint64_t>::iterator iter = referenced_files_.begin();
     bool seek_in_referenced_list = false;
@@ -393,8 +748,10 @@ namespace leveldb {
       if (list_iter == referenced_files_.end()) {
         // Cannot find = GC candidate
         printf("GC %d\n", *set_iter);
-        uint64_t index = GetIndexFromAllocatedMap(&allocated_map_, *set_iter);
-        ResetInfo(index, *set_iter);
+        uint64_t index;
+        if (FindIndex(*set_iter, &index)) {
+          ResetInfo(index, *set_iter);
+        }
         set_iter = pending_deletion_files_.erase(set_iter);
       } else {
         // printf("[[%d %d]]\n", *set_iter, *list_iter);
@@ -415,8 +772,44 @@ namespace leveldb {
 
   /* Check whether skiplist is valid in a specific version */
   bool PmemSkiplist::CheckNumberIsInPmem(uint64_t file_number) {
+    MutexLock l(&map_mutex_);
     return CheckMapValidation(&allocated_map_, file_number);
   }
 
+  /* Whole-table filter */
+  void PmemSkiplist::SetFilter(uint64_t file_number, const std::string& filter) {
+    MutexLock l(&map_mutex_);
+    filter_map_[file_number] = filter;
+  }
+  bool PmemSkiplist::KeyMayMatch(const FilterPolicy* policy, uint64_t file_number,
+                       const Slice& key) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, std::string>::iterator iter = 
+                                              filter_map_.find(file_number);
+    if (policy == nullptr || iter == filter_map_.end()) {
+      return true;
+    }
+    return policy->KeyMayMatch(key, Slice(iter->second));
+  }
+
+  /* Scan region */
+  void PmemSkiplist::SetScanRegion(uint64_t file_number, char* start,
+                                   uint64_t size) {
+    MutexLock l(&map_mutex_);
+    scan_region_map_[file_number] = std::make_pair(start, size);
+  }
+  bool PmemSkiplist::GetScanRegion(uint64_t file_number, char** start,
+                                   uint64_t* size) {
+    MutexLock l(&map_mutex_);
+    std::map<uint64_t, std::pair<char*, uint64_t> >::iterator iter = 
+                                          scan_region_map_.find(file_number);
+    if (iter == scan_region_map_.end()) {
+      return false;
+    }
+    *start = iter->second.first;
+    *size = iter->second.second;
+    return true;
+  }
+
 
 } // namespace leveldb 
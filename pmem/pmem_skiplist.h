@@ -8,10 +8,15 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 #include <algorithm> // std::find
 
+#include "leveldb/status.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
 #include "pmem/layout.h"
 #include "pmem/ds/skiplist_buffer.h"
+#include "pmem/ds/sorted_array.h"
 #include "pmem/map/hashmap.h"
 
 // C++
@@ -31,6 +36,18 @@ namespace leveldb {
   struct skiplist_map_node;     // Skiplist Actual node 
   struct root_skiplist;         // Skiplist head
   struct root_skiplist_manager; //  Manager of Multiple Skiplists
+  struct root_sorted_array;     // Sorted-array head
+
+  // Choose data-structure options
+  // kSortedArray: tables share the manager of skiplists (free-list, owner,
+  //               recovery), but each table is indexed by a dense array.
+  enum PmemDataStructrueType {
+    kSkiplist = 0,
+    kHashmap = 1,
+    kSortedArray = 2
+  };
+
+  class FilterPolicy;
 
   bool file_exists (const std::string &name);
   /* 
@@ -60,15 +77,37 @@ namespace leveldb {
    public:
     PmemSkiplist();
     PmemSkiplist(std::string pool_path);
+    PmemSkiplist(std::string pool_path, size_t pool_size,
+                 uint64_t list_size, uint64_t node_size);
+    // ds_type: kSkiplist or kSortedArray, fixed on create
+    PmemSkiplist(std::string pool_path, size_t pool_size,
+                 uint64_t list_size, uint64_t node_size,
+                 PmemDataStructrueType ds_type);
     ~PmemSkiplist();
-    void Init(std::string pool_path);
+    void Init(std::string pool_path, size_t pool_size,
+              uint64_t list_size, uint64_t node_size,
+              PmemDataStructrueType ds_type);
+    // Not ok if the pool does not match options (Init, SetNumOfShards),
+    // the pool must not be used then
+    Status status() const { return status_; }
     void ClearAll();
+    /* Rebuild free_list_, allocated_map_ from persistent owners */
+    void Recover(const std::set<uint64_t>& live_files);
 
     /* Wrapper functions */
     void Insert(char* key, char* buffer_ptr, 
                       int key_len, uint64_t file_number);
     void InsertByPtr(char* buffer_ptr, int key_len, uint64_t file_number);
     void InsertNullNode(uint64_t file_number);
+    // End of table build: drain entries, then publish owner of list
+    void FinishBuild(uint64_t file_number);
+    /* 
+     * Point lookup, reentrant (no shared iterator state)
+     * Return first entry (key >= target) of file_number
+     * NOTE: key & value point into PmemBuffer
+     */
+    bool Get(uint64_t file_number, const Slice& key, 
+             Slice* res_key, Slice* res_value);
     // [Deprecated]
     // char* Get(int index, char *key);
     void Foreach(uint64_t file_number, int (*callback) (
@@ -76,8 +115,11 @@ namespace leveldb {
     void PrintAll(uint64_t file_number);
 
     /* Iterator functions */
-    PMEMoid* GetPrevOID(uint64_t file_number, char* key);
-    PMEMoid* GetOID(uint64_t file_number, char* key);
+    // NOTE: kSortedArray uses GetSortedArrayView() instead of OIDs
+    bool GetSortedArrayView(uint64_t file_number, 
+                            struct sorted_array_view* view);
+    PMEMoid* GetPrevOID(uint64_t file_number, const Slice& key);
+    PMEMoid* GetOID(uint64_t file_number, const Slice& key);
     PMEMoid* GetFirstOID(uint64_t file_number);    
     PMEMoid* GetLastOID(uint64_t file_number);
 
@@ -85,9 +127,27 @@ namespace leveldb {
     PMEMobjpool* GetPool();
     size_t GetFreeListSize();
     size_t GetAllocatedMapSize();
+    // Tables which own a list (including unpublished ones)
+    void GetFileNumbers(std::vector<uint64_t>* file_numbers);
+    uint64_t GetListSize();
+    PmemDataStructrueType GetDataStructureType();
+    const struct skiplist_map_cmp* GetComparator();
 
     /* Setter */
-    void ResetCurrentNodeToHeader(uint64_t index);
+    // Base address and mapped size of each PmemBuffer shard, which nodes
+    // point into. Set once before any insert or read (not thread-safe).
+    void SetBufferBases(const std::vector<char*>& bases,
+                        const std::vector<uint64_t>& sizes);
+    // Next table of the list is built from its head (volatile only)
+    void ResetBuilder(uint64_t index);
+    // cmp: InternalKeyComparator of DB
+    // use_prefix: true only if user comparator is bytewise
+    void SetComparator(const Comparator* cmp, bool use_prefix);
+    void SetFileNumber(uint64_t index, uint64_t file_number);
+    // Entries are flushed without drain until FinishBuild()
+    void SetDeferredDrain(bool deferred_drain);
+    // Persisted on first set, other num_of_shards sets status()
+    void SetNumOfShards(uint64_t num_of_shards);
 
     bool IsFreeListEmpty();
     bool IsFreeListEmptyWarning();
@@ -103,12 +163,52 @@ namespace leveldb {
     /* Check whether skiplist is valid in a specific version */
     bool CheckNumberIsInPmem(uint64_t file_number);
 
+    /* Whole-table filter (DRAM only, not rebuilt on Recover) */
+    void SetFilter(uint64_t file_number, const std::string& filter);
+    // Return true if file_number has no filter
+    bool KeyMayMatch(const FilterPolicy* policy, uint64_t file_number,
+                     const Slice& key);
+
+    /*
+     * Scan region (DRAM only, rebuilt by DBImpl::RecoverPmemTier)
+     * Encoded entries of file_number are exactly [start, start+size) of
+     * PmemBuffer, in key order. Compaction streams it without the index.
+     */
+    void SetScanRegion(uint64_t file_number, char* start, uint64_t size);
+    // Return false if entries of file_number are not contiguous
+    bool GetScanRegion(uint64_t file_number, char** start, uint64_t* size);
+
    private:
+    // Same as GetActualIndex(), but persist owner of new index
+    uint64_t GetInsertIndex(uint64_t file_number);
+    // GetActualIndex() under map_mutex_
+    uint64_t GetIndex(uint64_t file_number);
+    // Read-only, false if file_number is not allocated
+    bool FindIndex(uint64_t file_number, uint64_t* index);
+    // FindIndex(), and list of index is not cleared until UnpinIndex()
+    bool PinIndex(uint64_t file_number, uint64_t* index);
+    void UnpinIndex(uint64_t index);
+    // Clear contents of list (skiplist nodes or sorted array)
+    void ClearList(uint64_t index);
+
+    Status status_;
     struct root_skiplist* root_skiplist_map_;
+    uint64_t list_size_; // NOTE: number of skiplists, fixed on create
+    struct skiplist_map_cmp cmp_; // Key ordering of all skiplists
+    struct skiplist_buffer_bases bases_; // NOTE: read-only after SetBufferBases()
+    std::vector<char*> buffer_bases_;
+    std::vector<uint64_t> buffer_sizes_;
+    std::vector<uint64_t> buffer_order_;
+    bool deferred_drain_;
 
     /* Actual Skiplist interface */
     TOID(struct skiplist_map_node)* skiplists_;
-    TOID(struct skiplist_map_node)* current_node;
+    struct skiplist_map_builder* builders_; // one per list, no shared state
+
+    /* Sorted-array interface (kSortedArray) */
+    PmemDataStructrueType ds_type_;
+    struct root_sorted_array* root_sorted_array_map_;
+    TOID(struct sorted_array)* sorted_arrays_;
     
     /* pmdk access object */
     PMEMobjpool* skiplist_pool_c;
@@ -116,8 +216,14 @@ namespace leveldb {
     pobj::persistent_ptr<root_skiplist_manager> root_skiplist_;
 
     /* Dynamic allocation */
+    // NOTE: Readers (Get) run without DB mutex, so guard maps by map_mutex_
+    port::Mutex map_mutex_;
+    port::CondVar unpinned_cv_; // NOTE: ResetInfo waits for readers of index
+    std::vector<uint32_t> pins_; // [ index -> readers walking the list ]
     std::list<uint64_t> free_list_;
     std::map<uint64_t, uint64_t> allocated_map_; // [ file_number -> index ]
+    std::map<uint64_t, std::string> filter_map_; // [ file_number -> filter ]
+    std::map<uint64_t, std::pair<char*, uint64_t> > scan_region_map_; // [ file_number -> (start, size) ]
 
     /* Pending deletion files by ref_count */
     std::set<uint64_t> pending_deletion_files_;
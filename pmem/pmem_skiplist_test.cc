@@ -38,6 +38,11 @@ SPDX-License-Identifier: BSD-3-Clause
 #include <fstream> //file_exists
 #include <chrono>
 #include "pmem/pmem_skiplist.h"
+#include "pmem/pmem_buffer.h"
+#include "pmem/pmem_iterator.h"
+#include "leveldb/env.h"
+#include "leveldb/filter_policy.h"
+#include "port/atomic_pointer.h"
 
 #define NUM_SKIPLISTS 3
 
@@ -56,6 +61,33 @@ file_exists (const std::string &name)
 	return f.good ();
 }
 
+/*
+ * Tables of the tests: entries "key%06d" (9 bytes) -> "value",
+ * written to PmemBuffer and indexed by PmemSkiplist
+ */
+static std::string EncodeTestEntries(int num_keys, int step) {
+  std::string entries;
+  for (int i=0; i<num_keys; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%06d", i * step);
+    EncodeToBuffer(&entries, Slice(key), Slice("value"));
+  }
+  return entries;
+}
+// Write entries as file_number, then index first num_indexed of them
+static char* BuildTestTable(PmemBuffer* pmem_buffer, PmemSkiplist* pmem_list,
+                            uint64_t file_number, const std::string& entries,
+                            int num_indexed) {
+  char* start = pmem_buffer->GetStartOffset(file_number);
+  pmem_buffer->SequentialWrite(file_number, Slice(entries));
+  int offset = 0;
+  for (int i=0; i<num_indexed; i++) {
+    pmem_list->InsertByPtr(start + offset, 9, file_number);
+    offset += GetEncodedLength(9, 5);
+  }
+  return start;
+}
+
 TEST (PmemSkiplistTest, Skiplist_manager) {
 	cout << "# Start Skiplist_manager" << endl;
 
@@ -169,6 +201,340 @@ TEST (PmemSkiplistTest, Skiplist_manager) {
 	printf("# End Skiplist_map\n");
 }
 
+TEST (PmemSkiplistTest, Filter) {
+	cout << "# Start Skiplist Filter" << endl;
+  const FilterPolicy* policy = NewBloomFilterPolicy(10);
+  PmemSkiplist* pmem_skiplist = new PmemSkiplist(SKIPLIST_MANAGER_PATH_0);
+  pmem_skiplist->ClearAll();
+
+  Slice keys[2] = { Slice("hello"), Slice("world") };
+  std::string filter;
+  policy->CreateFilter(keys, 2, &filter);
+  // No filter, must not skip
+  ASSERT_TRUE(pmem_skiplist->KeyMayMatch(policy, 21, Slice("missing")));
+  pmem_skiplist->SetFilter(21, filter);
+  ASSERT_TRUE(pmem_skiplist->KeyMayMatch(policy, 21, Slice("hello")));
+  ASSERT_TRUE(pmem_skiplist->KeyMayMatch(policy, 21, Slice("world")));
+  ASSERT_TRUE(!pmem_skiplist->KeyMayMatch(policy, 21, Slice("missing")));
+  ASSERT_TRUE(pmem_skiplist->KeyMayMatch(nullptr, 21, Slice("missing")));
+  pmem_skiplist->ClearAll();
+  ASSERT_TRUE(pmem_skiplist->KeyMayMatch(policy, 21, Slice("missing")));
+
+  delete pmem_skiplist;
+  delete policy;
+	cout << "# End Skiplist Filter" << endl;
+}
+
+TEST (PmemSkiplistTest, SortedArraySeek) {
+	cout << "# Start Skiplist SortedArraySeek" << endl;
+  const int num_keys = 100;
+  std::string entries = EncodeTestEntries(num_keys, 2); // even keys
+  std::string pool_path = std::string(PMEM_DIR) + "/sorted_array_test";
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  PmemSkiplist* pmem_array = new PmemSkiplist(pool_path, 
+                                    (size_t)(64 << 20), 4, num_keys, 
+                                    kSortedArray);
+  SetBufferBases(pmem_array, &pmem_buffer, 1);
+  ASSERT_EQ(kSortedArray, pmem_array->GetDataStructureType());
+  pmem_buffer->ClearAll();
+  pmem_array->ClearAll();
+  BuildTestTable(pmem_buffer, pmem_array, 13, entries, num_keys);
+
+  PmemIterator* iter = new PmemIterator(13, pmem_array);
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("key000000", iter->key().ToString());
+  int count = 0;
+  for ( ; iter->Valid(); iter->Next()) count++;
+  ASSERT_EQ(num_keys, count);
+  iter->Seek(Slice("key000051")); // between keys
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("key000052", iter->key().ToString());
+  ASSERT_EQ("value", iter->value().ToString());
+  iter->Prev();
+  ASSERT_EQ("key000050", iter->key().ToString());
+  iter->Seek(Slice("key000198"));
+  ASSERT_EQ("key000198", iter->key().ToString());
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  iter->SeekToLast();
+  ASSERT_EQ("key000198", iter->key().ToString());
+  iter->Seek(Slice("a"));
+  ASSERT_EQ("key000000", iter->key().ToString());
+  iter->Prev();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+
+  Slice res_key, res_value;
+  for (int i=0; i<num_keys * 2; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%06d", i);
+    bool found = pmem_array->Get(13, Slice(key), &res_key, &res_value);
+    if (i == num_keys * 2 - 1) {
+      ASSERT_TRUE(!found);
+    } else {
+      ASSERT_TRUE(found);
+      char expected[16];
+      snprintf(expected, sizeof(expected), "key%06d", (i + 1) / 2 * 2);
+      ASSERT_EQ(std::string(expected), res_key.ToString());
+    }
+  }
+  delete pmem_array;
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	cout << "# End Skiplist SortedArraySeek" << endl;
+}
+
+TEST (PmemSkiplistTest, SkiplistBulkBuild) {
+	cout << "# Start Skiplist SkiplistBulkBuild" << endl;
+  const int num_keys = 100;
+  std::string entries = EncodeTestEntries(num_keys, 2); // even keys
+  std::string pool_path = std::string(PMEM_DIR) + "/skiplist_build_test";
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  PmemSkiplist* pmem_skiplist = new PmemSkiplist(pool_path, 
+                                    (size_t)(64 << 20), 4, num_keys, 
+                                    kSkiplist);
+  SetBufferBases(pmem_skiplist, &pmem_buffer, 1);
+  Slice res_key, res_value;
+  // 2nd round re-builds shorter table on same lists, over stale towers
+  for (int round=0; round<2; round++) {
+    int table_keys = (round == 0) ? num_keys : num_keys / 3;
+    pmem_buffer->ClearAll();
+    pmem_skiplist->ClearAll();
+    BuildTestTable(pmem_buffer, pmem_skiplist, 14, entries, table_keys);
+    for (int i=0; i<num_keys * 2; i++) {
+      char key[16];
+      snprintf(key, sizeof(key), "key%06d", i);
+      bool found = pmem_skiplist->Get(14, Slice(key), &res_key, &res_value);
+      if (i >= table_keys * 2 - 1) {
+        ASSERT_TRUE(!found);
+      } else {
+        ASSERT_TRUE(found);
+        char expected[16];
+        snprintf(expected, sizeof(expected), "key%06d", (i + 1) / 2 * 2);
+        ASSERT_EQ(std::string(expected), res_key.ToString());
+      }
+    }
+  }
+  delete pmem_skiplist;
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	cout << "# End Skiplist SkiplistBulkBuild" << endl;
+}
+
+TEST (PmemSkiplistTest, GrowByExtents) {
+	cout << "# Start Skiplist GrowByExtents" << endl;
+  // More entries than pre-allocated nodes, over one extent
+  const int num_keys = SKIPLIST_EXTENT_MIN_NODES * 3;
+  std::string entries = EncodeTestEntries(num_keys, 1);
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+
+  PmemDataStructrueType ds_types[2] = { kSkiplist, kSortedArray };
+  for (int t=0; t<2; t++) {
+    std::string pool_path = std::string(PMEM_DIR) + "/grow_test";
+    std::remove(pool_path.c_str());
+    PmemSkiplist* pmem_list = new PmemSkiplist(pool_path, 
+                                      (size_t)(64 << 20), 2, 16, ds_types[t]);
+    SetBufferBases(pmem_list, &pmem_buffer, 1);
+    pmem_buffer->ClearAll();
+    pmem_list->ClearAll();
+    char* start = BuildTestTable(pmem_buffer, pmem_list, 15, entries, num_keys);
+    PmemIterator* iter = new PmemIterator(15, pmem_list);
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) count++;
+    ASSERT_EQ(num_keys, count);
+    delete iter;
+    Slice res_key, res_value;
+    ASSERT_TRUE(pmem_list->Get(15, Slice("key002999"), &res_key, &res_value));
+    ASSERT_EQ("key002999", res_key.ToString());
+
+    // Grown list is reused by a smaller table
+    pmem_list->DeleteFile(15);
+    pmem_list->InsertByPtr(start, 9, 16);
+    iter = new PmemIterator(16, pmem_list);
+    count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) count++;
+    ASSERT_EQ(1, count);
+    delete iter;
+    delete pmem_list;
+    std::remove(pool_path.c_str());
+  }
+  delete pmem_buffer;
+	cout << "# End Skiplist GrowByExtents" << endl;
+}
+
+TEST (PmemSkiplistTest, DeferredDrain) {
+	cout << "# Start Skiplist DeferredDrain" << endl;
+  const int num_keys = 100;
+  std::string entries = EncodeTestEntries(num_keys, 1);
+  PmemDataStructrueType ds_types[2] = { kSkiplist, kSortedArray };
+  for (int t=0; t<2; t++) {
+    std::string pool_path = std::string(PMEM_DIR) + "/deferred_drain_test";
+    std::remove(pool_path.c_str());
+    PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+    PmemSkiplist* pmem_list = new PmemSkiplist(pool_path, 
+                                      (size_t)(64 << 20), 2, num_keys, ds_types[t]);
+    SetBufferBases(pmem_list, &pmem_buffer, 1);
+    pmem_buffer->ClearAll();
+    pmem_list->ClearAll();
+    pmem_buffer->SetDeferredDrain(true);
+    pmem_list->SetDeferredDrain(true);
+    char* start = BuildTestTable(pmem_buffer, pmem_list, 17, entries, num_keys);
+    pmem_buffer->Drain();
+    pmem_list->FinishBuild(17);
+    // Crash during build of 18, it is never published
+    pmem_list->InsertByPtr(start, 9, 18);
+    delete pmem_list;
+    delete pmem_buffer;
+
+    // Reopen, table is durable after drain
+    std::set<uint64_t> live_files;
+    live_files.insert(17);
+    live_files.insert(18);
+    pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+    pmem_list = new PmemSkiplist(pool_path, 
+                        (size_t)(64 << 20), 2, num_keys, ds_types[t]);
+    SetBufferBases(pmem_list, &pmem_buffer, 1);
+    pmem_buffer->Recover(live_files);
+    pmem_list->Recover(live_files);
+    ASSERT_TRUE(pmem_list->CheckNumberIsInPmem(17));
+    ASSERT_TRUE(!pmem_list->CheckNumberIsInPmem(18));
+    Slice res_key, res_value;
+    for (int i=0; i<num_keys; i++) {
+      char key[16];
+      snprintf(key, sizeof(key), "key%06d", i);
+      ASSERT_TRUE(pmem_list->Get(17, Slice(key), &res_key, &res_value));
+      ASSERT_EQ(std::string(key), res_key.ToString());
+      ASSERT_EQ("value", res_value.ToString());
+    }
+    delete pmem_list;
+    delete pmem_buffer;
+    std::remove(pool_path.c_str());
+  }
+	cout << "# End Skiplist DeferredDrain" << endl;
+}
+
+TEST (PmemSkiplistTest, CompactionScan) {
+	cout << "# Start Skiplist CompactionScan" << endl;
+  const int num_keys = 100;
+  std::string entries = EncodeTestEntries(num_keys, 1);
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  PmemSkiplist* pmem_skiplist = new PmemSkiplist(SKIPLIST_MANAGER_PATH_0);
+  SetBufferBases(pmem_skiplist, &pmem_buffer, 1);
+  pmem_buffer->ClearAll();
+  pmem_skiplist->ClearAll();
+  char* start = BuildTestTable(pmem_buffer, pmem_skiplist, 21, entries, num_keys);
+  // 22 points to every other entry of 21, not contiguous
+  for (int i=0; i<num_keys; i+=2) {
+    pmem_skiplist->InsertByPtr(start + i * GetEncodedLength(9, 5), 9, 22);
+  }
+  pmem_skiplist->SetScanRegion(21, start, entries.size());
+
+  // Scan gives same entries (and buffer pointers) as index
+  Iterator* scan = NewPmemCompactionIterator(21, pmem_skiplist);
+  ASSERT_TRUE(dynamic_cast<PmemScanIterator*>(scan) != nullptr);
+  PmemIterator* iter = new PmemIterator(21, pmem_skiplist);
+  int count = 0;
+  for (scan->SeekToFirst(), iter->SeekToFirst(); iter->Valid(); 
+       scan->Next(), iter->Next()) {
+    ASSERT_TRUE(scan->Valid());
+    ASSERT_EQ(iter->key().ToString(), scan->key().ToString());
+    ASSERT_EQ(iter->value().ToString(), scan->value().ToString());
+    ASSERT_TRUE(iter->buffer_ptr() == scan->buffer_ptr());
+    count++;
+  }
+  ASSERT_TRUE(!scan->Valid());
+  ASSERT_TRUE(scan->status().ok());
+  ASSERT_EQ(num_keys, count);
+  scan->Seek(Slice("key000050"));
+  ASSERT_TRUE(scan->Valid());
+  ASSERT_EQ("key000050", scan->key().ToString());
+  delete iter;
+  delete scan;
+
+  // Table without scan region falls back to index
+  scan = NewPmemCompactionIterator(22, pmem_skiplist);
+  ASSERT_TRUE(dynamic_cast<PmemIterator*>(scan) != nullptr);
+  delete scan;
+  uint64_t size;
+  ASSERT_TRUE(pmem_skiplist->GetScanRegion(21, &start, &size));
+  pmem_skiplist->DeleteFile(21);
+  ASSERT_TRUE(!pmem_skiplist->GetScanRegion(21, &start, &size));
+  delete pmem_skiplist;
+  delete pmem_buffer;
+	cout << "# End Skiplist CompactionScan" << endl;
+}
+
+namespace {
+struct GetThreadState {
+  PmemSkiplist* pmem_skiplist;
+  port::AtomicPointer file_number; // table under Get, as uintptr_t
+  port::AtomicPointer stop;
+  port::AtomicPointer done;
+  int num_found;
+};
+static void GetThreadBody(void* arg) {
+  GetThreadState* state = reinterpret_cast<GetThreadState*>(arg);
+  Slice res_key, res_value;
+  while (state->stop.Acquire_Load() == nullptr) {
+    uint64_t file_number = reinterpret_cast<uintptr_t>(
+                                state->file_number.Acquire_Load());
+    // NOTE: Either not found, or entry of the table (never cleared nodes)
+    if (state->pmem_skiplist->Get(file_number, Slice("key000050"),
+                                  &res_key, &res_value)) {
+      ASSERT_EQ("key000050", res_key.ToString());
+      ASSERT_EQ("value", res_value.ToString());
+      state->num_found++;
+    }
+  }
+  state->done.Release_Store(state);
+}
+}  // namespace
+
+TEST (PmemSkiplistTest, ConcurrentGetAndDelete) {
+	cout << "# Start Skiplist ConcurrentGetAndDelete" << endl;
+  const int num_keys = 100;
+  std::string entries = EncodeTestEntries(num_keys, 1);
+  std::string pool_path = std::string(PMEM_DIR) + "/skiplist_concurrent_test";
+  std::remove(pool_path.c_str());
+  PmemBuffer* pmem_buffer = new PmemBuffer(BUFFER_PATH_0);
+  PmemSkiplist* pmem_skiplist = new PmemSkiplist(pool_path, 
+                                    (size_t)(64 << 20), 4, num_keys, 
+                                    kSkiplist);
+  SetBufferBases(pmem_skiplist, &pmem_buffer, 1);
+  pmem_buffer->ClearAll();
+  pmem_skiplist->ClearAll();
+
+  GetThreadState state;
+  state.pmem_skiplist = pmem_skiplist;
+  state.file_number.Release_Store(nullptr);
+  state.stop.Release_Store(nullptr);
+  state.done.Release_Store(nullptr);
+  state.num_found = 0;
+  Env::Default()->StartThread(GetThreadBody, &state);
+  // Lists are deleted and rebuilt under the reader
+  for (uint64_t file_number=1; file_number<=200; file_number++) {
+    BuildTestTable(pmem_buffer, pmem_skiplist, file_number, entries, num_keys);
+    pmem_skiplist->FinishBuild(file_number);
+    state.file_number.Release_Store(reinterpret_cast<void*>(
+                                        static_cast<uintptr_t>(file_number)));
+    Env::Default()->SleepForMicroseconds(100);
+    pmem_skiplist->DeleteFile(file_number);
+    pmem_buffer->DeleteFile(file_number);
+  }
+  state.stop.Release_Store(&state);
+  while (state.done.Acquire_Load() == nullptr) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  printf("found %d\n", state.num_found);
+  ASSERT_EQ(4, pmem_skiplist->GetFreeListSize());
+
+  delete pmem_skiplist;
+  delete pmem_buffer;
+  std::remove(pool_path.c_str());
+	cout << "# End Skiplist ConcurrentGetAndDelete" << endl;
+}
+
 } // namespace leveldb
 
 /* Main */
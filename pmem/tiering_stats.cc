@@ -5,6 +5,17 @@
 
 namespace leveldb {
 
+  Tiering_stats::tiering() 
+      : LRU_fileNumber_list(NUM_OF_SKIPLIST_MANAGER),
+        compaction_count(0) {
+  }
+  void Tiering_stats::SetNumOfShards(int num_of_shards) {
+    LRU_fileNumber_list.clear();
+    LRU_fileNumber_list.resize(num_of_shards);
+    pinned_list.clear();
+    LRU_index.clear();
+  }
+
   bool Tiering_stats::IsInFileSet(uint64_t number) {
     std::set<uint64_t>::iterator iter = file_set.find(number);
     if (iter != file_set.end()) {
@@ -40,6 +51,7 @@ namespace leveldb {
     if (DeleteFromSet(&file_set, number) <= 0) {
       printf("[WARN][DeleteFromFileSet] no deleted_file %d in file set\n", number);
     }
+    read_count.erase(number);
   }
   void Tiering_stats::DeleteFromSkiplistSet(uint64_t number) {
     if (DeleteFromSet(&skiplist_set, number) <= 0) {
@@ -49,50 +61,155 @@ namespace leveldb {
   }
 
   void Tiering_stats::PushToNumberListInPmem(int level, uint64_t number) {
+    if (LRU_index.find(number) != LRU_index.end()) {
+      printf("[WARNING][Tiering_stats][PushToNumberListInPmem] %lu is already in list\n", number);
+      return;
+    }
     level_number ln;
     ln.level = level;
     ln.number = number;
-    LRU_fileNumber_list[number % NUM_OF_SKIPLIST_MANAGER].push_back(ln);
-  }
-  /* Deprecated function */
-  // level_number Tiering_stats::PopFromNumberListInPmem(uint64_t number) {
-  //   int index = number % NUM_OF_SKIPLIST_MANAGER;
-  //   if (LRU_fileNumber_list[index].size() == 0) {
-  //     printf("[WARNING][Tiering_stats][PopFromNumberListInPmem] List is empty..\n");
-  //   }
-  //   level_number first = LRU_fileNumber_list[index].front();
-  //   LRU_fileNumber_list[index].pop_front();
-  //   return first;
-  // }
+    ln.birth = compaction_count;
+    ln.pins = 0;
+    std::list<level_number>* list = 
+            &LRU_fileNumber_list[number % LRU_fileNumber_list.size()];
+    LRU_index[number] = list->insert(list->end(), ln);
+  }
   void Tiering_stats::RemoveFromNumberListInPmem(uint64_t number) {
-    int index = number % NUM_OF_SKIPLIST_MANAGER;
-    std::list<level_number>::iterator iter = LRU_fileNumber_list[index].begin();
-    while ( iter != LRU_fileNumber_list[index].end()) {
-      if (iter->number == number) {
-          LRU_fileNumber_list[index].erase(iter);
-        break;
+    std::unordered_map<uint64_t, std::list<level_number>::iterator>::iterator 
+            index_iter = LRU_index.find(number);
+    if (index_iter == LRU_index.end()) return;
+    std::list<level_number>::iterator iter = index_iter->second;
+    if (iter->pins > 0) {
+      pinned_list.erase(iter);
+    } else {
+      LRU_fileNumber_list[number % LRU_fileNumber_list.size()].erase(iter);
+    }
+    LRU_index.erase(index_iter);
+  }
+  void Tiering_stats::TouchInPmem(uint64_t number) {
+    std::unordered_map<uint64_t, std::list<level_number>::iterator>::iterator 
+            index_iter = LRU_index.find(number);
+    if (index_iter == LRU_index.end()) return;
+    std::list<level_number>::iterator iter = index_iter->second;
+    if (iter->pins > 0) return; // NOTE: Goes to MRU end on unpin
+    std::list<level_number>* list = 
+            &LRU_fileNumber_list[number % LRU_fileNumber_list.size()];
+    list->splice(list->end(), *list, iter);
+  }
+  void Tiering_stats::PinInPmem(uint64_t number) {
+    std::unordered_map<uint64_t, std::list<level_number>::iterator>::iterator 
+            index_iter = LRU_index.find(number);
+    if (index_iter == LRU_index.end()) return;
+    std::list<level_number>::iterator iter = index_iter->second;
+    if (iter->pins++ == 0) {
+      pinned_list.splice(pinned_list.end(),
+          LRU_fileNumber_list[number % LRU_fileNumber_list.size()], iter);
+    }
+  }
+  void Tiering_stats::UnpinInPmem(uint64_t number) {
+    std::unordered_map<uint64_t, std::list<level_number>::iterator>::iterator 
+            index_iter = LRU_index.find(number);
+    if (index_iter == LRU_index.end()) return;
+    std::list<level_number>::iterator iter = index_iter->second;
+    if (iter->pins == 0) {
+      printf("[WARNING][Tiering_stats][UnpinInPmem] %lu is not pinned\n", number);
+      return;
+    }
+    if (--iter->pins == 0) {
+      std::list<level_number>* list = 
+              &LRU_fileNumber_list[number % LRU_fileNumber_list.size()];
+      list->splice(list->end(), pinned_list, iter);
+    }
+  }
+  void Tiering_stats::SetLevelInPmem(uint64_t number, int level) {
+    std::unordered_map<uint64_t, std::list<level_number>::iterator>::iterator 
+            index_iter = LRU_index.find(number);
+    if (index_iter == LRU_index.end()) return;
+    index_iter->second->level = level;
+    index_iter->second->birth = compaction_count;
+  }
+
+
+  /* ColdDataTiering */
+  void Tiering_stats::IncreaseCompactionCount() {
+    compaction_count++;
+    // NOTE: Decay, so the hot set can change over time
+    if (compaction_count % PROMOTION_DECAY_COMPACTIONS == 0) {
+      std::map<uint64_t, uint64_t>::iterator iter = read_count.begin();
+      while (iter != read_count.end()) {
+        iter->second /= 2;
+        if (iter->second == 0) {
+          iter = read_count.erase(iter);
+        } else {
+          iter++;
+        }
       }
-      iter++;
     }
   }
-  level_number Tiering_stats::GetElementFromNumberListInPmem(uint64_t number, uint64_t n) {
-    int index = number % NUM_OF_SKIPLIST_MANAGER;
-    // printf("%d] size %d \n",n, LRU_fileNumber_list[index].size());
-    std::list<level_number>::iterator iter = 
-            LRU_fileNumber_list[index].begin();
-    uint64_t res = 0;
-    if (LRU_fileNumber_list[index].size() > n) {
-      for (int i=0; i<n; i++) {
-        iter++;
+  uint64_t Tiering_stats::GetCompactionCount() {
+    return compaction_count;
+  }
+  uint64_t Tiering_stats::GetLifetimeThreshold(int level) {
+    switch (level) {
+      case 0: return L0_LIFETIME_THRESHOLD;
+      case 1: return L1_LIFETIME_THRESHOLD;
+      case 2: return L2_LIFETIME_THRESHOLD;
+      case 3: return L3_LIFETIME_THRESHOLD;
+      case 4: return L4_LIFETIME_THRESHOLD;
+      default: return 0;
+    }
+  }
+  bool Tiering_stats::GetColdTableInPmem(level_number* res) {
+    bool found = false;
+    uint64_t max_overdue = 0;
+    for (size_t i=0; i<LRU_fileNumber_list.size(); i++) {
+      std::list<level_number>::iterator iter = LRU_fileNumber_list[i].begin();
+      for ( ; iter != LRU_fileNumber_list[i].end(); iter++) {
+        uint64_t age = compaction_count - iter->birth;
+        uint64_t threshold = GetLifetimeThreshold(iter->level);
+        if (age < threshold) continue;
+        // NOTE: age >= threshold, so overdue of the first one can be 0
+        if (!found || age - threshold > max_overdue) {
+          found = true;
+          max_overdue = age - threshold;
+          *res = *iter;
+        }
       }
-      // res = *iter;
-      return *iter;
-    } else {
-      printf("[WARNING][GetElementFromNumberListInPmem]%d] n %d > size %d ..\n", number, n, LRU_fileNumber_list[index].size());
-      return LRU_fileNumber_list[index].front();
     }
+    return found;
+  }
+
+  /* LRUTiering */
+  bool Tiering_stats::GetLRUTableInPmem(uint64_t shard, level_number* res) {
+    if (LRU_fileNumber_list[shard].empty()) {
+      return false;
+    }
+    *res = LRU_fileNumber_list[shard].front();
+    return true;
   }
 
+  /* Read-driven promotion */
+  bool Tiering_stats::RecordRead(uint64_t number) {
+    if (!IsInFileSet(number)) return false;
+    return ++read_count[number] >= PROMOTION_READ_THRESHOLD;
+  }
+  bool Tiering_stats::GetHotFileInFileSet(uint64_t* number) {
+    bool found = false;
+    uint64_t max_reads = 0;
+    std::map<uint64_t, uint64_t>::iterator iter = read_count.begin();
+    for ( ; iter != read_count.end(); iter++) {
+      if (iter->second < PROMOTION_READ_THRESHOLD) continue;
+      if (!found || iter->second > max_reads) {
+        found = true;
+        max_reads = iter->second;
+        *number = iter->first;
+      }
+    }
+    return found;
+  }
+  void Tiering_stats::ResetReadCount(uint64_t number) {
+    read_count.erase(number);
+  }
 
   uint64_t Tiering_stats::GetFileSetSize() {
     return file_set.size();
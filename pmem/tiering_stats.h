@@ -2,7 +2,10 @@
 #define TIERING_STATS_H
 
 #include <list>
+#include <map>
 #include <set>
+#include <unordered_map>
+#include <vector>
 #include <stdint.h>
 #include "pmem/layout.h"
 
@@ -11,6 +14,8 @@
 #define PMEM_SKIPLIST_LEVEL_THRESHOLD 3
 
 // Opt2: Cold data tiering
+// Lifetime of a pmem table in a level, counted in compactions.
+// Older tables are demoted to SST in background (DBImpl::BackgroundDemotion)
 #define L0_LIFETIME_THRESHOLD 8
 #define L1_LIFETIME_THRESHOLD 20
 #define L2_LIFETIME_THRESHOLD 70
@@ -20,16 +25,27 @@
 
 // Opt3: LRU tiering
 
+// Read-driven promotion (ColdDataTiering, LRUTiering)
+// SST files which served this many reads are copied into pmem
+#define PROMOTION_READ_THRESHOLD 1000
+// Read counts are halved every this number of compactions
+#define PROMOTION_DECAY_COMPACTIONS 16
 
 namespace leveldb {
 
   struct LevelNumberPair {
     int level;
     uint64_t number;
+    uint64_t birth; // compaction count when it entered the level
+    uint32_t pins;  // > 0 = not a demotion victim
   } typedef level_number;
 
   struct tiering {
    public:
+    tiering();
+    // Number of LRU lists, same as PmemOptions::num_of_shards
+    void SetNumOfShards(int num_of_shards);
+
     bool IsInFileSet(uint64_t number);
     bool IsInSkiplistSet(uint64_t number);
     // void InsertIntoSet(std::set<uint64_t>* set, uint64_t file_number);
@@ -39,9 +55,35 @@ namespace leveldb {
     void DeleteFromFileSet(uint64_t number);
     void DeleteFromSkiplistSet(uint64_t number);
     
+    // NOTE: All O(1), by LRU_index
     void PushToNumberListInPmem(int level, uint64_t number);
     void RemoveFromNumberListInPmem(uint64_t number);
-    level_number GetElementFromNumberListInPmem(uint64_t number, uint64_t n);
+    // Read of pmem table, move it to MRU end
+    void TouchInPmem(uint64_t number);
+    // Pinned tables (e.g. compaction inputs) are skipped by victim selection
+    void PinInPmem(uint64_t number);
+    void UnpinInPmem(uint64_t number);
+    // Trivial move keeps the table in pmem, restart its lifetime in new level
+    void SetLevelInPmem(uint64_t number, int level);
+
+    /* ColdDataTiering */
+    void IncreaseCompactionCount();
+    uint64_t GetCompactionCount();
+    // 0 = not kept in pmem (L5, L6)
+    static uint64_t GetLifetimeThreshold(int level);
+    // Oldest table over its lifetime threshold, false if none
+    bool GetColdTableInPmem(level_number* res);
+
+    /* LRUTiering */
+    // Least recently used (unpinned) table of a shard, false if none
+    bool GetLRUTableInPmem(uint64_t shard, level_number* res);
+
+    /* Read-driven promotion */
+    // Count a read served by SST file, true if it is hot
+    bool RecordRead(uint64_t number);
+    // Most read file over PROMOTION_READ_THRESHOLD, false if none
+    bool GetHotFileInFileSet(uint64_t* number);
+    void ResetReadCount(uint64_t number);
     
     /* Deprecated function */
     // level_number PopFromNumberListInPmem(uint64_t number);
@@ -54,7 +96,14 @@ namespace leveldb {
     std::set<uint64_t> file_set;
     std::set<uint64_t> skiplist_set;
     // ColdDataTiering, LRUTiering 
-    std::list<level_number> LRU_fileNumber_list[NUM_OF_SKIPLIST_MANAGER]; // <level, Number> 
+    // Per-shard lists, front = LRU. Pinned tables are spliced out to
+    // pinned_list, so LRU victim is always the front.
+    std::vector<std::list<level_number> > LRU_fileNumber_list; // <level, Number> 
+    std::list<level_number> pinned_list;
+    std::unordered_map<uint64_t, std::list<level_number>::iterator> LRU_index;
+    uint64_t compaction_count;
+    // Promotion, [ number -> reads ] of files in file set
+    std::map<uint64_t, uint64_t> read_count;
   } typedef Tiering_stats;
 
 } // namespace leveldb
@@ -229,7 +229,8 @@ Iterator* Table::NewIteratorFromPmem(
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Iterator** pinned_block) {
   Status s;
   Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
@@ -251,7 +252,11 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
         // printf("[DEBUG InternalGet3]'%s'-'%s'\n", block_iter->key().data(), block_iter->value().data());
       }
       s = block_iter->status();
-      delete block_iter;
+      if (pinned_block != nullptr && s.ok() && block_iter->Valid()) {
+        *pinned_block = block_iter;
+      } else {
+        delete block_iter;
+      }
     }
   }
   if (s.ok()) {
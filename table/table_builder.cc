@@ -34,6 +34,19 @@ struct TableBuilder::Rep {
   uint64_t buffer_offset;
   bool first_addition_flag;
   std::string buffer;
+  // Keys of pmem table, flattened (same layout as FilterBlockBuilder)
+  // NOTE: Filter is built at FinishPmem and handed to owner ds
+  std::string pmem_filter_keys;
+  std::vector<size_t> pmem_filter_starts;
+  uint64_t pmem_number;
+  PmemSkiplist* pmem_filter_skiplist;
+  PmemHashmap* pmem_filter_hashmap;
+  PmemBuffer* pmem_buffer; // NOTE: Drained at FinishPmem
+  // Entries of pmem table so far are exactly [scan_start, scan_end)
+  // NOTE: Handed to owner skiplist at FinishPmem for compaction scan
+  char* scan_start;
+  char* scan_end;
+  bool scan_contiguous;
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -58,13 +71,19 @@ struct TableBuilder::Rep {
         index_block(&index_block_options),
         num_entries(0),
         closed(false),
+        filter_block(opt.filter_policy == nullptr ? nullptr
+                     : new FilterBlockBuilder(opt.filter_policy)),
         // JH
         start_offset(nullptr),
         buffer_offset(0),
         first_addition_flag(true),
-
-        filter_block(opt.filter_policy == nullptr ? nullptr
-                     : new FilterBlockBuilder(opt.filter_policy)),
+        pmem_number(0),
+        pmem_filter_skiplist(nullptr),
+        pmem_filter_hashmap(nullptr),
+        pmem_buffer(nullptr),
+        scan_start(nullptr),
+        scan_end(nullptr),
+        scan_contiguous(true),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
@@ -166,6 +185,17 @@ void TableBuilder::AddToPmemByPtr(PmemSkiplist* pmem_skiplist, uint64_t number,
   abort();
 }
 /* Skiplist + use_pmem_buffer */
+// Extend scan region by entry at buffer_ptr, if it follows previous one
+static void ExtendScanRegion(char** scan_start, char** scan_end,
+                             bool* scan_contiguous, char* buffer_ptr, int n) {
+  if (*scan_start == nullptr) {
+    *scan_start = buffer_ptr;
+  } else if (buffer_ptr != *scan_end) {
+    *scan_contiguous = false;
+  }
+  *scan_end = buffer_ptr + n;
+}
+
 void TableBuilder::AddToBufferAndSkiplist(
                         PmemBuffer* pmem_buffer, PmemSkiplist* pmem_skiplist, 
                         uint64_t number, const Slice& key, const Slice& value) {
@@ -182,15 +212,25 @@ void TableBuilder::AddToBufferAndSkiplist(
   if (r->first_addition_flag) {
     r->start_offset = pmem_buffer->GetStartOffset(number);
     r->first_addition_flag = false;
+    if (r->start_offset == nullptr) {
+      r->status = Status::IOError("pmem buffer has no free segments");
+      return;
+    }
   }
 
   // Add to buffer
   EncodeToBuffer(&r->buffer, key, value);
   int total_length = GetEncodedLength(key.size(), value.size());
 
+  AddKeyToPmemFilter(key);
+  r->pmem_filter_skiplist = pmem_skiplist;
+  r->pmem_number = number;
+
   // Add to pmem_skiplist
   pmem_skiplist->Insert((char *)key.data(), r->start_offset + r->buffer_offset, 
                         key.size(), number);
+  ExtendScanRegion(&r->scan_start, &r->scan_end, &r->scan_contiguous,
+                   r->start_offset + r->buffer_offset, total_length);
 
   // printf("start_offset %d '%d', total_length\n", r->start_offset, total_length);
   r->offset += (total_length);
@@ -209,6 +249,7 @@ void TableBuilder::FlushBufferToPmemBuffer(PmemBuffer* pmem_buffer, uint64_t num
   // printf("[DEBUG %d] '%s'\n",buffer_wrapper.size(), buffer_wrapper.data()); // 3,555,846
   // printf("[Sequential_write] file_number %d\n", number);
   pmem_buffer->SequentialWrite(number, buffer_wrapper);
+  r->pmem_buffer = pmem_buffer;
 }
 void TableBuilder::AddToSkiplistByPtr(PmemSkiplist* pmem_skiplist, uint64_t number,
                     const Slice& key, const Slice& value,
@@ -223,7 +264,16 @@ void TableBuilder::AddToSkiplistByPtr(PmemSkiplist* pmem_skiplist, uint64_t numb
   r->num_entries++;
   r->offset += (key.size() + value.size());
 
+  AddKeyToPmemFilter(key);
+  r->pmem_filter_skiplist = pmem_skiplist;
+  r->pmem_number = number;
+
   pmem_skiplist->InsertByPtr(buffer_ptr, key.size(), number);
+  // NOTE: Entry stays in (other) table's buffer, keep its segment alive
+  int total_length = GetEncodedLength(key.size(), value.size());
+  PmemBuffer::HoldBufferPtr(number, buffer_ptr, total_length);
+  ExtendScanRegion(&r->scan_start, &r->scan_end, &r->scan_contiguous,
+                   buffer_ptr, total_length);
 }
 
 
@@ -244,6 +294,10 @@ void TableBuilder::AddToBufferAndHashmap(
   if (r->first_addition_flag) {
     r->start_offset = pmem_buffer->GetStartOffset(number);
     r->first_addition_flag = false;
+    if (r->start_offset == nullptr) {
+      r->status = Status::IOError("pmem buffer has no free segments");
+      return;
+    }
   }
 
   // Add to buffer
@@ -251,6 +305,9 @@ void TableBuilder::AddToBufferAndHashmap(
   int total_length = GetEncodedLength(key.size(), value.size());
   // printf("%d %d] total_length %d\n", key.size(), value.size(), total_length);
   // Add to pmem_skiplist
+  AddKeyToPmemFilter(key);
+  r->pmem_filter_hashmap = pmem_hashmap;
+  r->pmem_number = number;
   pmem_hashmap->Insert((char *)key.data(), r->start_offset + r->offset, 
                         key.size(), number);
 
@@ -268,9 +325,20 @@ void TableBuilder::AddToHashmapByPtr(PmemHashmap* pmem_hashmap, uint64_t number,
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
   r->offset += (key.size() + value.size());
+  AddKeyToPmemFilter(key);
+  r->pmem_filter_hashmap = pmem_hashmap;
+  r->pmem_number = number;
   pmem_hashmap->InsertByPtr(key_ptr, buffer_ptr, key.size(), number);
+  PmemBuffer::HoldBufferPtr(number, buffer_ptr, 
+                            GetEncodedLength(key.size(), value.size()));
 }
 
+void TableBuilder::AddKeyToPmemFilter(const Slice& key) {
+  Rep* r = rep_;
+  if (r->options.filter_policy == nullptr) return;
+  r->pmem_filter_starts.push_back(r->pmem_filter_keys.size());
+  r->pmem_filter_keys.append(key.data(), key.size());
+}
 
 void TableBuilder::Flush() {
   Rep* r = rep_;
@@ -351,9 +419,48 @@ Status TableBuilder::status() const {
 Status TableBuilder::FinishPmem() {
   Rep* r = rep_;
   r->pending_index_entry = false;
-  r->status = Status::OK();
   assert(!r->closed);
   r->closed = true;
+  // NOTE: Table which got no room in pmem buffer is not published
+  if (!ok()) return r->status;
+
+  // Batched persistence: one drain for contents and entries of table,
+  // before it is published in MANIFEST
+  if (r->pmem_buffer != nullptr) {
+    r->pmem_buffer->Drain();
+  }
+  if (r->pmem_filter_skiplist != nullptr) {
+    r->pmem_filter_skiplist->FinishBuild(r->pmem_number);
+    if (r->scan_start != nullptr && r->scan_contiguous) {
+      r->pmem_filter_skiplist->SetScanRegion(r->pmem_number, r->scan_start,
+                                             r->scan_end - r->scan_start);
+    }
+  }
+  if (r->pmem_filter_hashmap != nullptr) {
+    r->pmem_filter_hashmap->FinishBuild(r->pmem_number);
+  }
+
+  // Whole-table filter, kept in DRAM by owner ds (GetFromPmem checks it)
+  const size_t num_keys = r->pmem_filter_starts.size();
+  if (r->options.filter_policy != nullptr && num_keys > 0) {
+    std::vector<Slice> keys(num_keys);
+    r->pmem_filter_starts.push_back(r->pmem_filter_keys.size());
+    for (size_t i = 0; i < num_keys; i++) {
+      const char* base = r->pmem_filter_keys.data() + r->pmem_filter_starts[i];
+      size_t length = r->pmem_filter_starts[i+1] - r->pmem_filter_starts[i];
+      keys[i] = Slice(base, length);
+    }
+    std::string filter;
+    r->options.filter_policy->CreateFilter(&keys[0], static_cast<int>(num_keys),
+                                           &filter);
+    if (r->pmem_filter_skiplist != nullptr) {
+      r->pmem_filter_skiplist->SetFilter(r->pmem_number, filter);
+    } else if (r->pmem_filter_hashmap != nullptr) {
+      r->pmem_filter_hashmap->SetFilter(r->pmem_number, filter);
+    }
+  }
+  r->pmem_filter_keys.clear();
+  r->pmem_filter_starts.clear();
   return r->status;
 }
 
@@ -4,11 +4,51 @@
 
 #include "leveldb/options.h"
 
+#include <algorithm>
+
 #include "leveldb/comparator.h"
 #include "leveldb/env.h"
 
 namespace leveldb {
 
+// JH
+PmemOptions::PmemOptions()
+    : pmem_dir(PMEM_DIR),
+      num_of_shards(NUM_OF_SKIPLIST_MANAGER),
+      skiplist_pool_size((size_t)SKIPLIST_MANAGER_POOL_SIZE),
+      buffer_pool_size((size_t)BUFFER_POOL_SIZE),
+      hashmap_pool_size((size_t)BUFFER_POOL_SIZE),
+      skiplist_list_size(SKIPLIST_MANAGER_LIST_SIZE),
+      hashmap_list_size(HASHMAP_LIST_SIZE),
+      max_skiplist_node_size(MAX_SKIPLIST_NODE_SIZE),
+      buffer_contents_size(MAX_CONTENTS_SIZE),
+      demotion_watermark(FREE_LIST_DEMOTION_WATERMARK),
+      deferred_drain(PMEM_DEFERRED_DRAIN),
+      log_pool_size((size_t)PMEM_LOG_POOL_SIZE),
+      log_contents_size(PMEM_LOG_CONTENTS_SIZE) {
+}
+std::string PmemOptions::SkiplistPath(int shard) const {
+  return pmem_dir + "/skiplist_manager_" + std::to_string(shard);
+}
+std::string PmemOptions::BufferPath(int shard) const {
+  return pmem_dir + "/pmem_buffer_" + std::to_string(shard);
+}
+std::string PmemOptions::HashmapPath(int shard) const {
+  return pmem_dir + "/pmem_hashmap_" + std::to_string(shard);
+}
+// NOTE: Logs and memtables are of one DB, other DBs in pmem_dir must not see them
+static std::string PoolNameOf(const std::string& dbname) {
+  std::string name = dbname;
+  std::replace(name.begin(), name.end(), '/', '_');
+  return name;
+}
+std::string PmemOptions::LogPath(const std::string& dbname) const {
+  return pmem_dir + "/pmem_log_" + PoolNameOf(dbname);
+}
+std::string PmemOptions::MemTablePath(const std::string& dbname) const {
+  return pmem_dir + "/pmem_memtable_" + PoolNameOf(dbname);
+}
+
 Options::Options()
     : comparator(BytewiseComparator()),
       create_if_missing(false),
@@ -36,13 +76,23 @@ Options::Options()
       , sst_type(kPmemSST) // ozption 1
       // , sst_type(kFileDescriptorSST) // option 2
 
+      /* Addtional cache option */
+      // , skiplist_cache(true) // NOTE: Only ds_type is "kSkiplist"
+      , skiplist_cache(false)
+
       /* Pmem-buffer option */
       , use_pmem_buffer(true)
       // , use_pmem_buffer(false)
 
-      /* Addtional cache option */
-      // , skiplist_cache(true) // NOTE: Only ds_type is "kSkiplist"
-      , skiplist_cache(false)
+      /* Pmem write-ahead log option */
+      , use_pmem_log(false)
+      // , use_pmem_log(true)
+      , pmem_log(nullptr)
+
+      /* Pmem memtable option */
+      , use_pmem_memtable(false)
+      // , use_pmem_memtable(true)
+      , pmem_memtable(nullptr)
 
       /*
        * [Tiering policies]
@@ -71,6 +121,7 @@ Options::Options()
       /* Data-Structure option */
       , ds_type(kSkiplist)
       // , ds_type(kHashmap)
+      // , ds_type(kSortedArray)
        {
 }
 }  // namespace leveldbf